@@ -0,0 +1,80 @@
+QT -= core gui
+
+TARGET = alterpcb-tlinesim-cli
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt app_bundle
+
+DEFINES += "ALTERPCB_VERSION=\\\"0.0.0\\\"" "SIMULATION_VERBOSE=0"
+
+QMAKE_CXXFLAGS += -std=c++11 -Wconversion -Wsign-conversion -Wfloat-conversion
+QMAKE_CXXFLAGS_RELEASE -= -O2 -g
+QMAKE_CXXFLAGS_RELEASE += -O3 -DNDEBUG
+
+INCLUDEPATH += cli common simulation /usr/include/eigen3/ /usr/include/suitesparse
+DEPENDPATH += cli common simulation
+
+########## Warning: Everything below this line is auto-generated and will be overwritten! ##########
+
+HEADERS += \
+	cli/BatchDaemon.h \
+	cli/BatchJob.h \
+	cli/BatchShard.h \
+	common/Basics.h \
+	common/Color.h \
+	common/ColorMap.h \
+	common/Cow.h \
+	common/Decimal.h \
+	common/EnumTranslator.h \
+	common/HashTable.h \
+	common/Json.h \
+	common/MiscMath.h \
+	common/MurmurHash.h \
+	common/NaturalSort.h \
+	common/StringHelper.h \
+	common/StringRegistry.h \
+	common/VData.h \
+	common/VDataReader.h \
+	common/Vector.h \
+	simulation/ChainSolver.h \
+	simulation/Eigen.h \
+	simulation/EigenModes.h \
+	simulation/EigenSparse.h \
+	simulation/FindRoot.h \
+	simulation/GenericMesh.h \
+	simulation/GridMesh2D.h \
+	simulation/MaterialDatabase.h \
+	simulation/MatrixMarket.h \
+	simulation/PortSolver.h \
+	simulation/RationalFit.h \
+	simulation/SparseMatrix.h \
+	simulation/TLineSimulation.h \
+	simulation/TLineTypes.h \
+	simulation/TriMesh2D.h
+
+SOURCES += \
+	cli/BatchDaemon.cpp \
+	cli/BatchJob.cpp \
+	cli/BatchShard.cpp \
+	cli/Main.cpp \
+	common/Color.cpp \
+	common/ColorMap.cpp \
+	common/Decimal.cpp \
+	common/Json.cpp \
+	common/NaturalSort.cpp \
+	common/StringRegistry.cpp \
+	common/VData.cpp \
+	simulation/ChainSolver.cpp \
+	simulation/EigenModes.cpp \
+	simulation/GenericMesh.cpp \
+	simulation/GridMesh2D.cpp \
+	simulation/MaterialDatabase.cpp \
+	simulation/PortSolver.cpp \
+	simulation/RationalFit.cpp \
+	simulation/TLineSimulation.cpp \
+	simulation/TLineTypes.cpp \
+	simulation/TLine_CoplanarWaveguide.cpp \
+	simulation/TLine_Generic.cpp \
+	simulation/TLine_Microstrip.cpp \
+	simulation/TLine_Stripline.cpp \
+	simulation/TriMesh2D.cpp
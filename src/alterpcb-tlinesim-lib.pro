@@ -0,0 +1,92 @@
+QT -= core gui
+
+TARGET = alterpcb-tlinesim
+TEMPLATE = lib
+CONFIG += shared
+CONFIG -= qt app_bundle
+
+# use 'qmake CONFIG+=staticlib' to build a static library instead
+# use 'qmake CONFIG+=tests' to build the tests instead of the library
+
+tests {
+	TARGET = alterpcb-tlinesim-tests
+	TEMPLATE = app
+	CONFIG -= shared
+	CONFIG += console
+}
+
+DEFINES += "ALTERPCB_VERSION=\\\"0.0.0\\\"" "SIMULATION_VERBOSE=0"
+
+QMAKE_CXXFLAGS += -std=c++11 -fvisibility=hidden -Wconversion -Wsign-conversion -Wfloat-conversion
+QMAKE_CXXFLAGS_RELEASE -= -O2 -g
+QMAKE_CXXFLAGS_RELEASE += -O3 -DNDEBUG
+
+INCLUDEPATH += library common simulation /usr/include/eigen3/ /usr/include/suitesparse
+DEPENDPATH += library common simulation
+
+########## Warning: Everything below this line is auto-generated and will be overwritten! ##########
+
+tests {
+
+	SOURCES += \
+		tests/TestTLineSimAPI.cpp
+
+}
+
+HEADERS += \
+	common/Basics.h \
+	common/Color.h \
+	common/ColorMap.h \
+	common/Cow.h \
+	common/Decimal.h \
+	common/EnumTranslator.h \
+	common/HashTable.h \
+	common/Json.h \
+	common/MiscMath.h \
+	common/MurmurHash.h \
+	common/NaturalSort.h \
+	common/StringHelper.h \
+	common/StringRegistry.h \
+	common/VData.h \
+	common/VDataReader.h \
+	common/Vector.h \
+	library/TLineSimAPI.h \
+	simulation/ChainSolver.h \
+	simulation/Eigen.h \
+	simulation/EigenModes.h \
+	simulation/EigenSparse.h \
+	simulation/FindRoot.h \
+	simulation/GenericMesh.h \
+	simulation/GridMesh2D.h \
+	simulation/MaterialDatabase.h \
+	simulation/MatrixMarket.h \
+	simulation/PortSolver.h \
+	simulation/RationalFit.h \
+	simulation/SparseMatrix.h \
+	simulation/TLineSimulation.h \
+	simulation/TLineTypes.h \
+	simulation/TriMesh2D.h
+
+SOURCES += \
+	common/Color.cpp \
+	common/ColorMap.cpp \
+	common/Decimal.cpp \
+	common/Json.cpp \
+	common/NaturalSort.cpp \
+	common/StringRegistry.cpp \
+	common/VData.cpp \
+	library/TLineSimAPI.cpp \
+	simulation/ChainSolver.cpp \
+	simulation/EigenModes.cpp \
+	simulation/GenericMesh.cpp \
+	simulation/GridMesh2D.cpp \
+	simulation/MaterialDatabase.cpp \
+	simulation/PortSolver.cpp \
+	simulation/RationalFit.cpp \
+	simulation/TLineSimulation.cpp \
+	simulation/TLineTypes.cpp \
+	simulation/TLine_CoplanarWaveguide.cpp \
+	simulation/TLine_Generic.cpp \
+	simulation/TLine_Microstrip.cpp \
+	simulation/TLine_Stripline.cpp \
+	simulation/TriMesh2D.cpp
@@ -37,6 +37,7 @@ HEADERS += \
 	common/Vector.h \
 	gui/AboutDialog.h \
 	gui/ApplicationDirs.h \
+	gui/CustomLineEdit.h \
 	gui/FixedScrollArea.h \
 	gui/GlobalDirs.h \
 	gui/Icons.h \
@@ -46,16 +47,21 @@ HEADERS += \
 	gui/QLineEditSmall.h \
 	gui/QProgressDialogThreaded.h \
 	gui/Qt.h \
+	simulation/ChainSolver.h \
 	simulation/Eigen.h \
+	simulation/EigenModes.h \
 	simulation/EigenSparse.h \
 	simulation/FindRoot.h \
 	simulation/GenericMesh.h \
 	simulation/GridMesh2D.h \
 	simulation/MaterialDatabase.h \
 	simulation/MatrixMarket.h \
+	simulation/PortSolver.h \
+	simulation/RationalFit.h \
 	simulation/SparseMatrix.h \
+	simulation/TLineSimulation.h \
 	simulation/TLineTypes.h \
-    gui/CustomLineEdit.h
+	simulation/TriMesh2D.h
 
 SOURCES += \
 	Main.cpp \
@@ -68,17 +74,24 @@ SOURCES += \
 	common/VData.cpp \
 	gui/AboutDialog.cpp \
 	gui/ApplicationDirs.cpp \
+	gui/CustomLineEdit.cpp \
 	gui/FixedScrollArea.cpp \
 	gui/Icons.cpp \
 	gui/MainWindow.cpp \
 	gui/MeshViewer.cpp \
 	gui/QLineEditSmall.cpp \
 	gui/QProgressDialogThreaded.cpp \
+	simulation/ChainSolver.cpp \
+	simulation/EigenModes.cpp \
 	simulation/GenericMesh.cpp \
 	simulation/GridMesh2D.cpp \
 	simulation/MaterialDatabase.cpp \
+	simulation/PortSolver.cpp \
+	simulation/RationalFit.cpp \
+	simulation/TLineSimulation.cpp \
 	simulation/TLineTypes.cpp \
 	simulation/TLine_CoplanarWaveguide.cpp \
+	simulation/TLine_Generic.cpp \
 	simulation/TLine_Microstrip.cpp \
 	simulation/TLine_Stripline.cpp \
-    gui/CustomLineEdit.cpp
+	simulation/TriMesh2D.cpp
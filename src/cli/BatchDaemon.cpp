@@ -0,0 +1,319 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "BatchDaemon.h"
+
+#include "BatchJob.h"
+#include "Json.h"
+#include "StringRegistry.h"
+#include "VDataReader.h"
+
+#include <iostream>
+#include <list>
+#include <unordered_map>
+
+#include <csignal>
+#include <cerrno>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Clients that send a request line longer than this are disconnected, so they can't make the daemon run out of memory.
+const size_t DAEMON_MAX_LINE_LENGTH = 16 * 1024 * 1024;
+
+static volatile sig_atomic_t g_daemon_stop = 0;
+
+static void DaemonSignalHandler(int) {
+	g_daemon_stop = 1;
+}
+
+// A least-recently-used cache of job results. The key is the normalized job in JSON format, so jobs that differ only in
+// formatting, parameter order or omitted default values map to the same entry.
+class BatchResultCache {
+
+private:
+	typedef std::list<std::pair<std::string, BatchResult>> EntryList;
+
+private:
+	size_t m_capacity;
+	EntryList m_entries;
+	std::unordered_map<std::string, EntryList::iterator> m_index;
+
+public:
+	inline BatchResultCache(size_t capacity) : m_capacity(capacity) {}
+
+	const BatchResult* Find(const std::string &key) {
+		auto it = m_index.find(key);
+		if(it == m_index.end())
+			return NULL;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return &it->second->second;
+	}
+
+	void Insert(const std::string &key, const BatchResult &result) {
+		if(m_capacity == 0)
+			return;
+		while(m_entries.size() >= m_capacity) {
+			m_index.erase(m_entries.back().first);
+			m_entries.pop_back();
+		}
+		m_entries.emplace_front(key, result);
+		m_index[key] = m_entries.begin();
+	}
+
+};
+
+struct DaemonClient {
+	int m_fd;
+	std::string m_input;
+};
+
+static std::string BatchJobKey(const BatchJob &job) {
+	VData data = MakeVDict(
+		SRNewTag("type"), (int64_t) job.m_tline_type,
+		SRNewTag("mode"), (int64_t) job.m_mode,
+		SRNewTag("mesh_detail"), FloatScale(job.m_mesh_detail),
+		SRNewTag("memory_budget"), (int64_t) job.m_memory_budget,
+		SRNewTag("mixed_precision"), job.m_mixed_precision,
+		SRNewTag("element_order"), (int64_t) job.m_element_order,
+		SRNewTag("adaptive_sweep"), job.m_adaptive_sweep,
+		SRNewTag("parameters"), job.m_parameters,
+		SRNewTag("frequencies"), VData::List(),
+		SRNewTag("sweep_parameter"), (int64_t) job.m_sweep_parameter,
+		SRNewTag("sweep_values"), VData::List(),
+		SRNewTag("tune_parameter"), (int64_t) job.m_tune_parameter,
+		SRNewTag("tune_result"), (int64_t) job.m_tune_result,
+		SRNewTag("tune_target"), FloatScale(job.m_tune_target)
+	);
+	VData::Dict &dict = data.AsDictUnique();
+	VData::List &frequencies = dict[dict.Find(SRNewTag("frequencies"))].Value().AsListUnique();
+	for(real_t frequency : job.m_frequencies) {
+		frequencies.emplace_back(FloatScale(frequency));
+	}
+	VData::List &sweep_values = dict[dict.Find(SRNewTag("sweep_values"))].Value().AsListUnique();
+	for(real_t value : job.m_sweep_values) {
+		sweep_values.emplace_back(FloatScale(value));
+	}
+	return Json::ToString(data);
+}
+
+static std::string MakeResultResponse(size_t job_index, bool cached, const BatchJob &job, const BatchResult &result) {
+	VData data = MakeVDict(
+		SRNewTag("job"), (int64_t) job_index,
+		SRNewTag("cached"), cached,
+		SRNewTag("columns"), VData::List(),
+		SRNewTag("rows"), VData::List(),
+		SRNewTag("warnings"), VData::List()
+	);
+	VData::Dict &dict = data.AsDictUnique();
+	VData::List &columns = dict[dict.Find(SRNewTag("columns"))].Value().AsListUnique();
+	VData::List &rows = dict[dict.Find(SRNewTag("rows"))].Value().AsListUnique();
+	VData::List &warnings = dict[dict.Find(SRNewTag("warnings"))].Value().AsListUnique();
+	for(const std::string &warning : result.m_warnings) {
+		warnings.emplace_back(warning);
+	}
+	size_t num_keys = result.m_key_names.size();
+	size_t num_rows = result.m_keys.size() / num_keys;
+	size_t row_size = result.m_results.size() / num_rows;
+	for(const std::string &name : result.m_key_names) {
+		columns.emplace_back(name);
+	}
+	const TLineType &tline_type = g_tline_types[job.m_tline_type];
+	for(size_t i = 0; i < tline_type.m_modes.size(); ++i) {
+		for(size_t j = 0; j < TLINERESULT_COUNT; ++j) {
+			columns.emplace_back(tline_type.m_modes[i] + " " + TLINERESULT_NAMES[j]);
+		}
+	}
+	rows.resize(num_rows);
+	for(size_t i = 0; i < num_rows; ++i) {
+		VData::List &row = rows[i].NewList();
+		row.reserve(num_keys + row_size);
+		for(size_t j = 0; j < num_keys; ++j) {
+			row.emplace_back(FloatScale(result.m_keys[num_keys * i + j]));
+		}
+		for(size_t j = 0; j < row_size; ++j) {
+			row.emplace_back(FloatScale(result.m_results[row_size * i + j]));
+		}
+	}
+	return Json::ToString(data) + "\n";
+}
+
+static std::string MakeErrorResponse(size_t job_index, const std::string &error) {
+	VData data = (job_index == INDEX_NONE)?
+		MakeVDict(SRNewTag("error"), error) :
+		MakeVDict(SRNewTag("job"), (int64_t) job_index, SRNewTag("error"), error);
+	return Json::ToString(data) + "\n";
+}
+
+static bool SendAll(int fd, const std::string &data) {
+	size_t pos = 0;
+	while(pos < data.size()) {
+		ssize_t res = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		pos += (size_t) res;
+	}
+	return true;
+}
+
+// Handles a single request line. Returns false if the client has disconnected.
+static bool HandleRequest(int fd, const std::string &line, MaterialDatabase *material_database, BatchResultCache &cache) {
+
+	// parse the request
+	VData data;
+	bool multiple;
+	size_t job_count;
+	try {
+		Json::FromString(data, line);
+		VDataReader reader(data);
+		multiple = (reader.GetType() == VDATA_DICT && reader.HasMember("jobs"));
+		job_count = (multiple)? reader.GetMember("jobs").GetElementCount() : 1;
+	} catch(const std::runtime_error &e) {
+		return SendAll(fd, MakeErrorResponse(INDEX_NONE, e.what()));
+	}
+
+	// run the jobs
+	for(size_t i = 0; i < job_count; ++i) {
+		std::string response;
+		try {
+			BatchJob job;
+			VDataReader reader(data);
+			if(multiple) {
+				VDataReader list = reader.GetMember("jobs");
+				ParseBatchJob(job, list.GetElement(i));
+			} else {
+				ParseBatchJob(job, reader);
+			}
+			std::string key = BatchJobKey(job);
+			const BatchResult *cached_result = cache.Find(key);
+			if(cached_result != NULL) {
+				response = MakeResultResponse(i, true, job, *cached_result);
+			} else {
+				BatchResult result;
+				RunBatchJob(job, material_database, result);
+				response = MakeResultResponse(i, false, job, result);
+				cache.Insert(key, result);
+			}
+		} catch(const std::runtime_error &e) {
+			response = MakeErrorResponse(i, e.what());
+		}
+		if(!SendAll(fd, response))
+			return false;
+	}
+	return true;
+
+}
+
+void RunBatchDaemon(const std::string &socket_path, MaterialDatabase *material_database, size_t cache_size) {
+
+	// create the socket
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if(socket_path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error(MakeString("Socket path '", socket_path, "' is too long."));
+	std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listen_fd < 0)
+		throw std::runtime_error(MakeString("Could not create socket: ", strerror(errno)));
+	unlink(socket_path.c_str());
+	if(bind(listen_fd, (sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+		std::string error = strerror(errno);
+		close(listen_fd);
+		throw std::runtime_error(MakeString("Could not listen on socket '", socket_path, "': ", error));
+	}
+
+	// stop on SIGINT and SIGTERM, without restarting poll
+	struct sigaction action = {};
+	action.sa_handler = DaemonSignalHandler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	std::cerr << "Listening on '" << socket_path << "'." << std::endl;
+
+	BatchResultCache cache(cache_size);
+	std::vector<DaemonClient> clients;
+	std::vector<pollfd> pollfds;
+	while(!g_daemon_stop) {
+
+		// wait for events
+		pollfds.resize(clients.size() + 1);
+		pollfds[0] = {listen_fd, POLLIN, 0};
+		for(size_t i = 0; i < clients.size(); ++i) {
+			pollfds[i + 1] = {clients[i].m_fd, POLLIN, 0};
+		}
+		if(poll(pollfds.data(), (nfds_t) pollfds.size(), -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			throw std::runtime_error(MakeString("Poll failed: ", strerror(errno)));
+		}
+
+		// handle existing clients
+		for(size_t i = clients.size(); i-- > 0; ) {
+			if(pollfds[i + 1].revents == 0)
+				continue;
+			DaemonClient &client = clients[i];
+			char buffer[4096];
+			ssize_t res = recv(client.m_fd, buffer, sizeof(buffer), 0);
+			bool keep = (res > 0 || (res < 0 && errno == EINTR));
+			if(res > 0) {
+				client.m_input.append(buffer, (size_t) res);
+				size_t end;
+				while(keep && (end = client.m_input.find('\n')) != std::string::npos) {
+					std::string line = client.m_input.substr(0, end);
+					client.m_input.erase(0, end + 1);
+					if(line.find_first_not_of(" \t\r") == std::string::npos)
+						continue;
+					keep = HandleRequest(client.m_fd, line, material_database, cache);
+				}
+				if(keep && client.m_input.size() > DAEMON_MAX_LINE_LENGTH) {
+					SendAll(client.m_fd, MakeErrorResponse(INDEX_NONE, MakeString("Request is longer than ", DAEMON_MAX_LINE_LENGTH, " bytes.")));
+					keep = false;
+				}
+			}
+			if(!keep) {
+				close(client.m_fd);
+				clients.erase(clients.begin() + (ptrdiff_t) i);
+			}
+		}
+
+		// accept new clients
+		if(pollfds[0].revents & POLLIN) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if(fd >= 0)
+				clients.push_back(DaemonClient{fd, std::string()});
+		}
+
+	}
+
+	// clean up
+	for(DaemonClient &client : clients) {
+		close(client.m_fd);
+	}
+	close(listen_fd);
+	unlink(socket_path.c_str());
+
+}
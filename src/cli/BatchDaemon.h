@@ -0,0 +1,42 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "Basics.h"
+
+#include <string>
+
+class MaterialDatabase;
+
+// Runs the batch solver as a daemon that listens on a Unix domain socket. This avoids the startup cost of the
+// command-line solver (loading the material database, registering the transmission line types) for every query, and
+// allows identical jobs to be answered from a result cache.
+//
+// Clients send requests as single lines of JSON, using the same format as the job files. The daemon answers with one
+// line of JSON per job, in the same order:
+//
+//     {"job": 0, "cached": false, "columns": ["Frequency", "Single-ended Impedance", ...], "rows": [[1e9, ...], ...]}
+//     {"job": 1, "error": "Unknown transmission line type 'foo'."}
+//
+// The 'output' field of a job is ignored, results are always sent back over the socket. The daemon stops when it
+// receives SIGINT or SIGTERM.
+void RunBatchDaemon(const std::string &socket_path, MaterialDatabase *material_database, size_t cache_size);
@@ -0,0 +1,294 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "BatchJob.h"
+
+#include "MaterialDatabase.h"
+#include "StringRegistry.h"
+#include "TLineSimulation.h"
+#include "VDataReader.h"
+
+#include <algorithm>
+
+static void ParseSweep(std::vector<real_t> &values, VDataReader reader) {
+	if(reader.GetType() == VDATA_LIST) {
+		values.resize(reader.GetElementCount());
+		for(size_t i = 0; i < values.size(); ++i) {
+			values[i] = reader.GetElement(i).AsFloat();
+		}
+	} else if(reader.HasMember("values")) {
+		ParseSweep(values, reader.GetMember("values"));
+	} else {
+		real_t min = reader.GetMember("min").AsFloat();
+		real_t max = reader.GetMember("max").AsFloat();
+		real_t step = reader.GetMember("step").AsFloat();
+		if(!FinitePositive(step))
+			throw std::runtime_error(MakeString("Sweep step in '", reader, "' must be positive."));
+		MakeSweep(values, min, max, step);
+	}
+	if(values.empty())
+		throw std::runtime_error(MakeString("Sweep '", reader, "' is empty."));
+}
+
+static size_t ParseParameter(const TLineType &tline_type, VDataReader reader) {
+	std::string name = reader.AsString();
+	size_t param_index = FindTLineParameter(tline_type, name);
+	if(param_index == INDEX_NONE)
+		throw std::runtime_error(MakeString("Transmission line type '", tline_type.m_name, "' has no parameter '", name, "'."));
+	if(tline_type.m_parameters[param_index].m_type != TLINE_PARAMETERTYPE_REAL)
+		throw std::runtime_error(MakeString("Parameter '", name, "' is not a real parameter."));
+	return param_index;
+}
+
+void ParseBatchJob(BatchJob &job, VDataReader reader) {
+
+	// transmission line type
+	std::string type_name = reader.GetMember("type").AsString();
+	job.m_tline_type = FindTLineType(type_name);
+	if(job.m_tline_type == INDEX_NONE)
+		throw std::runtime_error(MakeString("Unknown transmission line type '", type_name, "'."));
+	const TLineType &tline_type = g_tline_types[job.m_tline_type];
+
+	// simulation settings
+	VData default_mesh_detail = 0;
+	job.m_mesh_detail = exp2(reader.GetMemberDefault("mesh_detail", default_mesh_detail).AsFloat() * 0.5);
+	VData default_memory_budget = 0;
+	real_t memory_budget = reader.GetMemberDefault("memory_budget", default_memory_budget).AsFloat();
+	if(!(memory_budget >= 0.0))
+		throw std::runtime_error(MakeString("Memory budget in '", reader, "' can't be negative."));
+	job.m_memory_budget = (size_t) (memory_budget * 1048576.0);
+	VData default_mixed_precision = false;
+	job.m_mixed_precision = reader.GetMemberDefault("mixed_precision", default_mixed_precision).AsBool();
+	VData default_element_order = 1;
+	int64_t element_order = reader.GetMemberDefault("element_order", default_element_order).AsInt();
+	if(element_order != 1 && element_order != 2)
+		throw std::runtime_error(MakeString("Element order in '", reader, "' must be 1 (linear) or 2 (quadratic)."));
+	job.m_element_order = (size_t) element_order;
+	VData default_adaptive_sweep = false;
+	job.m_adaptive_sweep = reader.GetMemberDefault("adaptive_sweep", default_adaptive_sweep).AsBool();
+
+	// parameters
+	std::vector<VData> values(tline_type.m_parameters.size());
+	for(size_t i = 0; i < tline_type.m_parameters.size(); ++i) {
+		values[i] = tline_type.m_parameters[i].m_default_value;
+	}
+	if(reader.HasMember("parameters")) {
+		VDataReader parameters = reader.GetMember("parameters");
+		for(size_t i = 0; i < parameters.GetMemberCount(); ++i) {
+			stringtag_t key = parameters.GetMemberKey(i);
+			VDataReader value = parameters.GetMember(key);
+			std::string name = StringRegistry::GetString(key);
+			size_t param_index = FindTLineParameter(tline_type, name);
+			if(param_index == INDEX_NONE)
+				throw std::runtime_error(MakeString("Transmission line type '", tline_type.m_name, "' has no parameter '", name, "'."));
+			switch(tline_type.m_parameters[param_index].m_type) {
+				case TLINE_PARAMETERTYPE_BOOL: {
+					values[param_index] = value.AsBool();
+					break;
+				}
+				case TLINE_PARAMETERTYPE_REAL: {
+					values[param_index] = FloatScale(value.AsFloat());
+					break;
+				}
+				case TLINE_PARAMETERTYPE_MATERIAL_CONDUCTOR:
+				case TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC: {
+					values[param_index] = value.AsString();
+					break;
+				}
+				case TLINE_PARAMETERTYPE_COUNT: {
+					assert(false);
+					break;
+				}
+			}
+		}
+	}
+	job.m_parameters.Clear();
+	for(size_t i = 0; i < tline_type.m_parameters.size(); ++i) {
+		stringtag_t key = StringRegistry::NewTag(CanonicalName(tline_type.m_parameters[i].m_name));
+		job.m_parameters.EmplaceBack(VDataDictEntry(key, std::move(values[i])));
+	}
+
+	// frequencies
+	if(reader.HasMember("frequency_sweep")) {
+		if(reader.HasMember("frequency"))
+			throw std::runtime_error("A job can't have both 'frequency' and 'frequency_sweep'.");
+		ParseSweep(job.m_frequencies, reader.GetMember("frequency_sweep"));
+	} else {
+		VData default_frequency = FloatScale(1e9);
+		VDataReader frequency = reader.GetMemberDefault("frequency", default_frequency);
+		if(frequency.GetType() == VDATA_LIST) {
+			ParseSweep(job.m_frequencies, frequency);
+		} else {
+			job.m_frequencies = {frequency.AsFloat()};
+		}
+	}
+	for(real_t frequency : job.m_frequencies) {
+		if(!FinitePositive(frequency))
+			throw std::runtime_error(MakeString("Frequency ", frequency, " is not valid."));
+	}
+
+	// simulation mode
+	job.m_sweep_parameter = INDEX_NONE;
+	job.m_sweep_values.clear();
+	job.m_tune_parameter = INDEX_NONE;
+	job.m_tune_result = INDEX_NONE;
+	job.m_tune_target = 0.0;
+	if(reader.HasMember("parameter_sweep")) {
+		if(reader.HasMember("parameter_tune"))
+			throw std::runtime_error("A job can't have both 'parameter_sweep' and 'parameter_tune'.");
+		VDataReader sweep = reader.GetMember("parameter_sweep");
+		job.m_mode = BATCHJOBMODE_PARAMETER_SWEEP;
+		job.m_sweep_parameter = ParseParameter(tline_type, sweep.GetMember("parameter"));
+		ParseSweep(job.m_sweep_values, sweep);
+	} else if(reader.HasMember("parameter_tune")) {
+		if(job.m_frequencies.size() != 1)
+			throw std::runtime_error("A parameter tune requires a single frequency.");
+		VDataReader tune = reader.GetMember("parameter_tune");
+		job.m_mode = BATCHJOBMODE_PARAMETER_TUNE;
+		job.m_tune_parameter = ParseParameter(tline_type, tune.GetMember("parameter"));
+		std::string result_name = tune.GetMember("result").AsString();
+		size_t result_index = FindTLineResult(result_name);
+		if(result_index == INDEX_NONE)
+			throw std::runtime_error(MakeString("Unknown result '", result_name, "'."));
+		size_t mode_index = 0;
+		if(tune.HasMember("mode")) {
+			VDataReader mode = tune.GetMember("mode");
+			if(mode.GetType() == VDATA_INT) {
+				mode_index = (size_t) mode.AsInt();
+				if(mode_index >= tline_type.m_modes.size())
+					throw std::runtime_error(MakeString("Mode index ", mode_index, " is out of range."));
+			} else {
+				std::string mode_name = mode.AsString();
+				auto it = std::find(tline_type.m_modes.begin(), tline_type.m_modes.end(), mode_name);
+				if(it == tline_type.m_modes.end())
+					throw std::runtime_error(MakeString("Transmission line type '", tline_type.m_name, "' has no mode '", mode_name, "'."));
+				mode_index = (size_t) (it - tline_type.m_modes.begin());
+			}
+		}
+		job.m_tune_result = TLINERESULT_COUNT * mode_index + result_index;
+		job.m_tune_target = tune.GetMember("target").AsFloat();
+	} else if(reader.HasMember("frequency_sweep") || job.m_frequencies.size() != 1) {
+		job.m_mode = BATCHJOBMODE_FREQUENCY_SWEEP;
+	} else {
+		job.m_mode = BATCHJOBMODE_SINGLE;
+	}
+
+	// output file
+	VData default_output = "";
+	job.m_output = reader.GetMemberDefault("output", default_output).AsString();
+	job.m_matrix_output = reader.GetMemberDefault("matrix_output", default_output).AsString();
+	if(!job.m_matrix_output.empty() && job.m_mode != BATCHJOBMODE_SINGLE && job.m_mode != BATCHJOBMODE_FREQUENCY_SWEEP)
+		throw std::runtime_error("Circuit matrices can only be written for single frequency simulations and frequency sweeps.");
+
+}
+
+void ParseBatchJobs(std::vector<BatchJob> &jobs, const VData &data) {
+	VDataReader reader(data);
+	if(reader.GetType() == VDATA_DICT && reader.HasMember("jobs")) {
+		VDataReader list = reader.GetMember("jobs");
+		jobs.resize(list.GetElementCount());
+		for(size_t i = 0; i < jobs.size(); ++i) {
+			ParseBatchJob(jobs[i], list.GetElement(i));
+		}
+	} else {
+		jobs.resize(1);
+		ParseBatchJob(jobs[0], reader);
+	}
+}
+
+void MakeBatchResultKeys(const BatchJob &job, BatchResult &result) {
+	const TLineType &tline_type = g_tline_types[job.m_tline_type];
+	result.m_key_names.clear();
+	result.m_keys.clear();
+	switch(job.m_mode) {
+		case BATCHJOBMODE_SINGLE:
+		case BATCHJOBMODE_FREQUENCY_SWEEP: {
+			result.m_key_names = {"Frequency"};
+			result.m_keys = job.m_frequencies;
+			break;
+		}
+		case BATCHJOBMODE_PARAMETER_SWEEP: {
+			result.m_key_names = {tline_type.m_parameters[job.m_sweep_parameter].m_name, "Frequency"};
+			result.m_keys.reserve(2 * job.m_sweep_values.size() * job.m_frequencies.size());
+			for(real_t value : job.m_sweep_values) {
+				for(real_t frequency : job.m_frequencies) {
+					result.m_keys.push_back(value);
+					result.m_keys.push_back(frequency);
+				}
+			}
+			break;
+		}
+		case BATCHJOBMODE_PARAMETER_TUNE: {
+			assert(false);
+			break;
+		}
+	}
+}
+
+void RunBatchJob(const BatchJob &job, MaterialDatabase *material_database, BatchResult &result) {
+	const TLineType &tline_type = g_tline_types[job.m_tline_type];
+
+	// initialize context
+	TLineContext context;
+	context.m_material_database = material_database;
+	context.m_frequencies = job.m_frequencies;
+	context.m_mesh_detail = job.m_mesh_detail;
+	context.m_parameters = job.m_parameters;
+	context.m_requested_images = false;
+	context.m_memory_budget = job.m_memory_budget;
+	context.m_mixed_precision = job.m_mixed_precision;
+	context.m_element_order = job.m_element_order;
+	context.m_adaptive_sweep = job.m_adaptive_sweep;
+
+	// simulate
+	switch(job.m_mode) {
+		case BATCHJOBMODE_SINGLE:
+		case BATCHJOBMODE_FREQUENCY_SWEEP: {
+			tline_type.m_simulate(context);
+			MakeBatchResultKeys(job, result);
+			result.m_results = std::move(context.m_results);
+			result.m_matrices = std::move(context.m_circuit_matrices);
+			break;
+		}
+		case BATCHJOBMODE_PARAMETER_SWEEP: {
+			TLineParameterSweep(tline_type, context, job.m_sweep_parameter, job.m_sweep_values, result.m_results);
+			MakeBatchResultKeys(job, result);
+			break;
+		}
+		case BATCHJOBMODE_PARAMETER_TUNE: {
+			real_t root_value = TLineParameterTune(tline_type, context, job.m_tune_parameter, job.m_tune_result, job.m_tune_target);
+			result.m_key_names = {tline_type.m_parameters[job.m_tune_parameter].m_name, "Frequency"};
+			result.m_keys = {root_value, context.m_frequencies[0]};
+			result.m_results = std::move(context.m_results);
+			break;
+		}
+	}
+	result.m_warnings = std::move(context.m_warnings);
+
+}
+
+void WriteBatchResult(std::ostream &stream, const BatchJob &job, const BatchResult &result) {
+	TLineWriteResults(stream, g_tline_types[job.m_tline_type], result.m_key_names, result.m_keys, result.m_results);
+}
+
+void WriteBatchMatrices(std::ostream &stream, const BatchJob &job, const BatchResult &result) {
+	TLineWriteMatrices(stream, g_tline_types[job.m_tline_type], job.m_frequencies, result.m_matrices);
+}
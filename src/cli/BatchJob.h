@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "Basics.h"
+#include "TLineTypes.h"
+#include "VData.h"
+
+#include <ostream>
+
+class MaterialDatabase;
+class VDataReader;
+
+// A batch job describes one simulation (single frequency, frequency sweep, parameter sweep or parameter tune) in the
+// same way as the user interface does. Jobs are read from JSON files, for example:
+//
+//     {
+//         "type": "Microstrip (single)",
+//         "parameters": {"track_width": 0.3, "substrate_material": "Isola DE104"},
+//         "mesh_detail": 0,
+//         "frequency_sweep": {"min": 1e9, "max": 10e9, "step": 1e9},
+//         "output": "microstrip.txt"
+//     }
+//
+// Parameters are identified by their canonical names, missing parameters get their default value. Lengths are in mm,
+// frequencies are in Hz. The mesh detail is a number between -3 (very low) and 3 (very high). Sweeps can be specified
+// either as "min", "max" and "step", or as a list of "values". Single frequency simulations and frequency sweeps can
+// also write the full circuit matrices (including the coupling between modes) to a second file, "matrix_output".
+// The optional "memory_budget" (in MB) limits the memory used by the mesh, see GenericMesh::SetMemoryBudget. The optional
+// "mixed_precision" flag allows single-precision factorizations, see GenericMesh::SetMixedPrecision. The optional
+// "element_order" selects linear (1, the default) or quadratic (2) elements, see GenericMesh::SetElementOrder. The
+// optional "adaptive_sweep" flag interpolates frequency sweeps between a few solved frequencies, see
+// TLineContext::m_adaptive_sweep.
+
+enum BatchJobMode {
+	BATCHJOBMODE_SINGLE,
+	BATCHJOBMODE_FREQUENCY_SWEEP,
+	BATCHJOBMODE_PARAMETER_SWEEP,
+	BATCHJOBMODE_PARAMETER_TUNE,
+};
+
+struct BatchJob {
+	BatchJobMode m_mode;
+	size_t m_tline_type;
+	real_t m_mesh_detail;
+	size_t m_memory_budget;
+	bool m_mixed_precision;
+	size_t m_element_order;
+	bool m_adaptive_sweep;
+	VData::Dict m_parameters;
+	std::vector<real_t> m_frequencies;
+	size_t m_sweep_parameter;
+	std::vector<real_t> m_sweep_values;
+	size_t m_tune_parameter, m_tune_result;
+	real_t m_tune_target;
+	std::string m_output, m_matrix_output;
+};
+
+struct BatchResult {
+	std::vector<std::string> m_key_names;
+	std::vector<real_t> m_keys;
+	std::vector<real_t> m_results;
+	std::vector<real_t> m_matrices;
+	std::vector<std::string> m_warnings;
+};
+
+// Reads a single job. Throws an exception if the job is invalid.
+void ParseBatchJob(BatchJob &job, VDataReader reader);
+
+// Reads a job file, which contains either a single job or a dict with a list of "jobs".
+void ParseBatchJobs(std::vector<BatchJob> &jobs, const VData &data);
+
+// Fills in the key columns of the result of a job. Not valid for parameter tunes, since the key is the tuned value.
+void MakeBatchResultKeys(const BatchJob &job, BatchResult &result);
+
+// Runs a job and returns the results in tabular form.
+void RunBatchJob(const BatchJob &job, MaterialDatabase *material_database, BatchResult &result);
+
+// Writes the results of a job in the same format as the user interface.
+void WriteBatchResult(std::ostream &stream, const BatchJob &job, const BatchResult &result);
+
+// Writes the circuit matrices of a job, if the job requested them.
+void WriteBatchMatrices(std::ostream &stream, const BatchJob &job, const BatchResult &result);
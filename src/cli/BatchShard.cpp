@@ -0,0 +1,366 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "BatchShard.h"
+
+#include "MaterialDatabase.h"
+
+#include <algorithm>
+#include <deque>
+
+#include <cerrno>
+#include <csignal>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const uint32_t SHARD_MAGIC_REQUEST = 0x54527131, SHARD_MAGIC_RESPONSE = 0x54527231;
+const uint32_t SHARD_STATUS_OK = 0, SHARD_STATUS_ERROR = 1;
+const size_t SHARD_MAX_ATTEMPTS = 3;
+
+struct ShardRequestHeader {
+	uint32_t m_magic, m_shard, m_has_value, m_frequency_count;
+	double m_value;
+};
+
+struct ShardResponseHeader {
+	uint32_t m_magic, m_shard, m_status, m_count, m_warning_size;
+};
+
+struct Shard {
+	size_t m_sweep_index; // INDEX_NONE if there is no parameter sweep
+	size_t m_frequency_begin, m_frequency_end;
+	size_t m_attempts;
+};
+
+struct ShardWorker {
+	pid_t m_pid;
+	int m_request_fd, m_response_fd;
+	size_t m_shard; // INDEX_NONE if idle
+};
+
+static bool WriteAll(int fd, const void *data, size_t size) {
+	const char *ptr = (const char*) data;
+	while(size != 0) {
+		ssize_t res = write(fd, ptr, size);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		ptr += res;
+		size -= (size_t) res;
+	}
+	return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t size) {
+	char *ptr = (char*) data;
+	while(size != 0) {
+		ssize_t res = read(fd, ptr, size);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		if(res == 0)
+			return false;
+		ptr += res;
+		size -= (size_t) res;
+	}
+	return true;
+}
+
+static void ShardWorkerLoop(const BatchJob &job, MaterialDatabase *material_database, int request_fd, int response_fd) {
+	const TLineType &tline_type = g_tline_types[job.m_tline_type];
+	TLineContext context;
+	context.m_material_database = material_database;
+	context.m_mesh_detail = job.m_mesh_detail;
+	context.m_parameters = job.m_parameters;
+	context.m_requested_images = false;
+	context.m_memory_budget = job.m_memory_budget;
+	context.m_mixed_precision = job.m_mixed_precision;
+	context.m_element_order = job.m_element_order;
+	context.m_adaptive_sweep = job.m_adaptive_sweep;
+	size_t warnings_sent = 0;
+	for( ; ; ) {
+
+		// read request
+		ShardRequestHeader request;
+		if(!ReadAll(request_fd, &request, sizeof(request)) || request.m_magic != SHARD_MAGIC_REQUEST)
+			return;
+		context.m_frequencies.resize(request.m_frequency_count);
+		if(!ReadAll(request_fd, context.m_frequencies.data(), sizeof(real_t) * context.m_frequencies.size()))
+			return;
+
+		// simulate
+		ShardResponseHeader response = {SHARD_MAGIC_RESPONSE, request.m_shard, SHARD_STATUS_OK, 0, 0};
+		std::string message, warnings;
+		try {
+			if(request.m_has_value)
+				context.m_parameters[job.m_sweep_parameter].Value() = FloatScale(request.m_value);
+			tline_type.m_simulate(context);
+			response.m_count = (uint32_t) context.m_results.size();
+
+			// the context keeps its warnings, so only the new ones are sent
+			for( ; warnings_sent < context.m_warnings.size(); ++warnings_sent) {
+				warnings += context.m_warnings[warnings_sent];
+				warnings += '\0';
+			}
+			response.m_warning_size = (uint32_t) warnings.size();
+		} catch(const std::runtime_error &e) {
+			message = e.what();
+			response.m_status = SHARD_STATUS_ERROR;
+			response.m_count = (uint32_t) message.size();
+		}
+
+		// write response
+		if(!WriteAll(response_fd, &response, sizeof(response)))
+			return;
+		if(response.m_status == SHARD_STATUS_OK) {
+			if(!WriteAll(response_fd, context.m_results.data(), sizeof(real_t) * context.m_results.size()) ||
+					!WriteAll(response_fd, warnings.data(), warnings.size()))
+				return;
+		} else {
+			if(!WriteAll(response_fd, message.data(), message.size()))
+				return;
+		}
+
+	}
+}
+
+// Adds the warnings of a response (separated by null characters) to the result, without duplicates.
+static void AddShardWarnings(std::vector<std::string> &result_warnings, const std::string &warnings) {
+	size_t begin = 0;
+	while(begin < warnings.size()) {
+		size_t end = warnings.find('\0', begin);
+		if(end == std::string::npos)
+			end = warnings.size();
+		std::string warning = warnings.substr(begin, end - begin);
+		if(std::find(result_warnings.begin(), result_warnings.end(), warning) == result_warnings.end())
+			result_warnings.push_back(std::move(warning));
+		begin = end + 1;
+	}
+}
+
+static void StartShardWorker(ShardWorker &worker, std::vector<ShardWorker> &workers, const BatchJob &job,
+							 MaterialDatabase *material_database) {
+	int request_pipe[2], response_pipe[2];
+	if(pipe(request_pipe) < 0)
+		throw std::runtime_error(MakeString("Could not create pipe: ", strerror(errno)));
+	if(pipe(response_pipe) < 0) {
+		std::string error = strerror(errno);
+		close(request_pipe[0]);
+		close(request_pipe[1]);
+		throw std::runtime_error(MakeString("Could not create pipe: ", error));
+	}
+	pid_t pid = fork();
+	if(pid < 0) {
+		std::string error = strerror(errno);
+		close(request_pipe[0]);
+		close(request_pipe[1]);
+		close(response_pipe[0]);
+		close(response_pipe[1]);
+		throw std::runtime_error(MakeString("Could not start worker process: ", error));
+	}
+	if(pid == 0) {
+		// the worker should not keep the pipes of the other workers open, otherwise the coordinator won't notice
+		// when those workers die
+		for(ShardWorker &other : workers) {
+			if(other.m_pid > 0) {
+				close(other.m_request_fd);
+				close(other.m_response_fd);
+			}
+		}
+		close(request_pipe[1]);
+		close(response_pipe[0]);
+		try {
+			ShardWorkerLoop(job, material_database, request_pipe[0], response_pipe[1]);
+		} catch(...) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	close(request_pipe[0]);
+	close(response_pipe[1]);
+	worker.m_pid = pid;
+	worker.m_request_fd = request_pipe[1];
+	worker.m_response_fd = response_pipe[0];
+	worker.m_shard = INDEX_NONE;
+}
+
+static void StopShardWorker(ShardWorker &worker, bool kill_process) {
+	close(worker.m_request_fd);
+	close(worker.m_response_fd);
+	if(kill_process)
+		kill(worker.m_pid, SIGKILL);
+	waitpid(worker.m_pid, NULL, 0);
+	worker.m_pid = -1;
+	worker.m_shard = INDEX_NONE;
+}
+
+void RunBatchJobSharded(const BatchJob &job, MaterialDatabase *material_database, size_t num_workers, BatchResult &result) {
+	const TLineType &tline_type = g_tline_types[job.m_tline_type];
+
+	// Split the job into shards. Each simulation builds a mesh which is then reused for all frequencies, so splitting on
+	// the swept parameter is cheaper. The frequencies are only split if that doesn't result in enough shards. Adaptive
+	// sweeps choose their own frequencies based on the whole sweep, so they are never split.
+	size_t num_values = (job.m_mode == BATCHJOBMODE_PARAMETER_SWEEP)? job.m_sweep_values.size() : 1;
+	size_t num_frequencies = job.m_frequencies.size();
+	size_t chunks_per_value = (job.m_adaptive_sweep)? 1 : clamp<size_t>((2 * num_workers + num_values - 1) / num_values, 1, num_frequencies);
+	if(num_workers <= 1 || num_values * chunks_per_value <= 1 || job.m_mode == BATCHJOBMODE_PARAMETER_TUNE || !job.m_matrix_output.empty()) {
+		RunBatchJob(job, material_database, result);
+		return;
+	}
+	std::vector<Shard> shards;
+	for(size_t i = 0; i < num_values; ++i) {
+		for(size_t j = 0; j < chunks_per_value; ++j) {
+			Shard shard;
+			shard.m_sweep_index = (job.m_mode == BATCHJOBMODE_PARAMETER_SWEEP)? i : INDEX_NONE;
+			shard.m_frequency_begin = num_frequencies * j / chunks_per_value;
+			shard.m_frequency_end = num_frequencies * (j + 1) / chunks_per_value;
+			shard.m_attempts = 0;
+			shards.push_back(shard);
+		}
+	}
+	num_workers = std::min(num_workers, shards.size());
+
+	// prepare the result
+	size_t row_size = TLINERESULT_COUNT * tline_type.m_modes.size();
+	MakeBatchResultKeys(job, result);
+	result.m_results.clear();
+	result.m_results.resize(row_size * num_values * num_frequencies);
+	result.m_warnings.clear();
+
+	// writing to a dead worker should fail rather than kill the coordinator
+	struct sigaction ignore_action = {}, old_action;
+	ignore_action.sa_handler = SIG_IGN;
+	sigemptyset(&ignore_action.sa_mask);
+	sigaction(SIGPIPE, &ignore_action, &old_action);
+
+	std::vector<ShardWorker> workers(num_workers, ShardWorker{-1, -1, -1, INDEX_NONE});
+	std::deque<size_t> queue;
+	for(size_t i = 0; i < shards.size(); ++i) {
+		queue.push_back(i);
+	}
+	size_t remaining = shards.size();
+	try {
+
+		for(ShardWorker &worker : workers) {
+			StartShardWorker(worker, workers, job, material_database);
+		}
+
+		std::vector<pollfd> pollfds(num_workers);
+		std::vector<real_t> buffer;
+		std::string warnings;
+		while(remaining != 0) {
+
+			// dispatch shards to idle workers
+			for(ShardWorker &worker : workers) {
+				if(worker.m_shard != INDEX_NONE || queue.empty())
+					continue;
+				size_t shard_index = queue.front();
+				queue.pop_front();
+				Shard &shard = shards[shard_index];
+				if(++shard.m_attempts > SHARD_MAX_ATTEMPTS)
+					throw std::runtime_error(MakeString("Shard ", shard_index, " failed after ", SHARD_MAX_ATTEMPTS, " attempts."));
+				ShardRequestHeader request;
+				request.m_magic = SHARD_MAGIC_REQUEST;
+				request.m_shard = (uint32_t) shard_index;
+				request.m_has_value = (shard.m_sweep_index != INDEX_NONE);
+				request.m_frequency_count = (uint32_t) (shard.m_frequency_end - shard.m_frequency_begin);
+				request.m_value = (shard.m_sweep_index != INDEX_NONE)? job.m_sweep_values[shard.m_sweep_index] : 0.0;
+				worker.m_shard = shard_index;
+				if(!WriteAll(worker.m_request_fd, &request, sizeof(request)) ||
+						!WriteAll(worker.m_request_fd, job.m_frequencies.data() + shard.m_frequency_begin, sizeof(real_t) * request.m_frequency_count)) {
+					// the worker is dead, this will be detected when reading the response
+				}
+			}
+
+			// wait for responses
+			for(size_t i = 0; i < num_workers; ++i) {
+				pollfds[i] = {workers[i].m_response_fd, (short) ((workers[i].m_shard == INDEX_NONE)? 0 : POLLIN), 0};
+			}
+			if(poll(pollfds.data(), (nfds_t) pollfds.size(), -1) < 0) {
+				if(errno == EINTR)
+					continue;
+				throw std::runtime_error(MakeString("Poll failed: ", strerror(errno)));
+			}
+
+			// read responses
+			for(size_t i = 0; i < num_workers; ++i) {
+				ShardWorker &worker = workers[i];
+				if(worker.m_shard == INDEX_NONE || pollfds[i].revents == 0)
+					continue;
+				size_t shard_index = worker.m_shard;
+				const Shard &shard = shards[shard_index];
+				size_t rows = shard.m_frequency_end - shard.m_frequency_begin;
+				ShardResponseHeader response;
+				bool ok = ReadAll(worker.m_response_fd, &response, sizeof(response)) &&
+						  response.m_magic == SHARD_MAGIC_RESPONSE && response.m_shard == shard_index;
+				if(ok && response.m_status == SHARD_STATUS_ERROR) {
+					std::string message(response.m_count, '\0');
+					if(ReadAll(worker.m_response_fd, &message[0], message.size()))
+						throw std::runtime_error(message);
+					ok = false;
+				}
+				if(ok) {
+					ok = (response.m_status == SHARD_STATUS_OK && response.m_count == row_size * rows);
+				}
+				if(ok) {
+					buffer.resize(response.m_count);
+					warnings.resize(response.m_warning_size);
+					ok = ReadAll(worker.m_response_fd, buffer.data(), sizeof(real_t) * buffer.size()) &&
+						 ReadAll(worker.m_response_fd, &warnings[0], warnings.size());
+				}
+				if(!ok) {
+					// the worker died or sent garbage, replace it and try the shard again
+					StopShardWorker(worker, true);
+					queue.push_front(shard_index);
+					StartShardWorker(worker, workers, job, material_database);
+					continue;
+				}
+				AddShardWarnings(result.m_warnings, warnings);
+				size_t value_index = (shard.m_sweep_index == INDEX_NONE)? 0 : shard.m_sweep_index;
+				std::copy_n(buffer.data(), buffer.size(), result.m_results.data() + row_size * (num_frequencies * value_index + shard.m_frequency_begin));
+				worker.m_shard = INDEX_NONE;
+				--remaining;
+			}
+
+		}
+
+	} catch(...) {
+		for(ShardWorker &worker : workers) {
+			if(worker.m_pid > 0)
+				StopShardWorker(worker, true);
+		}
+		sigaction(SIGPIPE, &old_action, NULL);
+		throw;
+	}
+
+	// closing the request pipes tells the workers to stop
+	for(ShardWorker &worker : workers) {
+		StopShardWorker(worker, false);
+	}
+	sigaction(SIGPIPE, &old_action, NULL);
+
+}
@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "Basics.h"
+#include "BatchJob.h"
+
+// Runs a job on a number of local worker processes. The job is split into shards (one or more frequencies for a single
+// value of the swept parameter), which are sent to the workers over pipes. The results are merged in the original
+// order, so the final result is identical to that of RunBatchJob. If a worker dies (e.g. because it crashed or was
+// killed), it is replaced and its shard is dispatched again. Parameter tunes can't be split and run in-process.
+// Adaptive frequency sweeps are only split on the swept parameter, since they need all frequencies. The warnings of
+// all workers are merged (without duplicates) into the result.
+//
+// Shards use a compact binary protocol (native byte order, since workers are local):
+//
+//     request:  uint32 magic, uint32 shard, uint32 has_value, uint32 frequency_count, double value,
+//               double frequencies[frequency_count]
+//     response: uint32 magic, uint32 shard, uint32 status, uint32 count, uint32 warning_size,
+//               double results[count] and char warnings[warning_size] (status 0) or char message[count] (status 1)
+//
+// The warnings are the new warnings of the worker since the previous response, each followed by a null character.
+//
+// The request contains everything that varies between shards, the rest of the job is inherited by the worker when it
+// is forked.
+void RunBatchJobSharded(const BatchJob &job, MaterialDatabase *material_database, size_t num_workers, BatchResult &result);
@@ -0,0 +1,233 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Basics.h"
+#include "BatchDaemon.h"
+#include "BatchJob.h"
+#include "BatchShard.h"
+#include "Json.h"
+#include "MaterialDatabase.h"
+#include "StringRegistry.h"
+#include "TLineTypes.h"
+
+#include <fstream>
+#include <iostream>
+
+static void PrintUsage(const char *program) {
+	std::cerr << "Usage: " << program << " [options] JOBFILE..." << std::endl;
+	std::cerr << "       " << program << " [options] --daemon SOCKET" << std::endl;
+	std::cerr << std::endl;
+	std::cerr << "Options:" << std::endl;
+	std::cerr << "  --data DIR        Data directory (default: 'data' or '../data' next to the executable)." << std::endl;
+	std::cerr << "  --materials FILE  Material database, JSON or binary (default: 'materials.json' in the data directory)." << std::endl;
+	std::cerr << "  --compile-materials FILE" << std::endl;
+	std::cerr << "                    Convert the material database to the binary format and write it to FILE." << std::endl;
+	std::cerr << "  --types FILE      Load additional transmission line types from a JSON cross-section file." << std::endl;
+	std::cerr << "  --list-types      List all transmission line types and their parameters." << std::endl;
+	std::cerr << "  --workers N       Split sweeps over N worker processes (default: 1)." << std::endl;
+	std::cerr << "  --daemon SOCKET   Accept jobs on a Unix domain socket instead of reading job files." << std::endl;
+	std::cerr << "  --cache-size N    Number of results cached by the daemon (default: 1000)." << std::endl;
+	std::cerr << "  --help            Show this help message." << std::endl;
+}
+
+static void ListTypes() {
+	for(const TLineType &tline_type : g_tline_types) {
+		std::cout << tline_type.m_name << std::endl;
+		for(const TLineParameter &parameter : tline_type.m_parameters) {
+			std::cout << "\t" << CanonicalName(parameter.m_name) << " = " << parameter.m_default_value;
+			if(parameter.m_unit_mm)
+				std::cout << " mm";
+			std::cout << std::endl;
+		}
+		std::cout << "\tmodes:";
+		for(const std::string &mode : tline_type.m_modes) {
+			std::cout << " '" << mode << "'";
+		}
+		std::cout << std::endl;
+	}
+}
+
+static bool FileExists(const std::string &filename) {
+	std::ifstream f(filename);
+	return f.good();
+}
+
+static std::string FindMaterialDatabase(const char *program) {
+	std::string program_dir = program;
+	size_t slash = program_dir.find_last_of('/');
+	program_dir = (slash == std::string::npos)? "." : program_dir.substr(0, slash);
+	std::vector<std::string> global_data_dirs = {
+		program_dir + "/data",
+		program_dir + "/../data",
+	};
+	for(auto &dir : global_data_dirs) {
+		if(FileExists(dir + "/materials.json"))
+			return dir + "/materials.json";
+	}
+	throw std::runtime_error("Could not find application data directory, use --data or --materials.");
+}
+
+int main(int argc, char *argv[]) {
+
+	// create singletons
+	StringRegistry string_registry;
+	UNUSED(string_registry);
+
+	// parse arguments
+	std::string materials_file, compile_materials_file;
+	std::vector<std::string> job_files, type_files;
+	std::string daemon_socket;
+	size_t cache_size = 1000, num_workers = 1;
+	bool list_types = false;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--data" && i + 1 < argc) {
+			materials_file = std::string(argv[++i]) + "/materials.json";
+		} else if(arg == "--materials" && i + 1 < argc) {
+			materials_file = argv[++i];
+		} else if(arg == "--daemon" && i + 1 < argc) {
+			daemon_socket = argv[++i];
+		} else if(arg == "--workers" && i + 1 < argc) {
+			num_workers = (size_t) std::max(1l, strtol(argv[++i], NULL, 10));
+		} else if(arg == "--cache-size" && i + 1 < argc) {
+			cache_size = (size_t) std::max(0l, strtol(argv[++i], NULL, 10));
+		} else if(arg == "--compile-materials" && i + 1 < argc) {
+			compile_materials_file = argv[++i];
+		} else if(arg == "--types" && i + 1 < argc) {
+			type_files.push_back(argv[++i]);
+		} else if(arg == "--list-types") {
+			list_types = true;
+		} else if(arg == "--help" || arg == "-h") {
+			PrintUsage(argv[0]);
+			return 0;
+		} else if(arg.size() > 1 && arg[0] == '-') {
+			std::cerr << "Error: Unknown option '" << arg << "'." << std::endl;
+			PrintUsage(argv[0]);
+			return 1;
+		} else {
+			job_files.push_back(arg);
+		}
+	}
+
+	RegisterTLineTypes();
+	for(const std::string &type_file : type_files) {
+		try {
+			RegisterTLineTypesFromFile(type_file);
+		} catch(const std::runtime_error &e) {
+			std::cerr << "Error: Could not load transmission line types from '" << type_file << "': " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if(list_types) {
+		ListTypes();
+		return 0;
+	}
+	if(job_files.empty() == daemon_socket.empty() && compile_materials_file.empty()) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	// load material database
+	MaterialDatabase material_database;
+	try {
+		if(materials_file.empty())
+			materials_file = FindMaterialDatabase(argv[0]);
+		material_database.LoadFile(materials_file);
+		material_database.Finish();
+	} catch(const std::runtime_error &e) {
+		std::cerr << "Error: Could not load material database: " << e.what() << std::endl;
+		return 1;
+	}
+
+	// compile material database
+	if(!compile_materials_file.empty()) {
+		try {
+			material_database.SaveBinaryFile(compile_materials_file);
+		} catch(const std::runtime_error &e) {
+			std::cerr << "Error: Could not write binary material database: " << e.what() << std::endl;
+			return 1;
+		}
+		if(job_files.empty() && daemon_socket.empty())
+			return 0;
+	}
+
+	// run daemon
+	if(!daemon_socket.empty()) {
+		try {
+			RunBatchDaemon(daemon_socket, &material_database, cache_size);
+		} catch(const std::runtime_error &e) {
+			std::cerr << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// run jobs
+	size_t failed = 0;
+	bool first_output = true;
+	for(const std::string &job_file : job_files) {
+		std::vector<BatchJob> jobs;
+		try {
+			VData data;
+			Json::FromFile(data, job_file);
+			ParseBatchJobs(jobs, data);
+		} catch(const std::runtime_error &e) {
+			std::cerr << "Error: Could not read job file '" << job_file << "': " << e.what() << std::endl;
+			++failed;
+			continue;
+		}
+		for(size_t i = 0; i < jobs.size(); ++i) {
+			const BatchJob &job = jobs[i];
+			try {
+				BatchResult result;
+				RunBatchJobSharded(job, &material_database, num_workers, result);
+				for(const std::string &warning : result.m_warnings) {
+					std::cerr << "Warning: Job " << i << " in '" << job_file << "': " << warning << std::endl;
+				}
+				if(job.m_output.empty()) {
+					if(!first_output)
+						std::cout << std::endl;
+					first_output = false;
+					WriteBatchResult(std::cout, job, result);
+				} else {
+					std::ofstream f;
+					f.open(job.m_output, std::ios_base::out | std::ios_base::trunc);
+					if(f.fail())
+						throw std::runtime_error("Could not open file '" + job.m_output + "' for writing.");
+					WriteBatchResult(f, job, result);
+				}
+				if(!job.m_matrix_output.empty()) {
+					std::ofstream f;
+					f.open(job.m_matrix_output, std::ios_base::out | std::ios_base::trunc);
+					if(f.fail())
+						throw std::runtime_error("Could not open file '" + job.m_matrix_output + "' for writing.");
+					WriteBatchMatrices(f, job, result);
+				}
+			} catch(const std::runtime_error &e) {
+				std::cerr << "Error: Job " << i << " in '" << job_file << "' failed: " << e.what() << std::endl;
+				++failed;
+			}
+		}
+	}
+
+	return (failed == 0)? 0 : 1;
+}
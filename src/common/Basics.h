@@ -44,6 +44,37 @@ constexpr size_t INDEX_NONE = (size_t) -1;
 constexpr size_t INDEX_OFFSET = ~(INDEX_NONE >> 1);
 constexpr stringtag_t STRINGTAG_NONE = (stringtag_t) -1;
 
+// Compact 32-bit storage for indices which may also be INDEX_NONE or offset by INDEX_OFFSET. This halves the size of
+// large index tables. The indices (with the offset removed) must be less than COMPACT_INDEX_LIMIT.
+constexpr size_t COMPACT_INDEX_LIMIT = 0x7fffffff;
+class CompactIndex {
+
+private:
+	uint32_t m_value;
+
+public:
+	inline CompactIndex() : m_value(UINT32_MAX) {}
+	inline CompactIndex(size_t index) {
+		if(index == INDEX_NONE) {
+			m_value = UINT32_MAX;
+		} else if(index >= INDEX_OFFSET) {
+			assert(index - INDEX_OFFSET < COMPACT_INDEX_LIMIT);
+			m_value = (uint32_t) (index - INDEX_OFFSET) | UINT32_C(0x80000000);
+		} else {
+			assert(index < COMPACT_INDEX_LIMIT);
+			m_value = (uint32_t) index;
+		}
+	}
+	inline operator size_t() const {
+		if(m_value == UINT32_MAX)
+			return INDEX_NONE;
+		if(m_value & UINT32_C(0x80000000))
+			return INDEX_OFFSET + (size_t) (m_value & UINT32_C(0x7fffffff));
+		return (size_t) m_value;
+	}
+
+};
+
 static_assert(sizeof(void*) == sizeof(size_t), "Size of size_t does not match pointer size!");
 static_assert(sizeof(void*) == sizeof(ptrdiff_t), "Size of ptrdiff_t does not match pointer size!");
 
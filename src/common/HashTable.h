@@ -24,6 +24,7 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #include "MiscMath.h"
 #include "MurmurHash.h"
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -69,11 +70,41 @@ public:
 			delete[] m_buckets;
 	}
 
-	// default copy and assignment
-	HashTable(const HashTable&) = default;
-	HashTable(HashTable&&) noexcept = default;
-	HashTable& operator=(const HashTable&) = default;
-	HashTable& operator=(HashTable&&) noexcept = default;
+	// the buckets are owned by the hash table, so they have to be copied or moved explicitly
+	HashTable(const HashTable &other)
+		: m_hasher(other.m_hasher), m_num_buckets(other.m_num_buckets), m_data(other.m_data), m_hash_bits(other.m_hash_bits) {
+		if(other.m_buckets == SENTINEL_BUCKETS) {
+			m_buckets = SENTINEL_BUCKETS;
+		} else {
+			m_buckets = new Bucket[m_num_buckets];
+			std::copy_n(other.m_buckets, m_num_buckets, m_buckets);
+		}
+	}
+	HashTable(HashTable &&other) noexcept
+		: m_hasher(std::move(other.m_hasher)), m_buckets(other.m_buckets), m_num_buckets(other.m_num_buckets),
+		  m_data(std::move(other.m_data)), m_hash_bits(other.m_hash_bits) {
+		other.m_buckets = SENTINEL_BUCKETS;
+		other.m_data.clear();
+		other.m_num_buckets = 0;
+		other.m_hash_bits = 0;
+	}
+	HashTable& operator=(const HashTable &other) {
+		if(this != &other) {
+			HashTable copy(other);
+			*this = std::move(copy);
+		}
+		return *this;
+	}
+	HashTable& operator=(HashTable &&other) noexcept {
+		if(this != &other) {
+			std::swap(m_hasher, other.m_hasher);
+			std::swap(m_buckets, other.m_buckets);
+			std::swap(m_num_buckets, other.m_num_buckets);
+			std::swap(m_data, other.m_data);
+			std::swap(m_hash_bits, other.m_hash_bits);
+		}
+		return *this;
+	}
 
 	void Free() noexcept {
 		if(m_buckets != SENTINEL_BUCKETS) {
@@ -18,6 +18,88 @@ You should have received a copy of the GNU General Public License
 along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #include "StringRegistry.h"
 
 StringRegistry *StringRegistry::s_instance = NULL;
+
+StringRegistry::StringRegistry() {
+	Table *table = new Table();
+	table->m_mask = 255;
+	table->m_slots.reset(new std::atomic<stringtag_t>[table->m_mask + 1]);
+	for(size_t i = 0; i <= table->m_mask; ++i) {
+		table->m_slots[i].store(STRINGTAG_NONE, std::memory_order_relaxed);
+	}
+	m_table.store(table, std::memory_order_release);
+	for(size_t i = 0; i < MAX_BLOCKS; ++i) {
+		m_blocks[i].store(NULL, std::memory_order_relaxed);
+	}
+	m_size = 0;
+	s_instance = this;
+}
+
+StringRegistry::~StringRegistry() {
+	s_instance = NULL;
+	delete m_table.load(std::memory_order_acquire);
+	for(size_t i = 0; i < MAX_BLOCKS; ++i) {
+		delete[] m_blocks[i].load(std::memory_order_acquire);
+	}
+}
+
+stringtag_t StringRegistry::Insert(const char *str, size_t len) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// another thread may have added the string in the meantime
+	stringtag_t tag = Find(str, len);
+	if(tag != STRINGTAG_NONE)
+		return tag;
+
+	// keep the load factor below 1/2
+	if(2 * (m_size + 1) > m_table.load(std::memory_order_relaxed)->m_mask + 1)
+		Grow();
+
+	// store the string, allocating a new block if needed
+	tag = m_size;
+	if((tag >> BLOCK_BITS) >= MAX_BLOCKS)
+		throw std::runtime_error("String registry is full.");
+	std::string *block = m_blocks[tag >> BLOCK_BITS].load(std::memory_order_relaxed);
+	if(block == NULL) {
+		block = new std::string[BLOCK_SIZE];
+		m_blocks[tag >> BLOCK_BITS].store(block, std::memory_order_release);
+	}
+	block[tag & (BLOCK_SIZE - 1)].assign(str, len);
+	++m_size;
+
+	// publish the tag
+	Table *table = m_table.load(std::memory_order_relaxed);
+	for(size_t i = Hash(str, len); ; ++i) {
+		std::atomic<stringtag_t> &slot = table->m_slots[i & table->m_mask];
+		if(slot.load(std::memory_order_relaxed) == STRINGTAG_NONE) {
+			slot.store(tag, std::memory_order_release);
+			break;
+		}
+	}
+	return tag;
+}
+
+void StringRegistry::Grow() {
+	Table *old_table = m_table.load(std::memory_order_relaxed);
+	std::unique_ptr<Table> table(new Table());
+	table->m_mask = old_table->m_mask * 2 + 1;
+	table->m_slots.reset(new std::atomic<stringtag_t>[table->m_mask + 1]);
+	for(size_t i = 0; i <= table->m_mask; ++i) {
+		table->m_slots[i].store(STRINGTAG_NONE, std::memory_order_relaxed);
+	}
+	for(size_t tag = 0; tag < m_size; ++tag) {
+		const std::string &entry = Get(tag);
+		for(size_t i = Hash(entry.data(), entry.size()); ; ++i) {
+			std::atomic<stringtag_t> &slot = table->m_slots[i & table->m_mask];
+			if(slot.load(std::memory_order_relaxed) == STRINGTAG_NONE) {
+				slot.store(tag, std::memory_order_relaxed);
+				break;
+			}
+		}
+	}
+	table->m_previous.reset(old_table);
+	m_table.store(table.release(), std::memory_order_release);
+}
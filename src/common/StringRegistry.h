@@ -18,116 +18,122 @@ You should have received a copy of the GNU General Public License
 along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #pragma once
 
-#include "HashTable.h"
+#include "Basics.h"
+#include "MurmurHash.h"
+
+#include <atomic>
+#include <mutex>
 
 /*
 AlterPCB uses short strings in lots of places, most importantly for parameters. String lookup is slow, so instead all
 these strings are replaced with a string tag (stringtag_t). This is really just a number that identifies, nothing more.
 These tags are tracked by StringRegistry.
 
-Currently this is not thread-safe.
+All functions are thread-safe. Strings are added rarely (almost all of them are registered at startup) but looked up
+constantly, so lookups are lock-free and only insertions take a mutex:
+- Strings are stored in fixed-size blocks that are never moved, so references returned by GetString stay valid.
+- The lookup table is an open addressing hash table of tags. A slot is written only once, after the string has been
+  stored, and a full table is replaced by a larger copy which is published atomically. Old tables are kept until the
+  registry is destroyed since other threads may still be reading them.
+If a lookup races with an insertion of the same string, it may not find the string. NewTag then repeats the lookup
+while holding the mutex, so a string is never added twice.
 */
 
-class StringRegistryEntry {
+class StringRegistry {
 
 private:
-	std::string m_string;
-
-public:
-	inline StringRegistryEntry(const std::string &str) : m_string(str) {}
-	inline StringRegistryEntry(std::string &&str) : m_string(std::move(str)) {}
+	static constexpr size_t BLOCK_BITS = 10, BLOCK_SIZE = (size_t) 1 << BLOCK_BITS, MAX_BLOCKS = 4096;
 
-	// default copy and assignment
-	StringRegistryEntry(const StringRegistryEntry&) = default;
-	StringRegistryEntry(StringRegistryEntry&&) = default;
-	StringRegistryEntry& operator=(const StringRegistryEntry&) = default;
-	StringRegistryEntry& operator=(StringRegistryEntry&&) = default;
-
-	inline const std::string& GetString() const {
-		return m_string;
-	}
-
-};
-
-struct StringRegistryHasher {
-	inline static bool Equal(const StringRegistryEntry &a, const StringRegistryEntry &b) {
-		return a.GetString() == b.GetString();
-	}
-	inline static bool Equal(const StringRegistryEntry &a, const std::string &b) {
-		return a.GetString() == b;
-	}
-	inline static bool Equal(const StringRegistryEntry &a, const char *b) {
-		return a.GetString() == b;
-	}
-	inline static hash_t Hash(hash_t hash, const StringRegistryEntry &value) {
-		return MurmurHash::HashData(hash, value.GetString().data(), value.GetString().size());
-	}
-	inline static hash_t Hash(hash_t hash, const std::string &value) {
-		return MurmurHash::HashData(hash, value.data(), value.size());
-	}
-	inline static hash_t Hash(hash_t hash, const char *value) {
-		return MurmurHash::HashData(hash, value, strlen(value));
-	}
-};
-
-class StringRegistry {
+	struct Table {
+		size_t m_mask;
+		std::unique_ptr<std::atomic<stringtag_t>[]> m_slots;
+		std::unique_ptr<Table> m_previous;
+	};
 
 private:
 	static StringRegistry *s_instance;
 
 private:
-	HashTable<StringRegistryEntry, StringRegistryHasher> m_entries;
+	std::mutex m_mutex;
+	std::atomic<Table*> m_table;
+	std::atomic<std::string*> m_blocks[MAX_BLOCKS];
+	size_t m_size; // protected by the mutex
 
 public:
-	inline StringRegistry() {
-		s_instance = this;
-	}
-	inline ~StringRegistry() {
-		s_instance = NULL;
-	}
+	StringRegistry();
+	~StringRegistry();
 
 	// noncopyable
 	StringRegistry(const StringRegistry&) = delete;
 	StringRegistry& operator=(const StringRegistry&) = delete;
 
+	inline static bool HasInstance() {
+		return (s_instance != NULL);
+	}
+
 	// Converts a string to a tag, adding the string to the registry if necessary.
 	inline static stringtag_t NewTag(const std::string &str) {
 		assert(s_instance != NULL);
-		return s_instance->m_entries.TryEmplaceBack(str, str).first;
-	}
-	inline static stringtag_t NewTag(std::string &&str) {
-		assert(s_instance != NULL);
-		return s_instance->m_entries.TryEmplaceBack(str, std::move(str)).first;
+		stringtag_t tag = s_instance->Find(str.data(), str.size());
+		return (tag != STRINGTAG_NONE)? tag : s_instance->Insert(str.data(), str.size());
 	}
 	inline static stringtag_t NewTag(const char *str) {
 		assert(s_instance != NULL);
-		return s_instance->m_entries.TryEmplaceBack(str, str).first;
+		size_t len = strlen(str);
+		stringtag_t tag = s_instance->Find(str, len);
+		return (tag != STRINGTAG_NONE)? tag : s_instance->Insert(str, len);
 	}
 
 	// Converts a string to a tag, but if the string is not already registered, the string is not added and instead the
 	// function returns STRINGTAG_NONE. Useful for things like key lookup.
 	inline static stringtag_t FindTag(const std::string &str) {
 		assert(s_instance != NULL);
-		return s_instance->m_entries.Find(str);
+		return s_instance->Find(str.data(), str.size());
 	}
 	inline static stringtag_t FindTag(const char *str) {
 		assert(s_instance != NULL);
-		return s_instance->m_entries.Find(str);
+		return s_instance->Find(str, strlen(str));
 	}
 
 	// Converts a tag back to a string. the tag *must* be valid, there is no error checking.
 	inline static const std::string& GetString(stringtag_t tag) {
 		assert(s_instance != NULL);
-		return s_instance->m_entries[tag].GetString();
+		return s_instance->Get(tag);
 	}
 
+private:
+	inline static hash_t Hash(const char *str, size_t len) {
+		return MurmurHash::HashFinish(MurmurHash::HashData(0x8d3a61f7, str, len));
+	}
+
+	inline const std::string& Get(stringtag_t tag) const {
+		std::string *block = m_blocks[tag >> BLOCK_BITS].load(std::memory_order_acquire);
+		assert(block != NULL);
+		return block[tag & (BLOCK_SIZE - 1)];
+	}
+
+	inline stringtag_t Find(const char *str, size_t len) const {
+		const Table *table = m_table.load(std::memory_order_acquire);
+		for(size_t i = Hash(str, len); ; ++i) {
+			stringtag_t tag = table->m_slots[i & table->m_mask].load(std::memory_order_acquire);
+			if(tag == STRINGTAG_NONE)
+				return STRINGTAG_NONE;
+			const std::string &entry = Get(tag);
+			if(entry.size() == len && memcmp(entry.data(), str, len) == 0)
+				return tag;
+		}
+	}
+
+	stringtag_t Insert(const char *str, size_t len);
+	void Grow();
+
 };
 
 // convenience functions (shorter name)
 inline stringtag_t SRNewTag(const std::string &str) { return StringRegistry::NewTag(str); }
-inline stringtag_t SRNewTag(std::string &&str) { return StringRegistry::NewTag(str); }
 inline stringtag_t SRNewTag(const char *str) { return StringRegistry::NewTag(str); }
 inline stringtag_t SRFindTag(const std::string &str) { return StringRegistry::FindTag(str); }
 inline stringtag_t SRFindTag(const char *str) { return StringRegistry::FindTag(str); }
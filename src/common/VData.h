@@ -387,7 +387,8 @@ inline void ExtendVDict(VData::Dict &ref, K &&key, V &&value, Args&&... args) {
 template<typename... Args>
 inline VData MakeVDict(Args&&... args) {
 	VData data;
-	VData::Dict &ref = data.NewDict(sizeof...(Args));
+	VData::Dict &ref = data.NewDict();
+	ref.Reserve(sizeof...(Args) / 2);
 	ExtendVDict(ref, std::forward<Args>(args)...);
 	return data;
 }
@@ -38,6 +38,10 @@ public:
 	inline VDataReader(const VData &data, VDataReader *parent = NULL, stringtag_t key = INDEX_NONE, size_t index = INDEX_NONE)
 		: m_data(data), m_parent(parent), m_key(key), m_index(index) {}
 
+	inline VDataType GetType() {
+		return m_data.GetType();
+	}
+
 	inline bool AsBool() {
 		if(m_data.GetType() == VDATA_BOOL)
 			return m_data.AsBool();
@@ -93,6 +97,29 @@ public:
 		return GetMember(StringRegistry::NewTag(key));
 	}
 
+	inline bool HasMember(stringtag_t key) {
+		if(m_data.GetType() != VDATA_DICT)
+			throw std::runtime_error(MakeString("Expected '", *this, "' to be dict, got ", EnumToString(m_data.GetType()), " instead."));
+		return (m_data.AsDict().Find(key) != INDEX_NONE);
+	}
+	inline bool HasMember(const char *key) {
+		return HasMember(StringRegistry::NewTag(key));
+	}
+
+	inline size_t GetMemberCount() {
+		if(m_data.GetType() != VDATA_DICT)
+			throw std::runtime_error(MakeString("Expected '", *this, "' to be dict, got ", EnumToString(m_data.GetType()), " instead."));
+		return m_data.AsDict().GetSize();
+	}
+
+	inline stringtag_t GetMemberKey(size_t index) {
+		if(m_data.GetType() != VDATA_DICT)
+			throw std::runtime_error(MakeString("Expected '", *this, "' to be dict, got ", EnumToString(m_data.GetType()), " instead."));
+		const VData::Dict &dict = m_data.AsDict();
+		assert(index < dict.GetSize());
+		return dict[index].Key();
+	}
+
 	inline VDataReader GetMemberDefault(stringtag_t key, const VData &default_value) {
 		if(m_data.GetType() != VDATA_DICT)
 			throw std::runtime_error(MakeString("Expected '", *this, "' to be dict, got ", EnumToString(m_data.GetType()), " instead."));
@@ -107,7 +134,7 @@ public:
 	}
 
 public:
-	//inline const VData& GetData() { return m_data; }
+	inline const VData& GetData() { return m_data; }
 	//inline VDataPath* GetParent() { return m_parent; }
 
 public:
@@ -22,7 +22,6 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ApplicationDirs.h"
 #include "CustomLineEdit.h"
-#include "FindRoot.h"
 #include "Icons.h"
 #include "Json.h"
 #include "LayoutHelper.h"
@@ -30,6 +29,7 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #include "MeshViewer.h"
 #include "QLineEditSmall.h"
 #include "QProgressDialogThreaded.h"
+#include "TLineSimulation.h"
 #include "TLineTypes.h"
 
 #include <fstream>
@@ -51,17 +51,6 @@ static real_t FloatFromString(const std::string &str) {
   return FloatFromVData(Json::FromString(str));
 }
 
-static void MakeSweep(std::vector<real_t> &results, real_t min, real_t max,
-                      real_t step) {
-  size_t num = (size_t)std::max<ptrdiff_t>(
-      rintp(std::max(0.0, max - min) / step + 0.5 + 1e-12), 1);
-  results.clear();
-  results.resize(num);
-  for (size_t i = 0; i < num; ++i) {
-    results[i] = min + step * (real_t)i;
-  }
-}
-
 MainWindow::MainWindow() {
 
   m_material_database.reset(new MaterialDatabase());
@@ -466,6 +455,7 @@ void MainWindow::SimulateFrequencySweep() {
   // initialize context
   TLineContext context;
   SimulationInit(context);
+  context.m_requested_images = false; // the mesh isn't shown
 
   // generate sweep
   real_t freq_min =
@@ -504,25 +494,9 @@ void MainWindow::SimulateFrequencySweep() {
     throw std::runtime_error("Could not open file '" + filename +
                              "' for writing.");
 
-  // write header
-  f << "Frequency";
-  for (size_t i = 0; i < tline_type.m_modes.size(); ++i) {
-    for (size_t j = 0; j < TLINERESULT_COUNT; ++j) {
-      f << '\t' << tline_type.m_modes[i] << ' ' << TLINERESULT_NAMES[j];
-    }
-  }
-  f << std::endl;
-
-  // write body
-  for (size_t i = 0; i < context.m_frequencies.size(); ++i) {
-    f << context.m_frequencies[i];
-    real_t *results = context.m_results.data() +
-                      TLINERESULT_COUNT * tline_type.m_modes.size() * i;
-    for (size_t j = 0; j < TLINERESULT_COUNT * tline_type.m_modes.size(); ++j) {
-      f << '\t' << results[j];
-    }
-    f << std::endl;
-  }
+  // write results
+  TLineWriteResults(f, tline_type, {"Frequency"}, context.m_frequencies,
+                    context.m_results);
 }
 
 void MainWindow::SimulateParameterSweep() {
@@ -531,6 +505,7 @@ void MainWindow::SimulateParameterSweep() {
   // initialize context
   TLineContext context;
   SimulationInit(context);
+  context.m_requested_images = false; // the mesh isn't shown
 
   // set frequency
   context.m_frequencies = {
@@ -552,8 +527,6 @@ void MainWindow::SimulateParameterSweep() {
           ->itemData(m_combobox_parameter_sweep_parameter->currentIndex())
           .toInt();
   std::vector<real_t> combined_results;
-  combined_results.resize(TLINERESULT_COUNT * tline_type.m_modes.size() *
-                          sweep_values.size());
 
   // simulate
   QProgressDialogThreaded dialog("Parameter sweep ...", "Cancel", 0,
@@ -562,17 +535,14 @@ void MainWindow::SimulateParameterSweep() {
   dialog.setMinimumDuration(0);
   dialog.execThreaded([&](std::atomic<int> &task_progress,
                           std::atomic<bool> &task_canceled) {
-    for (size_t i = 0; i < sweep_values.size(); ++i) {
-      context.m_parameters[param_index].Value() = FloatScale(sweep_values[i]);
-      tline_type.m_simulate(context);
-      std::copy_n(context.m_results.data(), context.m_results.size(),
-                  combined_results.data() +
-                      TLINERESULT_COUNT * tline_type.m_modes.size() * i);
-      task_progress = (int)i + 1;
-      if (task_canceled) {
-        throw std::runtime_error("Parameter sweep canceled by user.");
-      }
-    }
+    TLineParameterSweep(
+        tline_type, context, param_index, sweep_values, combined_results,
+        [&](size_t progress) {
+          task_progress = (int)progress;
+          if (task_canceled) {
+            throw std::runtime_error("Parameter sweep canceled by user.");
+          }
+        });
   });
 
   // open output file
@@ -584,25 +554,9 @@ void MainWindow::SimulateParameterSweep() {
     throw std::runtime_error("Could not open file '" + filename +
                              "' for writing.");
 
-  // write header
-  f << tline_type.m_parameters[param_index].m_name;
-  for (size_t i = 0; i < tline_type.m_modes.size(); ++i) {
-    for (size_t j = 0; j < TLINERESULT_COUNT; ++j) {
-      f << '\t' << tline_type.m_modes[i] << ' ' << TLINERESULT_NAMES[j];
-    }
-  }
-  f << std::endl;
-
-  // write body
-  for (size_t i = 0; i < sweep_values.size(); ++i) {
-    f << sweep_values[i];
-    real_t *results = combined_results.data() +
-                      TLINERESULT_COUNT * tline_type.m_modes.size() * i;
-    for (size_t j = 0; j < TLINERESULT_COUNT * tline_type.m_modes.size(); ++j) {
-      f << '\t' << results[j];
-    }
-    f << std::endl;
-  }
+  // write results
+  TLineWriteResults(f, tline_type, {tline_type.m_parameters[param_index].m_name},
+                    sweep_values, combined_results);
 }
 
 void MainWindow::SimulateParameterTune() {
@@ -630,20 +584,8 @@ void MainWindow::SimulateParameterTune() {
       m_lineedit_parameter_tune_target_value->text().toStdString());
 
   // simulate
-  real_t initial_value =
-      FloatFromVData(context.m_parameters[param_index].Value());
-  if (!FinitePositive(initial_value)) {
-    initial_value =
-        FloatFromVData(tline_type.m_parameters[param_index].m_default_value);
-  }
-  real_t root_value = FindRootRelative(
-      [&context, &tline_type, param_index, result_index,
-       target_value](real_t x) {
-        context.m_parameters[param_index].Value() = FloatScale(x);
-        tline_type.m_simulate(context);
-        return context.m_results[result_index] - target_value;
-      },
-      initial_value, 1e-8, target_value * 1e-8, 1e6);
+  real_t root_value = TLineParameterTune(tline_type, context, param_index,
+                                         result_index, target_value);
 
   // write the result back
   CustomLineEdit *lineedit_value =
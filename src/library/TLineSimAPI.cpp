@@ -0,0 +1,323 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "TLineSimAPI.h"
+
+#include "Basics.h"
+#include "MaterialDatabase.h"
+#include "StringRegistry.h"
+#include "TLineSimulation.h"
+#include "TLineTypes.h"
+
+#include <algorithm>
+#include <mutex>
+
+static_assert((int) TLINESIM_RESULT_COUNT == (int) TLINERESULT_COUNT, "tlinesim_result does not match TLineResult");
+
+// TLineSolveModes scales the results to the units of the result tables (TLINERESULT_UNITS), these factors convert them
+// back to SI units (the loss stays in dB, per meter).
+const double TLINESIM_RESULT_SI_SCALES[TLINESIM_RESULT_COUNT] = {
+	1.0, // Ω
+	1.0, // m/s
+	1.0e-3, // mm -> m
+	1.0e3, // dB/mm -> dB/m
+	1.0e-6, // nH/mm -> H/m
+	1.0e-9, // pF/mm -> F/m
+	1.0e3, // Ω/mm -> Ω/m
+	1.0e3, // S/mm -> S/m
+	1.0, // Np/m
+	1.0, // rad/m
+};
+
+struct tlinesim_materials {
+	MaterialDatabase m_material_database;
+};
+
+struct tlinesim_session {
+	const TLineType *m_tline_type;
+	TLineContext m_context;
+	bool m_solved;
+	mutable std::string m_error; // also set by functions that don't change the session
+};
+
+static std::once_flag g_library_once;
+static std::unique_ptr<StringRegistry> g_library_string_registry;
+static std::vector<std::vector<std::string>> g_library_parameter_names;
+
+// The library can be used by a program that already has its own string registry and transmission line types, in that
+// case they are reused.
+static void LibraryInit() {
+	std::call_once(g_library_once, []() {
+		if(!StringRegistry::HasInstance())
+			g_library_string_registry.reset(new StringRegistry());
+		if(g_tline_types.empty())
+			RegisterTLineTypes();
+		g_library_parameter_names.resize(g_tline_types.size());
+		for(size_t i = 0; i < g_tline_types.size(); ++i) {
+			for(const TLineParameter &parameter : g_tline_types[i].m_parameters) {
+				g_library_parameter_names[i].push_back(CanonicalName(parameter.m_name));
+			}
+		}
+	});
+}
+
+static void CopyError(char *error, size_t error_size, const char *message) {
+	if(error != NULL && error_size != 0) {
+		strncpy(error, message, error_size - 1);
+		error[error_size - 1] = '\0';
+	}
+}
+
+// Runs a function and converts exceptions to an error message, since exceptions can't cross the C interface.
+template<typename F>
+static int SessionCall(const tlinesim_session *session, F &&func) {
+	try {
+		func();
+		session->m_error.clear();
+		return 0;
+	} catch(const std::exception &e) {
+		session->m_error = e.what();
+	} catch(...) {
+		session->m_error = "Unknown error.";
+	}
+	return -1;
+}
+
+static VData& FindSessionParameter(tlinesim_session *session, const char *parameter, std::initializer_list<TLineParameterType> types) {
+	size_t param_index = FindTLineParameter(*session->m_tline_type, parameter);
+	if(param_index == INDEX_NONE)
+		throw std::runtime_error(MakeString("Transmission line type '", session->m_tline_type->m_name, "' has no parameter '", parameter, "'."));
+	if(std::find(types.begin(), types.end(), session->m_tline_type->m_parameters[param_index].m_type) == types.end())
+		throw std::runtime_error(MakeString("Parameter '", parameter, "' has a different type."));
+	session->m_solved = false;
+	return session->m_context.m_parameters[param_index].Value();
+}
+
+tlinesim_materials* tlinesim_materials_load(const char *filename, char *error, size_t error_size) {
+	LibraryInit();
+	try {
+		std::unique_ptr<tlinesim_materials> materials(new tlinesim_materials());
+		materials->m_material_database.LoadFile(filename);
+		materials->m_material_database.Finish();
+		return materials.release();
+	} catch(const std::exception &e) {
+		CopyError(error, error_size, e.what());
+	} catch(...) {
+		CopyError(error, error_size, "Unknown error.");
+	}
+	return NULL;
+}
+
+void tlinesim_materials_free(tlinesim_materials *materials) {
+	delete materials;
+}
+
+size_t tlinesim_type_count(void) {
+	LibraryInit();
+	return g_tline_types.size();
+}
+
+const char* tlinesim_type_name(size_t type) {
+	LibraryInit();
+	if(type >= g_tline_types.size())
+		return NULL;
+	return g_tline_types[type].m_name.c_str();
+}
+
+size_t tlinesim_type_parameter_count(size_t type) {
+	LibraryInit();
+	if(type >= g_tline_types.size())
+		return 0;
+	return g_tline_types[type].m_parameters.size();
+}
+
+const char* tlinesim_type_parameter_name(size_t type, size_t parameter) {
+	LibraryInit();
+	if(type >= g_tline_types.size() || parameter >= g_library_parameter_names[type].size())
+		return NULL;
+	return g_library_parameter_names[type][parameter].c_str();
+}
+
+size_t tlinesim_type_mode_count(size_t type) {
+	LibraryInit();
+	if(type >= g_tline_types.size())
+		return 0;
+	return g_tline_types[type].m_modes.size();
+}
+
+const char* tlinesim_type_mode_name(size_t type, size_t mode) {
+	LibraryInit();
+	if(type >= g_tline_types.size() || mode >= g_tline_types[type].m_modes.size())
+		return NULL;
+	return g_tline_types[type].m_modes[mode].c_str();
+}
+
+tlinesim_session* tlinesim_session_create(const tlinesim_materials *materials, const char *type_name, char *error, size_t error_size) {
+	LibraryInit();
+	try {
+		size_t type = FindTLineType(type_name);
+		if(type == INDEX_NONE)
+			throw std::runtime_error(MakeString("Unknown transmission line type '", type_name, "'."));
+		const TLineType &tline_type = g_tline_types[type];
+		std::unique_ptr<tlinesim_session> session(new tlinesim_session());
+		session->m_tline_type = &tline_type;
+		session->m_context.m_material_database = const_cast<MaterialDatabase*>(&materials->m_material_database);
+		session->m_context.m_frequencies = {1e9};
+		session->m_context.m_mesh_detail = 1.0;
+		session->m_context.m_requested_images = false;
+		for(size_t i = 0; i < tline_type.m_parameters.size(); ++i) {
+			stringtag_t key = StringRegistry::NewTag(g_library_parameter_names[type][i]);
+			session->m_context.m_parameters.EmplaceBack(VDataDictEntry(key, tline_type.m_parameters[i].m_default_value));
+		}
+		session->m_solved = false;
+		return session.release();
+	} catch(const std::exception &e) {
+		CopyError(error, error_size, e.what());
+	} catch(...) {
+		CopyError(error, error_size, "Unknown error.");
+	}
+	return NULL;
+}
+
+void tlinesim_session_destroy(tlinesim_session *session) {
+	delete session;
+}
+
+const char* tlinesim_session_error(const tlinesim_session *session) {
+	return session->m_error.c_str();
+}
+
+int tlinesim_session_set_real(tlinesim_session *session, const char *parameter, double value) {
+	return SessionCall(session, [&]() {
+		FindSessionParameter(session, parameter, {TLINE_PARAMETERTYPE_REAL}) = FloatScale(value);
+	});
+}
+
+int tlinesim_session_set_bool(tlinesim_session *session, const char *parameter, int value) {
+	return SessionCall(session, [&]() {
+		FindSessionParameter(session, parameter, {TLINE_PARAMETERTYPE_BOOL}) = (value != 0);
+	});
+}
+
+int tlinesim_session_set_material(tlinesim_session *session, const char *parameter, const char *material) {
+	return SessionCall(session, [&]() {
+		FindSessionParameter(session, parameter, {TLINE_PARAMETERTYPE_MATERIAL_CONDUCTOR, TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC}) = std::string(material);
+	});
+}
+
+int tlinesim_session_set_mesh_detail(tlinesim_session *session, double mesh_detail) {
+	return SessionCall(session, [&]() {
+		session->m_context.m_mesh_detail = exp2(mesh_detail * 0.5);
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_set_memory_budget(tlinesim_session *session, size_t megabytes) {
+	return SessionCall(session, [&]() {
+		session->m_context.m_memory_budget = megabytes << 20;
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_set_mixed_precision(tlinesim_session *session, int mixed_precision) {
+	return SessionCall(session, [&]() {
+		session->m_context.m_mixed_precision = (mixed_precision != 0);
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_set_element_order(tlinesim_session *session, int order) {
+	return SessionCall(session, [&]() {
+		if(order != 1 && order != 2)
+			throw std::runtime_error("The element order must be 1 (linear) or 2 (quadratic).");
+		session->m_context.m_element_order = (size_t) order;
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_set_adaptive_sweep(tlinesim_session *session, int adaptive_sweep) {
+	return SessionCall(session, [&]() {
+		session->m_context.m_adaptive_sweep = (adaptive_sweep != 0);
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_set_frequencies(tlinesim_session *session, const double *frequencies, size_t count) {
+	return SessionCall(session, [&]() {
+		if(count == 0)
+			throw std::runtime_error("At least one frequency is required.");
+		for(size_t i = 0; i < count; ++i) {
+			if(!FinitePositive(frequencies[i]))
+				throw std::runtime_error(MakeString("Frequency ", frequencies[i], " is not valid."));
+		}
+		session->m_context.m_frequencies.assign(frequencies, frequencies + count);
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_set_requested_results(tlinesim_session *session, const enum tlinesim_result *results, size_t count) {
+	return SessionCall(session, [&]() {
+		uint32_t mask = 0;
+		for(size_t i = 0; i < count; ++i) {
+			if((size_t) results[i] >= TLINERESULT_COUNT)
+				throw std::runtime_error(MakeString("Result ", (int) results[i], " is not valid."));
+			mask |= 1u << (size_t) results[i];
+		}
+		if(mask == 0)
+			throw std::runtime_error("At least one result is required.");
+		session->m_context.m_requested_results = mask;
+		session->m_solved = false;
+	});
+}
+
+int tlinesim_session_solve(tlinesim_session *session) {
+	return SessionCall(session, [&]() {
+		session->m_solved = false;
+		session->m_context.m_warnings.clear();
+		session->m_tline_type->m_simulate(session->m_context);
+		session->m_solved = true;
+	});
+}
+
+int tlinesim_session_get_result(const tlinesim_session *session, size_t frequency, size_t mode, enum tlinesim_result result, double *value) {
+	return SessionCall(session, [&]() {
+		if(!session->m_solved)
+			throw std::runtime_error("The session has not been solved.");
+		if(frequency >= session->m_context.m_frequencies.size())
+			throw std::runtime_error(MakeString("Frequency ", frequency, " is out of range, the session has ", session->m_context.m_frequencies.size(), " frequencies."));
+		if(mode >= session->m_tline_type->m_modes.size())
+			throw std::runtime_error(MakeString("Mode ", mode, " is out of range, the session has ", session->m_tline_type->m_modes.size(), " modes."));
+		if((size_t) result >= TLINERESULT_COUNT)
+			throw std::runtime_error(MakeString("Result ", (int) result, " is not valid."));
+		size_t index = (frequency * session->m_tline_type->m_modes.size() + mode) * TLINERESULT_COUNT + (size_t) result;
+		*value = session->m_context.m_results[index] * TLINESIM_RESULT_SI_SCALES[(size_t) result];
+	});
+}
+
+size_t tlinesim_session_warning_count(const tlinesim_session *session) {
+	return session->m_context.m_warnings.size();
+}
+
+const char* tlinesim_session_warning(const tlinesim_session *session, size_t warning) {
+	if(warning >= session->m_context.m_warnings.size())
+		return NULL;
+	return session->m_context.m_warnings[warning].c_str();
+}
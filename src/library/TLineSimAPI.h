@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+/*
+C interface for embedding the transmission line simulator in other programs.
+
+The library is reentrant: any number of sessions can be used concurrently from different threads, as long as each
+session is only used by one thread at a time. A material database can be shared by all sessions once it has been loaded.
+
+All functions that can fail return 0 on success and -1 on failure. The error message can be retrieved with
+tlinesim_session_error (or is written to the provided buffer for functions that don't take a session). Lengths are in
+mm, frequencies in Hz, all results are in SI units (per meter of line), except the loss which is in dB/m. Note that
+the result tables of the GUI and the command-line solver use per-mm units instead.
+*/
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define TLINESIM_API __declspec(dllexport)
+#else
+#define TLINESIM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tlinesim_materials tlinesim_materials;
+typedef struct tlinesim_session tlinesim_session;
+
+/* must match TLineResult */
+enum tlinesim_result {
+	TLINESIM_RESULT_IMPEDANCE, /* ohm */
+	TLINESIM_RESULT_VELOCITY, /* m/s */
+	TLINESIM_RESULT_WAVELENGTH, /* m */
+	TLINESIM_RESULT_LOSS, /* dB/m */
+	TLINESIM_RESULT_INDUCTANCE, /* H/m */
+	TLINESIM_RESULT_CAPACITANCE, /* F/m */
+	TLINESIM_RESULT_RESISTANCE, /* ohm/m */
+	TLINESIM_RESULT_CONDUCTANCE, /* S/m */
+	TLINESIM_RESULT_ALPHA, /* Np/m */
+	TLINESIM_RESULT_BETA, /* rad/m */
+	TLINESIM_RESULT_COUNT,
+};
+
+/* material database */
+TLINESIM_API tlinesim_materials* tlinesim_materials_load(const char *filename, char *error, size_t error_size);
+TLINESIM_API void tlinesim_materials_free(tlinesim_materials *materials);
+
+/* transmission line types */
+TLINESIM_API size_t tlinesim_type_count(void);
+TLINESIM_API const char* tlinesim_type_name(size_t type);
+TLINESIM_API size_t tlinesim_type_parameter_count(size_t type);
+TLINESIM_API const char* tlinesim_type_parameter_name(size_t type, size_t parameter); /* canonical name, e.g. 'track_width' */
+TLINESIM_API size_t tlinesim_type_mode_count(size_t type);
+TLINESIM_API const char* tlinesim_type_mode_name(size_t type, size_t mode);
+
+/* sessions */
+TLINESIM_API tlinesim_session* tlinesim_session_create(const tlinesim_materials *materials, const char *type_name, char *error, size_t error_size);
+TLINESIM_API void tlinesim_session_destroy(tlinesim_session *session);
+TLINESIM_API const char* tlinesim_session_error(const tlinesim_session *session);
+
+TLINESIM_API int tlinesim_session_set_real(tlinesim_session *session, const char *parameter, double value);
+TLINESIM_API int tlinesim_session_set_bool(tlinesim_session *session, const char *parameter, int value);
+TLINESIM_API int tlinesim_session_set_material(tlinesim_session *session, const char *parameter, const char *material);
+TLINESIM_API int tlinesim_session_set_mesh_detail(tlinesim_session *session, double mesh_detail); /* -3 (very low) to 3 (very high) */
+TLINESIM_API int tlinesim_session_set_memory_budget(tlinesim_session *session, size_t megabytes); /* 0 (no limit) by default */
+TLINESIM_API int tlinesim_session_set_mixed_precision(tlinesim_session *session, int mixed_precision); /* 0 (disabled) by default */
+TLINESIM_API int tlinesim_session_set_element_order(tlinesim_session *session, int order); /* 1 (linear) by default, or 2 (quadratic) */
+TLINESIM_API int tlinesim_session_set_adaptive_sweep(tlinesim_session *session, int adaptive_sweep); /* 0 (disabled) by default */
+TLINESIM_API int tlinesim_session_set_frequencies(tlinesim_session *session, const double *frequencies, size_t count);
+TLINESIM_API int tlinesim_session_set_requested_results(tlinesim_session *session, const enum tlinesim_result *results, size_t count); /* all by default, the other results will be NaN */
+
+TLINESIM_API int tlinesim_session_solve(tlinesim_session *session);
+TLINESIM_API int tlinesim_session_get_result(const tlinesim_session *session, size_t frequency, size_t mode, enum tlinesim_result result, double *value);
+TLINESIM_API size_t tlinesim_session_warning_count(const tlinesim_session *session); /* warnings of the last solve, e.g. a reduced mesh detail */
+TLINESIM_API const char* tlinesim_session_warning(const tlinesim_session *session, size_t warning);
+
+#ifdef __cplusplus
+}
+#endif
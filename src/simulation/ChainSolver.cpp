@@ -0,0 +1,273 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ChainSolver.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+ChainSolver::ChainSolver() {
+	m_size = 0;
+	m_factorized = false;
+}
+
+void ChainSolver::Factorize(const Eigen::SparseMatrix<real_t> &matrix) {
+	assert(matrix.rows() == matrix.cols());
+	Clear();
+	m_size = matrix.rows();
+
+	// extract the diagonal and the graph of the off-diagonal coefficients
+	std::vector<real_t> diag((size_t) m_size, 0.0);
+	std::vector<size_t> degree((size_t) m_size, 0);
+	for(Eigen::Index k = 0; k < matrix.outerSize(); ++k) {
+		for(Eigen::SparseMatrix<real_t>::InnerIterator it(matrix, k); it; ++it) {
+			if(it.row() == it.col()) {
+				diag[(size_t) it.row()] += it.value();
+			} else {
+				++degree[(size_t) it.row()];
+				++degree[(size_t) it.col()];
+			}
+		}
+	}
+	std::vector<size_t> adj_offsets((size_t) m_size + 1, 0);
+	for(size_t i = 0; i < (size_t) m_size; ++i) {
+		adj_offsets[i + 1] = adj_offsets[i] + degree[i];
+	}
+	std::vector<Eigen::Index> adj_indices(adj_offsets.back());
+	std::vector<real_t> adj_values(adj_offsets.back());
+	std::fill(degree.begin(), degree.end(), 0);
+	for(Eigen::Index k = 0; k < matrix.outerSize(); ++k) {
+		for(Eigen::SparseMatrix<real_t>::InnerIterator it(matrix, k); it; ++it) {
+			if(it.row() != it.col()) {
+				size_t r = (size_t) it.row(), c = (size_t) it.col();
+				adj_indices[adj_offsets[r] + degree[r]] = it.col();
+				adj_values[adj_offsets[r] + degree[r]++] = it.value();
+				adj_indices[adj_offsets[c] + degree[c]] = it.row();
+				adj_values[adj_offsets[c] + degree[c]++] = it.value();
+			}
+		}
+	}
+
+	// find the connected components
+	std::vector<bool> visited((size_t) m_size, false);
+	std::vector<Eigen::Index> component, stack;
+	for(Eigen::Index start = 0; start < m_size; ++start) {
+		if(visited[(size_t) start])
+			continue;
+		component.clear();
+		stack.push_back(start);
+		visited[(size_t) start] = true;
+		bool junction = false;
+		Eigen::Index endpoint = start;
+		bool has_endpoint = false;
+		while(!stack.empty()) {
+			Eigen::Index i = stack.back();
+			stack.pop_back();
+			component.push_back(i);
+			if(degree[(size_t) i] > 2)
+				junction = true;
+			if(degree[(size_t) i] < 2 && !has_endpoint) {
+				endpoint = i;
+				has_endpoint = true;
+			}
+			for(size_t p = adj_offsets[(size_t) i]; p < adj_offsets[(size_t) i + 1]; ++p) {
+				Eigen::Index j = adj_indices[p];
+				if(!visited[(size_t) j]) {
+					visited[(size_t) j] = true;
+					stack.push_back(j);
+				}
+			}
+		}
+
+		// components with junctions are handled by the general solver
+		if(junction) {
+			m_general_indices.insert(m_general_indices.end(), component.begin(), component.end());
+			continue;
+		}
+
+		// walk along the chain, starting from an endpoint if there is one
+		Chain chain;
+		chain.m_cyclic = !has_endpoint;
+		chain.m_indices.reserve(component.size());
+		chain.m_diag.reserve(component.size());
+		chain.m_lower.reserve(component.size());
+		Eigen::Index prev = -1, cur = endpoint;
+		real_t closing = 0.0;
+		for( ; ; ) {
+			chain.m_indices.push_back(cur);
+			chain.m_diag.push_back(diag[(size_t) cur]);
+			Eigen::Index next = -1;
+			real_t value = 0.0;
+			for(size_t p = adj_offsets[(size_t) cur]; p < adj_offsets[(size_t) cur + 1]; ++p) {
+				if(adj_indices[p] != prev && adj_indices[p] != endpoint) {
+					next = adj_indices[p];
+					value = adj_values[p];
+					break;
+				}
+				if(adj_indices[p] == endpoint && cur != endpoint && prev != endpoint)
+					closing = adj_values[p];
+			}
+			if(next == -1)
+				break;
+			chain.m_lower.push_back(value);
+			prev = cur;
+			cur = next;
+		}
+		assert(chain.m_indices.size() == component.size());
+
+		if(chain.m_cyclic) {
+
+			// Split the matrix as A = T + u * v^T, where T is tridiagonal, u = [gamma, 0, ..., 0, closing]
+			// and v = [1, 0, ..., 0, closing / gamma]. Choosing gamma = -A(0, 0) keeps T positive definite.
+			size_t n = chain.m_indices.size();
+			real_t gamma = -chain.m_diag[0];
+			chain.m_closing_ratio = closing / gamma;
+			chain.m_diag[0] -= gamma;
+			chain.m_diag[n - 1] -= closing * chain.m_closing_ratio;
+			FactorizeTridiagonal(chain);
+
+			// precompute z = T \ u
+			std::vector<real_t> &z = chain.m_correction;
+			z.assign(n, 0.0);
+			z[0] = gamma;
+			z[n - 1] = closing;
+			for(size_t i = 1; i < n; ++i) {
+				z[i] -= chain.m_lower[i - 1] * z[i - 1];
+			}
+			for(size_t i = 0; i < n; ++i) {
+				z[i] /= chain.m_diag[i];
+			}
+			for(size_t i = n - 1; i > 0; --i) {
+				z[i - 1] -= chain.m_lower[i - 1] * z[i];
+			}
+			chain.m_correction_scale = 1.0 / (1.0 + z[0] + chain.m_closing_ratio * z[n - 1]);
+
+		} else {
+			chain.m_closing_ratio = 0.0;
+			chain.m_correction_scale = 0.0;
+			FactorizeTridiagonal(chain);
+		}
+		m_chains.emplace_back(std::move(chain));
+
+	}
+
+	// factorize the remaining variables with the general solver
+	if(!m_general_indices.empty()) {
+		std::sort(m_general_indices.begin(), m_general_indices.end()); // keeps the lower triangle in the lower triangle
+		std::vector<Eigen::Index> local_index((size_t) m_size, -1);
+		for(size_t i = 0; i < m_general_indices.size(); ++i) {
+			local_index[(size_t) m_general_indices[i]] = (Eigen::Index) i;
+		}
+		std::vector<Eigen::Triplet<real_t>> triplets;
+		for(Eigen::Index k = 0; k < matrix.outerSize(); ++k) {
+			if(local_index[(size_t) k] == -1)
+				continue;
+			for(Eigen::SparseMatrix<real_t>::InnerIterator it(matrix, k); it; ++it) {
+				triplets.emplace_back(local_index[(size_t) it.row()], local_index[(size_t) it.col()], it.value());
+			}
+		}
+		Eigen::Index size = (Eigen::Index) m_general_indices.size();
+		Eigen::SparseMatrix<real_t> general_matrix(size, size);
+		general_matrix.setFromTriplets(triplets.begin(), triplets.end());
+		m_general_chol.reset(new Eigen::SimplicialLDLT<Eigen::SparseMatrix<real_t>, Eigen::Lower>(general_matrix));
+		if(m_general_chol->info() != Eigen::Success)
+			throw std::runtime_error("Sparse matrix factorization failed!");
+	}
+
+	m_factorized = true;
+}
+
+void ChainSolver::Solve(const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result) const {
+	assert(m_factorized);
+	assert(rhs.rows() == m_size);
+	result = rhs;
+	for(const Chain &chain : m_chains) {
+		SolveTridiagonal(chain, result);
+		if(chain.m_cyclic) {
+			size_t n = chain.m_indices.size();
+			Eigen::RowVectorXr correction = (result.row(chain.m_indices[0]) + chain.m_closing_ratio * result.row(chain.m_indices[n - 1])) * chain.m_correction_scale;
+			for(size_t i = 0; i < n; ++i) {
+				result.row(chain.m_indices[i]) -= chain.m_correction[i] * correction;
+			}
+		}
+	}
+	if(!m_general_indices.empty()) {
+		Eigen::MatrixXr general_rhs((Eigen::Index) m_general_indices.size(), rhs.cols());
+		for(size_t i = 0; i < m_general_indices.size(); ++i) {
+			general_rhs.row((Eigen::Index) i) = rhs.row(m_general_indices[i]);
+		}
+		Eigen::MatrixXr general_result = m_general_chol->solve(general_rhs);
+		for(size_t i = 0; i < m_general_indices.size(); ++i) {
+			result.row(m_general_indices[i]) = general_result.row((Eigen::Index) i);
+		}
+	}
+}
+
+void ChainSolver::Clear() {
+	m_size = 0;
+	m_factorized = false;
+	m_chains.clear();
+	m_chains.shrink_to_fit();
+	m_general_indices.clear();
+	m_general_indices.shrink_to_fit();
+	m_general_chol.reset();
+}
+
+size_t ChainSolver::GetMemoryUsage() const {
+	size_t usage = m_chains.capacity() * sizeof(Chain) + m_general_indices.capacity() * sizeof(Eigen::Index);
+	for(const Chain &chain : m_chains) {
+		usage += chain.m_indices.capacity() * sizeof(Eigen::Index);
+		usage += (chain.m_diag.capacity() + chain.m_lower.capacity() + chain.m_correction.capacity()) * sizeof(real_t);
+	}
+	if(m_general_chol) {
+		usage += EigenSparseMemoryUsage(m_general_chol->matrixL().nestedExpression()) + (size_t) m_general_chol->vectorD().size() * sizeof(real_t);
+	}
+	return usage;
+}
+
+void ChainSolver::FactorizeTridiagonal(Chain &chain) {
+	// in-place LDL^T factorization, m_lower[i] is the coefficient between variables i and i + 1
+	std::vector<real_t> &d = chain.m_diag, &l = chain.m_lower;
+	for(size_t i = 1; i < d.size(); ++i) {
+		if(!(d[i - 1] > 0.0))
+			throw std::runtime_error("Sparse matrix factorization failed!");
+		real_t a = l[i - 1];
+		l[i - 1] = a / d[i - 1];
+		d[i] -= l[i - 1] * a;
+	}
+	if(!(d.back() > 0.0))
+		throw std::runtime_error("Sparse matrix factorization failed!");
+}
+
+void ChainSolver::SolveTridiagonal(const Chain &chain, Eigen::MatrixXr &result) {
+	const std::vector<Eigen::Index> &idx = chain.m_indices;
+	const std::vector<real_t> &d = chain.m_diag, &l = chain.m_lower;
+	size_t n = idx.size();
+	for(size_t i = 1; i < n; ++i) {
+		result.row(idx[i]) -= l[i - 1] * result.row(idx[i - 1]);
+	}
+	for(size_t i = 0; i < n; ++i) {
+		result.row(idx[i]) /= d[i];
+	}
+	for(size_t i = n - 1; i > 0; --i) {
+		result.row(idx[i - 1]) -= l[i - 1] * result.row(idx[i]);
+	}
+}
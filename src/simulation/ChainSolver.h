@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "Basics.h"
+#include "Eigen.h"
+#include "EigenSparse.h"
+
+#include <memory>
+#include <vector>
+
+// Direct solver for symmetric positive definite sparse matrices whose graph consists mostly of simple paths and
+// cycles, such as the surface current matrix of GridMesh2D (one cycle for each conductor perimeter). Paths are
+// factorized as tridiagonal systems, cycles as cyclic tridiagonal systems using the Sherman-Morrison formula. Both
+// take linear time and don't cause any fill-in. Connected components which contain junctions (variables with more
+// than two neighbors) fall back to a general sparse Cholesky factorization.
+
+class ChainSolver {
+
+private:
+	struct Chain {
+		std::vector<Eigen::Index> m_indices; // variables in chain order
+		std::vector<real_t> m_diag, m_lower; // LDL^T factorization of the (modified) tridiagonal part
+		std::vector<real_t> m_correction; // Sherman-Morrison correction vector (cyclic chains only)
+		real_t m_closing_ratio, m_correction_scale;
+		bool m_cyclic;
+	};
+
+private:
+	Eigen::Index m_size;
+	bool m_factorized;
+	std::vector<Chain> m_chains;
+	std::vector<Eigen::Index> m_general_indices;
+	std::unique_ptr<Eigen::SimplicialLDLT<Eigen::SparseMatrix<real_t>, Eigen::Lower>> m_general_chol;
+
+public:
+	ChainSolver();
+
+	// Factorizes a symmetric matrix of which only the lower triangle is stored.
+	void Factorize(const Eigen::SparseMatrix<real_t> &matrix);
+
+	// Solves the system for all columns of the right-hand side at once.
+	void Solve(const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result) const;
+
+	// Frees the factorization.
+	void Clear();
+
+	// Returns the memory used by the factorization (in bytes).
+	size_t GetMemoryUsage() const;
+
+	inline bool IsFactorized() const { return m_factorized; }
+	inline size_t GetChainCount() const { return m_chains.size(); }
+	inline size_t GetGeneralSize() const { return m_general_indices.size(); }
+
+private:
+	static void FactorizeTridiagonal(Chain &chain);
+	static void SolveTridiagonal(const Chain &chain, Eigen::MatrixXr &result);
+
+};
@@ -0,0 +1,220 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "EigenModes.h"
+
+#include "EigenSparse.h"
+
+#include <vector>
+
+template<int N>
+struct EigenModeTypes {
+	typedef Eigen::Matrix<real_t, N, N> MatrixR;
+	typedef Eigen::Matrix<complex_t, N, N> MatrixC;
+	typedef Eigen::Matrix<complex_t, N, 1> VectorC;
+};
+
+// General eigenvalue decomposition, used for 3 or more modes.
+template<int N>
+struct EigenDecomposition {
+	typedef typename EigenModeTypes<N>::MatrixC MatrixC;
+	typedef typename EigenModeTypes<N>::VectorC VectorC;
+	Eigen::ComplexEigenSolver<MatrixC> m_eigensolver;
+	void Compute(const MatrixC &matrix, VectorC &eigval, MatrixC &eigvec) {
+		m_eigensolver.compute(matrix);
+		if(m_eigensolver.info() != Eigen::Success)
+			throw std::runtime_error("Eigenmode decomposition failed!");
+		eigval = m_eigensolver.eigenvalues();
+		eigvec = m_eigensolver.eigenvectors();
+	}
+};
+
+// Trivial eigenvalue decomposition for a single mode.
+template<>
+struct EigenDecomposition<1> {
+	void Compute(const Eigen::Matrix<complex_t, 1, 1> &matrix, Eigen::Matrix<complex_t, 1, 1> &eigval, Eigen::Matrix<complex_t, 1, 1> &eigvec) {
+		eigval(0, 0) = matrix(0, 0);
+		eigvec(0, 0) = complex_t(1.0, 0.0);
+	}
+};
+
+// Closed-form eigenvalue decomposition for two modes.
+template<>
+struct EigenDecomposition<2> {
+	static void Eigenvector(complex_t a, complex_t b, complex_t c, complex_t d, complex_t lambda, Eigen::Ref<Eigen::Vector2c> vec) {
+		// both rows of (A - lambda * I) give a valid solution, the one with the largest norm is the most accurate
+		Eigen::Vector2c v1(b, lambda - a), v2(lambda - d, c);
+		vec = (v1.squaredNorm() >= v2.squaredNorm())? v1 : v2;
+		vec.normalize();
+	}
+	void Compute(const Eigen::Matrix2c &matrix, Eigen::Vector2c &eigval, Eigen::Matrix2c &eigvec) {
+		complex_t a = matrix(0, 0), b = matrix(0, 1), c = matrix(1, 0), d = matrix(1, 1);
+		if(b == 0.0 && c == 0.0) {
+			eigval = Eigen::Vector2c(a, d);
+			eigvec.setIdentity();
+			return;
+		}
+		// roots of x^2 - (a + d) * x + (a * d - b * c), the second root is derived from the product to avoid cancellation
+		complex_t half_trace = 0.5 * (a + d);
+		complex_t root = std::sqrt(0.25 * (a - d) * (a - d) + b * c);
+		complex_t lambda1 = (std::norm(half_trace + root) >= std::norm(half_trace - root))? half_trace + root : half_trace - root;
+		complex_t lambda2 = (lambda1 == 0.0)? complex_t(0.0, 0.0) : (a * d - b * c) / lambda1;
+		eigval = Eigen::Vector2c(lambda1, lambda2);
+		Eigenvector(a, b, c, d, lambda1, eigvec.col(0));
+		Eigenvector(a, b, c, d, lambda2, eigvec.col(1));
+	}
+};
+
+// Calculates the eigenmodes of a single frequency point. Fixed-size matrices (N = 1 to 4) avoid heap allocations and
+// let Eigen use closed-form inverses, Eigen::Dynamic handles everything else. The object can be reused for multiple
+// frequency points.
+template<int N>
+struct EigenModeKernel {
+
+	typedef typename EigenModeTypes<N>::MatrixR MatrixR;
+	typedef typename EigenModeTypes<N>::MatrixC MatrixC;
+	typedef typename EigenModeTypes<N>::VectorC VectorC;
+
+	EigenDecomposition<N> m_decomposition;
+	MatrixC m_impedance, m_admittance, m_matrix_zy, m_eigvec;
+	VectorC m_eigval, m_eigval_sqrt;
+	MatrixC m_characteristic_impedance_matrix;
+	VectorC m_characteristic_impedances, m_propagation_constants;
+
+	void Compute(size_t modes, real_t frequency, const real_t *inductance, const real_t *capacitance, const real_t *resistance, const real_t *conductance) {
+		Eigen::Index n = (Eigen::Index) modes;
+
+		// convert to impedance and admittance matrices
+		real_t solution_omega = 2.0 * M_PI * frequency;
+		m_impedance.resize(n, n);
+		m_admittance.resize(n, n);
+		m_impedance.real() = Eigen::Map<const MatrixR>(resistance, n, n);
+		m_impedance.imag() = solution_omega * Eigen::Map<const MatrixR>(inductance, n, n);
+		m_admittance.real() = Eigen::Map<const MatrixR>(conductance, n, n);
+		m_admittance.imag() = solution_omega * Eigen::Map<const MatrixR>(capacitance, n, n);
+
+		// calculate eigenmodes
+		m_matrix_zy.noalias() = m_impedance * m_admittance;
+		m_eigval.resize(n);
+		m_eigvec.resize(n, n);
+		m_decomposition.Compute(m_matrix_zy, m_eigval, m_eigvec);
+
+		// make sure we get the correct complex square root (positive imaginary part)
+		m_eigval_sqrt = (-m_eigval).cwiseSqrt() * complex_t(0.0, 1.0);
+
+		// calculate impedances, admittance and (approximated) characteristic impedance
+		MatrixC matrix_zy_invsqrt = m_eigvec * m_eigval_sqrt.cwiseInverse().asDiagonal() * m_eigvec.inverse();
+		m_characteristic_impedance_matrix.noalias() = matrix_zy_invsqrt * m_impedance;
+		VectorC diag_impedance = m_characteristic_impedance_matrix.diagonal();
+		VectorC diag_admittance = m_characteristic_impedance_matrix.inverse().diagonal();
+		m_characteristic_impedances = (diag_impedance.array() / diag_admittance.array()).sqrt().matrix();
+
+		// calculate propagation constants
+		m_propagation_constants = (-m_matrix_zy.diagonal()).cwiseSqrt() * complex_t(0.0, 1.0);
+
+	}
+
+};
+
+template<int N>
+static void SolveEigenModesFixed(real_t frequency, const Eigen::MatrixXr &inductance, const Eigen::MatrixXr &capacitance,
+						  const Eigen::MatrixXr &resistance, const Eigen::MatrixXr &conductance,
+						  Eigen::MatrixXc &characteristic_impedance_matrix, Eigen::VectorXc &characteristic_impedances,
+						  Eigen::VectorXc &propagation_constants, Eigen::MatrixXc &eigenmodes, Eigen::VectorXc &eigenmode_propagation_constants) {
+	size_t modes = (size_t) inductance.cols();
+	EigenModeKernel<N> kernel;
+	kernel.Compute(modes, frequency, inductance.data(), capacitance.data(), resistance.data(), conductance.data());
+	characteristic_impedance_matrix = kernel.m_characteristic_impedance_matrix;
+	characteristic_impedances = kernel.m_characteristic_impedances;
+	propagation_constants = kernel.m_propagation_constants;
+
+	// reorder eigenmodes to match user-provided modes and calculate eigenmode propagation constants
+	eigenmodes.resize((Eigen::Index) modes, (Eigen::Index) modes);
+	eigenmode_propagation_constants.resize((Eigen::Index) modes);
+	std::vector<size_t> modemap(modes);
+	for(size_t i = 0; i < modes; ++i) {
+		modemap[i] = i;
+	}
+	for(size_t i = 0; i < modes; ++i) {
+		size_t best_index = i;
+		complex_t best_value = complex_t(0.0, 0.0);
+		for(size_t j = i; j < modes; ++j) {
+			complex_t value = kernel.m_eigvec((Eigen::Index) i, (Eigen::Index) modemap[j]);
+			if(std::norm(value) > std::norm(best_value)) {
+				best_index = j;
+				best_value = value;
+			}
+		}
+		std::swap(modemap[i], modemap[best_index]);
+		eigenmodes.col((Eigen::Index) i) = kernel.m_eigvec.col((Eigen::Index) modemap[i]); // / best_value;
+		eigenmode_propagation_constants[(Eigen::Index) i] = kernel.m_eigval_sqrt((Eigen::Index) modemap[i]);
+	}
+
+}
+
+template<int N>
+static void SolveEigenModesBatchFixed(size_t modes, size_t count, const real_t *frequencies, const real_t *inductance, const real_t *capacitance,
+							   const real_t *resistance, const real_t *conductance, complex_t *characteristic_impedances, complex_t *propagation_constants) {
+	typedef typename EigenModeTypes<N>::VectorC VectorC;
+	Eigen::Index n = (Eigen::Index) modes;
+	size_t matrix_size = modes * modes;
+	EigenModeKernel<N> kernel;
+	for(size_t i = 0; i < count; ++i) {
+		size_t offset = matrix_size * i;
+		kernel.Compute(modes, frequencies[i], inductance + offset, capacitance + offset, resistance + offset, conductance + offset);
+		Eigen::Map<VectorC>(characteristic_impedances + modes * i, n) = kernel.m_characteristic_impedances;
+		Eigen::Map<VectorC>(propagation_constants + modes * i, n) = kernel.m_propagation_constants;
+	}
+}
+
+void SolveEigenModes(real_t frequency, const Eigen::MatrixXr &inductance, const Eigen::MatrixXr &capacitance,
+					 const Eigen::MatrixXr &resistance, const Eigen::MatrixXr &conductance,
+					 Eigen::MatrixXc &characteristic_impedance_matrix, Eigen::VectorXc &characteristic_impedances,
+					 Eigen::VectorXc &propagation_constants, Eigen::MatrixXc &eigenmodes, Eigen::VectorXc &eigenmode_propagation_constants) {
+	assert(inductance.rows() == inductance.cols());
+	assert(capacitance.rows() == inductance.rows() && capacitance.cols() == inductance.cols());
+	assert(resistance.rows() == inductance.rows() && resistance.cols() == inductance.cols());
+	assert(conductance.rows() == inductance.rows() && conductance.cols() == inductance.cols());
+	switch(inductance.cols()) {
+		case 1: SolveEigenModesFixed<1>(frequency, inductance, capacitance, resistance, conductance, characteristic_impedance_matrix,
+										characteristic_impedances, propagation_constants, eigenmodes, eigenmode_propagation_constants); break;
+		case 2: SolveEigenModesFixed<2>(frequency, inductance, capacitance, resistance, conductance, characteristic_impedance_matrix,
+										characteristic_impedances, propagation_constants, eigenmodes, eigenmode_propagation_constants); break;
+		case 3: SolveEigenModesFixed<3>(frequency, inductance, capacitance, resistance, conductance, characteristic_impedance_matrix,
+										characteristic_impedances, propagation_constants, eigenmodes, eigenmode_propagation_constants); break;
+		case 4: SolveEigenModesFixed<4>(frequency, inductance, capacitance, resistance, conductance, characteristic_impedance_matrix,
+										characteristic_impedances, propagation_constants, eigenmodes, eigenmode_propagation_constants); break;
+		default: SolveEigenModesFixed<Eigen::Dynamic>(frequency, inductance, capacitance, resistance, conductance, characteristic_impedance_matrix,
+													  characteristic_impedances, propagation_constants, eigenmodes, eigenmode_propagation_constants); break;
+	}
+}
+
+void SolveEigenModesBatch(size_t modes, size_t count, const real_t *frequencies, const real_t *inductance, const real_t *capacitance,
+						  const real_t *resistance, const real_t *conductance, complex_t *characteristic_impedances, complex_t *propagation_constants) {
+	assert(modes != 0);
+	switch(modes) {
+		case 1: SolveEigenModesBatchFixed<1>(modes, count, frequencies, inductance, capacitance, resistance, conductance, characteristic_impedances, propagation_constants); break;
+		case 2: SolveEigenModesBatchFixed<2>(modes, count, frequencies, inductance, capacitance, resistance, conductance, characteristic_impedances, propagation_constants); break;
+		case 3: SolveEigenModesBatchFixed<3>(modes, count, frequencies, inductance, capacitance, resistance, conductance, characteristic_impedances, propagation_constants); break;
+		case 4: SolveEigenModesBatchFixed<4>(modes, count, frequencies, inductance, capacitance, resistance, conductance, characteristic_impedances, propagation_constants); break;
+		default: SolveEigenModesBatchFixed<Eigen::Dynamic>(modes, count, frequencies, inductance, capacitance, resistance, conductance, characteristic_impedances, propagation_constants); break;
+	}
+}
@@ -0,0 +1,42 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "Basics.h"
+#include "Eigen.h"
+
+// Eigenmode analysis of the per-unit-length circuit matrices (L, C, R, G) of a multiconductor transmission line.
+// Nearly all transmission line types have only one or two modes, so the calculations are specialized for up to four
+// modes using fixed-size matrices (with closed-form solutions for one and two modes). Larger systems fall back to
+// dynamic-size matrices.
+
+// Solves the eigenmodes of a single frequency point.
+void SolveEigenModes(real_t frequency, const Eigen::MatrixXr &inductance, const Eigen::MatrixXr &capacitance,
+					 const Eigen::MatrixXr &resistance, const Eigen::MatrixXr &conductance,
+					 Eigen::MatrixXc &characteristic_impedance_matrix, Eigen::VectorXc &characteristic_impedances,
+					 Eigen::VectorXc &propagation_constants, Eigen::MatrixXc &eigenmodes, Eigen::VectorXc &eigenmode_propagation_constants);
+
+// Solves the characteristic impedances and propagation constants of all points of a frequency sweep at once.
+// The circuit matrices are stored consecutively in column-major order (modes * modes values per point), the results
+// are stored consecutively as well (modes values per point).
+void SolveEigenModesBatch(size_t modes, size_t count, const real_t *frequencies, const real_t *inductance, const real_t *capacitance,
+						  const real_t *resistance, const real_t *conductance, complex_t *characteristic_impedances, complex_t *propagation_constants);
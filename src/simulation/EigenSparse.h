@@ -37,3 +37,103 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #if defined(__GNUC__) && !defined(__clang__)
 #pragma GCC diagnostic pop
 #endif
+
+// Returns the memory used by an Eigen sparse matrix (in bytes).
+template<class EigenSparseMatrix>
+size_t EigenSparseMemoryUsage(const EigenSparseMatrix &matrix) {
+	typedef typename EigenSparseMatrix::StorageIndex I;
+	typedef typename EigenSparseMatrix::Scalar F;
+	return (size_t) (matrix.outerSize() + 1) * sizeof(I) + (size_t) matrix.data().allocatedSize() * (sizeof(I) + sizeof(F));
+}
+
+// Frees the memory used by an Eigen sparse matrix.
+template<class EigenSparseMatrix>
+void EigenSparseFree(EigenSparseMatrix &matrix) {
+	matrix.resize(0, 0);
+	matrix.data().squeeze();
+}
+
+// Calculates X^T * A * X for a symmetric matrix A of which only the lower triangle is stored, with a single pass over
+// the matrix. The solution is passed transposed (one column per variable) so the values of each variable are contiguous.
+template<class EigenSparseMatrix>
+inline Eigen::MatrixXr SparseQuadraticForm(const EigenSparseMatrix &matrix, const Eigen::MatrixXr &solution_t) {
+	typedef typename EigenSparseMatrix::StorageIndex StorageIndex;
+	const StorageIndex *outer = matrix.outerIndexPtr(), *inner = matrix.innerIndexPtr();
+	const real_t *values = matrix.valuePtr(), *solution = solution_t.data();
+	size_t size = (size_t) solution_t.rows();
+	Eigen::MatrixXr partial = Eigen::MatrixXr::Zero(solution_t.rows(), solution_t.rows());
+	std::vector<real_t> sum(size);
+	for(Eigen::Index j = 0; j < matrix.outerSize(); ++j) {
+		// the diagonal is counted half, since the result is symmetrized afterwards
+		std::fill(sum.begin(), sum.end(), 0.0);
+		for(StorageIndex q = outer[j]; q < outer[j + 1]; ++q) {
+			Eigen::Index i = inner[q];
+			real_t value = (i == j)? 0.5 * values[q] : values[q];
+			const real_t *xi = solution + size * (size_t) i;
+			for(size_t m = 0; m < size; ++m) {
+				sum[m] += value * xi[m];
+			}
+		}
+		const real_t *xj = solution + size * (size_t) j;
+		for(size_t n = 0; n < size; ++n) {
+			for(size_t m = 0; m < size; ++m) {
+				partial.data()[m + size * n] += sum[m] * xj[n];
+			}
+		}
+	}
+	return partial + partial.transpose();
+}
+
+// Solves A * X = B for a symmetric positive definite matrix A of which only the lower triangle is stored, with the
+// preconditioned conjugate gradient method. The preconditioner can be anything with a 'solve' function, such as the
+// factorization of a similar matrix. All columns are iterated at the same time, but each column has its own step sizes,
+// so this is equivalent to solving them separately. The result should contain the initial guess (e.g. zero). Iterates
+// until the residual of every column is below the tolerance (relative to the norm of that column of B). Returns the
+// number of iterations, or max_iterations + 1 if it didn't converge.
+template<class EigenSparseMatrix, class Preconditioner>
+size_t SparseConjugateGradient(const EigenSparseMatrix &matrix, const Preconditioner &preconditioner, const Eigen::MatrixXr &rhs,
+							   Eigen::MatrixXr &result, real_t tolerance, size_t max_iterations) {
+	assert(result.rows() == rhs.rows() && result.cols() == rhs.cols());
+	Eigen::RowVectorXr threshold = rhs.colwise().norm() * tolerance;
+	Eigen::MatrixXr residual = rhs - matrix.template selfadjointView<Eigen::Lower>() * result;
+	if(((residual.colwise().norm() - threshold).array() <= 0.0).all())
+		return 0;
+	Eigen::MatrixXr direction = preconditioner.solve(residual), product;
+	Eigen::RowVectorXr rho = residual.cwiseProduct(direction).colwise().sum(), alpha(rhs.cols()), beta(rhs.cols());
+	for(size_t iteration = 1; iteration <= max_iterations; ++iteration) {
+		product = matrix.template selfadjointView<Eigen::Lower>() * direction;
+		for(Eigen::Index j = 0; j < rhs.cols(); ++j) {
+			real_t curvature = direction.col(j).dot(product.col(j));
+			alpha[j] = (curvature > 0.0)? rho[j] / curvature : 0.0;
+		}
+		result += direction * alpha.asDiagonal();
+		residual -= product * alpha.asDiagonal();
+		bool converged = true;
+		for(Eigen::Index j = 0; j < rhs.cols(); ++j) {
+			if(!(residual.col(j).norm() <= threshold[j]))
+				converged = false;
+		}
+		if(converged)
+			return iteration;
+		Eigen::MatrixXr correction = preconditioner.solve(residual);
+		for(Eigen::Index j = 0; j < rhs.cols(); ++j) {
+			real_t rho_new = residual.col(j).dot(correction.col(j));
+			beta[j] = (rho[j] > 0.0)? rho_new / rho[j] : 0.0;
+			rho[j] = rho_new;
+		}
+		direction = correction + direction * beta.asDiagonal();
+	}
+	return max_iterations + 1;
+}
+
+// Returns the best approximation of the solution of A * X = B within the space spanned by the columns of V (in the
+// energy norm of A), i.e. X = V * (V^T * A * V)^-1 * V^T * B, for a symmetric positive definite matrix A of which only
+// the lower triangle is stored. This is a good initial guess for SparseConjugateGradient if V contains the solutions of
+// a similar system. For each column, the error is never larger than that of any other vector in that space.
+template<class EigenSparseMatrix>
+Eigen::MatrixXr SparseGalerkinProjection(const EigenSparseMatrix &matrix, const Eigen::MatrixXr &basis, const Eigen::MatrixXr &rhs) {
+	Eigen::MatrixXr product = matrix.template selfadjointView<Eigen::Lower>() * basis;
+	Eigen::MatrixXr reduced_matrix = basis.transpose() * product;
+	Eigen::MatrixXr reduced_rhs = basis.transpose() * rhs;
+	return basis * reduced_matrix.ldlt().solve(reduced_rhs);
+}
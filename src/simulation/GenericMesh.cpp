@@ -20,14 +20,25 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "GenericMesh.h"
 
+#include "EigenModes.h"
 #include "EigenSparse.h"
 #include "StringHelper.h"
 
 #include <iostream>
 
+#ifndef SIMULATION_VERBOSE
+#define SIMULATION_VERBOSE 1
+#endif
+
 GenericMesh::GenericMesh() {
 	m_initialized = false;
+	m_ports_solved = false;
 	m_solved = false;
+	m_losses_requested = true;
+	m_fields_requested = true;
+	m_memory_budget = 0;
+	m_mixed_precision = false;
+	m_element_order = 1;
 	m_frequency = 0.0;
 }
 
@@ -42,20 +53,78 @@ void GenericMesh::Initialize() {
 	m_initialized = true;
 }
 
-void GenericMesh::Solve(const Eigen::MatrixXr &modes, real_t frequency) {
+// Selects the optional outputs of Solve. Without losses, the loss calculations are skipped and the resistance and
+// conductance matrices will be zero. Without fields, the mesh doesn't keep the field solution needed for images.
+void GenericMesh::SetRequestedOutputs(bool losses, bool fields) {
+	m_losses_requested = losses;
+	m_fields_requested = fields;
+	m_solved = false;
+	m_ports_solved = false;
+}
+
+// Sets the maximum amount of memory (in bytes) the mesh may use, or 0 for no limit. Meshes that can predict their memory
+// usage will reduce the mesh detail if necessary (see GetWarnings), or throw an exception if the mesh is still too large.
+// This should be called before Initialize.
+void GenericMesh::SetMemoryBudget(size_t budget) {
+	m_memory_budget = budget;
+}
+
+// Allows the mesh to factorize its matrices in single precision, and refine the solutions in double precision. This
+// needs less memory for the factorization. Meshes that don't support this ignore it, and meshes that do will fall back to
+// double precision if the refinement doesn't converge. This should be called before Initialize.
+void GenericMesh::SetMixedPrecision(bool mixed_precision) {
+	m_mixed_precision = mixed_precision;
+}
+
+// Sets the polynomial order of the finite elements (1 = linear, 2 = quadratic). Higher orders are more accurate for the
+// same grid, but have more variables per element. Meshes that don't support the requested order will throw an exception
+// during Initialize. This should be called before Initialize.
+void GenericMesh::SetElementOrder(size_t order) {
+	m_element_order = order;
+}
+
+// Tells the mesh which frequencies will be solved next, so it can precalculate frequency-dependent data for all of them
+// at once. This is optional, the mesh will calculate whatever is missing during Solve.
+void GenericMesh::PrepareFrequencies(const std::vector<real_t> &frequencies) {
 	if(!m_initialized)
 		throw std::runtime_error("GenericMesh error: The mesh must be initialized first.");
-	if((size_t) modes.rows() != GetFixedVariableCount())
-		throw std::runtime_error(MakeString("GenericMesh error: Expected mode matrix with ", GetFixedVariableCount(), " rows, got ", modes.rows(), " instead."));
-	if((size_t) modes.cols() == 0)
-		throw std::runtime_error(MakeString("GenericMesh error: Expected mode matrix with at least one column, got ", modes.cols(), " instead."));
-	if((size_t) modes.cols() >= GetFixedVariableCount())
-		throw std::runtime_error(MakeString("GenericMesh error: Expected mode matrix with less than ", GetFixedVariableCount(), " columns, got ", modes.cols(), " instead."));
+	DoPrepareFrequencies(frequencies);
+}
+
+// Solves the mesh for the given modes and frequency. The eigenmode analysis can be skipped when the caller only needs
+// the circuit matrices, e.g. because it will process all frequencies at once with SolveEigenModesBatch.
+void GenericMesh::Solve(const Eigen::MatrixXr &modes, real_t frequency, bool solve_eigenmodes) {
+	if(!m_initialized)
+		throw std::runtime_error("GenericMesh error: The mesh must be initialized first.");
+	CheckModes(modes);
 	m_solved = false;
-	m_modes = modes;
+	m_ports_solved = false;
 	m_frequency = frequency;
 	DoSolve();
-	SolveEigenModes();
+	m_ports_solved = true;
+	SetModes(modes, solve_eigenmodes);
+}
+
+// Changes the modes without solving the mesh again. The mesh is solved in the port basis, and all results only depend
+// on the modes through bilinear forms (M^T * X * M), so the circuit matrices for any mode matrix can be derived from
+// the port-basis results directly.
+void GenericMesh::SetModes(const Eigen::MatrixXr &modes, bool solve_eigenmodes) {
+	if(!m_ports_solved)
+		throw std::runtime_error("GenericMesh error: The mesh must be solved first.");
+	CheckModes(modes);
+	m_solved = false;
+	m_modes = modes;
+	ProjectModes();
+	DoSetModes();
+	if(solve_eigenmodes) {
+		SolveEigenModes();
+	} else {
+		m_characteristic_impedance_matrix.resize(0, 0);
+		m_characteristic_impedances.resize(0);
+		m_propagation_constants.resize(0);
+		m_eigenmodes.resize(0, 0);
+		m_eigenmode_propagation_constants.resize(0);
+	}
 	m_solved = true;
 }
 
@@ -63,76 +132,96 @@ void GenericMesh::Cleanup() {
 	DoCleanup();
 }
 
+void GenericMesh::AddWarning(const std::string &warning) {
+	m_warnings.push_back(warning);
+}
+
+void GenericMesh::DoPrepareFrequencies(const std::vector<real_t> &frequencies) {
+	UNUSED(frequencies);
+}
+
+void GenericMesh::DoSetModes() {
+	// nothing
+}
+
+void GenericMesh::CheckModes(const Eigen::MatrixXr &modes) {
+	if((size_t) modes.rows() != GetFixedVariableCount())
+		throw std::runtime_error(MakeString("GenericMesh error: Expected mode matrix with ", GetFixedVariableCount(), " rows, got ", modes.rows(), " instead."));
+	if((size_t) modes.cols() == 0)
+		throw std::runtime_error(MakeString("GenericMesh error: Expected mode matrix with at least one column, got ", modes.cols(), " instead."));
+	if((size_t) modes.cols() >= GetFixedVariableCount())
+		throw std::runtime_error(MakeString("GenericMesh error: Expected mode matrix with less than ", GetFixedVariableCount(), " columns, got ", modes.cols(), " instead."));
+}
+
+void GenericMesh::ProjectModes() {
+
+	// project port-basis results onto the modes
+	Eigen::MatrixXr charge_matrix = m_modes.transpose() * m_port_matrices.m_charge * m_modes;
+	Eigen::MatrixXr current_matrix = m_modes.transpose() * m_port_matrices.m_current * m_modes;
+
+#if SIMULATION_VERBOSE
+	std::cerr << "charges =\n" << charge_matrix << std::endl;
+	std::cerr << "currents =\n" << current_matrix << std::endl;
+#endif
+
+	// calculate L and C
+	m_inductance_matrix = current_matrix.inverse();
+	m_capacitance_matrix = charge_matrix;
+
+	// the losses are optional
+	if(!m_losses_requested) {
+		m_resistance_matrix = Eigen::MatrixXr::Zero(m_modes.cols(), m_modes.cols());
+		m_conductance_matrix = Eigen::MatrixXr::Zero(m_modes.cols(), m_modes.cols());
+		return;
+	}
+
+	// project port-basis losses onto the modes
+	Eigen::MatrixXr electric_loss_matrix = m_modes.transpose() * m_port_matrices.m_electric_loss * m_modes;
+	Eigen::MatrixXr magnetic_loss_matrix = m_modes.transpose() * m_port_matrices.m_magnetic_loss * m_modes;
+	Eigen::MatrixXr surface_loss_matrix = m_modes.transpose() * m_port_matrices.m_surface_loss * m_modes;
+	Eigen::MatrixXr dc_loss_matrix = m_modes.transpose() * m_port_matrices.m_dc_loss * m_modes;
+
+	// combine DC losses with surface losses (this is not bilinear, so it has to be done after the projection)
+	Eigen::MatrixXr combined_loss_matrix = surface_loss_matrix.cwiseMax(dc_loss_matrix);
+
+#if SIMULATION_VERBOSE
+	std::cerr << "electric_loss_matrix =\n" << electric_loss_matrix << std::endl;
+	std::cerr << "magnetic_loss_matrix =\n" << magnetic_loss_matrix << std::endl;
+	std::cerr << "surface_loss_matrix =\n" << surface_loss_matrix << std::endl;
+	std::cerr << "dc_loss_matrix =\n" << dc_loss_matrix << std::endl;
+	std::cerr << "combined_loss_matrix =\n" << combined_loss_matrix << std::endl;
+	std::cerr << std::endl;
+#endif
+
+	// calculate R and G
+	real_t omega = 2.0 * M_PI * m_frequency;
+	m_resistance_matrix = m_inductance_matrix.transpose() * (-omega * magnetic_loss_matrix + combined_loss_matrix) * m_inductance_matrix;
+	m_conductance_matrix = -omega * electric_loss_matrix;
+
+}
+
 void GenericMesh::SolveEigenModes() {
 
+#if SIMULATION_VERBOSE
 	std::cerr << "inductance =\n" << m_inductance_matrix << std::endl;
 	std::cerr << "capacitance =\n" << m_capacitance_matrix << std::endl;
 	std::cerr << "resistance =\n" << m_resistance_matrix << std::endl;
 	std::cerr << "conductance =\n" << m_conductance_matrix << std::endl;
 	std::cerr << std::endl;
-
-	// convert to impedance and admittance matrices
-	real_t solution_omega = 2.0 * M_PI * m_frequency;
-	Eigen::MatrixXc impedance(m_modes.cols(), m_modes.cols()), admittance(m_modes.cols(), m_modes.cols());
-	impedance.real() = m_resistance_matrix;
-	impedance.imag() = solution_omega * m_inductance_matrix;
-	admittance.real() = m_conductance_matrix;
-	admittance.imag() = solution_omega * m_capacitance_matrix;
+#endif
 
 	// calculate eigenmodes
-	Eigen::MatrixXc matrix_zy = impedance * admittance;
-	Eigen::ComplexEigenSolver<Eigen::MatrixXc> eigensolver(matrix_zy);
-	if(eigensolver.info() != Eigen::Success)
-		throw std::runtime_error("Eigenmode decomposition failed!");
-	auto &eigval = eigensolver.eigenvalues();
-	auto &eigvec = eigensolver.eigenvectors();
-
-	std::cerr << "eigenvalues =\n" << eigval << std::endl;
-	std::cerr << "eigenvectors =\n" << eigvec << std::endl;
-	std::cerr << std::endl;
-
-	// make sure we get the correct complex square root (positive imaginary part)
-	Eigen::VectorXc eigval_sqrt = (-eigval).cwiseSqrt() * complex_t(0.0, 1.0);
-
-	// calculate impedances, admittance and (approximated) characteristic impedance
-	Eigen::MatrixXc matrix_zy_invsqrt = eigvec * eigval_sqrt.cwiseInverse().asDiagonal() * eigvec.inverse();
-	m_characteristic_impedance_matrix = matrix_zy_invsqrt * impedance;
-	Eigen::VectorXc diag_impedance = m_characteristic_impedance_matrix.diagonal();
-	Eigen::VectorXc diag_admittance = m_characteristic_impedance_matrix.inverse().diagonal();
-	m_characteristic_impedances = (diag_impedance.array() / diag_admittance.array()).sqrt().matrix();
-
-	// calculate propagation constants
-	m_propagation_constants = (-matrix_zy.diagonal()).cwiseSqrt() * complex_t(0.0, 1.0);
+	::SolveEigenModes(m_frequency, m_inductance_matrix, m_capacitance_matrix, m_resistance_matrix, m_conductance_matrix,
+					  m_characteristic_impedance_matrix, m_characteristic_impedances, m_propagation_constants,
+					  m_eigenmodes, m_eigenmode_propagation_constants);
 
+#if SIMULATION_VERBOSE
 	std::cerr << "m_characteristic_impedance_matrix =\n" << m_characteristic_impedance_matrix << std::endl;
 	std::cerr << "m_characteristic_impedances =\n" << m_characteristic_impedances << std::endl;
 	std::cerr << "m_propagation_constants =\n" << m_propagation_constants << std::endl;
-	std::cerr << std::endl;
-
-	// reorder eigenmodes to match user-provided modes and calculate eigenmode propagation constants
-	m_eigenmodes.resize(m_modes.cols(), m_modes.cols());
-	m_eigenmode_propagation_constants.resize(m_modes.cols());
-	std::vector<size_t> modemap((size_t) m_modes.cols());
-	for(size_t i = 0; i < (size_t) m_modes.cols(); ++i) {
-		modemap[i] = i;
-	}
-	for(size_t i = 0; i < (size_t) m_modes.cols(); ++i) {
-		size_t best_index = i;
-		complex_t best_value = complex_t(0.0, 0.0);
-		for(size_t j = i; j < (size_t) m_modes.cols(); ++j) {
-			complex_t value = eigvec((Eigen::Index) i, (Eigen::Index) modemap[j]);
-			if(std::norm(value) > std::norm(best_value)) {
-				best_index = j;
-				best_value = value;
-			}
-		}
-		std::swap(modemap[i], modemap[best_index]);
-		m_eigenmodes.col((Eigen::Index) i) = eigvec.col((Eigen::Index) modemap[i]); // / best_value;
-		m_eigenmode_propagation_constants[(Eigen::Index) i] = eigval_sqrt((Eigen::Index) modemap[i]);
-	}
-
 	std::cerr << "m_eigenmodes =\n" << m_eigenmodes << std::endl;
 	std::cerr << "m_eigenmode_propagation_constants =\n" << m_eigenmode_propagation_constants << std::endl;
 	std::cerr << std::endl;
+#endif
 
 }
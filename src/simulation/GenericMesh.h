@@ -24,6 +24,7 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #include "Eigen.h"
 #include "Vector.h"
 
+#include <string>
 #include <vector>
 
 enum MeshImageType {
@@ -34,17 +35,38 @@ enum MeshImageType {
 	MESHIMAGETYPE_CURRENT,
 };
 
+// port-basis results of a mesh (one row and column per fixed variable), see PortSolver
+struct MeshPortMatrices {
+	Eigen::MatrixXr m_charge, m_current;
+	Eigen::MatrixXr m_electric_loss, m_magnetic_loss, m_surface_loss, m_dc_loss;
+};
+
 class GenericMesh {
 
+public:
+	// Fixed ports have a potential set by the modes, floating ports (e.g. isolated copper) get whatever potential
+	// results in zero net charge.
+	enum PortType {
+		PORTTYPE_FIXED,
+		PORTTYPE_FLOATING,
+	};
+
 private:
-	bool m_initialized, m_solved;
+	bool m_initialized, m_ports_solved, m_solved;
+	bool m_losses_requested, m_fields_requested;
+	size_t m_memory_budget;
+	bool m_mixed_precision;
+	size_t m_element_order;
+	std::vector<std::string> m_warnings;
 	Eigen::MatrixXr m_modes;
 	real_t m_frequency;
 
 protected:
-	Eigen::MatrixXr m_inductance_matrix, m_capacitance_matrix, m_resistance_matrix, m_conductance_matrix;
+	// filled in by DoSolve
+	MeshPortMatrices m_port_matrices;
 
 private:
+	Eigen::MatrixXr m_inductance_matrix, m_capacitance_matrix, m_resistance_matrix, m_conductance_matrix;
 	Eigen::MatrixXc m_characteristic_impedance_matrix;
 	Eigen::VectorXc m_characteristic_impedances, m_propagation_constants;
 	Eigen::MatrixXc m_eigenmodes;
@@ -55,17 +77,32 @@ public:
 	virtual ~GenericMesh();
 
 	void Initialize();
-	void Solve(const Eigen::MatrixXr &modes, real_t frequency);
+	void SetRequestedOutputs(bool losses, bool fields);
+	void SetMemoryBudget(size_t budget);
+	void SetMixedPrecision(bool mixed_precision);
+	void SetElementOrder(size_t order);
+	void PrepareFrequencies(const std::vector<real_t> &frequencies);
+	void Solve(const Eigen::MatrixXr &modes, real_t frequency, bool solve_eigenmodes = true);
+	void SetModes(const Eigen::MatrixXr &modes, bool solve_eigenmodes = true);
 	void Cleanup();
 
 	virtual Box2D GetWorldBox2D() = 0;
 	virtual Box2D GetWorldFocus2D() = 0;
 	virtual void GetImage2D(std::vector<real_t> &image_value, std::vector<Vector2D> &image_gradient,
 							size_t width, size_t height, const Box2D &view, MeshImageType type, size_t mode) = 0;
+	virtual size_t GetMemoryUsage() = 0;
 
 public:
 	inline bool IsInitialized() { return m_initialized; }
 	inline bool IsSolved() { return m_solved; }
+	inline bool AreLossesRequested() { return m_losses_requested; }
+	inline bool AreFieldsRequested() { return m_fields_requested; }
+	inline size_t GetMemoryBudget() { return m_memory_budget; }
+	inline bool IsMixedPrecision() { return m_mixed_precision; }
+	inline size_t GetElementOrder() { return m_element_order; }
+
+	// warnings about changes the mesh made to the simulation settings (e.g. a lower mesh detail)
+	inline const std::vector<std::string>& GetWarnings() { return m_warnings; }
 
 	inline size_t GetModeCount() { return (size_t) m_modes.cols(); }
 	inline const Eigen::MatrixXr& GetModes() { return m_modes; }
@@ -86,10 +123,16 @@ public:
 protected:
 	virtual size_t GetFixedVariableCount() = 0;
 	virtual void DoInitialize() = 0;
+	virtual void DoPrepareFrequencies(const std::vector<real_t> &frequencies);
 	virtual void DoSolve() = 0;
+	virtual void DoSetModes();
 	virtual void DoCleanup() = 0;
 
+	void AddWarning(const std::string &warning);
+
 private:
+	void CheckModes(const Eigen::MatrixXr &modes);
+	void ProjectModes();
 	void SolveEigenModes();
 
 };
@@ -30,20 +30,39 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #include <chrono>
 #include <iostream>
 
+#ifndef SIMULATION_VERBOSE
 #define SIMULATION_VERBOSE 1
+#endif
 #define SIMULATION_SAVE_MATRIXMARKET 0
 
-template<class EigenSparseMatrix>
-void EigenSparseFree(EigenSparseMatrix &matrix) {
-	matrix.resize(0, 0);
-	matrix.data().squeeze();
-}
-
-template<class SparseMatrix, typename F>
-inline void BuildMatrix_Symm1(SparseMatrix &matrix, size_t i0, size_t i1, F cs, F cx) {
-	matrix.Insert(i0, i0, cs * 0.5);
-	matrix.Insert(i1, i1, cs * 0.5);
-	matrix.Insert(i0, i1, cx);
+// bulk storage sizes of the matrix builders (in nested dissection order, a node can have 8 neighbors with a higher
+// index, plus the diagonal)
+constexpr size_t POTENTIAL_BULK_SIZE = 9, SURFACE_BULK_SIZE = 5;
+
+// With quadratic elements, a vertex node can have 24 neighbors, but edge and center nodes have only 14 or 8, so on
+// average a node has less than 8 neighbors with a higher index. The few columns that need more use the hash table.
+constexpr size_t POTENTIAL_BULK_SIZE_QUADRATIC = 13, SURFACE_BULK_SIZE_QUADRATIC = 9;
+
+// Stiffness and mass matrices of a 1D quadratic element with nodes at 0, 0.5 and 1, for an element of length 1 (they
+// scale with 1 / length and length respectively). The biquadratic element matrices are tensor products of these.
+constexpr real_t QUADRATIC_STIFFNESS[3][3] = {
+	{ 7.0 / 3.0, -8.0 / 3.0,  1.0 / 3.0},
+	{-8.0 / 3.0, 16.0 / 3.0, -8.0 / 3.0},
+	{ 1.0 / 3.0, -8.0 / 3.0,  7.0 / 3.0},
+};
+constexpr real_t QUADRATIC_MASS[3][3] = {
+	{ 4.0 / 30.0,  2.0 / 30.0, -1.0 / 30.0},
+	{ 2.0 / 30.0, 16.0 / 30.0,  2.0 / 30.0},
+	{-1.0 / 30.0,  2.0 / 30.0,  4.0 / 30.0},
+};
+
+// If the mesh doesn't fit in the memory budget, the mesh detail is reduced in steps of sqrt(2) (one mesh detail level)
+// up to the given number of times.
+constexpr real_t MEMORY_BUDGET_DETAIL_STEP = M_SQRT2;
+constexpr size_t MEMORY_BUDGET_MAX_STEPS = 6;
+
+inline size_t BytesToMegabytes(size_t bytes) {
+	return (bytes + (1 << 20) - 1) >> 20;
 }
 
 template<class SparseMatrix, typename F>
@@ -84,6 +103,57 @@ inline void BuildMatrix_Asymm2(
 	BuildMatrix_Asymm2_Sub(matrix, i11, j11, j10, j01, j00, cs, cx, cy, cd);
 }
 
+// Quadratic versions of the functions above. The nodes of an edge are ordered from one end to the other, the nodes of a
+// cell row by row (index x + 3 * y). The scale factors are the (x and y) length of the edge, or the aspect ratios of the
+// cell (delta_y / delta_x and delta_x / delta_y), multiplied by the material property.
+template<class SparseMatrix, typename F>
+inline void BuildMatrix_Symm1Q(SparseMatrix &matrix, const size_t (&vars)[3], F scale) {
+	for(size_t a = 0; a < 3; ++a) {
+		matrix.Insert(vars[a], vars[a], scale * (QUADRATIC_MASS[a][a] * 0.5));
+		for(size_t b = a + 1; b < 3; ++b) {
+			matrix.Insert(vars[a], vars[b], scale * QUADRATIC_MASS[a][b]);
+		}
+	}
+}
+
+template<typename F>
+inline void BuildMatrix_Asymm1Q(SparseBlockMatrixC<F> &matrix, const size_t (&rows)[3], const size_t (&cols)[3], F scale) {
+	for(size_t a = 0; a < 3; ++a) {
+		if(rows[a] != INDEX_NONE) {
+			for(size_t b = 0; b < 3; ++b) {
+				matrix.Insert(rows[a], cols[b], scale * QUADRATIC_MASS[a][b]);
+			}
+		}
+	}
+}
+
+template<typename F>
+inline F BuildMatrix_Coef2Q(size_t a, size_t b, F scale_x, F scale_y) {
+	return scale_x * (QUADRATIC_STIFFNESS[a % 3][b % 3] * QUADRATIC_MASS[a / 3][b / 3]) +
+		   scale_y * (QUADRATIC_MASS[a % 3][b % 3] * QUADRATIC_STIFFNESS[a / 3][b / 3]);
+}
+
+template<class SparseMatrix, typename F>
+inline void BuildMatrix_Symm2Q(SparseMatrix &matrix, const size_t (&vars)[9], F scale_x, F scale_y) {
+	for(size_t a = 0; a < 9; ++a) {
+		matrix.Insert(vars[a], vars[a], BuildMatrix_Coef2Q(a, a, scale_x, scale_y) * 0.5);
+		for(size_t b = a + 1; b < 9; ++b) {
+			matrix.Insert(vars[a], vars[b], BuildMatrix_Coef2Q(a, b, scale_x, scale_y));
+		}
+	}
+}
+
+template<typename F>
+inline void BuildMatrix_Asymm2Q(SparseBlockMatrixC<F> &matrix, const size_t (&rows)[9], const size_t (&cols)[9], F scale_x, F scale_y) {
+	for(size_t a = 0; a < 9; ++a) {
+		if(rows[a] != INDEX_NONE) {
+			for(size_t b = 0; b < 9; ++b) {
+				matrix.Insert(rows[a], cols[b], BuildMatrix_Coef2Q(a, b, scale_x, scale_y));
+			}
+		}
+	}
+}
+
 GridMesh2D::GridMesh2D(const Box2D &world_box, const Box2D &world_focus, real_t grid_inc, real_t grid_epsilon) {
 	if(!FinitePositive(grid_inc))
 		throw std::runtime_error("GridMesh2D error: grid_inc must be positive.");
@@ -96,9 +166,14 @@ GridMesh2D::GridMesh2D(const Box2D &world_box, const Box2D &world_focus, real_t
 	m_pml_box = m_world_box;
 	m_pml_step = Box2D(REAL_MAX, REAL_MAX, REAL_MAX, REAL_MAX);
 	m_pml_attenuation = 0.0;
+	m_open_boundary = false;
+	m_open_boundary_origin = Vector2D(0.0, 0.0);
+	m_open_boundary_dipole = Vector2D(0.0, 1.0);
 	m_vars_free = 0;
 	m_vars_fixed = 0;
 	m_vars_surf = 0;
+	m_port_reference = INDEX_NONE;
+	m_homogeneous_permittivity = 0.0;
 }
 
 GridMesh2D::~GridMesh2D() {
@@ -115,6 +190,19 @@ void GridMesh2D::SetPML(const Box2D &box, const Box2D &step, real_t attenuation)
 	m_pml_attenuation = attenuation;
 }
 
+// Replaces the default boundary condition on the edges of the world box (zero normal field) by an open boundary
+// condition, which assumes that the potential outside the world box is the field of a dipole at the given origin,
+// pointing in the given direction. This is the far field of any structure above a ground plane (with the origin on the
+// ground plane, and the dipole perpendicular to it), so the world box can be much smaller for the same accuracy.
+void GridMesh2D::SetOpenBoundary(const Vector2D &origin, const Vector2D &dipole) {
+	real_t norm = std::hypot(dipole.x, dipole.y);
+	if(!FinitePositive(norm))
+		throw std::runtime_error("GridMesh2D error: The dipole direction must not be zero.");
+	m_open_boundary = true;
+	m_open_boundary_origin = origin;
+	m_open_boundary_dipole = Vector2D(dipole.x / norm, dipole.y / norm);
+}
+
 size_t GridMesh2D::AddPort(GridMesh2D::PortType type, bool infinite_area) {
 	if(IsInitialized())
 		throw std::runtime_error("GridMesh2D error: Can't add port after initialization.");
@@ -170,6 +258,8 @@ void GridMesh2D::GetImage2D(std::vector<real_t> &image_value, std::vector<Vector
 	if(type != MESHIMAGETYPE_MESH) {
 		if(!IsSolved())
 			throw std::runtime_error("GridMesh2D error: The mesh must be solved first.");
+		if(!AreFieldsRequested())
+			throw std::runtime_error("GridMesh2D error: The fields were not requested.");
 		if(mode >= GetModeCount())
 			throw std::runtime_error("GridMesh2D error: Invalid mode index.");
 	}
@@ -287,36 +377,87 @@ void GridMesh2D::GetImage2D(std::vector<real_t> &image_value, std::vector<Vector
 void GridMesh2D::DoInitialize() {
 	assert(!IsInitialized());
 
+	if(GetElementOrder() != 1 && GetElementOrder() != 2)
+		throw std::runtime_error("GridMesh2D error: Only linear and quadratic elements (order 1 and 2) are supported.");
+
+	// If there is a memory budget, reduce the mesh detail until the predicted memory usage fits.
+	real_t detail_reduction = 1.0;
+	for(size_t step = 0; ; ++step) {
+
 #if SIMULATION_VERBOSE
-	auto t1 = std::chrono::high_resolution_clock::now();
+		auto t1 = std::chrono::high_resolution_clock::now();
 #endif
-	InitGrid();
+		InitGrid();
 #if SIMULATION_VERBOSE
-	auto t2 = std::chrono::high_resolution_clock::now();
+		auto t2 = std::chrono::high_resolution_clock::now();
 #endif
-	InitCells();
+		InitCells();
 #if SIMULATION_VERBOSE
-	auto t3 = std::chrono::high_resolution_clock::now();
+		auto t3 = std::chrono::high_resolution_clock::now();
 #endif
-	InitVariables();
+		InitVariables();
 #if SIMULATION_VERBOSE
-	auto t4 = std::chrono::high_resolution_clock::now();
+		auto t4 = std::chrono::high_resolution_clock::now();
 #endif
 
 #if SIMULATION_VERBOSE
-	std::cerr << "GridMesh2D stats:"
-			  << " grid=" << m_grid_x.size() << "x" << m_grid_y.size()
-			  << " nodes=" << m_nodes.size()
-			  << " cells=" << m_cells.size()
-			  << " vars=" << m_vars_free << "+" << m_vars_fixed
-			  << std::endl;
-	std::cerr << "GridMesh2D init time:"
-			  << " grid=" << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us"
-			  << " cells=" << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() << "us"
-			  << " vars=" << std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count() << "us"
-			  << std::endl;
+		std::cerr << "GridMesh2D stats:"
+				  << " grid=" << m_grid_x.size() << "x" << m_grid_y.size()
+				  << " nodes=" << m_nodes.size()
+				  << " cells=" << m_cells.size()
+				  << " vars=" << m_vars_free << "+" << m_vars_fixed
+				  << std::endl;
+		std::cerr << "GridMesh2D init time:"
+				  << " grid=" << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us"
+				  << " cells=" << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() << "us"
+				  << " vars=" << std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count() << "us"
+				  << std::endl;
 #endif
 
+		if(GetMemoryBudget() == 0)
+			break;
+		size_t predicted_memory = PredictMemoryUsage(1);
+		if(predicted_memory <= GetMemoryBudget())
+			break;
+		if(step == MEMORY_BUDGET_MAX_STEPS) {
+			throw std::runtime_error(MakeString("GridMesh2D error: The mesh needs about ", BytesToMegabytes(predicted_memory), " MB of memory, "
+												"which exceeds the memory budget of ", BytesToMegabytes(GetMemoryBudget()), " MB, "
+												"even after reducing the mesh detail by a factor ", detail_reduction, "."));
+		}
+
+		ClearVariables();
+		ReduceDetail(MEMORY_BUDGET_DETAIL_STEP);
+		detail_reduction *= MEMORY_BUDGET_DETAIL_STEP;
+
+	}
+
+	if(detail_reduction != 1.0) {
+		AddWarning(MakeString("The mesh detail was reduced by a factor ", detail_reduction, " to stay within the memory budget of ",
+							  BytesToMegabytes(GetMemoryBudget()), " MB."));
+	}
+
+	m_port_solver.SetMixedPrecision(IsMixedPrecision());
+
+}
+
+void GridMesh2D::DoPrepareFrequencies(const std::vector<real_t> &frequencies) {
+	std::vector<const MaterialConductor*> conductors(m_conductors.size());
+	for(size_t i = 0; i < m_conductors.size(); ++i) {
+		conductors[i] = m_conductors[i].m_material;
+	}
+	std::vector<const MaterialDielectric*> dielectrics(m_dielectrics.size());
+	for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+		dielectrics[i] = m_dielectrics[i].m_material;
+	}
+	m_material_table.Build(frequencies, conductors, dielectrics);
+
+	// Keeping a factorization of both potential matrices only pays off in a sweep, and it needs more memory. Mixed
+	// precision is used to save memory, so it always uses a single factorization.
+	bool factor_reuse = (frequencies.size() > 1 && !IsMixedPrecision());
+	if(factor_reuse && GetMemoryBudget() != 0)
+		factor_reuse = (PredictMemoryUsage(2) <= GetMemoryBudget());
+	m_port_solver.SetFactorReuse(factor_reuse);
+
 }
 
 void GridMesh2D::DoSolve() {
@@ -329,7 +470,9 @@ void GridMesh2D::DoSolve() {
 #if SIMULATION_VERBOSE
 	auto t2 = std::chrono::high_resolution_clock::now();
 #endif
-	SolveMatrices();
+	size_t port_reference = (m_open_boundary)? INDEX_NONE : m_port_reference; // see PortSolver::Solve
+	m_port_solver.Solve(m_matrix_epot, m_matrix_mpot, m_homogeneous_permittivity, m_matrix_surf_resid, m_matrix_surf_loss, m_surf_solver,
+						m_vector_dc_resistances, port_reference, AreLossesRequested(), AreLossesRequested() || AreFieldsRequested(), m_port_matrices);
 #if SIMULATION_VERBOSE
 	auto t3 = std::chrono::high_resolution_clock::now();
 #endif
@@ -339,25 +482,51 @@ void GridMesh2D::DoSolve() {
 			  << " build=" << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us"
 			  << " solve=" << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() << "us"
 			  << std::endl;
+	std::cerr << "GridMesh2D solver:"
+			  << " reuse=" << m_port_solver.IsFactorReuse()
+			  << " factorizations=" << m_port_solver.GetFactorizationCount()
+			  << " iterations=" << m_port_solver.GetIterationCount()
+			  << std::endl;
+	std::cerr << "GridMesh2D memory:"
+			  << " tables=" << BytesToMegabytes(GetTableMemoryUsage()) << "MB"
+			  << " matrices=" << BytesToMegabytes(GetMatrixMemoryUsage()) << "MB"
+			  << " solver=" << BytesToMegabytes(GetSolverMemoryUsage()) << "MB"
+			  << " solutions=" << BytesToMegabytes(GetSolutionMemoryUsage()) << "MB"
+			  << std::endl;
 #endif
 
 }
 
+void GridMesh2D::DoSetModes() {
+	assert(IsInitialized());
+
+	// reconstruct the solutions of the modes for the images
+	if(!AreFieldsRequested()) {
+		m_eigen_solution_epot.resize(0, 0);
+		m_eigen_solution_mpot.resize(0, 0);
+		m_eigen_solution_surf.resize(0, 0);
+		return;
+	}
+	m_port_solver.GetModeSolutions(GetModes(), m_eigen_solution_epot, m_eigen_solution_mpot, m_eigen_solution_surf);
+
+}
+
 void GridMesh2D::DoCleanup() {
-	EigenSparseFree(m_matrix_epot[0]);
-	EigenSparseFree(m_matrix_epot[1]);
-	EigenSparseFree(m_matrix_epot[2]);
-	EigenSparseFree(m_matrix_mpot[0]);
-	EigenSparseFree(m_matrix_mpot[1]);
-	EigenSparseFree(m_matrix_mpot[2]);
+	m_matrix_epot[0].Free();
+	m_matrix_epot[1].Free();
+	m_matrix_epot[2].Free();
+	m_matrix_mpot[0].Free();
+	m_matrix_mpot[1].Free();
+	m_matrix_mpot[2].Free();
 	EigenSparseFree(m_matrix_surf_resid[0]);
 	EigenSparseFree(m_matrix_surf_resid[1]);
-	EigenSparseFree(m_matrix_surf_curr);
 	EigenSparseFree(m_matrix_surf_loss);
-	// TODO: m_eigen_chol
-	// TODO: m_eigen_chol_surf;
-	m_eigen_rhs.resize(0, 0);
-	m_eigen_rhs_surf.resize(0, 0);
+	m_matrix_surf_loss_parts.clear();
+	m_matrix_surf_loss_parts.shrink_to_fit();
+	m_surf_loss_part_conductors.clear();
+	m_surf_solver.Clear();
+	m_port_solver.Clear();
+	m_material_table.Clear();
 }
 
 size_t GridMesh2D::GetFixedVariableCount() {
@@ -386,6 +555,13 @@ void GridMesh2D::InitGrid() {
 	if(m_grid_x.size() < 2 || m_grid_y.size() < 2)
 		throw std::runtime_error("GridMesh2D error: The mesh must have at least 2 grid lines.");
 
+	// With quadratic elements, each element consists of 2x2 cells. The extra grid lines go through the middle of the
+	// elements, so the materials never change within an element.
+	if(GetElementOrder() == 2) {
+		GridSubdivide(m_grid_x);
+		GridSubdivide(m_grid_y);
+	}
+
 	// calculate midpoints
 	GridMidpoints(m_midpoints_x, m_grid_x);
 	GridMidpoints(m_midpoints_y, m_grid_y);
@@ -396,6 +572,8 @@ void GridMesh2D::InitCells() {
 	assert(!IsInitialized());
 
 	// generate nodes and cells
+	if(m_grid_x.size() * m_grid_y.size() >= COMPACT_INDEX_LIMIT)
+		throw std::runtime_error("GridMesh2D error: The mesh has too many nodes.");
 	m_nodes.resize(m_grid_x.size() * m_grid_y.size());
 	m_edges_h.resize((m_grid_x.size() - 1) * m_grid_y.size());
 	m_edges_v.resize(m_grid_x.size() * (m_grid_y.size() - 1));
@@ -457,7 +635,15 @@ void GridMesh2D::InitCells() {
 void GridMesh2D::InitVariables() {
 	assert(!IsInitialized());
 
-	// assign variables to ports
+	// assign variables to free nodes in nested dissection order
+	std::vector<size_t> node_order;
+	node_order.reserve(m_nodes.size());
+	OrderNodes(node_order, 0, 0, m_grid_x.size(), m_grid_y.size());
+	for(size_t i = 0; i < node_order.size(); ++i) {
+		m_nodes[node_order[i]].m_var = m_vars_free++;
+	}
+
+	// assign variables to ports (floating ports are coupled to many nodes, so they go last)
 	for(size_t i = 0; i < m_ports.size(); ++i) {
 		Port &port = m_ports[i];
 		switch(port.m_type) {
@@ -472,15 +658,21 @@ void GridMesh2D::InitVariables() {
 		}
 	}
 
-	// assign variables to nodes
-	for(size_t iy = 0; iy < m_grid_y.size(); ++iy) {
-		for(size_t ix = 0; ix < m_grid_x.size(); ++ix) {
-			Node &node = GetNode(ix, iy);
-			if(node.m_port == INDEX_NONE) {
-				node.m_var = m_vars_free++;
-			} else {
-				node.m_var = m_ports[node.m_port].m_var;
-			}
+	// select the reference port, preferably one with infinite area (i.e. ground)
+	for(size_t i = 0; i < m_ports.size(); ++i) {
+		Port &port = m_ports[i];
+		if(port.m_type == PORTTYPE_FIXED && (m_port_reference == INDEX_NONE || port.m_infinite_area)) {
+			m_port_reference = port.m_var - INDEX_OFFSET;
+			if(port.m_infinite_area)
+				break;
+		}
+	}
+
+	// assign port variables to nodes
+	for(size_t i = 0; i < m_nodes.size(); ++i) {
+		Node &node = m_nodes[i];
+		if(node.m_port != INDEX_NONE) {
+			node.m_var = m_ports[node.m_port].m_var;
 		}
 	}
 
@@ -510,6 +702,35 @@ void GridMesh2D::InitVariables() {
 		}
 	}
 
+	// Sort the elements by the last free variable they touch (with a counting sort). The matrices are built in this
+	// order, which accesses the columns almost sequentially, unlike the grid order. Elements are identified by their
+	// first cell.
+	size_t order = GetElementOrder();
+	size_t elements_x = (m_grid_x.size() - 1) / order, elements_y = (m_grid_y.size() - 1) / order;
+	std::vector<size_t> element_keys(elements_x * elements_y);
+	std::vector<size_t> key_offsets(m_vars_free + 2, 0);
+	for(size_t ey = 0; ey < elements_y; ++ey) {
+		for(size_t ex = 0; ex < elements_x; ++ex) {
+			size_t key = 0;
+			for(size_t jy = 0; jy <= order; ++jy) {
+				for(size_t jx = 0; jx <= order; ++jx) {
+					Node &node = GetNode(ex * order + jx, ey * order + jy);
+					if(node.m_port == INDEX_NONE)
+						key = std::max<size_t>(key, node.m_var + 1);
+				}
+			}
+			element_keys[ex + ey * elements_x] = key;
+			++key_offsets[key + 1];
+		}
+	}
+	for(size_t i = 1; i < key_offsets.size(); ++i) {
+		key_offsets[i] += key_offsets[i - 1];
+	}
+	m_cell_order.resize(element_keys.size());
+	for(size_t i = 0; i < element_keys.size(); ++i) {
+		m_cell_order[key_offsets[element_keys[i]]++] = GetCellIndex(i % elements_x * order, i / elements_x * order);
+	}
+
 	// avoid problems later
 	if(m_vars_free == 0)
 		throw std::runtime_error("GridMesh2D error: The mesh has no free variables.");
@@ -520,23 +741,163 @@ void GridMesh2D::InitVariables() {
 
 }
 
+void GridMesh2D::ClearVariables() {
+	assert(!IsInitialized());
+
+	// undo InitGrid, InitCells and InitVariables, so they can be called again with different settings
+	m_grid_x.clear();
+	m_grid_x.shrink_to_fit();
+	m_grid_y.clear();
+	m_grid_y.shrink_to_fit();
+	m_midpoints_x.clear();
+	m_midpoints_x.shrink_to_fit();
+	m_midpoints_y.clear();
+	m_midpoints_y.shrink_to_fit();
+	m_nodes.clear();
+	m_nodes.shrink_to_fit();
+	m_edges_h.clear();
+	m_edges_h.shrink_to_fit();
+	m_edges_v.clear();
+	m_edges_v.shrink_to_fit();
+	m_cells.clear();
+	m_cells.shrink_to_fit();
+	m_cell_order.clear();
+	m_cell_order.shrink_to_fit();
+	m_vars_free = 0;
+	m_vars_fixed = 0;
+	m_vars_surf = 0;
+	m_port_reference = INDEX_NONE;
+
+}
+
+void GridMesh2D::ReduceDetail(real_t factor) {
+	assert(!IsInitialized());
+
+	// The mesh detail scales the grid increment and all grid steps, so this has the same effect as a lower mesh detail
+	// setting. Unlimited steps (REAL_MAX) are left alone.
+	auto scale = [factor](real_t &step) {
+		if(step != REAL_MAX)
+			step *= factor;
+	};
+	auto scale_box = [&scale](Box2D &step) {
+		scale(step.x1);
+		scale(step.y1);
+		scale(step.x2);
+		scale(step.y2);
+	};
+	scale(m_grid_inc);
+	scale_box(m_pml_step);
+	for(Conductor &conductor : m_conductors) {
+		scale_box(conductor.m_step);
+	}
+	for(Dielectric &dielectric : m_dielectrics) {
+		scale_box(dielectric.m_step);
+	}
+
+}
+
+void GridMesh2D::OrderNodes(std::vector<size_t> &node_order, size_t ix1, size_t iy1, size_t ix2, size_t iy2) {
+
+	// Nested dissection: the block is split in two by a grid line, both halves are ordered recursively, and the nodes on
+	// the separating line go last. The line is chosen near the middle of the longest side, preferably one which crosses
+	// conductors since those nodes aren't free variables. Small blocks are simply ordered row by row. With quadratic
+	// elements, only grid lines on the boundaries between elements can separate the nodes.
+	size_t nx = ix2 - ix1, ny = iy2 - iy1;
+	if(nx * ny <= 8 || nx < 3 || ny < 3) {
+		for(size_t iy = iy1; iy < iy2; ++iy) {
+			for(size_t ix = ix1; ix < ix2; ++ix) {
+				if(GetNode(ix, iy).m_port == INDEX_NONE)
+					node_order.push_back(GetNodeIndex(ix, iy));
+			}
+		}
+		return;
+	}
+
+	// find the best separator in the middle half
+	bool split_x = (nx >= ny);
+	size_t length = (split_x)? nx : ny, width = (split_x)? ny : nx;
+	size_t best_line = INDEX_NONE, best_count = INDEX_NONE, best_distance = INDEX_NONE;
+	for(size_t i = length / 4; i < length - length / 4; ++i) {
+		if(((split_x)? ix1 + i : iy1 + i) % GetElementOrder() != 0)
+			continue;
+		size_t count = 0;
+		for(size_t j = 0; j < width; ++j) {
+			const Node &node = (split_x)? GetNode(ix1 + i, iy1 + j) : GetNode(ix1 + j, iy1 + i);
+			if(node.m_port == INDEX_NONE)
+				++count;
+		}
+		size_t distance = (size_t) std::abs((ptrdiff_t) (2 * i) - (ptrdiff_t) length);
+		if(count < best_count || (count == best_count && distance < best_distance)) {
+			best_line = i;
+			best_count = count;
+			best_distance = distance;
+		}
+	}
+
+	// order both halves, then the separator
+	if(split_x) {
+		OrderNodes(node_order, ix1, iy1, ix1 + best_line, iy2);
+		OrderNodes(node_order, ix1 + best_line + 1, iy1, ix2, iy2);
+		OrderNodes(node_order, ix1 + best_line, iy1, ix1 + best_line + 1, iy2);
+	} else {
+		OrderNodes(node_order, ix1, iy1, ix2, iy1 + best_line);
+		OrderNodes(node_order, ix1, iy1 + best_line + 1, ix2, iy2);
+		OrderNodes(node_order, ix1, iy1 + best_line, ix2, iy1 + best_line + 1);
+	}
+
+}
+
 void GridMesh2D::BuildMatrices() {
 	assert(IsInitialized() && !IsSolved());
 
 	//real_t omega = 2.0 * M_PI * GetFrequency();
 
-	// load conductor properties
+	// load material properties, from the table if possible
 	m_conductor_properties.clear();
 	m_conductor_properties.resize(m_conductors.size());
-	for(size_t i = 0; i < m_conductors.size(); ++i) {
-		GetConductorProperties(m_conductor_properties[i], m_conductors[i].m_material, GetFrequency());
-	}
-
-	// load dielectric properties
 	m_dielectric_properties.clear();
 	m_dielectric_properties.resize(m_dielectrics.size());
-	for(size_t i = 0; i < m_dielectrics.size(); ++i) {
-		GetDielectricProperties(m_dielectric_properties[i], m_dielectrics[i].m_material, GetFrequency());
+	size_t table_frequency = m_material_table.FindFrequency(GetFrequency());
+	if(table_frequency != INDEX_NONE) {
+		for(size_t i = 0; i < m_conductors.size(); ++i) {
+			m_conductor_properties[i] = m_material_table.GetConductorProperties(table_frequency, i);
+		}
+		for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+			m_dielectric_properties[i] = m_material_table.GetDielectricProperties(table_frequency, i);
+		}
+	} else {
+		for(size_t i = 0; i < m_conductors.size(); ++i) {
+			GetConductorProperties(m_conductor_properties[i], m_conductors[i].m_material, GetFrequency());
+		}
+		for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+			GetDielectricProperties(m_dielectric_properties[i], m_dielectrics[i].m_material, GetFrequency());
+		}
+	}
+
+	// Check whether all cells outside the conductors have the same real isotropic permittivity. In that case (and
+	// without PML) the real part of the magnetic potential matrix is just the electric one scaled by 1 / (mu0 * eps),
+	// so the magnetic potential solution is identical and doesn't have to be calculated separately.
+	bool pml_active = (m_pml_attenuation != 0.0 && (m_pml_box.x1 > m_world_box.x1 || m_pml_box.x2 < m_world_box.x2 ||
+													 m_pml_box.y1 > m_world_box.y1 || m_pml_box.y2 < m_world_box.y2));
+	m_homogeneous_permittivity = 0.0;
+	if(!pml_active) {
+		bool homogeneous = true;
+		real_t homogeneous_permittivity = 0.0;
+		for(size_t i = 0; i < m_cells.size() && homogeneous; ++i) {
+			const Cell &cell = m_cells[i];
+			if(cell.m_conductor != INDEX_NONE)
+				continue;
+			real_t permittivity_x = VACUUM_PERMITTIVITY, permittivity_y = VACUUM_PERMITTIVITY;
+			if(cell.m_dielectric != INDEX_NONE) {
+				permittivity_x = m_dielectric_properties[cell.m_dielectric].m_permittivity_x.real();
+				permittivity_y = m_dielectric_properties[cell.m_dielectric].m_permittivity_y.real();
+			}
+			if(homogeneous_permittivity == 0.0)
+				homogeneous_permittivity = permittivity_x;
+			homogeneous = (permittivity_x == homogeneous_permittivity && permittivity_y == homogeneous_permittivity);
+		}
+		if(homogeneous)
+			m_homogeneous_permittivity = homogeneous_permittivity;
 	}
 
 	// prepare PML
@@ -545,89 +906,296 @@ void GridMesh2D::BuildMatrices() {
 	complex_t pml_mult_y1 = m_pml_attenuation / ((m_pml_box.y1 - m_world_box.y1) * complex_t(1.0, -2.0 * GetFrequency() * (m_pml_box.y1 - m_world_box.y1) / SPEED_OF_LIGHT));
 	complex_t pml_mult_y2 = m_pml_attenuation / ((m_world_box.y2 - m_pml_box.y2) * complex_t(1.0, -2.0 * GetFrequency() * (m_world_box.y2 - m_pml_box.y2) / SPEED_OF_LIGHT));
 
+	// the surface currents are needed for the surface losses and the current image
+	bool solve_surface = (AreLossesRequested() || AreFieldsRequested());
+
 	// allocate matrices
+	size_t order = GetElementOrder();
+	size_t potential_bulk_size = (order == 1)? POTENTIAL_BULK_SIZE : POTENTIAL_BULK_SIZE_QUADRATIC;
+	size_t surface_bulk_size = (order == 1)? SURFACE_BULK_SIZE : SURFACE_BULK_SIZE_QUADRATIC;
 	std::vector<real_t> port_dc_conductances(m_ports.size(), 0.0);
 	SparseBlockMatrixCSL<complex_t> matrix_epot, matrix_mpot;
 	SparseBlockMatrixC<real_t> matrix_surf_resid;
-	SparseMatrixCSL<real_t> matrix_surf_curr, matrix_surf_loss;
-	matrix_epot.Reset(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, 5);
-	matrix_mpot.Reset(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, 5);
-	matrix_surf_resid.Reset(m_vars_surf, 0, m_vars_free, m_vars_fixed, 5);
-	matrix_surf_curr.Reset(m_vars_surf, m_vars_surf, 2);
-	matrix_surf_loss.Reset(m_vars_surf, m_vars_surf, 2);
+	matrix_epot.Reset(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, potential_bulk_size);
+	matrix_mpot.Reset(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, potential_bulk_size);
+	if(solve_surface) {
+		matrix_surf_resid.Reset(m_vars_surf, 0, m_vars_free, m_vars_fixed, surface_bulk_size);
+	}
 
 	// build matrices
-	for(size_t iy = 0; iy < m_grid_y.size() - 1; ++iy) {
-		for(size_t ix = 0; ix < m_grid_x.size() - 1; ++ix) {
-
-			// get cell
-			Cell &cell = GetCell(ix, iy);
+	for(size_t i = 0; i < m_cell_order.size(); ++i) {
+
+		// get element (with quadratic elements, this is the first of 2x2 cells, which all have the same materials)
+		size_t ix = m_cell_order[i] % (m_grid_x.size() - 1), iy = m_cell_order[i] / (m_grid_x.size() - 1);
+		Cell &cell = GetCell(ix, iy);
+
+		// get element size
+		real_t delta_x = m_grid_x[ix + order] - m_grid_x[ix];
+		real_t delta_y = m_grid_y[iy + order] - m_grid_y[iy];
+
+		// skip elements that are inside conductors
+		if(cell.m_conductor != INDEX_NONE) {
+			size_t port = m_conductors[cell.m_conductor].m_port;
+			real_t conductivity = m_conductor_properties[cell.m_conductor].m_conductivity;
+			port_dc_conductances[port] += conductivity * delta_x * delta_y;
+			continue;
+		}
 
-			// get cell size
-			real_t delta_x = m_grid_x[ix + 1] - m_grid_x[ix];
-			real_t delta_y = m_grid_y[iy + 1] - m_grid_y[iy];
+		// get dielectric properties
+		complex_t permittivity_x(VACUUM_PERMITTIVITY, 0.0), permittivity_y(VACUUM_PERMITTIVITY, 0.0);
+		if(cell.m_dielectric != INDEX_NONE) {
+			permittivity_x = m_dielectric_properties[cell.m_dielectric].m_permittivity_x;
+			permittivity_y = m_dielectric_properties[cell.m_dielectric].m_permittivity_y;
+		}
 
-			// skip cells that are inside conductors
-			if(cell.m_conductor != INDEX_NONE) {
-				size_t port = m_conductors[cell.m_conductor].m_port;
-				real_t conductivity = m_conductor_properties[cell.m_conductor].m_conductivity;
-				port_dc_conductances[port] += conductivity * delta_x * delta_y;
-				continue;
+		// get PML properties
+		real_t center_x = 0.5 * (m_grid_x[ix] + m_grid_x[ix + order]);
+		real_t center_y = 0.5 * (m_grid_y[iy] + m_grid_y[iy + order]);
+		complex_t pml_sx = 1.0, pml_sy = 1.0;
+		if(center_x < m_pml_box.x1) pml_sx += (m_pml_box.x1 - center_x) * pml_mult_x1;
+		if(center_x > m_pml_box.x2) pml_sx += (center_x - m_pml_box.x2) * pml_mult_x2;
+		if(center_y < m_pml_box.y1) pml_sy += (m_pml_box.y1 - center_y) * pml_mult_y1;
+		if(center_y > m_pml_box.y2) pml_sy += (center_y - m_pml_box.y2) * pml_mult_y2;
+		complex_t delta_pml_x = delta_x * pml_sx;
+		complex_t delta_pml_y = delta_y * pml_sy;
+
+		if(order == 2) {
+
+			// get nodes
+			size_t vars[9], vars_surf[9];
+			for(size_t j = 0; j < 9; ++j) {
+				Node &node = GetNode(ix + j % 3, iy + j / 3);
+				vars[j] = node.m_var;
+				vars_surf[j] = node.m_var_surf;
 			}
 
-			// get neighboring nodes
-			Node &node00 = GetNode(ix    , iy    );
-			Node &node01 = GetNode(ix + 1, iy    );
-			Node &node10 = GetNode(ix    , iy + 1);
-			Node &node11 = GetNode(ix + 1, iy + 1);
+			// calculate scale factors
+			complex_t scale_x_epot = delta_pml_y / delta_pml_x * permittivity_x;
+			complex_t scale_y_epot = delta_pml_x / delta_pml_y * permittivity_y;
+			complex_t scale_x_mpot = delta_pml_y / delta_pml_x / VACUUM_PERMEABILITY;
+			complex_t scale_y_mpot = delta_pml_x / delta_pml_y / VACUUM_PERMEABILITY;
 
-			// get dielectric properties
-			complex_t permittivity_x(VACUUM_PERMITTIVITY, 0.0), permittivity_y(VACUUM_PERMITTIVITY, 0.0);
-			if(cell.m_dielectric != INDEX_NONE) {
-				permittivity_x = m_dielectric_properties[cell.m_dielectric].m_permittivity_x;
-				permittivity_y = m_dielectric_properties[cell.m_dielectric].m_permittivity_y;
+			// add to potential matrices
+			BuildMatrix_Symm2Q(matrix_epot, vars, scale_x_epot, scale_y_epot);
+			if(m_homogeneous_permittivity == 0.0) {
+				BuildMatrix_Symm2Q(matrix_mpot, vars, scale_x_mpot, scale_y_mpot);
 			}
 
-			// get PML properties
-			real_t center_x = 0.5 * (m_grid_x[ix] + m_grid_x[ix + 1]);
-			real_t center_y = 0.5 * (m_grid_y[iy] + m_grid_y[iy + 1]);
-			complex_t pml_sx = 1.0, pml_sy = 1.0;
-			if(center_x < m_pml_box.x1) pml_sx += (m_pml_box.x1 - center_x) * pml_mult_x1;
-			if(center_x > m_pml_box.x2) pml_sx += (center_x - m_pml_box.x2) * pml_mult_x2;
-			if(center_y < m_pml_box.y1) pml_sy += (m_pml_box.y1 - center_y) * pml_mult_y1;
-			if(center_y > m_pml_box.y2) pml_sy += (center_y - m_pml_box.y2) * pml_mult_y2;
-			complex_t delta_pml_x = delta_x * pml_sx;
-			complex_t delta_pml_y = delta_y * pml_sy;
+			// add to surface residual matrix
+			if(solve_surface) {
+				BuildMatrix_Asymm2Q(matrix_surf_resid, vars_surf, vars, scale_x_mpot.real(), scale_y_mpot.real());
+			}
 
-			// calculate scale factors
-			complex_t scale_x_epot = 1.0 / 6.0 * delta_pml_y / delta_pml_x * permittivity_x;
-			complex_t scale_y_epot = 1.0 / 6.0 * delta_pml_x / delta_pml_y * permittivity_y;
-			complex_t scale_x_mpot = 1.0 / 6.0 * delta_pml_y / delta_pml_x / VACUUM_PERMEABILITY;
-			complex_t scale_y_mpot = 1.0 / 6.0 * delta_pml_x / delta_pml_y / VACUUM_PERMEABILITY;
-
-			// calculate electric potential coefficients
-			complex_t coef_s_epot = 2.0 * (scale_x_epot + scale_y_epot);
-			complex_t coef_x_epot = scale_y_epot - 2.0 * scale_x_epot;
-			complex_t coef_y_epot = scale_x_epot - 2.0 * scale_y_epot;
-			complex_t coef_d_epot = -(scale_x_epot + scale_y_epot);
-
-			// calculate magnetic potential coefficients
-			complex_t coef_s_mpot = 2.0 * (scale_x_mpot + scale_y_mpot);
-			complex_t coef_x_mpot = scale_y_mpot - 2.0 * scale_x_mpot;
-			complex_t coef_y_mpot = scale_x_mpot - 2.0 * scale_y_mpot;
-			complex_t coef_d_mpot = -(scale_x_mpot + scale_y_mpot);
+			continue;
+		}
 
-			// add to potential matrices
-			BuildMatrix_Symm2(matrix_epot, node00.m_var, node01.m_var, node10.m_var, node11.m_var,
-							  coef_s_epot, coef_x_epot, coef_y_epot, coef_d_epot);
+		// get neighboring nodes
+		Node &node00 = GetNode(ix    , iy    );
+		Node &node01 = GetNode(ix + 1, iy    );
+		Node &node10 = GetNode(ix    , iy + 1);
+		Node &node11 = GetNode(ix + 1, iy + 1);
+
+		// calculate scale factors
+		complex_t scale_x_epot = 1.0 / 6.0 * delta_pml_y / delta_pml_x * permittivity_x;
+		complex_t scale_y_epot = 1.0 / 6.0 * delta_pml_x / delta_pml_y * permittivity_y;
+		complex_t scale_x_mpot = 1.0 / 6.0 * delta_pml_y / delta_pml_x / VACUUM_PERMEABILITY;
+		complex_t scale_y_mpot = 1.0 / 6.0 * delta_pml_x / delta_pml_y / VACUUM_PERMEABILITY;
+
+		// calculate electric potential coefficients
+		complex_t coef_s_epot = 2.0 * (scale_x_epot + scale_y_epot);
+		complex_t coef_x_epot = scale_y_epot - 2.0 * scale_x_epot;
+		complex_t coef_y_epot = scale_x_epot - 2.0 * scale_y_epot;
+		complex_t coef_d_epot = -(scale_x_epot + scale_y_epot);
+
+		// calculate magnetic potential coefficients
+		complex_t coef_s_mpot = 2.0 * (scale_x_mpot + scale_y_mpot);
+		complex_t coef_x_mpot = scale_y_mpot - 2.0 * scale_x_mpot;
+		complex_t coef_y_mpot = scale_x_mpot - 2.0 * scale_y_mpot;
+		complex_t coef_d_mpot = -(scale_x_mpot + scale_y_mpot);
+
+		// add to potential matrices
+		BuildMatrix_Symm2(matrix_epot, node00.m_var, node01.m_var, node10.m_var, node11.m_var,
+						  coef_s_epot, coef_x_epot, coef_y_epot, coef_d_epot);
+		if(m_homogeneous_permittivity == 0.0) {
 			BuildMatrix_Symm2(matrix_mpot, node00.m_var, node01.m_var, node10.m_var, node11.m_var,
 							  coef_s_mpot, coef_x_mpot, coef_y_mpot, coef_d_mpot);
+		}
 
-			// add to surface residual matrix
+		// add to surface residual matrix
+		if(solve_surface) {
 			BuildMatrix_Asymm2(matrix_surf_resid,
 							   node00.m_var_surf, node01.m_var_surf, node10.m_var_surf, node11.m_var_surf,
 							   node00.m_var, node01.m_var, node10.m_var, node11.m_var,
 							   coef_s_mpot.real(), coef_x_mpot.real(), coef_y_mpot.real(), coef_d_mpot.real());
+		}
+
+	}
+
+	// Add the open boundary condition to the edges of the world box (except conductors). The dipole potential
+	// V = (d . p) / |d|^2 satisfies dV/dn = -alpha * V with alpha = 2 * (d . n) / |d|^2 - (n . p) / (d . p), where d is the
+	// position relative to the origin, p the dipole direction and n the outward normal. This adds the integral of
+	// alpha * permittivity * V * W over the edge, which is a 1D mass matrix. Edges where alpha isn't positive are skipped,
+	// since the matrix must stay positive definite (this only happens in far corners of very wide world boxes).
+	if(m_open_boundary) {
+		auto build_edge = [&](size_t ix0, size_t iy0, size_t ix1, size_t iy1, const Edge &edge, const Cell &cell, real_t normal_x, real_t normal_y) {
+			if(edge.m_conductor != INDEX_NONE || cell.m_conductor != INDEX_NONE)
+				return;
+			real_t dx = 0.5 * (m_grid_x[ix0] + m_grid_x[ix1]) - m_open_boundary_origin.x;
+			real_t dy = 0.5 * (m_grid_y[iy0] + m_grid_y[iy1]) - m_open_boundary_origin.y;
+			real_t dn = dx * normal_x + dy * normal_y;
+			real_t dp = dx * m_open_boundary_dipole.x + dy * m_open_boundary_dipole.y;
+			real_t np = normal_x * m_open_boundary_dipole.x + normal_y * m_open_boundary_dipole.y;
+			real_t alpha = 2.0 * dn / (dx * dx + dy * dy) - ((np == 0.0)? 0.0 : np / dp);
+			if(!(alpha > 0.0))
+				return;
+			real_t length = (m_grid_x[ix1] - m_grid_x[ix0]) + (m_grid_y[iy1] - m_grid_y[iy0]);
+			complex_t permittivity(VACUUM_PERMITTIVITY, 0.0);
+			if(cell.m_dielectric != INDEX_NONE) {
+				permittivity = (normal_x != 0.0)? m_dielectric_properties[cell.m_dielectric].m_permittivity_x : m_dielectric_properties[cell.m_dielectric].m_permittivity_y;
+			}
+			if(order == 2) {
+				size_t vars[3], vars_surf[3];
+				for(size_t j = 0; j < 3; ++j) {
+					Node &node = GetNode(ix0 + (ix1 - ix0) * j / 2, iy0 + (iy1 - iy0) * j / 2);
+					vars[j] = node.m_var;
+					vars_surf[j] = node.m_var_surf;
+				}
+				complex_t scale_epot = alpha * length * permittivity;
+				real_t scale_mpot = alpha * length / VACUUM_PERMEABILITY;
+				BuildMatrix_Symm1Q(matrix_epot, vars, scale_epot);
+				if(m_homogeneous_permittivity == 0.0) {
+					BuildMatrix_Symm1Q(matrix_mpot, vars, complex_t(scale_mpot));
+				}
+				if(solve_surface) {
+					BuildMatrix_Asymm1Q(matrix_surf_resid, vars_surf, vars, scale_mpot);
+				}
+				return;
+			}
+			Node &node0 = GetNode(ix0, iy0);
+			Node &node1 = GetNode(ix1, iy1);
+			complex_t coef_epot = alpha * length / 6.0 * permittivity;
+			real_t coef_mpot = alpha * length / 6.0 / VACUUM_PERMEABILITY;
+			BuildMatrix_Symm1(matrix_epot, node0.m_var, node1.m_var, 2.0 * coef_epot, coef_epot);
+			if(m_homogeneous_permittivity == 0.0) {
+				BuildMatrix_Symm1(matrix_mpot, node0.m_var, node1.m_var, complex_t(2.0 * coef_mpot), complex_t(coef_mpot));
+			}
+			if(solve_surface) {
+				BuildMatrix_Asymm1(matrix_surf_resid, node0.m_var_surf, node1.m_var_surf, node0.m_var, node1.m_var, 2.0 * coef_mpot, coef_mpot);
+			}
+		};
+		size_t nx = m_grid_x.size(), ny = m_grid_y.size();
+		for(size_t ix = 0; ix < nx - 1; ix += order) {
+			build_edge(ix, 0, ix + order, 0, GetEdgeH(ix, 0), GetCell(ix, 0), 0.0, -1.0);
+			build_edge(ix, ny - 1, ix + order, ny - 1, GetEdgeH(ix, ny - 1), GetCell(ix, ny - 2), 0.0, 1.0);
+		}
+		for(size_t iy = 0; iy < ny - 1; iy += order) {
+			build_edge(0, iy, 0, iy + order, GetEdgeV(0, iy), GetCell(0, iy), -1.0, 0.0);
+			build_edge(nx - 1, iy, nx - 1, iy + order, GetEdgeV(nx - 1, iy), GetCell(nx - 2, iy), 1.0, 0.0);
+		}
+	}
+
+	// convert port DC conductance to resistance
+	m_vector_dc_resistances.resize((Eigen::Index) m_vars_fixed);
+	for(size_t i = 0; i < m_ports.size(); ++i) {
+		size_t var = m_ports[i].m_var;
+		if(var >= INDEX_OFFSET) {
+			m_vector_dc_resistances[(Eigen::Index) (var - INDEX_OFFSET)] = (m_ports[i].m_infinite_area)? 0.0 : 1.0 / port_dc_conductances[i];
+		}
+	}
+
+	// convert to Eigen sparse matrices
+	matrix_epot.GetMatrixA().ToEigenSplit(m_matrix_epot[0]);
+	matrix_epot.GetMatrixBC().ToEigenSplit(m_matrix_epot[1]);
+	matrix_epot.GetMatrixD().ToEigenSplit(m_matrix_epot[2]);
+	matrix_mpot.GetMatrixA().ToEigenSplit(m_matrix_mpot[0]);
+	matrix_mpot.GetMatrixBC().ToEigenSplit(m_matrix_mpot[1]);
+	matrix_mpot.GetMatrixD().ToEigenSplit(m_matrix_mpot[2]);
+
+	// build the surface matrices if needed, and scale the loss matrix
+	if(solve_surface) {
+		matrix_surf_resid.GetMatrixA().ToEigen(m_matrix_surf_resid[0]);
+		matrix_surf_resid.GetMatrixB().ToEigen(m_matrix_surf_resid[1]);
+		if(!m_surf_solver.IsFactorized()) {
+			BuildSurfaceMatrices();
+		}
+	}
+	if(AreLossesRequested()) {
+		m_matrix_surf_loss = m_matrix_surf_loss_parts[0] / m_conductor_properties[m_surf_loss_part_conductors[0]].m_surface_conductivity;
+		for(size_t i = 1; i < m_matrix_surf_loss_parts.size(); ++i) {
+			m_matrix_surf_loss += m_matrix_surf_loss_parts[i] / m_conductor_properties[m_surf_loss_part_conductors[i]].m_surface_conductivity;
+		}
+	}
+
+#if SIMULATION_SAVE_MATRIXMARKET
+	MatrixMarket::Save("matrix_epot.mtx", m_matrix_epot[0].Real(), true);
+	MatrixMarket::Save("matrix_mpot.mtx", m_matrix_mpot[0].Real(), true);
+#endif
+
+}
+
+void GridMesh2D::BuildSurfaceMatrices() {
+	assert(IsInitialized());
+
+	// conductors with the same material share the same part of the loss matrix
+	std::vector<size_t> conductor_parts(m_conductors.size());
+	m_surf_loss_part_conductors.clear();
+	for(size_t i = 0; i < m_conductors.size(); ++i) {
+		size_t part = 0;
+		while(part < m_surf_loss_part_conductors.size() && m_conductors[m_surf_loss_part_conductors[part]].m_material != m_conductors[i].m_material) {
+			++part;
+		}
+		if(part == m_surf_loss_part_conductors.size())
+			m_surf_loss_part_conductors.push_back(i);
+		conductor_parts[i] = part;
+	}
+
+	// allocate matrices
+	size_t order = GetElementOrder();
+	SparseMatrixCSL<real_t> matrix_surf_curr;
+	std::vector<SparseMatrixCSL<real_t>> matrix_surf_loss_parts(m_surf_loss_part_conductors.size());
+	matrix_surf_curr.Reset(m_vars_surf, m_vars_surf, 2 * order);
+	for(size_t i = 0; i < matrix_surf_loss_parts.size(); ++i) {
+		matrix_surf_loss_parts[i].Reset(m_vars_surf, m_vars_surf, 2 * order);
+	}
+
+	// build matrices
+	for(size_t iy = 0; iy < m_grid_y.size() - 1; iy += order) {
+		for(size_t ix = 0; ix < m_grid_x.size() - 1; ix += order) {
+
+			// skip elements that are inside conductors
+			Cell &cell = GetCell(ix, iy);
+			if(cell.m_conductor != INDEX_NONE)
+				continue;
+
+			// get element size
+			real_t delta_x = m_grid_x[ix + order] - m_grid_x[ix];
+			real_t delta_y = m_grid_y[iy + order] - m_grid_y[iy];
+
+			// process conductor surfaces of quadratic elements
+			if(order == 2) {
+				auto build_edge = [&](const Edge &edge, size_t ix0, size_t iy0, size_t step_x, size_t step_y, real_t length) {
+					if(edge.m_conductor == INDEX_NONE)
+						return;
+					size_t vars_surf[3];
+					for(size_t j = 0; j < 3; ++j) {
+						vars_surf[j] = GetNode(ix0 + step_x * j, iy0 + step_y * j).m_var_surf;
+						assert(vars_surf[j] != INDEX_NONE);
+					}
+					BuildMatrix_Symm1Q(matrix_surf_curr, vars_surf, length);
+					BuildMatrix_Symm1Q(matrix_surf_loss_parts[conductor_parts[edge.m_conductor]], vars_surf, length);
+				};
+				build_edge(GetEdgeH(ix, iy), ix, iy, 1, 0, delta_x);
+				build_edge(GetEdgeH(ix, iy + 2), ix, iy + 2, 1, 0, delta_x);
+				build_edge(GetEdgeV(ix, iy), ix, iy, 0, 1, delta_y);
+				build_edge(GetEdgeV(ix + 2, iy), ix + 2, iy, 0, 1, delta_y);
+				continue;
+			}
+
+			// get neighboring nodes
+			Node &node00 = GetNode(ix    , iy    );
+			Node &node01 = GetNode(ix + 1, iy    );
+			Node &node10 = GetNode(ix    , iy + 1);
+			Node &node11 = GetNode(ix + 1, iy + 1);
 
 			// process conductor surfaces
 			Edge &edgeh0 = GetEdgeH(ix, iy);
@@ -638,143 +1206,171 @@ void GridMesh2D::BuildMatrices() {
 				assert(node00.m_var_surf != INDEX_NONE);
 				assert(node01.m_var_surf != INDEX_NONE);
 				real_t coef_curr = 1.0 / 6.0 * delta_x;
-				real_t coef_loss = coef_curr / m_conductor_properties[edgeh0.m_conductor].m_surface_conductivity;
 				BuildMatrix_Symm1(matrix_surf_curr, node00.m_var_surf, node01.m_var_surf, 2.0 * coef_curr, coef_curr);
-				BuildMatrix_Symm1(matrix_surf_loss, node00.m_var_surf, node01.m_var_surf, 2.0 * coef_loss, coef_loss);
+				BuildMatrix_Symm1(matrix_surf_loss_parts[conductor_parts[edgeh0.m_conductor]], node00.m_var_surf, node01.m_var_surf, 2.0 * coef_curr, coef_curr);
 			}
 			if(edgeh1.m_conductor != INDEX_NONE) {
 				assert(node10.m_var_surf != INDEX_NONE);
 				assert(node11.m_var_surf != INDEX_NONE);
 				real_t coef_curr = 1.0 / 6.0 * delta_x;
-				real_t coef_loss = coef_curr / m_conductor_properties[edgeh1.m_conductor].m_surface_conductivity;
 				BuildMatrix_Symm1(matrix_surf_curr, node10.m_var_surf, node11.m_var_surf, 2.0 * coef_curr, coef_curr);
-				BuildMatrix_Symm1(matrix_surf_loss, node10.m_var_surf, node11.m_var_surf, 2.0 * coef_loss, coef_loss);
+				BuildMatrix_Symm1(matrix_surf_loss_parts[conductor_parts[edgeh1.m_conductor]], node10.m_var_surf, node11.m_var_surf, 2.0 * coef_curr, coef_curr);
 			}
 			if(edgev0.m_conductor != INDEX_NONE) {
 				assert(node00.m_var_surf != INDEX_NONE);
 				assert(node10.m_var_surf != INDEX_NONE);
 				real_t coef_curr = 1.0 / 6.0 * delta_y;
-				real_t coef_loss = coef_curr / m_conductor_properties[edgev0.m_conductor].m_surface_conductivity;
 				BuildMatrix_Symm1(matrix_surf_curr, node00.m_var_surf, node10.m_var_surf, 2.0 * coef_curr, coef_curr);
-				BuildMatrix_Symm1(matrix_surf_loss, node00.m_var_surf, node10.m_var_surf, 2.0 * coef_loss, coef_loss);
+				BuildMatrix_Symm1(matrix_surf_loss_parts[conductor_parts[edgev0.m_conductor]], node00.m_var_surf, node10.m_var_surf, 2.0 * coef_curr, coef_curr);
 			}
 			if(edgev1.m_conductor != INDEX_NONE) {
 				assert(node01.m_var_surf != INDEX_NONE);
 				assert(node11.m_var_surf != INDEX_NONE);
 				real_t coef_curr = 1.0 / 6.0 * delta_y;
-				real_t coef_loss = coef_curr / m_conductor_properties[edgev1.m_conductor].m_surface_conductivity;
 				BuildMatrix_Symm1(matrix_surf_curr, node01.m_var_surf, node11.m_var_surf, 2.0 * coef_curr, coef_curr);
-				BuildMatrix_Symm1(matrix_surf_loss, node01.m_var_surf, node11.m_var_surf, 2.0 * coef_loss, coef_loss);
+				BuildMatrix_Symm1(matrix_surf_loss_parts[conductor_parts[edgev1.m_conductor]], node01.m_var_surf, node11.m_var_surf, 2.0 * coef_curr, coef_curr);
 			}
 
 		}
 	}
 
-	// convert port DC conductance to resistance
-	m_vector_dc_resistances.resize((Eigen::Index) m_vars_fixed);
-	for(size_t i = 0; i < m_ports.size(); ++i) {
-		size_t var = m_ports[i].m_var;
-		if(var >= INDEX_OFFSET) {
-			m_vector_dc_resistances[(Eigen::Index) (var - INDEX_OFFSET)] = (m_ports[i].m_infinite_area)? 0.0 : 1.0 / port_dc_conductances[i];
+	// convert to Eigen sparse matrices
+	Eigen::SparseMatrix<real_t> eigen_surf_curr;
+	matrix_surf_curr.ToEigen(eigen_surf_curr);
+	m_matrix_surf_loss_parts.resize(matrix_surf_loss_parts.size());
+	for(size_t i = 0; i < matrix_surf_loss_parts.size(); ++i) {
+		matrix_surf_loss_parts[i].ToEigen(m_matrix_surf_loss_parts[i]);
+	}
+
+	// The current matrix consists of one chain for each conductor perimeter, which can be factorized very efficiently.
+	m_surf_solver.Factorize(eigen_surf_curr);
+
+#if SIMULATION_VERBOSE
+	std::cerr << "GridMesh2D surface matrices: chains=" << m_surf_solver.GetChainCount()
+			  << " general=" << m_surf_solver.GetGeneralSize() << std::endl;
+#endif
+
+}
+
+// Returns the number of nonzero coefficients below the diagonal of the LDL^T factorization of the potential matrices
+// (see PortSolver::PredictFactorNonZeros). The index structure of the matrix is derived from the cells directly.
+size_t GridMesh2D::PredictFactorNonZeros() {
+
+	// collect the coefficients above the diagonal for each column (duplicates don't matter)
+	size_t order = GetElementOrder(), element_nodes = (order + 1) * (order + 1);
+	std::vector<size_t> upper_outer(m_vars_free + 1, 0);
+	std::vector<CompactIndex> upper_inner;
+	for(size_t pass = 0; pass < 2; ++pass) {
+		for(size_t iy = 0; iy < m_grid_y.size() - 1; iy += order) {
+			for(size_t ix = 0; ix < m_grid_x.size() - 1; ix += order) {
+				if(GetCell(ix, iy).m_conductor != INDEX_NONE)
+					continue;
+				size_t vars[9];
+				for(size_t j = 0; j < element_nodes; ++j) {
+					vars[j] = GetNode(ix + j % (order + 1), iy + j / (order + 1)).m_var;
+				}
+				for(size_t j = 0; j < element_nodes; ++j) {
+					for(size_t k = 0; k < element_nodes; ++k) {
+						if(vars[j] < vars[k] && vars[k] < m_vars_free) {
+							if(pass == 0) {
+								++upper_outer[vars[k] + 1];
+							} else {
+								upper_inner[upper_outer[vars[k]]++] = (CompactIndex) vars[j];
+							}
+						}
+					}
+				}
+			}
+		}
+		if(pass == 0) {
+			for(size_t k = 0; k < m_vars_free; ++k) {
+				upper_outer[k + 1] += upper_outer[k];
+			}
+			upper_inner.resize(upper_outer[m_vars_free]);
+		} else {
+			for(size_t k = m_vars_free; k > 0; --k) {
+				upper_outer[k] = upper_outer[k - 1];
+			}
+			upper_outer[0] = 0;
 		}
 	}
 
-	// convert to Eigen sparse matrices
-	matrix_epot.GetMatrixA().ToEigen(m_matrix_epot[0]);
-	matrix_epot.GetMatrixBC().ToEigen(m_matrix_epot[1]);
-	matrix_epot.GetMatrixD().ToEigen(m_matrix_epot[2]);
-	matrix_mpot.GetMatrixA().ToEigen(m_matrix_mpot[0]);
-	matrix_mpot.GetMatrixBC().ToEigen(m_matrix_mpot[1]);
-	matrix_mpot.GetMatrixD().ToEigen(m_matrix_mpot[2]);
-	matrix_surf_resid.GetMatrixA().ToEigen(m_matrix_surf_resid[0]);
-	matrix_surf_resid.GetMatrixB().ToEigen(m_matrix_surf_resid[1]);
-	matrix_surf_curr.ToEigen(m_matrix_surf_curr);
-	matrix_surf_loss.ToEigen(m_matrix_surf_loss);
+	return PortSolver::PredictFactorNonZeros(m_vars_free, upper_outer, upper_inner);
 
-#if SIMULATION_SAVE_MATRIXMARKET
-	MatrixMarket::Save("matrix_epot.mtx", m_matrix_epot[0], true);
-	MatrixMarket::Save("matrix_mpot.mtx", m_matrix_mpot[0], true);
+}
+
+// Predicts the peak memory usage of Solve, with the given number of factorizations. During the conversion to Eigen
+// matrices, the builders and the converted matrices exist at the same time. During the factorization, the converted
+// matrices, the factors, a permuted copy of the matrix and the solutions exist at the same time. When the factorizations
+// are reused, the solution history and the starting point of the iterative solver need about 5 more solutions. With
+// linear elements, each free variable has on average 4 neighbors with a higher index (plus the diagonal) in the
+// potential matrices, and at most 4 surface neighbors. With quadratic elements, it has 7.5 neighbors with a higher
+// index on average, and at most 8 surface neighbors.
+size_t GridMesh2D::PredictMemoryUsage(size_t factors) {
+	size_t order = GetElementOrder();
+	size_t potential_bulk_size = (order == 1)? POTENTIAL_BULK_SIZE : POTENTIAL_BULK_SIZE_QUADRATIC;
+	size_t surface_bulk_size = (order == 1)? SURFACE_BULK_SIZE : SURFACE_BULK_SIZE_QUADRATIC;
+	size_t potential_row_size = (order == 1)? 5 : 9, surface_row_size = (order == 1)? 4 : 8;
+	size_t table_memory = GetTableMemoryUsage();
+	size_t builder_memory = SparseBlockMatrixCSL<complex_t>::PredictMemoryUsage(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, potential_bulk_size) * 2 +
+							SparseBlockMatrixC<real_t>::PredictMemoryUsage(m_vars_surf, 0, m_vars_free, m_vars_fixed, surface_bulk_size);
+	size_t matrix_memory = m_vars_free * (potential_row_size * (sizeof(int) + 2 * sizeof(real_t)) * 2 + surface_row_size * (sizeof(int) + sizeof(real_t)));
+	size_t factor_memory = (PredictFactorNonZeros() * (sizeof(int) + sizeof(real_t)) + m_vars_free * (sizeof(real_t) + 4 * sizeof(int))) * factors +
+						   m_vars_free * potential_row_size * (sizeof(int) + sizeof(real_t));
+	size_t excitations = (m_open_boundary)? m_vars_fixed : m_vars_fixed - 1;
+	size_t solution_memory = ((factors > 1)? 8 : 3) * m_vars_free * excitations * sizeof(real_t);
+	size_t build_peak = table_memory + builder_memory + matrix_memory;
+	size_t solve_peak = table_memory + matrix_memory + factor_memory + solution_memory;
+
+#if SIMULATION_VERBOSE
+	std::cerr << "GridMesh2D predicted memory:"
+			  << " tables=" << BytesToMegabytes(table_memory) << "MB"
+			  << " builders=" << BytesToMegabytes(builder_memory) << "MB"
+			  << " matrices=" << BytesToMegabytes(matrix_memory) << "MB"
+			  << " factor=" << BytesToMegabytes(factor_memory) << "MB"
+			  << " solutions=" << BytesToMegabytes(solution_memory) << "MB"
+			  << " budget=" << BytesToMegabytes(GetMemoryBudget()) << "MB"
+			  << std::endl;
 #endif
 
+	return std::max(build_peak, solve_peak);
 }
 
-void GridMesh2D::SolveMatrices() {
-	assert(IsInitialized() && !IsSolved());
+size_t GridMesh2D::GetMemoryUsage() {
+	return GetTableMemoryUsage() + GetMatrixMemoryUsage() + GetSolverMemoryUsage() + GetSolutionMemoryUsage();
+}
+
+size_t GridMesh2D::GetTableMemoryUsage() {
+	return (m_grid_x.capacity() + m_grid_y.capacity() + m_midpoints_x.capacity() + m_midpoints_y.capacity()) * sizeof(real_t) +
+			m_nodes.capacity() * sizeof(Node) + (m_edges_h.capacity() + m_edges_v.capacity()) * sizeof(Edge) +
+			m_cells.capacity() * sizeof(Cell) + m_cell_order.capacity() * sizeof(CompactIndex);
+}
+
+size_t GridMesh2D::GetMatrixMemoryUsage() {
+	size_t usage = (size_t) m_vector_dc_resistances.size() * sizeof(real_t);
+	for(size_t i = 0; i < 3; ++i) {
+		usage += m_matrix_epot[i].GetMemoryUsage() + m_matrix_mpot[i].GetMemoryUsage();
+	}
+	usage += EigenSparseMemoryUsage(m_matrix_surf_resid[0]) + EigenSparseMemoryUsage(m_matrix_surf_resid[1]) + EigenSparseMemoryUsage(m_matrix_surf_loss);
+	for(const Eigen::SparseMatrix<real_t> &part : m_matrix_surf_loss_parts) {
+		usage += EigenSparseMemoryUsage(part);
+	}
+	return usage;
+}
 
-	real_t omega = 2.0 * M_PI * GetFrequency();
-
-	// factorize electric potential matrix
-	if(m_eigen_chol.permutationP().size() == 0) {
-		m_eigen_chol.analyzePattern(m_matrix_epot[0].real());
-	}
-	m_eigen_chol.factorize(m_matrix_epot[0].real());
-	if(m_eigen_chol.info() != Eigen::Success)
-		throw std::runtime_error("Sparse matrix factorization failed!");
-
-	// solve electric potential matrix
-	m_eigen_rhs = -m_matrix_epot[1].real().transpose() * GetModes();
-	m_eigen_solution_epot = m_eigen_chol.solve(m_eigen_rhs);
-
-	// factorize magnetic potential matrix
-	if(m_eigen_chol.permutationP().size() == 0) {
-		m_eigen_chol.analyzePattern(m_matrix_mpot[0].real());
-	}
-	m_eigen_chol.factorize(m_matrix_mpot[0].real());
-	if(m_eigen_chol.info() != Eigen::Success)
-		throw std::runtime_error("Sparse matrix factorization failed!");
-
-	// solve magnetic potential matrix
-	m_eigen_rhs = -m_matrix_mpot[1].real().transpose() * GetModes();
-	m_eigen_solution_mpot = m_eigen_chol.solve(m_eigen_rhs);
-
-	// calculate residuals
-	Eigen::MatrixXr residual_epot = m_matrix_epot[1].real() * m_eigen_solution_epot + m_matrix_epot[2].real().selfadjointView<Eigen::Lower>() * GetModes();
-	Eigen::MatrixXr residual_mpot = m_matrix_mpot[1].real() * m_eigen_solution_mpot + m_matrix_mpot[2].real().selfadjointView<Eigen::Lower>() * GetModes();
-	Eigen::MatrixXr charge_matrix = GetModes().transpose() * residual_epot;
-	Eigen::MatrixXr current_matrix = GetModes().transpose() * residual_mpot;
-
-	// calculate losses
-	Eigen::MatrixXr electric_loss_matrix =
-			m_eigen_solution_epot.transpose() * (m_matrix_epot[0].imag().selfadjointView<Eigen::Lower>() * m_eigen_solution_epot + m_matrix_epot[1].imag().transpose() * GetModes()) +
-			GetModes().transpose() * (m_matrix_epot[1].imag() * m_eigen_solution_epot + m_matrix_epot[2].imag().selfadjointView<Eigen::Lower>() * GetModes());
-	Eigen::MatrixXr magnetic_loss_matrix =
-			m_eigen_solution_mpot.transpose() * (m_matrix_mpot[0].imag().selfadjointView<Eigen::Lower>() * m_eigen_solution_mpot + m_matrix_mpot[1].imag().transpose() * GetModes()) +
-			GetModes().transpose() * (m_matrix_mpot[1].imag() * m_eigen_solution_mpot + m_matrix_mpot[2].imag().selfadjointView<Eigen::Lower>() * GetModes());
-
-	// factorize current matrix
-	if(m_eigen_chol_surf.permutationP().size() == 0) {
-		m_eigen_chol_surf.analyzePattern(m_matrix_surf_curr);
-	}
-	m_eigen_chol_surf.factorize(m_matrix_surf_curr);
-	if(m_eigen_chol_surf.info() != Eigen::Success)
-		throw std::runtime_error("Sparse matrix factorization failed!");
-
-	// calculate surface currents
-	m_eigen_rhs_surf = m_matrix_surf_resid[0] * m_eigen_solution_mpot + m_matrix_surf_resid[1] * GetModes();
-	m_eigen_solution_surf = m_eigen_chol_surf.solve(m_eigen_rhs_surf);
-
-	// calculate surface losses
-	Eigen::MatrixXr surface_loss_matrix = m_eigen_solution_surf.transpose() * m_matrix_surf_loss.selfadjointView<Eigen::Lower>() * m_eigen_solution_surf;
-
-	// calculate DC losses and combine with surface losses
-	Eigen::MatrixXr dc_loss_matrix = residual_mpot.transpose() * m_vector_dc_resistances.asDiagonal() * residual_mpot;
-	Eigen::MatrixXr combined_loss_matrix = surface_loss_matrix.cwiseMax(dc_loss_matrix);
-
-	std::cerr << "charges =\n" << charge_matrix << std::endl;
-	std::cerr << "currents =\n" << current_matrix << std::endl;
-	std::cerr << "electric_loss_matrix =\n" << electric_loss_matrix << std::endl;
-	std::cerr << "magnetic_loss_matrix =\n" << magnetic_loss_matrix << std::endl;
-	std::cerr << "surface_loss_matrix =\n" << surface_loss_matrix << std::endl;
-	std::cerr << "dc_loss_matrix =\n" << dc_loss_matrix << std::endl;
-	std::cerr << "combined_loss_matrix =\n" << combined_loss_matrix << std::endl;
-	std::cerr << std::endl;
-
-	// calculate L, C, R and G
-	m_inductance_matrix = current_matrix.inverse();
-	m_capacitance_matrix = charge_matrix;
-	m_resistance_matrix = m_inductance_matrix.transpose() * (-omega * magnetic_loss_matrix + combined_loss_matrix) * m_inductance_matrix;
-	m_conductance_matrix = -omega * electric_loss_matrix;
+size_t GridMesh2D::GetSolverMemoryUsage() {
+	return m_port_solver.GetSolverMemoryUsage() + m_surf_solver.GetMemoryUsage();
+}
 
+size_t GridMesh2D::GetSolutionMemoryUsage() {
+	const Eigen::MatrixXr *matrices[] = {
+		&m_eigen_solution_epot, &m_eigen_solution_mpot, &m_eigen_solution_surf,
+	};
+	size_t usage = m_port_solver.GetSolutionMemoryUsage();
+	for(const Eigen::MatrixXr *matrix : matrices) {
+		usage += (size_t) matrix->size() * sizeof(real_t);
+	}
+	return usage;
 }
 
 void GridMesh2D::GetCellValues(std::vector<real_t> &cell_values, size_t mode, MeshImageType type) {
@@ -802,7 +1398,7 @@ void GridMesh2D::GetCellValues(std::vector<real_t> &cell_values, size_t mode, Me
 			size_t cell_index = GetCellIndex(ix, iy);
 			Cell &cell = m_cells[cell_index];
 			real_t val = (cell.m_conductor != INDEX_NONE)? 0.0 : (cell.m_dielectric != INDEX_NONE)? dielectric_values[cell.m_dielectric] : 0.9;
-			if((ix & 1) == (iy & 1))
+			if(((ix / GetElementOrder()) & 1) == ((iy / GetElementOrder()) & 1))
 				val += 0.1;
 			cell_values[cell_index] = val;
 		}
@@ -1074,6 +1670,17 @@ void GridMesh2D::GridRefine2(std::vector<real_t> &result, real_t x1, real_t x2,
 
 }
 
+void GridMesh2D::GridSubdivide(std::vector<real_t> &grid) {
+	assert(grid.size() >= 2);
+	std::vector<real_t> result(grid.size() * 2 - 1);
+	for(size_t i = 0; i < grid.size() - 1; ++i) {
+		result[i * 2] = grid[i];
+		result[i * 2 + 1] = (grid[i] + grid[i + 1]) * 0.5;
+	}
+	result.back() = grid.back();
+	grid = std::move(result);
+}
+
 void GridMesh2D::GridMidpoints(std::vector<real_t> &result, const std::vector<real_t> &grid) {
 	assert(grid.size() >= 2);
 	result.clear();
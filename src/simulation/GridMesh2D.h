@@ -21,21 +21,18 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "Basics.h"
+#include "ChainSolver.h"
 #include "Eigen.h"
 #include "EigenSparse.h"
 #include "GenericMesh.h"
 #include "MaterialDatabase.h"
+#include "PortSolver.h"
 #include "SparseMatrix.h"
 #include "Vector.h"
 
 class GridMesh2D : public GenericMesh {
 
 public:
-	enum PortType {
-		PORTTYPE_FIXED,
-		PORTTYPE_FLOATING,
-	};
-
 	static constexpr real_t DEFAULT_GRID_INC = 0.15;
 	static constexpr real_t DEFAULT_GRID_STEP = 0.005;
 
@@ -64,19 +61,17 @@ private:
 		inline GridLine(real_t value, real_t step) : m_value(value), m_step(step) {}
 		inline bool operator<(const GridLine &other) const { return m_value < other.m_value; }
 	};
+	// nodes, edges and cells use compact indices to save memory bandwidth (the constructors set them to INDEX_NONE)
 	struct Node {
-		size_t m_port;
-		size_t m_var, m_var_surf;
-		inline Node() : m_port(INDEX_NONE), m_var(INDEX_NONE), m_var_surf(INDEX_NONE) {}
+		CompactIndex m_port;
+		CompactIndex m_var, m_var_surf;
 	};
 	struct Edge {
-		size_t m_conductor;
-		inline Edge() : m_conductor(INDEX_NONE) {}
+		CompactIndex m_conductor;
 	};
 	struct Cell {
-		size_t m_conductor;
-		size_t m_dielectric;
-		inline Cell() : m_conductor(INDEX_NONE), m_dielectric(INDEX_NONE) {}
+		CompactIndex m_conductor;
+		CompactIndex m_dielectric;
 	};
 
 private:
@@ -86,6 +81,9 @@ private:
 	Box2D m_pml_box, m_pml_step;
 	real_t m_pml_attenuation;
 
+	bool m_open_boundary;
+	Vector2D m_open_boundary_origin, m_open_boundary_dipole;
+
 	std::vector<Port> m_ports;
 	std::vector<Conductor> m_conductors;
 	std::vector<Dielectric> m_dielectrics;
@@ -94,16 +92,27 @@ private:
 	std::vector<Node> m_nodes;
 	std::vector<Edge> m_edges_h, m_edges_v;
 	std::vector<Cell> m_cells;
+	std::vector<CompactIndex> m_cell_order;
 	size_t m_vars_free, m_vars_fixed, m_vars_surf;
+	size_t m_port_reference;
 
+	MaterialPropertyTable m_material_table;
 	std::vector<MaterialConductorProperties> m_conductor_properties;
 	std::vector<MaterialDielectricProperties> m_dielectric_properties;
+	real_t m_homogeneous_permittivity;
 	Eigen::VectorXr m_vector_dc_resistances;
-	Eigen::SparseMatrix<complex_t> m_matrix_epot[3], m_matrix_mpot[3];
-	Eigen::SparseMatrix<real_t> m_matrix_surf_resid[2], m_matrix_surf_curr, m_matrix_surf_loss;
-
-	Eigen::SimplicialLDLT<Eigen::SparseMatrix<real_t>, Eigen::Lower> m_eigen_chol, m_eigen_chol_surf;
-	Eigen::MatrixXr m_eigen_rhs, m_eigen_rhs_surf;
+	EigenSparseSplit m_matrix_epot[3], m_matrix_mpot[3];
+	Eigen::SparseMatrix<real_t> m_matrix_surf_resid[2], m_matrix_surf_loss;
+
+	// The surface current and surface loss matrices only depend on the geometry, so they are built and factorized only
+	// once. The loss matrix is split by conductor material and scaled by the surface resistivity at each frequency.
+	std::vector<Eigen::SparseMatrix<real_t>> m_matrix_surf_loss_parts;
+	std::vector<size_t> m_surf_loss_part_conductors;
+	ChainSolver m_surf_solver;
+
+	// The free variables are numbered in nested dissection order (see OrderNodes), which is already a good fill-reducing
+	// ordering, so the port solver uses it directly.
+	PortSolver m_port_solver;
 	Eigen::MatrixXr m_eigen_solution_epot, m_eigen_solution_mpot, m_eigen_solution_surf;
 
 public:
@@ -116,6 +125,7 @@ public:
 
 	void SetPML(const Box2D &box, real_t step, real_t attenuation);
 	void SetPML(const Box2D &box, const Box2D &step, real_t attenuation);
+	void SetOpenBoundary(const Vector2D &origin, const Vector2D &dipole);
 
 	size_t AddPort(PortType type, bool infinite_area);
 	void AddConductor(const Box2D &box, real_t step, const MaterialConductor *material, size_t port);
@@ -126,10 +136,13 @@ public:
 	virtual Box2D GetWorldBox2D() override;
 	virtual Box2D GetWorldFocus2D() override;
 	virtual void GetImage2D(std::vector<real_t> &image_value, std::vector<Vector2D> &image_gradient, size_t width, size_t height, const Box2D &view, MeshImageType type, size_t mode) override;
+	virtual size_t GetMemoryUsage() override;
 
 protected:
 	virtual void DoInitialize() override;
+	virtual void DoPrepareFrequencies(const std::vector<real_t> &frequencies) override;
 	virtual void DoSolve() override;
+	virtual void DoSetModes() override;
 	virtual void DoCleanup() override;
 	virtual size_t GetFixedVariableCount() override;
 
@@ -137,8 +150,18 @@ private:
 	void InitGrid();
 	void InitCells();
 	void InitVariables();
+	void ClearVariables();
+	void ReduceDetail(real_t factor);
+	void OrderNodes(std::vector<size_t> &node_order, size_t ix1, size_t iy1, size_t ix2, size_t iy2);
 	void BuildMatrices();
-	void SolveMatrices();
+	void BuildSurfaceMatrices();
+
+	size_t PredictFactorNonZeros();
+	size_t PredictMemoryUsage(size_t factors);
+	size_t GetTableMemoryUsage();
+	size_t GetMatrixMemoryUsage();
+	size_t GetSolverMemoryUsage();
+	size_t GetSolutionMemoryUsage();
 
 	void GetCellValues(std::vector<real_t> &cell_values, size_t mode, MeshImageType type);
 	void GetNodeValues(std::vector<real_t> &node_values, size_t mode, MeshImageType type);
@@ -158,6 +181,7 @@ private:
 	static void GridAddBox(std::vector<GridLine> &grid_x, std::vector<GridLine> &grid_y, const Box2D &box, const Box2D &step);
 	static void GridRefine(std::vector<real_t> &m_cholmod_result, std::vector<GridLine> &grid, real_t inc, real_t epsilon);
 	static void GridRefine2(std::vector<real_t> &m_cholmod_result, real_t x1, real_t x2, real_t step1, real_t step2, real_t inc);
+	static void GridSubdivide(std::vector<real_t> &grid);
 	static void GridMidpoints(std::vector<real_t> &m_cholmod_result, const std::vector<real_t> &grid);
 	static void PrepareNodeImage(std::vector<size_t> &index, std::vector<real_t> &frac, const std::vector<real_t> &grid, real_t value1, real_t value2, size_t size);
 	static void PrepareCellImage(std::vector<size_t> &index, std::vector<real_t> &frac, const std::vector<real_t> &grid, const std::vector<real_t> &midpoints, real_t value1, real_t value2, size_t size);
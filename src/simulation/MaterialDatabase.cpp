@@ -22,10 +22,21 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "EnumTranslator.h"
 #include "Json.h"
+#include "MurmurHash.h"
 #include "NaturalSort.h"
 #include "StringRegistry.h"
 #include "VDataReader.h"
 
+#include <algorithm>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 template<typename T>
 struct NaturalNameCompare {
 	inline bool operator()(const T &a, const T &b) const {
@@ -36,11 +47,155 @@ struct NaturalNameCompare {
 	}
 };
 
+// binary file format, all values are in native byte order
+const char MATERIAL_BINARY_MAGIC[8] = {'T', 'L', 'M', 'A', 'T', 'D', 'B', '\0'};
+const uint32_t MATERIAL_BINARY_VERSION = 1;
+const uint32_t MATERIAL_BINARY_BYTE_ORDER = 0x01020304;
+
+struct MaterialBinaryHeader {
+	char m_magic[8];
+	uint32_t m_version, m_byte_order;
+	uint32_t m_conductor_count, m_dielectric_count;
+	uint32_t m_conductor_hash_size, m_dielectric_hash_size;
+	uint64_t m_conductor_offset, m_dielectric_offset;
+	uint64_t m_conductor_hash_offset, m_dielectric_hash_offset;
+	uint64_t m_string_offset, m_string_size;
+};
+
+struct MaterialBinaryConductor {
+	uint32_t m_name_offset, m_name_size;
+	double m_conductivity;
+	double m_permeability;
+	double m_permeability_unity_frequency;
+};
+
+struct MaterialBinaryDielectric {
+	uint32_t m_name_offset, m_name_size;
+	double m_permittivity_x, m_permittivity_y;
+	double m_loss_tangent_x, m_loss_tangent_y;
+	double m_test_frequency;
+};
+
+inline size_t MaterialHash(const std::string &name) {
+	return MurmurHash::HashFinish(MurmurHash::HashData(0x4d617473, name.data(), name.size()));
+}
+
+// Builds an open addressing hash table (linear probing) with a load factor of at most 1/2.
+template<typename T>
+static void MaterialBuildHash(std::vector<uint32_t> &hash, const std::vector<T> &materials) {
+	size_t size = 16;
+	while(size < materials.size() * 2) {
+		size *= 2;
+	}
+	hash.clear();
+	hash.resize(size, 0);
+	for(size_t i = 0; i < materials.size(); ++i) {
+		for(size_t j = MaterialHash(materials[i].m_name); ; ++j) {
+			uint32_t &slot = hash[j & (size - 1)];
+			if(slot == 0) {
+				slot = (uint32_t) (i + 1);
+				break;
+			}
+		}
+	}
+}
+
+template<typename T>
+static const T* MaterialFindHash(const std::vector<uint32_t> &hash, const std::vector<T> &materials, const std::string &name) {
+	if(hash.empty())
+		return NULL;
+	for(size_t j = MaterialHash(name); ; ++j) {
+		uint32_t slot = hash[j & (hash.size() - 1)];
+		if(slot == 0)
+			return NULL;
+		if(materials[slot - 1].m_name == name)
+			return &materials[slot - 1];
+	}
+}
+
+// A read-only view of a file. Uses mmap where available.
+class MaterialFileView {
+
+private:
+	const char *m_data;
+	size_t m_size;
+	std::vector<char> m_buffer;
+
+public:
+	MaterialFileView(const std::string &filename) {
+#ifndef _WIN32
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw std::runtime_error(MakeString("Could not open file '", filename, "'."));
+		struct stat st;
+		if(fstat(fd, &st) < 0) {
+			close(fd);
+			throw std::runtime_error(MakeString("Could not read file '", filename, "'."));
+		}
+		m_size = (size_t) st.st_size;
+		if(m_size == 0) {
+			m_data = NULL;
+		} else {
+			void *ptr = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(ptr == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error(MakeString("Could not map file '", filename, "'."));
+			}
+			m_data = (const char*) ptr;
+		}
+		close(fd);
+#else
+		std::ifstream stream(filename, std::ios_base::in | std::ios_base::binary);
+		if(!stream.good())
+			throw std::runtime_error(MakeString("Could not open file '", filename, "'."));
+		m_buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+		m_data = m_buffer.data();
+		m_size = m_buffer.size();
+#endif
+	}
+
+	~MaterialFileView() {
+#ifndef _WIN32
+		if(m_data != NULL)
+			munmap((void*) m_data, m_size);
+#endif
+	}
+
+	// noncopyable
+	MaterialFileView(const MaterialFileView&) = delete;
+	MaterialFileView& operator=(const MaterialFileView&) = delete;
+
+	inline const char* GetData() { return m_data; }
+	inline size_t GetSize() { return m_size; }
+
+	// Returns a pointer to an array in the file, after checking that it is within bounds.
+	template<typename T>
+	const T* GetArray(uint64_t offset, uint64_t count) {
+		if(offset > m_size || count > (m_size - offset) / sizeof(T) || offset % alignof(T) != 0)
+			throw std::runtime_error("Invalid binary material database: offset out of range.");
+		return (const T*) (m_data + offset);
+	}
+
+};
+
 MaterialDatabase::MaterialDatabase() {
-	// nothing
+	m_finished = false;
 }
 
 void MaterialDatabase::LoadFile(const std::string &filename) {
+	char magic[sizeof(MATERIAL_BINARY_MAGIC)] = {};
+	{
+		std::ifstream stream(filename, std::ios_base::in | std::ios_base::binary);
+		stream.read(magic, sizeof(magic));
+	}
+	if(std::equal(magic, magic + sizeof(magic), MATERIAL_BINARY_MAGIC)) {
+		LoadBinaryFile(filename);
+	} else {
+		LoadJsonFile(filename);
+	}
+}
+
+void MaterialDatabase::LoadJsonFile(const std::string &filename) {
 
 	VData default_permeability = Json::FromString("1.0");
 	VData default_permeability_unity_frequency = Json::FromString("1.0e9");
@@ -73,38 +228,182 @@ void MaterialDatabase::LoadFile(const std::string &filename) {
 		});
 	}
 
+	m_finished = false;
+
+}
+
+void MaterialDatabase::LoadBinaryFile(const std::string &filename) {
+	MaterialFileView view(filename);
+
+	// check header
+	const MaterialBinaryHeader *header = view.GetArray<MaterialBinaryHeader>(0, 1);
+	if(!std::equal(header->m_magic, header->m_magic + sizeof(MATERIAL_BINARY_MAGIC), MATERIAL_BINARY_MAGIC))
+		throw std::runtime_error(MakeString("File '", filename, "' is not a binary material database."));
+	if(header->m_byte_order != MATERIAL_BINARY_BYTE_ORDER)
+		throw std::runtime_error(MakeString("Binary material database '", filename, "' has the wrong byte order."));
+	if(header->m_version != MATERIAL_BINARY_VERSION)
+		throw std::runtime_error(MakeString("Binary material database '", filename, "' has unsupported version ", header->m_version, "."));
+	const MaterialBinaryConductor *conductors = view.GetArray<MaterialBinaryConductor>(header->m_conductor_offset, header->m_conductor_count);
+	const MaterialBinaryDielectric *dielectrics = view.GetArray<MaterialBinaryDielectric>(header->m_dielectric_offset, header->m_dielectric_count);
+	const uint32_t *conductor_hash = view.GetArray<uint32_t>(header->m_conductor_hash_offset, header->m_conductor_hash_size);
+	const uint32_t *dielectric_hash = view.GetArray<uint32_t>(header->m_dielectric_hash_offset, header->m_dielectric_hash_size);
+	const char *strings = view.GetArray<char>(header->m_string_offset, header->m_string_size);
+	auto get_string = [&](uint32_t offset, uint32_t size) {
+		if(offset > header->m_string_size || size > header->m_string_size - offset)
+			throw std::runtime_error("Invalid binary material database: string out of range.");
+		return std::string(strings + offset, size);
+	};
+
+	// the hash tables can only be reused if this is the only file
+	bool reuse_hash = (m_conductors.empty() && m_dielectrics.empty());
+
+	// load materials
+	m_conductors.reserve(m_conductors.size() + header->m_conductor_count);
+	for(size_t i = 0; i < header->m_conductor_count; ++i) {
+		const MaterialBinaryConductor &conductor = conductors[i];
+		m_conductors.push_back(MaterialConductor{
+			get_string(conductor.m_name_offset, conductor.m_name_size),
+			conductor.m_conductivity,
+			conductor.m_permeability,
+			conductor.m_permeability_unity_frequency,
+		});
+	}
+	m_dielectrics.reserve(m_dielectrics.size() + header->m_dielectric_count);
+	for(size_t i = 0; i < header->m_dielectric_count; ++i) {
+		const MaterialBinaryDielectric &dielectric = dielectrics[i];
+		m_dielectrics.push_back(MaterialDielectric{
+			get_string(dielectric.m_name_offset, dielectric.m_name_size),
+			dielectric.m_permittivity_x,
+			dielectric.m_permittivity_y,
+			dielectric.m_loss_tangent_x,
+			dielectric.m_loss_tangent_y,
+			dielectric.m_test_frequency,
+		});
+	}
+
+	// load hash tables
+	if(reuse_hash) {
+		// The lookup stops at the first empty slot, so a table without empty slots would make it loop forever. A valid
+		// table has one slot per material, which leaves at least half of the slots empty.
+		auto valid_hash = [](const uint32_t *hash, size_t size, size_t count) {
+			if(size < 2 * count || (size & (size - 1)) != 0)
+				return false;
+			if(!std::all_of(hash, hash + size, [&](uint32_t slot) { return slot <= count; }))
+				return false;
+			return (size_t) std::count_if(hash, hash + size, [](uint32_t slot) { return slot != 0; }) <= count;
+		};
+		if(!valid_hash(conductor_hash, header->m_conductor_hash_size, header->m_conductor_count) ||
+				!valid_hash(dielectric_hash, header->m_dielectric_hash_size, header->m_dielectric_count))
+			throw std::runtime_error("Invalid binary material database: corrupt hash table.");
+		m_conductor_hash.assign(conductor_hash, conductor_hash + header->m_conductor_hash_size);
+		m_dielectric_hash.assign(dielectric_hash, dielectric_hash + header->m_dielectric_hash_size);
+		m_finished = true;
+	} else {
+		m_finished = false;
+	}
+
+}
+
+void MaterialDatabase::SaveBinaryFile(const std::string &filename) {
+	Finish();
+
+	// build the file in memory
+	MaterialBinaryHeader header = {};
+	std::copy_n(MATERIAL_BINARY_MAGIC, sizeof(MATERIAL_BINARY_MAGIC), header.m_magic);
+	header.m_version = MATERIAL_BINARY_VERSION;
+	header.m_byte_order = MATERIAL_BINARY_BYTE_ORDER;
+	header.m_conductor_count = (uint32_t) m_conductors.size();
+	header.m_dielectric_count = (uint32_t) m_dielectrics.size();
+	header.m_conductor_hash_size = (uint32_t) m_conductor_hash.size();
+	header.m_dielectric_hash_size = (uint32_t) m_dielectric_hash.size();
+	std::string strings;
+	std::vector<MaterialBinaryConductor> conductors(m_conductors.size());
+	for(size_t i = 0; i < m_conductors.size(); ++i) {
+		const MaterialConductor &conductor = m_conductors[i];
+		conductors[i] = MaterialBinaryConductor{
+			(uint32_t) strings.size(), (uint32_t) conductor.m_name.size(),
+			conductor.m_conductivity,
+			conductor.m_permeability,
+			conductor.m_permeability_unity_frequency,
+		};
+		strings += conductor.m_name;
+	}
+	std::vector<MaterialBinaryDielectric> dielectrics(m_dielectrics.size());
+	for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+		const MaterialDielectric &dielectric = m_dielectrics[i];
+		dielectrics[i] = MaterialBinaryDielectric{
+			(uint32_t) strings.size(), (uint32_t) dielectric.m_name.size(),
+			dielectric.m_permittivity_x,
+			dielectric.m_permittivity_y,
+			dielectric.m_loss_tangent_x,
+			dielectric.m_loss_tangent_y,
+			dielectric.m_test_frequency,
+		};
+		strings += dielectric.m_name;
+	}
+	header.m_conductor_offset = sizeof(MaterialBinaryHeader);
+	header.m_dielectric_offset = header.m_conductor_offset + sizeof(MaterialBinaryConductor) * conductors.size();
+	header.m_conductor_hash_offset = header.m_dielectric_offset + sizeof(MaterialBinaryDielectric) * dielectrics.size();
+	header.m_dielectric_hash_offset = header.m_conductor_hash_offset + sizeof(uint32_t) * m_conductor_hash.size();
+	header.m_string_offset = header.m_dielectric_hash_offset + sizeof(uint32_t) * m_dielectric_hash.size();
+	header.m_string_size = strings.size();
+
+	// write the file
+	std::ofstream stream(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+	if(stream.fail())
+		throw std::runtime_error(MakeString("Could not open file '", filename, "' for writing."));
+	stream.write((const char*) &header, sizeof(header));
+	stream.write((const char*) conductors.data(), (std::streamsize) (sizeof(MaterialBinaryConductor) * conductors.size()));
+	stream.write((const char*) dielectrics.data(), (std::streamsize) (sizeof(MaterialBinaryDielectric) * dielectrics.size()));
+	stream.write((const char*) m_conductor_hash.data(), (std::streamsize) (sizeof(uint32_t) * m_conductor_hash.size()));
+	stream.write((const char*) m_dielectric_hash.data(), (std::streamsize) (sizeof(uint32_t) * m_dielectric_hash.size()));
+	stream.write(strings.data(), (std::streamsize) strings.size());
+	if(stream.fail())
+		throw std::runtime_error(MakeString("Could not write file '", filename, "'."));
+
 }
 
 void MaterialDatabase::Finish() {
+	if(m_finished)
+		return;
 	std::stable_sort(m_conductors.begin(), m_conductors.end(), NaturalNameCompare<MaterialConductor>());
 	std::stable_sort(m_dielectrics.begin(), m_dielectrics.end(), NaturalNameCompare<MaterialDielectric>());
+	MaterialBuildHash(m_conductor_hash, m_conductors);
+	MaterialBuildHash(m_dielectric_hash, m_dielectrics);
+	m_finished = true;
 }
 
-const MaterialConductor *MaterialDatabase::FindConductor(const std::string &name) {
-	auto it = std::lower_bound(m_conductors.begin(), m_conductors.end(), name, NaturalNameCompare<MaterialConductor>());
-	if(it == m_conductors.end() || it->m_name != name)
-		return NULL;
-	return &(*it);
+const MaterialConductor *MaterialDatabase::FindConductor(const std::string &name) const {
+	return MaterialFindHash(m_conductor_hash, m_conductors, name);
 }
 
-const MaterialDielectric *MaterialDatabase::FindDielectric(const std::string &name) {
-	auto it = std::lower_bound(m_dielectrics.begin(), m_dielectrics.end(), name, NaturalNameCompare<MaterialDielectric>());
-	if(it == m_dielectrics.end() || it->m_name != name)
-		return NULL;
-	return &(*it);
+const MaterialDielectric *MaterialDatabase::FindDielectric(const std::string &name) const {
+	return MaterialFindHash(m_dielectric_hash, m_dielectrics, name);
 }
 
-complex_t DjordjevicSarkar(real_t permittivity, real_t loss_tangent, real_t reference_frequency, real_t target_frequency) {
-	// The Djordjevic-Sarkar model generates permittivity values that satisfy the Kramers-Kronig relations,
-	// which is necessary to ensure that frequency domain simulations will produce causal results.
-	// The parameters omega_min and omega_max exist purely for numerical reasons, they have no physical meaning.
-	real_t omega_min = 2.0 * M_PI * 1.0e6;
-	real_t omega_max = 2.0 * M_PI * 1.0e12;
-	real_t reference_omega = 2.0 * M_PI * reference_frequency;
+// The Djordjevic-Sarkar model generates permittivity values that satisfy the Kramers-Kronig relations,
+// which is necessary to ensure that frequency domain simulations will produce causal results.
+// The parameters omega_min and omega_max exist purely for numerical reasons, they have no physical meaning.
+// The model is split into a material-independent part (the logarithm) and a material-dependent part (the coefficients),
+// so the logarithm can be reused for many materials.
+constexpr real_t DJORDJEVIC_SARKAR_OMEGA_MIN = 2.0 * M_PI * 1.0e6;
+constexpr real_t DJORDJEVIC_SARKAR_OMEGA_MAX = 2.0 * M_PI * 1.0e12;
+
+inline complex_t DjordjevicSarkarLog(real_t target_frequency) {
 	real_t target_omega = 2.0 * M_PI * target_frequency;
-	real_t permittivity_slope = permittivity * loss_tangent * 2.0 / M_PI;
-	real_t permittivity_inf = permittivity - permittivity_slope * log(omega_max / reference_omega);
-	return  permittivity_inf + permittivity_slope * log(complex_t(omega_max, target_omega) / complex_t(omega_min, target_omega));
+	return log(complex_t(DJORDJEVIC_SARKAR_OMEGA_MAX, target_omega) / complex_t(DJORDJEVIC_SARKAR_OMEGA_MIN, target_omega));
+}
+
+inline void DjordjevicSarkarCoefficients(real_t &permittivity_inf, real_t &permittivity_slope, real_t permittivity, real_t loss_tangent, real_t reference_frequency) {
+	real_t reference_omega = 2.0 * M_PI * reference_frequency;
+	permittivity_slope = permittivity * loss_tangent * 2.0 / M_PI;
+	permittivity_inf = permittivity - permittivity_slope * log(DJORDJEVIC_SARKAR_OMEGA_MAX / reference_omega);
+}
+
+complex_t DjordjevicSarkar(real_t permittivity, real_t loss_tangent, real_t reference_frequency, real_t target_frequency) {
+	real_t permittivity_inf, permittivity_slope;
+	DjordjevicSarkarCoefficients(permittivity_inf, permittivity_slope, permittivity, loss_tangent, reference_frequency);
+	return permittivity_inf + permittivity_slope * DjordjevicSarkarLog(target_frequency);
 }
 
 void GetConductorProperties(MaterialConductorProperties &result, const MaterialConductor *source, real_t target_frequency) {
@@ -118,3 +417,66 @@ void GetDielectricProperties(MaterialDielectricProperties &result, const Materia
 	result.m_permittivity_x = VACUUM_PERMITTIVITY * DjordjevicSarkar(source->m_permittivity_x, source->m_loss_tangent_x, source->m_test_frequency, target_frequency);
 	result.m_permittivity_y = VACUUM_PERMITTIVITY * DjordjevicSarkar(source->m_permittivity_y, source->m_loss_tangent_y, source->m_test_frequency, target_frequency);
 }
+
+template<typename T>
+static void MapUnique(std::vector<const T*> &unique, std::vector<size_t> &map, const std::vector<const T*> &source) {
+	unique.clear();
+	map.resize(source.size());
+	for(size_t i = 0; i < source.size(); ++i) {
+		auto it = std::find(unique.begin(), unique.end(), source[i]);
+		map[i] = (size_t) (it - unique.begin());
+		if(it == unique.end())
+			unique.push_back(source[i]);
+	}
+}
+
+void MaterialPropertyTable::Build(const std::vector<real_t> &frequencies, const std::vector<const MaterialConductor*> &conductors,
+								  const std::vector<const MaterialDielectric*> &dielectrics) {
+	m_frequencies = frequencies;
+	MapUnique(m_conductors, m_conductor_map, conductors);
+	MapUnique(m_dielectrics, m_dielectric_map, dielectrics);
+
+	// conductors
+	m_conductor_properties.resize(m_frequencies.size() * m_conductors.size());
+	for(size_t i = 0; i < m_frequencies.size(); ++i) {
+		MaterialConductorProperties *row = m_conductor_properties.data() + i * m_conductors.size();
+		for(size_t j = 0; j < m_conductors.size(); ++j) {
+			::GetConductorProperties(row[j], m_conductors[j], m_frequencies[i]);
+		}
+	}
+
+	// dielectrics
+	std::vector<real_t> coefficients(m_dielectrics.size() * 4);
+	for(size_t j = 0; j < m_dielectrics.size(); ++j) {
+		const MaterialDielectric *source = m_dielectrics[j];
+		real_t *c = coefficients.data() + j * 4;
+		DjordjevicSarkarCoefficients(c[0], c[1], source->m_permittivity_x, source->m_loss_tangent_x, source->m_test_frequency);
+		DjordjevicSarkarCoefficients(c[2], c[3], source->m_permittivity_y, source->m_loss_tangent_y, source->m_test_frequency);
+	}
+	m_dielectric_properties.resize(m_frequencies.size() * m_dielectrics.size());
+	for(size_t i = 0; i < m_frequencies.size(); ++i) {
+		complex_t ds_log = DjordjevicSarkarLog(m_frequencies[i]);
+		MaterialDielectricProperties *row = m_dielectric_properties.data() + i * m_dielectrics.size();
+		for(size_t j = 0; j < m_dielectrics.size(); ++j) {
+			const real_t *c = coefficients.data() + j * 4;
+			row[j].m_permittivity_x = VACUUM_PERMITTIVITY * (c[0] + c[1] * ds_log);
+			row[j].m_permittivity_y = VACUUM_PERMITTIVITY * (c[2] + c[3] * ds_log);
+		}
+	}
+
+}
+
+void MaterialPropertyTable::Clear() {
+	m_frequencies.clear();
+	m_conductors.clear();
+	m_dielectrics.clear();
+	m_conductor_map.clear();
+	m_dielectric_map.clear();
+	m_conductor_properties.clear();
+	m_dielectric_properties.clear();
+}
+
+size_t MaterialPropertyTable::FindFrequency(real_t frequency) const {
+	auto it = std::find(m_frequencies.begin(), m_frequencies.end(), frequency);
+	return (it == m_frequencies.end())? INDEX_NONE : (size_t) (it - m_frequencies.begin());
+}
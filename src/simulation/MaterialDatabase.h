@@ -50,20 +50,31 @@ struct MaterialDielectricProperties {
 	std::complex<real_t> m_permittivity_x, m_permittivity_y;
 };
 
+// The material database can be loaded from JSON files (the format used by 'materials.json') or from a compiled binary
+// file created with SaveBinaryFile. Binary files contain the materials in sorted order as well as hash tables for name
+// lookup, so they can be loaded without parsing, sorting or hashing. LoadFile detects the format automatically. The
+// binary file is mapped into memory, but the materials are still copied into MaterialConductor and MaterialDielectric
+// (the simulations keep pointers to these), so lookups don't use the mapping. The copy is a single pass over the
+// records, which is cheap compared to parsing.
 class MaterialDatabase {
 
 private:
 	std::vector<MaterialConductor> m_conductors;
 	std::vector<MaterialDielectric> m_dielectrics;
+	std::vector<uint32_t> m_conductor_hash, m_dielectric_hash; // index + 1, or 0 if empty
+	bool m_finished;
 
 public:
 	MaterialDatabase();
 
 	void LoadFile(const std::string &filename);
+	void LoadJsonFile(const std::string &filename);
+	void LoadBinaryFile(const std::string &filename);
+	void SaveBinaryFile(const std::string &filename);
 	void Finish();
 
-	const MaterialConductor* FindConductor(const std::string &name);
-	const MaterialDielectric* FindDielectric(const std::string &name);
+	const MaterialConductor* FindConductor(const std::string &name) const;
+	const MaterialDielectric* FindDielectric(const std::string &name) const;
 
 public:
 	inline const std::vector<MaterialConductor>& GetConductors() { return m_conductors; }
@@ -71,5 +82,40 @@ public:
 
 };
 
+// Evaluates the properties of a set of materials for all frequencies of a sweep in one pass. The frequency-dependent part
+// of the Djordjevic-Sarkar model (a complex logarithm) doesn't depend on the material, so it is only calculated once per
+// frequency. Materials that are used more than once are only evaluated once. The results are identical to those of
+// GetConductorProperties and GetDielectricProperties.
+class MaterialPropertyTable {
+
+private:
+	std::vector<real_t> m_frequencies;
+	std::vector<const MaterialConductor*> m_conductors;
+	std::vector<const MaterialDielectric*> m_dielectrics;
+	std::vector<size_t> m_conductor_map, m_dielectric_map;
+	std::vector<MaterialConductorProperties> m_conductor_properties; // [frequency][conductor]
+	std::vector<MaterialDielectricProperties> m_dielectric_properties; // [frequency][dielectric]
+
+public:
+	void Build(const std::vector<real_t> &frequencies, const std::vector<const MaterialConductor*> &conductors,
+			   const std::vector<const MaterialDielectric*> &dielectrics);
+	void Clear();
+
+	// Returns the index of a frequency in the table, or INDEX_NONE if the table doesn't contain the frequency.
+	size_t FindFrequency(real_t frequency) const;
+
+public:
+	// The conductor and dielectric indices are the indices in the lists that were passed to Build.
+	inline const MaterialConductorProperties& GetConductorProperties(size_t frequency, size_t conductor) const {
+		assert(frequency < m_frequencies.size() && conductor < m_conductor_map.size());
+		return m_conductor_properties[frequency * m_conductors.size() + m_conductor_map[conductor]];
+	}
+	inline const MaterialDielectricProperties& GetDielectricProperties(size_t frequency, size_t dielectric) const {
+		assert(frequency < m_frequencies.size() && dielectric < m_dielectric_map.size());
+		return m_dielectric_properties[frequency * m_dielectrics.size() + m_dielectric_map[dielectric]];
+	}
+
+};
+
 void GetConductorProperties(MaterialConductorProperties &result, const MaterialConductor *source, real_t target_frequency);
 void GetDielectricProperties(MaterialDielectricProperties &result, const MaterialDielectric *source, real_t target_frequency);
@@ -0,0 +1,356 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PortSolver.h"
+
+#include "MaterialDatabase.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
+#ifndef SIMULATION_VERBOSE
+#define SIMULATION_VERBOSE 1
+#endif
+
+// With mixed precision, the solution is refined until the relative residual is close to what a double-precision
+// factorization achieves (about 1e-15). The refinement is abandoned if the residual doesn't drop fast enough.
+constexpr size_t MIXED_PRECISION_MAX_STEPS = 10;
+constexpr real_t MIXED_PRECISION_TOLERANCE = 1e-12, MIXED_PRECISION_MIN_REDUCTION = 0.1;
+
+// When a factorization is reused as a preconditioner, the solution is iterated to the same accuracy as the mixed
+// precision refinement. If it takes more than a few iterations, the matrix is factorized again for the next frequency.
+// If it doesn't converge at all, the matrix is factorized again right away.
+constexpr size_t FACTOR_REUSE_MAX_ITERATIONS = 20, FACTOR_REUSE_REFACTORIZE_ITERATIONS = 6;
+constexpr real_t FACTOR_REUSE_TOLERANCE = 1e-12;
+
+// The fill-in of the factorization decays exponentially away from the separators, so in single precision it produces
+// lots of denormal numbers, which are extremely slow on x86. Flushing them to zero is harmless because the solution is
+// refined in double precision anyway. This only changes the floating point mode of the current thread, and restores it
+// afterwards.
+class FlushDenormals {
+#if defined(__SSE2__)
+private:
+	unsigned int m_csr;
+public:
+	inline FlushDenormals() { m_csr = _mm_getcsr(); _mm_setcsr(m_csr | 0x8040); } // flush-to-zero and denormals-are-zero
+	inline ~FlushDenormals() { _mm_setcsr(m_csr); }
+#endif
+};
+
+PortSolver::PortSolver() {
+	m_mixed_precision = false;
+	m_factor_reuse = false;
+	m_refactorize[0] = false;
+	m_refactorize[1] = false;
+	m_single_precision_failed = false;
+	m_solver_memory = 0;
+	m_factorizations = 0;
+	m_iterations = 0;
+	m_port_reference = INDEX_NONE;
+}
+
+void PortSolver::SetMixedPrecision(bool mixed_precision) {
+	m_mixed_precision = mixed_precision;
+}
+
+void PortSolver::SetFactorReuse(bool factor_reuse) {
+	m_factor_reuse = factor_reuse;
+	if(!m_factor_reuse) {
+		m_eigen_chol[1].reset();
+		m_solution_history[0].resize(0, 0);
+		m_solution_history[1].resize(0, 0);
+		UpdateSolverMemoryUsage();
+	}
+}
+
+void PortSolver::Solve(const EigenSparseSplit (&matrix_epot)[3], const EigenSparseSplit (&matrix_mpot)[3], real_t homogeneous_permittivity,
+					   const Eigen::SparseMatrix<real_t> (&matrix_surf_resid)[2], const Eigen::SparseMatrix<real_t> &matrix_surf_loss,
+					   const ChainSolver &surf_solver, const Eigen::VectorXr &vector_dc_resistances, size_t port_reference,
+					   bool losses, bool surface, MeshPortMatrices &port_matrices) {
+
+	// The mesh is solved in the port basis, with one excitation for each fixed port except the reference port. Raising
+	// all potentials by the same amount doesn't change the fields, so the response to any mode can be derived from this.
+	// An open boundary breaks this, because it assumes that the potential is zero far away from the conductors. In that
+	// case there is no reference port (INDEX_NONE) and all fixed ports are excited.
+	Eigen::Index num_fixed = matrix_epot[2].Real().rows();
+	Eigen::Index ref = (port_reference == INDEX_NONE)? -1 : (Eigen::Index) port_reference;
+	Eigen::Index num_excitations = (ref == -1)? num_fixed : num_fixed - 1;
+	Eigen::MatrixXr excitation = Eigen::MatrixXr::Zero(num_fixed, num_excitations);
+	for(Eigen::Index i = 0, j = 0; i < num_fixed; ++i) {
+		if(i != ref)
+			excitation(i, j++) = 1.0;
+	}
+	m_port_reference = port_reference;
+
+	// solve electric potential matrix
+	m_eigen_rhs = -matrix_epot[1].Real().transpose() * excitation;
+	SolvePotentialMatrix(0, matrix_epot[0].Real(), m_eigen_rhs, m_port_solution_epot);
+
+	if(homogeneous_permittivity == 0.0) {
+
+		// solve magnetic potential matrix
+		m_eigen_rhs = -matrix_mpot[1].Real().transpose() * excitation;
+		SolvePotentialMatrix(1, matrix_mpot[0].Real(), m_eigen_rhs, m_port_solution_mpot);
+
+	} else {
+
+		// homogeneous dielectric, reuse the electric potential solution
+		m_port_solution_mpot = m_port_solution_epot;
+
+	}
+
+	// calculate residuals and dielectric losses
+	Eigen::MatrixXr residual_epot, residual_mpot, electric_loss_matrix, magnetic_loss_matrix;
+	PotentialResidualAndLoss(matrix_epot, m_port_solution_epot, excitation, residual_epot, (losses)? &electric_loss_matrix : NULL);
+	if(homogeneous_permittivity == 0.0) {
+		PotentialResidualAndLoss(matrix_mpot, m_port_solution_mpot, excitation, residual_mpot, (losses)? &magnetic_loss_matrix : NULL);
+	} else {
+		residual_mpot = residual_epot / (VACUUM_PERMEABILITY * homogeneous_permittivity);
+		magnetic_loss_matrix = Eigen::MatrixXr::Zero(num_excitations, num_excitations); // no magnetic losses without PML
+	}
+	Eigen::MatrixXr charge_matrix = excitation.transpose() * residual_epot;
+	Eigen::MatrixXr current_matrix = excitation.transpose() * residual_mpot;
+
+	// calculate surface currents
+	if(surface) {
+		m_eigen_rhs_surf = matrix_surf_resid[0] * m_port_solution_mpot + matrix_surf_resid[1] * excitation;
+		surf_solver.Solve(m_eigen_rhs_surf, m_port_solution_surf);
+	} else {
+		m_port_solution_surf.resize(0, 0);
+	}
+
+	// expand to all fixed ports, the row and column of the reference port are derived from the others
+	m_port_reduction = excitation.transpose();
+	if(ref != -1)
+		m_port_reduction.col(ref).setConstant(-1.0);
+	port_matrices.m_charge = m_port_reduction.transpose() * charge_matrix * m_port_reduction;
+	port_matrices.m_current = m_port_reduction.transpose() * current_matrix * m_port_reduction;
+
+	// the losses are optional
+	if(!losses) {
+		port_matrices.m_electric_loss.resize(0, 0);
+		port_matrices.m_magnetic_loss.resize(0, 0);
+		port_matrices.m_surface_loss.resize(0, 0);
+		port_matrices.m_dc_loss.resize(0, 0);
+		return;
+	}
+
+	// calculate surface losses
+	Eigen::MatrixXr surface_loss_matrix = SparseQuadraticForm(matrix_surf_loss, Eigen::MatrixXr(m_port_solution_surf.transpose()));
+
+	// calculate DC losses
+	Eigen::MatrixXr dc_loss_matrix = residual_mpot.transpose() * vector_dc_resistances.asDiagonal() * residual_mpot;
+
+	port_matrices.m_electric_loss = m_port_reduction.transpose() * electric_loss_matrix * m_port_reduction;
+	port_matrices.m_magnetic_loss = m_port_reduction.transpose() * magnetic_loss_matrix * m_port_reduction;
+	port_matrices.m_surface_loss = m_port_reduction.transpose() * surface_loss_matrix * m_port_reduction;
+	port_matrices.m_dc_loss = m_port_reduction.transpose() * dc_loss_matrix * m_port_reduction;
+
+}
+
+void PortSolver::GetModeSolutions(const Eigen::MatrixXr &modes, Eigen::MatrixXr &solution_epot, Eigen::MatrixXr &solution_mpot,
+								  Eigen::MatrixXr &solution_surf) const {
+	Eigen::MatrixXr reduced_modes = m_port_reduction * modes;
+	solution_epot = m_port_solution_epot * reduced_modes;
+	solution_mpot = m_port_solution_mpot * reduced_modes;
+	solution_surf = m_port_solution_surf * reduced_modes;
+
+	// the reference port was not excited, the modes raise all potentials by its potential
+	if(m_port_reference != INDEX_NONE) {
+		Eigen::RowVectorXr offset = modes.row((Eigen::Index) m_port_reference);
+		solution_epot.rowwise() += offset;
+		solution_mpot.rowwise() += offset;
+	}
+}
+
+void PortSolver::Clear() {
+	m_eigen_chol[0].reset();
+	m_eigen_chol[1].reset();
+	m_eigen_chol_single.reset();
+	m_refactorize[0] = false;
+	m_refactorize[1] = false;
+	m_solution_history[0].resize(0, 0);
+	m_solution_history[1].resize(0, 0);
+	m_solver_memory = 0;
+	m_eigen_rhs.resize(0, 0);
+	m_eigen_rhs_surf.resize(0, 0);
+}
+
+size_t PortSolver::GetSolverMemoryUsage() const {
+	return m_solver_memory;
+}
+
+size_t PortSolver::GetSolutionMemoryUsage() const {
+	const Eigen::MatrixXr *matrices[] = {
+		&m_eigen_rhs, &m_eigen_rhs_surf,
+		&m_port_solution_epot, &m_port_solution_mpot, &m_port_solution_surf,
+		&m_solution_history[0], &m_solution_history[1],
+	};
+	size_t usage = 0;
+	for(const Eigen::MatrixXr *matrix : matrices) {
+		usage += (size_t) matrix->size() * sizeof(real_t);
+	}
+	return usage;
+}
+
+// Solves the electric (0) or magnetic (1) potential matrix. In a sweep, each potential matrix has its own factorization,
+// which is used as a preconditioner for later frequencies. Otherwise both potential matrices share a factorization.
+void PortSolver::SolvePotentialMatrix(size_t potential, const Eigen::SparseMatrix<real_t> &matrix, const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result) {
+	size_t slot = (m_factor_reuse)? potential : 0;
+
+	// The result still contains the solution of the previous frequency. The iterative solver starts from the best
+	// combination of this solution and the one before it, which includes a linear extrapolation.
+	Eigen::MatrixXr basis;
+	if(m_factor_reuse && result.rows() == rhs.rows() && result.cols() == rhs.cols()) {
+		if(m_solution_history[slot].rows() == rhs.rows() && m_solution_history[slot].cols() == rhs.cols()) {
+			basis.resize(rhs.rows(), 2 * rhs.cols());
+			basis << result, m_solution_history[slot];
+		} else {
+			basis = result;
+		}
+		m_solution_history[slot] = result;
+	}
+
+	// try the factorization of an earlier frequency first
+	if(m_factor_reuse && m_eigen_chol[slot] && !m_refactorize[slot]) {
+		if(basis.cols() != 0) {
+			result = SparseGalerkinProjection(matrix, basis, rhs);
+		} else {
+			result.setZero(rhs.rows(), rhs.cols());
+		}
+		size_t iterations = SparseConjugateGradient(matrix, *m_eigen_chol[slot], rhs, result, FACTOR_REUSE_TOLERANCE, FACTOR_REUSE_MAX_ITERATIONS);
+		m_iterations += std::min(iterations, FACTOR_REUSE_MAX_ITERATIONS);
+		if(iterations <= FACTOR_REUSE_MAX_ITERATIONS) {
+			m_refactorize[slot] = (iterations > FACTOR_REUSE_REFACTORIZE_ITERATIONS);
+			return;
+		}
+	}
+
+	FactorizeMatrix(slot, matrix);
+	SolveMatrix(slot, matrix, rhs, result);
+	m_refactorize[slot] = false;
+
+}
+
+void PortSolver::FactorizeMatrix(size_t slot, const Eigen::SparseMatrix<real_t> &matrix) {
+	++m_factorizations;
+
+	// try single precision first if allowed
+	if(m_mixed_precision && !m_single_precision_failed) {
+		FlushDenormals flush_denormals;
+		Eigen::SparseMatrix<float> matrix_single = matrix.cast<float>();
+		if(!m_eigen_chol_single) { // the pattern is the same for all frequencies and both potential matrices
+			m_eigen_chol_single.reset(new DirectSolverSingle());
+			m_eigen_chol_single->analyzePattern(matrix_single);
+		}
+		m_eigen_chol_single->factorize(matrix_single);
+		if(m_eigen_chol_single->info() == Eigen::Success) {
+			UpdateSolverMemoryUsage();
+			return;
+		}
+		m_eigen_chol_single.reset();
+		m_single_precision_failed = true;
+	}
+
+	if(!m_eigen_chol[slot]) { // the pattern is the same for all frequencies and both potential matrices
+		m_eigen_chol[slot].reset(new DirectSolver());
+		m_eigen_chol[slot]->analyzePattern(matrix);
+	}
+	m_eigen_chol[slot]->factorize(matrix);
+	if(m_eigen_chol[slot]->info() != Eigen::Success)
+		throw std::runtime_error("Sparse matrix factorization failed!");
+	UpdateSolverMemoryUsage();
+
+}
+
+void PortSolver::SolveMatrix(size_t slot, const Eigen::SparseMatrix<real_t> &matrix, const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result) {
+	if(m_eigen_chol_single) {
+		if(SolveMatrixRefined(matrix, rhs, result))
+			return;
+
+		// the refinement failed, switch to double precision
+		m_eigen_chol_single.reset();
+		m_single_precision_failed = true;
+		FactorizeMatrix(slot, matrix);
+	}
+	result = m_eigen_chol[slot]->solve(rhs);
+}
+
+// Solves the matrix with the single-precision factorization, and then applies iterative refinement: the residual is
+// calculated in double precision, and the correction is solved with the single-precision factorization again. Each step
+// reduces the error by about the condition number times the single-precision epsilon, so for well-conditioned matrices
+// this converges to double-precision accuracy in a few steps. Returns false if it doesn't converge.
+bool PortSolver::SolveMatrixRefined(const Eigen::SparseMatrix<real_t> &matrix, const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result) {
+	real_t rhs_norm = rhs.norm();
+	FlushDenormals flush_denormals;
+	result = m_eigen_chol_single->solve(rhs.cast<float>()).cast<real_t>();
+	real_t previous_norm = REAL_MAX;
+	for(size_t step = 0; ; ++step) {
+		Eigen::MatrixXr residual = rhs - matrix.selfadjointView<Eigen::Lower>() * result;
+		real_t residual_norm = residual.norm();
+#if SIMULATION_VERBOSE
+		std::cerr << "PortSolver refinement: step=" << step << " residual=" << residual_norm / rhs_norm << std::endl;
+#endif
+		if(residual_norm <= rhs_norm * MIXED_PRECISION_TOLERANCE)
+			return true;
+		if(step == MIXED_PRECISION_MAX_STEPS || !(residual_norm <= previous_norm * MIXED_PRECISION_MIN_REDUCTION))
+			return false;
+		previous_norm = residual_norm;
+		result += m_eigen_chol_single->solve(residual.cast<float>()).cast<real_t>();
+	}
+}
+
+void PortSolver::UpdateSolverMemoryUsage() {
+	m_solver_memory = 0;
+	for(size_t slot = 0; slot < 2; ++slot) {
+		if(m_eigen_chol[slot])
+			m_solver_memory += EigenSparseMemoryUsage(m_eigen_chol[slot]->matrixL().nestedExpression()) + (size_t) m_eigen_chol[slot]->vectorD().size() * sizeof(real_t);
+	}
+	if(m_eigen_chol_single)
+		m_solver_memory += EigenSparseMemoryUsage(m_eigen_chol_single->matrixL().nestedExpression()) + (size_t) m_eigen_chol_single->vectorD().size() * sizeof(float);
+}
+
+size_t PortSolver::PredictFactorNonZeros(size_t size, const std::vector<size_t> &upper_outer, const std::vector<CompactIndex> &upper_inner) {
+	assert(upper_outer.size() == size + 1);
+
+	// walk up the elimination tree from each coefficient until a node that was already visited for this row
+	std::vector<size_t> parent(size), tags(size);
+	size_t nonzeros = 0;
+	for(size_t k = 0; k < size; ++k) {
+		parent[k] = INDEX_NONE;
+		tags[k] = k;
+		for(size_t q = upper_outer[k]; q < upper_outer[k + 1]; ++q) {
+			for(size_t i = upper_inner[q]; tags[i] != k; i = parent[i]) {
+				if(parent[i] == INDEX_NONE)
+					parent[i] = k;
+				++nonzeros;
+				tags[i] = k;
+			}
+		}
+	}
+	return nonzeros;
+
+}
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "Basics.h"
+#include "ChainSolver.h"
+#include "Eigen.h"
+#include "EigenSparse.h"
+#include "GenericMesh.h"
+#include "SparseMatrix.h"
+
+#include <memory>
+#include <vector>
+
+// Solves the assembled matrices of a 2D mesh (GridMesh2D or TriMesh2D) in the port basis, with one excitation for each
+// fixed port except the reference port, and calculates the port-basis charge, current and loss matrices. The meshes
+// number the free variables in a fill-reducing order, so the factorization uses that order directly.
+//
+// In a frequency sweep (see SetFactorReuse), the factorizations of both potential matrices are kept, and the potential
+// matrices of later frequencies (which are very similar) are solved iteratively with the old factorization as the
+// preconditioner. The matrices are only factorized again when the iteration count grows too large. With mixed
+// precision, the potential matrices are factorized in single precision and the solutions are refined in double
+// precision. If the refinement doesn't converge, the remaining solves use double precision.
+
+class PortSolver {
+
+private:
+	typedef Eigen::SimplicialLDLT<Eigen::SparseMatrix<real_t>, Eigen::Lower, Eigen::NaturalOrdering<int>> DirectSolver;
+	typedef Eigen::SimplicialLDLT<Eigen::SparseMatrix<float>, Eigen::Lower, Eigen::NaturalOrdering<int>> DirectSolverSingle;
+
+private:
+	bool m_mixed_precision, m_factor_reuse;
+
+	std::unique_ptr<DirectSolver> m_eigen_chol[2];
+	std::unique_ptr<DirectSolverSingle> m_eigen_chol_single;
+	bool m_refactorize[2], m_single_precision_failed;
+	Eigen::MatrixXr m_solution_history[2];
+	size_t m_solver_memory, m_factorizations, m_iterations;
+
+	Eigen::MatrixXr m_eigen_rhs, m_eigen_rhs_surf;
+	size_t m_port_reference;
+	Eigen::MatrixXr m_port_reduction, m_port_solution_epot, m_port_solution_mpot, m_port_solution_surf;
+
+public:
+	PortSolver();
+
+	// noncopyable
+	PortSolver(const PortSolver&) = delete;
+	PortSolver& operator=(const PortSolver&) = delete;
+
+	// These should be called before Solve. Factor reuse needs a second factorization, so the meshes don't combine it
+	// with mixed precision, which is used to save memory.
+	void SetMixedPrecision(bool mixed_precision);
+	void SetFactorReuse(bool factor_reuse);
+
+	// Solves the potential matrices (free, fixed-free and fixed parts, only the lower triangle is stored) and the surface
+	// current matrix (which was already factorized by the mesh). If the permittivity is homogeneous, the magnetic
+	// potential matrix is not used. The surface current is only needed for the losses and the fields. The reference port
+	// must be INDEX_NONE if the potential matrices don't have the constant potential in their null space (open boundary).
+	void Solve(const EigenSparseSplit (&matrix_epot)[3], const EigenSparseSplit (&matrix_mpot)[3], real_t homogeneous_permittivity,
+			   const Eigen::SparseMatrix<real_t> (&matrix_surf_resid)[2], const Eigen::SparseMatrix<real_t> &matrix_surf_loss,
+			   const ChainSolver &surf_solver, const Eigen::VectorXr &vector_dc_resistances, size_t port_reference,
+			   bool losses, bool surface, MeshPortMatrices &port_matrices);
+
+	// Reconstructs the solutions of the free and surface variables for the given modes (one column per mode).
+	void GetModeSolutions(const Eigen::MatrixXr &modes, Eigen::MatrixXr &solution_epot, Eigen::MatrixXr &solution_mpot,
+						  Eigen::MatrixXr &solution_surf) const;
+
+	// Frees the factorizations and everything else that is only needed during Solve. The port-basis solutions are kept
+	// for GetModeSolutions.
+	void Clear();
+
+	// Returns the memory used by the factorizations and the solutions (in bytes).
+	size_t GetSolverMemoryUsage() const;
+	size_t GetSolutionMemoryUsage() const;
+
+	inline bool IsFactorReuse() const { return m_factor_reuse; }
+	inline size_t GetFactorizationCount() const { return m_factorizations; }
+	inline size_t GetIterationCount() const { return m_iterations; }
+
+private:
+	void SolvePotentialMatrix(size_t potential, const Eigen::SparseMatrix<real_t> &matrix, const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result);
+	void FactorizeMatrix(size_t slot, const Eigen::SparseMatrix<real_t> &matrix);
+	void SolveMatrix(size_t slot, const Eigen::SparseMatrix<real_t> &matrix, const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result);
+	bool SolveMatrixRefined(const Eigen::SparseMatrix<real_t> &matrix, const Eigen::MatrixXr &rhs, Eigen::MatrixXr &result);
+	void UpdateSolverMemoryUsage();
+
+public:
+	// Returns the number of nonzero coefficients below the diagonal of the LDL^T factorization of a matrix, based on the
+	// elimination tree. The matrix is given by the row indices above the diagonal for each column (in compressed column
+	// format, duplicates don't matter). This is the same symbolic analysis that the factorization does, but the meshes
+	// can derive the index structure from their elements directly, without building the matrix.
+	static size_t PredictFactorNonZeros(size_t size, const std::vector<size_t> &upper_outer, const std::vector<CompactIndex> &upper_inner);
+
+};
@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "RationalFit.h"
+
+#include "EigenSparse.h"
+
+#include <limits>
+#include <vector>
+
+RationalModel::RationalModel() {
+	// nothing
+}
+
+RationalModel::RationalModel(const Eigen::VectorXr &support_points, const Eigen::VectorXr &weights, const Eigen::MatrixXr &support_values)
+	: m_support_points(support_points), m_weights(weights), m_support_values(support_values) {
+	assert(support_points.size() == weights.size());
+	assert(support_points.size() == support_values.rows());
+}
+
+void RationalModel::Evaluate(real_t x, real_t *values) const {
+	Eigen::Map<Eigen::RowVectorXr> result(values, m_support_values.cols());
+	if(m_support_points.size() == 0) {
+		result.setConstant(std::numeric_limits<real_t>::quiet_NaN());
+		return;
+	}
+
+	// the barycentric formula can't be evaluated at the support points themselves, but the values are known there
+	for(Eigen::Index j = 0; j < m_support_points.size(); ++j) {
+		if(x == m_support_points[j]) {
+			result = m_support_values.row(j);
+			return;
+		}
+	}
+
+	real_t denominator = 0.0;
+	result.setZero();
+	for(Eigen::Index j = 0; j < m_support_points.size(); ++j) {
+		real_t coef = m_weights[j] / (x - m_support_points[j]);
+		denominator += coef;
+		result += coef * m_support_values.row(j);
+	}
+	result /= denominator;
+
+}
+
+real_t FitRationalModel(const Eigen::VectorXr &points, const Eigen::MatrixXr &values, size_t max_order, real_t tolerance,
+						RationalModel &model, RationalModel &previous_model) {
+	assert(points.size() == values.rows());
+	assert(points.size() != 0);
+	Eigen::Index n = points.size(), k = values.cols();
+
+	// At least one sample must be left to determine the weights, unless there is only one sample.
+	max_order = std::max<size_t>(1, std::min(max_order, (size_t) n - 1));
+
+	// start with the mean of every function
+	Eigen::MatrixXr approximation = values.colwise().mean().replicate(n, 1);
+	real_t error = (values - approximation).cwiseAbs().maxCoeff();
+
+	std::vector<bool> is_support((size_t) n, false);
+	std::vector<Eigen::Index> support, others;
+	model = RationalModel();
+	previous_model = RationalModel();
+	while(support.size() < max_order && (support.empty() || error > tolerance)) {
+
+		// the sample with the largest error becomes the next support point
+		Eigen::Index best = 0;
+		real_t best_error = -1.0;
+		for(Eigen::Index i = 0; i < n; ++i) {
+			if(is_support[(size_t) i])
+				continue;
+			real_t sample_error = (values.row(i) - approximation.row(i)).cwiseAbs().maxCoeff();
+			if(sample_error > best_error) {
+				best = i;
+				best_error = sample_error;
+			}
+		}
+		support.push_back(best);
+		is_support[(size_t) best] = true;
+		others.clear();
+		for(Eigen::Index i = 0; i < n; ++i) {
+			if(!is_support[(size_t) i])
+				others.push_back(i);
+		}
+
+		Eigen::Index m = (Eigen::Index) support.size(), p = (Eigen::Index) others.size();
+		Eigen::VectorXr support_points(m);
+		Eigen::MatrixXr support_values(m, k);
+		for(Eigen::Index j = 0; j < m; ++j) {
+			support_points[j] = points[support[(size_t) j]];
+			support_values.row(j) = values.row(support[(size_t) j]);
+		}
+
+		// The weights are the right singular vector of the smallest singular value of the Loewner matrices of all
+		// functions stacked on top of each other.
+		Eigen::MatrixXr cauchy(p, m), loewner(p * k, m);
+		for(Eigen::Index i = 0; i < p; ++i) {
+			for(Eigen::Index j = 0; j < m; ++j) {
+				assert(points[others[(size_t) i]] != support_points[j]);
+				cauchy(i, j) = 1.0 / (points[others[(size_t) i]] - support_points[j]);
+			}
+		}
+		for(Eigen::Index c = 0; c < k; ++c) {
+			for(Eigen::Index i = 0; i < p; ++i) {
+				for(Eigen::Index j = 0; j < m; ++j) {
+					loewner(c * p + i, j) = (values(others[(size_t) i], c) - support_values(j, c)) * cauchy(i, j);
+				}
+			}
+		}
+		Eigen::VectorXr weights;
+		if(p == 0) {
+			weights = Eigen::VectorXr::Ones(m);
+		} else {
+			Eigen::JacobiSVD<Eigen::MatrixXr> svd(loewner, Eigen::ComputeFullV);
+			weights = svd.matrixV().col(m - 1);
+		}
+
+		// evaluate the new model at the other samples
+		Eigen::MatrixXr numerator = cauchy * (weights.asDiagonal() * support_values);
+		Eigen::VectorXr denominator = cauchy * weights;
+		approximation = values;
+		for(Eigen::Index i = 0; i < p; ++i) {
+			approximation.row(others[(size_t) i]) = numerator.row(i) / denominator[i];
+		}
+		error = (values - approximation).cwiseAbs().maxCoeff();
+		if(!std::isfinite(error))
+			error = std::numeric_limits<real_t>::infinity();
+
+		previous_model = std::move(model);
+		model = RationalModel(support_points, weights, support_values);
+
+	}
+
+	return error;
+}
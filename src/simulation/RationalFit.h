@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Basics.h"
+#include "Eigen.h"
+
+// Rational approximation of sampled functions with the AAA algorithm (Nakatsukasa, Sete and Trefethen). The model is
+// stored in barycentric form, r(x) = sum(w_j * f_j / (x - x_j)) / sum(w_j / (x - x_j)), which interpolates the values
+// f_j at the support points x_j. The support points are picked greedily from the samples (where the error is largest)
+// and the weights are chosen to minimize the linearized error at the other samples. Multiple functions sampled at the
+// same points share the support points and weights (i.e. the poles), which is much more robust than fitting every
+// function separately when they all have the same underlying physics.
+
+class RationalModel {
+
+private:
+	Eigen::VectorXr m_support_points, m_weights;
+	Eigen::MatrixXr m_support_values;
+
+public:
+	RationalModel();
+	RationalModel(const Eigen::VectorXr &support_points, const Eigen::VectorXr &weights, const Eigen::MatrixXr &support_values);
+
+	// Evaluates all functions at one point.
+	void Evaluate(real_t x, real_t *values) const;
+
+	inline size_t GetOrder() const { return (size_t) m_support_points.size(); }
+
+};
+
+// Fits a model to the samples (one row for each sample point, one column for each function). The sample points must be
+// distinct. Support points are added until the largest error at the samples is below the tolerance or the maximum
+// order is reached. The model of the previous order is returned as well, the difference between both models is a good
+// indication of the error of the final model between the samples. The returned value is the largest error of the
+// final model at the samples.
+real_t FitRationalModel(const Eigen::VectorXr &points, const Eigen::MatrixXr &values, size_t max_order, real_t tolerance,
+						RationalModel &model, RationalModel &previous_model);
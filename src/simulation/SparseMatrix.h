@@ -26,6 +26,7 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #include "EigenSparse.h"
 
 #include <type_traits>
+#include <vector>
 
 // This file contains a sparse block matrix implementation optimized for the construction of FEM problems.
 // The matrix is partitioned as follows:
@@ -57,6 +58,8 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 // flat array instead of a hash table. This greatly improves the locality, assuming that the matrix is constructed in
 // nearly sequential order. For the few columns that might need extra storage, we can fall back to a hash table.
 // Usually the number of fixed variables is very small, so the B, C and D blocks don't need any special optimizations.
+// They get only one coefficient of bulk storage per column (or row), which is enough for variables that are coupled to
+// a single fixed variable, since the full bulk size would waste a lot of memory when they have as many columns as A.
 
 // Symmetric sparse matrices are stored in lower or upper triangular format, with diagonal entry values halved.
 // The lower and upper triangular parts are assumed to be identical (i.e. not complex conjugates).
@@ -83,15 +86,85 @@ void InsertionSortPairs(A *data_a, B *data_b, size_t size) {
 	}
 }
 
+// Complex Eigen sparse matrix (column-major) stored as separate real and imaginary parts. The imaginary part shares the
+// index structure of the real part, so both parts can be used by real-valued solvers and products without creating
+// temporary copies (which is what calling real() or imag() on a complex sparse matrix does).
+struct EigenSparseSplit {
+
+	Eigen::SparseMatrix<real_t> m_real;
+	std::vector<real_t> m_imag_values;
+
+	inline const Eigen::SparseMatrix<real_t>& Real() const {
+		return m_real;
+	}
+	inline Eigen::Map<const Eigen::SparseMatrix<real_t>> Imag() const {
+		assert(m_real.isCompressed() && (size_t) m_real.nonZeros() == m_imag_values.size());
+		return Eigen::Map<const Eigen::SparseMatrix<real_t>>(m_real.rows(), m_real.cols(), m_real.nonZeros(),
+															 m_real.outerIndexPtr(), m_real.innerIndexPtr(), m_imag_values.data());
+	}
+
+	void Free() {
+		m_real.resize(0, 0);
+		m_real.data().squeeze();
+		m_imag_values.clear();
+		m_imag_values.shrink_to_fit();
+	}
+
+	size_t GetMemoryUsage() const {
+		return EigenSparseMemoryUsage(m_real) + m_imag_values.capacity() * sizeof(real_t);
+	}
+
+};
+
+// Calculates the residual at the fixed variables (C * X + D * E) and optionally the loss matrix
+// (X^T * A' * X + (C' * X)^T * E + E^T * (C' * X) + E^T * D' * E, where ' denotes the imaginary part) of a solved
+// potential matrix. The real and imaginary parts of C share their index structure, so both products are calculated in
+// a single pass, and the quadratic form of A' takes a second pass.
+inline void PotentialResidualAndLoss(const EigenSparseSplit (&matrix)[3], const Eigen::MatrixXr &solution, const Eigen::MatrixXr &excitation,
+									 Eigen::MatrixXr &residual, Eigen::MatrixXr *loss) {
+	typedef Eigen::SparseMatrix<real_t>::StorageIndex StorageIndex;
+	const Eigen::SparseMatrix<real_t> &matrix_c = matrix[1].Real();
+	const StorageIndex *outer = matrix_c.outerIndexPtr(), *inner = matrix_c.innerIndexPtr();
+	const real_t *values_real = matrix_c.valuePtr(), *values_imag = matrix[1].m_imag_values.data();
+	Eigen::MatrixXr solution_t = solution.transpose();
+	size_t size = (size_t) solution.cols();
+
+	// products with C (transposed, one column per fixed variable)
+	Eigen::MatrixXr product_real_t = Eigen::MatrixXr::Zero(solution.cols(), matrix_c.rows());
+	Eigen::MatrixXr product_imag_t = Eigen::MatrixXr::Zero(solution.cols(), (loss == NULL)? 0 : matrix_c.rows());
+	for(Eigen::Index j = 0; j < matrix_c.outerSize(); ++j) {
+		const real_t *xj = solution_t.data() + size * (size_t) j;
+		for(StorageIndex q = outer[j]; q < outer[j + 1]; ++q) {
+			real_t *pr = product_real_t.data() + size * (size_t) inner[q];
+			for(size_t m = 0; m < size; ++m) {
+				pr[m] += values_real[q] * xj[m];
+			}
+			if(loss != NULL) {
+				real_t *pi = product_imag_t.data() + size * (size_t) inner[q];
+				for(size_t m = 0; m < size; ++m) {
+					pi[m] += values_imag[q] * xj[m];
+				}
+			}
+		}
+	}
+
+	// residual
+	residual = product_real_t.transpose() + matrix[2].Real().selfadjointView<Eigen::Lower>() * excitation;
+
+	// losses
+	if(loss != NULL) {
+		Eigen::MatrixXr cross = product_imag_t * excitation;
+		*loss = SparseQuadraticForm(matrix[0].Imag(), solution_t) + cross + cross.transpose() +
+				excitation.transpose() * (matrix[2].Imag().selfadjointView<Eigen::Lower>() * excitation);
+	}
+
+}
+
 template<typename F, bool ROWMAJOR, bool SYMMETRIC, bool UPPER>
 class SparseMatrixBase {
 
 private:
-	struct BulkEntry {
-		size_t inner;
-		F value;
-		inline BulkEntry() : inner(INDEX_NONE) {}
-	};
+	static constexpr uint32_t BULK_NONE = UINT32_MAX;
 
 	struct TableEntry {
 		size_t outer, inner;
@@ -112,7 +185,8 @@ private:
 
 private:
 	size_t m_outer_size, m_inner_size, m_bulk_size, m_bulk_coefficients;
-	std::unique_ptr<BulkEntry[]> m_bulk_data;
+	std::unique_ptr<uint32_t[]> m_bulk_inner; // bulk storage uses separate index and value arrays with 32-bit indices
+	std::unique_ptr<F[]> m_bulk_values;
 	HashTable<TableEntry, TableHasher> m_table_data;
 
 private:
@@ -134,7 +208,8 @@ public:
 		m_inner_size = 0;
 		m_bulk_size = 0;
 		m_bulk_coefficients = 0;
-		m_bulk_data.reset();
+		m_bulk_inner.reset();
+		m_bulk_values.reset();
 		m_table_data.Free();
 	}
 
@@ -144,7 +219,11 @@ public:
 		m_inner_size = Inner(rows, cols);
 		m_bulk_size = bulk_size;
 		m_bulk_coefficients = 0;
-		m_bulk_data.reset(new BulkEntry[m_bulk_size * m_outer_size]());
+		if(m_inner_size >= BULK_NONE)
+			throw std::runtime_error("SparseMatrix error: The matrix is too large.");
+		m_bulk_inner.reset(new uint32_t[m_bulk_size * m_outer_size]);
+		std::fill_n(m_bulk_inner.get(), m_bulk_size * m_outer_size, BULK_NONE);
+		m_bulk_values.reset(new F[m_bulk_size * m_outer_size]());
 		m_table_data.Clear();
 	}
 
@@ -171,16 +250,16 @@ public:
 				}
 			}
 		}
-		BulkEntry *bulk = m_bulk_data.get() + m_bulk_size * outer;
+		uint32_t *bulk_inner = m_bulk_inner.get() + m_bulk_size * outer;
+		F *bulk_values = m_bulk_values.get() + m_bulk_size * outer;
 		for(size_t i = 0; i < m_bulk_size; ++i) {
-			BulkEntry &entry = bulk[i];
-			if(entry.inner == inner) {
-				entry.value += value;
+			if(bulk_inner[i] == inner) {
+				bulk_values[i] += value;
 				return;
 			}
-			if(entry.inner == INDEX_NONE) {
-				entry.inner = inner;
-				entry.value = value;
+			if(bulk_inner[i] == BULK_NONE) {
+				bulk_inner[i] = (uint32_t) inner;
+				bulk_values[i] = value;
 				++m_bulk_coefficients;
 				return;
 			}
@@ -200,12 +279,11 @@ public:
 		// count coefficients per row/column
 		std::fill_n(offsets, (TRANSPOSE)? m_inner_size : m_outer_size, 0);
 		for(size_t outer = 0; outer < m_outer_size; ++outer) {
-			const BulkEntry *bulk = m_bulk_data.get() + m_bulk_size * outer;
+			const uint32_t *bulk_inner = m_bulk_inner.get() + m_bulk_size * outer;
 			for(size_t i = 0; i < m_bulk_size; ++i) {
-				const BulkEntry &entry = bulk[i];
-				if(entry.inner == INDEX_NONE)
+				if(bulk_inner[i] == BULK_NONE)
 					break;
-				++offsets[(TRANSPOSE)? entry.inner : outer];
+				++offsets[(TRANSPOSE)? (size_t) bulk_inner[i] : outer];
 			}
 		}
 		for(size_t i = 0; i < m_table_data.GetSize(); ++i) {
@@ -224,14 +302,15 @@ public:
 
 		// calculate indices and values
 		for(size_t outer = 0; outer < m_outer_size; ++outer) {
-			const BulkEntry *bulk = m_bulk_data.get() + m_bulk_size * outer;
+			const uint32_t *bulk_inner = m_bulk_inner.get() + m_bulk_size * outer;
+			const F *bulk_values = m_bulk_values.get() + m_bulk_size * outer;
 			for(size_t i = 0; i < m_bulk_size; ++i) {
-				const BulkEntry &entry = bulk[i];
-				if(entry.inner == INDEX_NONE)
+				if(bulk_inner[i] == BULK_NONE)
 					break;
-				size_t j = (size_t) --offsets[(TRANSPOSE)? entry.inner : outer];
-				indices[j] = I((TRANSPOSE)? outer : entry.inner);
-				values[j] = (SYMMETRIC && outer == entry.inner)? entry.value + entry.value : entry.value;
+				size_t inner = bulk_inner[i];
+				size_t j = (size_t) --offsets[(TRANSPOSE)? inner : outer];
+				indices[j] = I((TRANSPOSE)? outer : inner);
+				values[j] = (SYMMETRIC && outer == inner)? bulk_values[i] + bulk_values[i] : bulk_values[i];
 			}
 		}
 		for(size_t i = 0; i < m_table_data.GetSize(); ++i) {
@@ -273,6 +352,22 @@ public:
 		}
 	}
 
+	// Convert to Eigen sparse matrix with separate real and imaginary parts (complex matrices only).
+	void ToEigenSplit(EigenSparseSplit &output) const {
+		static_assert(std::is_same<F, complex_t>::value, "ToEigenSplit requires a complex matrix");
+		size_t coefficients = GetCoefficients();
+		std::unique_ptr<F[]> values(new F[coefficients]);
+		output.m_real.resize((Eigen::Index) GetRows(), (Eigen::Index) GetCols());
+		output.m_real.resizeNonZeros((Eigen::Index) coefficients);
+		ToCSC(output.m_real.outerIndexPtr(), output.m_real.innerIndexPtr(), values.get());
+		real_t *real_values = output.m_real.valuePtr();
+		output.m_imag_values.resize(coefficients);
+		for(size_t i = 0; i < coefficients; ++i) {
+			real_values[i] = values[i].real();
+			output.m_imag_values[i] = values[i].imag();
+		}
+	}
+
 public:
 	inline size_t GetOuterSize() const { return m_outer_size; }
 	inline size_t GetInnerSize() const { return m_inner_size; }
@@ -280,6 +375,16 @@ public:
 	inline size_t GetCols() const { return Col(m_outer_size, m_inner_size); }
 	inline size_t GetCoefficients() const { return m_bulk_coefficients + m_table_data.GetSize(); }
 
+	// Returns the memory used by the matrix (in bytes). The hash table overhead is not included.
+	inline size_t GetMemoryUsage() const {
+		return m_bulk_size * m_outer_size * (sizeof(uint32_t) + sizeof(F)) + m_table_data.GetSize() * sizeof(TableEntry);
+	}
+
+	// Returns the memory that will be used by the bulk storage after calling Reset (in bytes).
+	inline static size_t PredictMemoryUsage(size_t rows, size_t cols, size_t bulk_size) {
+		return bulk_size * Outer(rows, cols) * (sizeof(uint32_t) + sizeof(F));
+	}
+
 };
 
 template<typename F> using SparseMatrixC   = SparseMatrixBase<F, false, false, false>;
@@ -312,9 +417,9 @@ public:
 		assert(cols1 < INDEX_OFFSET);
 		assert(cols2 < INDEX_OFFSET - 1);
 		m_matrix_a.Reset(rows1, cols1, bulk_size);
-		m_matrix_b.Reset(rows1, cols2, bulk_size);
-		m_matrix_c.Reset(rows2, cols1, bulk_size);
-		m_matrix_d.Reset(rows2, cols2, bulk_size);
+		m_matrix_b.Reset(rows1, cols2, 1);
+		m_matrix_c.Reset(rows2, cols1, 1);
+		m_matrix_d.Reset(rows2, cols2, 1);
 	}
 
 	// Insert a new coefficient. If it already exists, the new value will be added to the existing one.
@@ -347,6 +452,15 @@ public:
 	inline const SparseMatrixBase<F, ROWMAJOR, false, false>& GetMatrixC() const { return m_matrix_c; }
 	inline const SparseMatrixBase<F, ROWMAJOR, false, false>& GetMatrixD() const { return m_matrix_d; }
 
+	inline size_t GetMemoryUsage() const {
+		return m_matrix_a.GetMemoryUsage() + m_matrix_b.GetMemoryUsage() + m_matrix_c.GetMemoryUsage() + m_matrix_d.GetMemoryUsage();
+	}
+	inline static size_t PredictMemoryUsage(size_t rows1, size_t rows2, size_t cols1, size_t cols2, size_t bulk_size) {
+		typedef SparseMatrixBase<F, ROWMAJOR, false, false> Block;
+		return Block::PredictMemoryUsage(rows1, cols1, bulk_size) + Block::PredictMemoryUsage(rows1, cols2, 1) +
+				Block::PredictMemoryUsage(rows2, cols1, 1) + Block::PredictMemoryUsage(rows2, cols2, 1);
+	}
+
 };
 
 template<typename F, bool ROWMAJOR, bool UPPER>
@@ -373,11 +487,11 @@ public:
 		assert(rows2 == cols2);
 		m_matrix_a.Reset(rows1, cols1, bulk_size);
 		if(UPPER) {
-			m_matrix_bc.Reset(rows1, cols2, bulk_size); // use B
+			m_matrix_bc.Reset(rows1, cols2, 1); // use B
 		} else {
-			m_matrix_bc.Reset(rows2, cols1, bulk_size); // use C
+			m_matrix_bc.Reset(rows2, cols1, 1); // use C
 		}
-		m_matrix_d.Reset(rows2, cols2, bulk_size);
+		m_matrix_d.Reset(rows2, cols2, 1);
 	}
 
 	// Insert a new coefficient. If it already exists, the new value will be added to the existing one.
@@ -410,6 +524,17 @@ public:
 	inline const SparseMatrixBase<F, ROWMAJOR, false, false>& GetMatrixBC() const { return m_matrix_bc; }
 	inline const SparseMatrixBase<F, ROWMAJOR, true , UPPER>& GetMatrixD()  const { return m_matrix_d;  }
 
+	inline size_t GetMemoryUsage() const {
+		return m_matrix_a.GetMemoryUsage() + m_matrix_bc.GetMemoryUsage() + m_matrix_d.GetMemoryUsage();
+	}
+	inline static size_t PredictMemoryUsage(size_t rows1, size_t rows2, size_t cols1, size_t cols2, size_t bulk_size) {
+		typedef SparseMatrixBase<F, ROWMAJOR, true , UPPER> BlockSymm;
+		typedef SparseMatrixBase<F, ROWMAJOR, false, false> Block;
+		return BlockSymm::PredictMemoryUsage(rows1, cols1, bulk_size) +
+				((UPPER)? Block::PredictMemoryUsage(rows1, cols2, 1) : Block::PredictMemoryUsage(rows2, cols1, 1)) +
+				BlockSymm::PredictMemoryUsage(rows2, cols2, 1);
+	}
+
 };
 
 template<typename F> using SparseBlockMatrixC   = SparseBlockMatrixBase<F, false, false, false>;
@@ -418,3 +543,26 @@ template<typename F> using SparseBlockMatrixCSU = SparseBlockMatrixBase<F, false
 template<typename F> using SparseBlockMatrixR   = SparseBlockMatrixBase<F, true , false, false>;
 template<typename F> using SparseBlockMatrixRSL = SparseBlockMatrixBase<F, true , true , false>;
 template<typename F> using SparseBlockMatrixRSU = SparseBlockMatrixBase<F, true , true , true >;
+
+// Adds a symmetric 2x2 element (e.g. a 1D mass matrix along an edge) to a matrix builder. The diagonal is halved because
+// symmetric builders store each coefficient once and double the diagonal during the conversion.
+template<class SparseMatrix, typename F>
+inline void BuildMatrix_Symm1(SparseMatrix &matrix, size_t i0, size_t i1, F cs, F cx) {
+	matrix.Insert(i0, i0, cs * 0.5);
+	matrix.Insert(i1, i1, cs * 0.5);
+	matrix.Insert(i0, i1, cx);
+}
+
+// Adds the rows of the same element to an unsymmetric matrix builder (e.g. the surface residual matrix). Rows which are
+// INDEX_NONE are skipped.
+template<typename F>
+inline void BuildMatrix_Asymm1(SparseBlockMatrixC<F> &matrix, size_t i0, size_t i1, size_t j0, size_t j1, F cs, F cx) {
+	if(i0 != INDEX_NONE) {
+		matrix.Insert(i0, j0, cs);
+		matrix.Insert(i0, j1, cx);
+	}
+	if(i1 != INDEX_NONE) {
+		matrix.Insert(i1, j1, cs);
+		matrix.Insert(i1, j0, cx);
+	}
+}
@@ -0,0 +1,190 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TLineSimulation.h"
+
+#include "FindRoot.h"
+#include "MiscMath.h"
+#include "VDataReader.h"
+
+#include <algorithm>
+
+void MakeSweep(std::vector<real_t> &results, real_t min, real_t max, real_t step) {
+	size_t num = (size_t) std::max<ptrdiff_t>(rintp(std::max(0.0, max - min) / step + 0.5 + 1e-12), 1);
+	results.clear();
+	results.resize(num);
+	for(size_t i = 0; i < num; ++i) {
+		results[i] = min + step * (real_t) i;
+	}
+}
+
+size_t FindTLineType(const std::string &name) {
+	for(size_t i = 0; i < g_tline_types.size(); ++i) {
+		if(g_tline_types[i].m_name == name)
+			return i;
+	}
+	std::string canonical_name = CanonicalName(name);
+	for(size_t i = 0; i < g_tline_types.size(); ++i) {
+		if(CanonicalName(g_tline_types[i].m_name) == canonical_name)
+			return i;
+	}
+	return INDEX_NONE;
+}
+
+size_t FindTLineParameter(const TLineType &tline_type, const std::string &name) {
+	std::string canonical_name = CanonicalName(name);
+	for(size_t i = 0; i < tline_type.m_parameters.size(); ++i) {
+		if(CanonicalName(tline_type.m_parameters[i].m_name) == canonical_name)
+			return i;
+	}
+	return INDEX_NONE;
+}
+
+size_t FindTLineResult(const std::string &name) {
+	std::string canonical_name = CanonicalName(name);
+	for(size_t i = 0; i < TLINERESULT_COUNT; ++i) {
+		if(CanonicalName(TLINERESULT_NAMES[i]) == canonical_name)
+			return i;
+	}
+	return INDEX_NONE;
+}
+
+void TLineParameterSweep(const TLineType &tline_type, TLineContext &context, size_t param_index, const std::vector<real_t> &sweep_values,
+						 std::vector<real_t> &combined_results, const std::function<void(size_t)> &progress_callback) {
+	assert(param_index < tline_type.m_parameters.size());
+	size_t result_count = TLINERESULT_COUNT * tline_type.m_modes.size() * context.m_frequencies.size();
+	combined_results.clear();
+	combined_results.resize(result_count * sweep_values.size());
+	for(size_t i = 0; i < sweep_values.size(); ++i) {
+		context.m_parameters[param_index].Value() = FloatScale(sweep_values[i]);
+		tline_type.m_simulate(context);
+		assert(context.m_results.size() == result_count);
+		std::copy_n(context.m_results.data(), result_count, combined_results.data() + result_count * i);
+		if(progress_callback) {
+			progress_callback(i + 1);
+		}
+	}
+}
+
+real_t TLineParameterTune(const TLineType &tline_type, TLineContext &context, size_t param_index, size_t result_index, real_t target_value) {
+	assert(param_index < tline_type.m_parameters.size());
+	assert(result_index < TLINERESULT_COUNT * tline_type.m_modes.size());
+	real_t initial_value = VDataReader(context.m_parameters[param_index].Value()).AsFloat();
+	if(!FinitePositive(initial_value)) {
+		initial_value = VDataReader(tline_type.m_parameters[param_index].m_default_value).AsFloat();
+	}
+
+	// If the target doesn't depend on losses, the search only calculates the target (without losses or images), and the
+	// other requested results are calculated once at the end.
+	uint32_t requested_results = context.m_requested_results;
+	bool requested_images = context.m_requested_images;
+	uint32_t target_mask = 1u << (result_index % TLINERESULT_COUNT);
+	bool restrict_search = ((target_mask & TLINERESULT_MASK_LOSSLESS) != 0 && ((requested_results & ~TLINERESULT_MASK_LOSSLESS) != 0 || requested_images));
+	if(restrict_search) {
+		context.m_requested_results = target_mask;
+		context.m_requested_images = false;
+	} else {
+		context.m_requested_results |= target_mask;
+	}
+
+	real_t root_value = FindRootRelative([&](real_t x) {
+		context.m_parameters[param_index].Value() = FloatScale(x);
+		tline_type.m_simulate(context);
+		return context.m_results[result_index] - target_value;
+	}, initial_value, 1e-8, target_value * 1e-8, 1e6);
+
+	context.m_requested_results = requested_results;
+	context.m_requested_images = requested_images;
+	if(restrict_search) {
+		context.m_parameters[param_index].Value() = FloatScale(root_value);
+		tline_type.m_simulate(context);
+	}
+	return root_value;
+}
+
+void TLineWriteResults(std::ostream &stream, const TLineType &tline_type, const std::vector<std::string> &key_names,
+					   const std::vector<real_t> &keys, const std::vector<real_t> &results) {
+	assert(!key_names.empty());
+	size_t rows = keys.size() / key_names.size();
+	size_t row_size = TLINERESULT_COUNT * tline_type.m_modes.size();
+	assert(keys.size() == key_names.size() * rows);
+	assert(results.size() == row_size * rows);
+
+	// write header
+	for(size_t i = 0; i < key_names.size(); ++i) {
+		if(i != 0)
+			stream << '\t';
+		stream << key_names[i];
+	}
+	for(size_t i = 0; i < tline_type.m_modes.size(); ++i) {
+		for(size_t j = 0; j < TLINERESULT_COUNT; ++j) {
+			stream << '\t' << tline_type.m_modes[i] << ' ' << TLINERESULT_NAMES[j];
+		}
+	}
+	stream << std::endl;
+
+	// write body
+	for(size_t i = 0; i < rows; ++i) {
+		const real_t *row_keys = keys.data() + key_names.size() * i;
+		for(size_t j = 0; j < key_names.size(); ++j) {
+			if(j != 0)
+				stream << '\t';
+			stream << row_keys[j];
+		}
+		const real_t *row = results.data() + row_size * i;
+		for(size_t j = 0; j < row_size; ++j) {
+			stream << '\t' << row[j];
+		}
+		stream << std::endl;
+	}
+
+}
+
+void TLineWriteMatrices(std::ostream &stream, const TLineType &tline_type, const std::vector<real_t> &frequencies, const std::vector<real_t> &matrices) {
+	size_t modes = tline_type.m_modes.size();
+	size_t row_size = 4 * modes * modes;
+	assert(matrices.size() == row_size * frequencies.size());
+	const size_t names[4] = {TLINERESULT_INDUCTANCE, TLINERESULT_CAPACITANCE, TLINERESULT_RESISTANCE, TLINERESULT_CONDUCTANCE};
+	const real_t scales[4] = {1e6, 1e9, 1e-3, 1e-3};
+
+	// write header
+	stream << "Frequency";
+	for(size_t k = 0; k < 4; ++k) {
+		for(size_t j = 0; j < modes; ++j) {
+			for(size_t i = 0; i < modes; ++i) {
+				stream << '\t' << TLINERESULT_NAMES[names[k]] << ' ' << tline_type.m_modes[i] << '/' << tline_type.m_modes[j];
+			}
+		}
+	}
+	stream << std::endl;
+
+	// write body
+	for(size_t f = 0; f < frequencies.size(); ++f) {
+		stream << frequencies[f];
+		const real_t *row = matrices.data() + row_size * f;
+		for(size_t k = 0; k < 4; ++k) {
+			for(size_t j = 0; j < modes * modes; ++j) {
+				stream << '\t' << row[modes * modes * k + j] * scales[k];
+			}
+		}
+		stream << std::endl;
+	}
+
+}
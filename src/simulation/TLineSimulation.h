@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Basics.h"
+#include "TLineTypes.h"
+
+#include <ostream>
+
+// These functions implement the simulation types offered by the user interface (single frequency, frequency sweep,
+// parameter sweep and parameter tune) on top of the TLineType interface. They don't depend on Qt, so they can be used
+// by the GUI as well as the command-line batch solver.
+
+// Generates the values min, min + step, min + 2 * step, ... up to and including max.
+void MakeSweep(std::vector<real_t> &results, real_t min, real_t max, real_t step);
+
+// Finds a transmission line type based on its name or canonical name. Returns INDEX_NONE if not found.
+size_t FindTLineType(const std::string &name);
+
+// Finds a parameter of a transmission line type based on its name or canonical name. Returns INDEX_NONE if not found.
+size_t FindTLineParameter(const TLineType &tline_type, const std::string &name);
+
+// Finds a result based on its name. Returns INDEX_NONE if not found.
+size_t FindTLineResult(const std::string &name);
+
+// Simulates every value of a parameter sweep. The results of all simulations are concatenated.
+void TLineParameterSweep(const TLineType &tline_type, TLineContext &context, size_t param_index, const std::vector<real_t> &sweep_values,
+						 std::vector<real_t> &combined_results, const std::function<void(size_t)> &progress_callback = nullptr);
+
+// Changes a parameter until the selected result matches the target value, and returns the final parameter value.
+// The context will contain the results of the last simulation. The target result is always calculated, even if it
+// isn't part of the requested results of the context.
+real_t TLineParameterTune(const TLineType &tline_type, TLineContext &context, size_t param_index, size_t result_index, real_t target_value);
+
+// Writes a table of results in tab-separated format. Each row starts with one or more key columns (e.g. the frequency
+// or the value of the swept parameter), followed by the results for all modes.
+void TLineWriteResults(std::ostream &stream, const TLineType &tline_type, const std::vector<std::string> &key_names,
+					   const std::vector<real_t> &keys, const std::vector<real_t> &results);
+
+// Writes the full inductance, capacitance, resistance and conductance matrices (as stored in
+// TLineContext::m_circuit_matrices) in tab-separated format, one row per frequency.
+void TLineWriteMatrices(std::ostream &stream, const TLineType &tline_type, const std::vector<real_t> &frequencies, const std::vector<real_t> &matrices);
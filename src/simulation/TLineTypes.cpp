@@ -20,11 +20,20 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "TLineTypes.h"
 
+#include "EigenModes.h"
 #include "MaterialDatabase.h"
+#include "RationalFit.h"
+
+#include <algorithm>
+#include <limits>
 
 // TODO: remove
 #include <iostream>
 
+#ifndef SIMULATION_VERBOSE
+#define SIMULATION_VERBOSE 1
+#endif
+
 const char *const TLINERESULT_NAMES[TLINERESULT_COUNT] = {
 	"Impedance",
 	"Velocity",
@@ -96,31 +105,223 @@ std::string CanonicalName(const std::string &name) {
 	return out;
 }
 
+// Adaptive frequency sweeps only solve a few frequencies and interpolate the circuit matrices in between. Sweeps with
+// few frequencies are always solved completely. The tolerance is relative to the largest value of each matrix (L, C, R
+// and G) over the whole sweep.
+const size_t TLINE_ADAPTIVE_SWEEP_MIN_FREQUENCIES = 16;
+const size_t TLINE_ADAPTIVE_SWEEP_INITIAL_SAMPLES = 5;
+const real_t TLINE_ADAPTIVE_SWEEP_TOLERANCE = 1.0e-5;
+
+// Solves one frequency and stores the circuit matrices (L, C, R and G, consecutively).
+static void TLineSolveFrequency(TLineContext &context, const Eigen::MatrixXr &modes, real_t frequency, real_t *matrices) {
+	size_t matrix_size = (size_t) (modes.cols() * modes.cols());
+	context.m_output_mesh->Solve(modes, frequency, false);
+	Eigen::Map<Eigen::MatrixXr>(matrices, modes.cols(), modes.cols()) = context.m_output_mesh->GetInductanceMatrix();
+	Eigen::Map<Eigen::MatrixXr>(matrices + matrix_size, modes.cols(), modes.cols()) = context.m_output_mesh->GetCapacitanceMatrix();
+	Eigen::Map<Eigen::MatrixXr>(matrices + 2 * matrix_size, modes.cols(), modes.cols()) = context.m_output_mesh->GetResistanceMatrix();
+	Eigen::Map<Eigen::MatrixXr>(matrices + 3 * matrix_size, modes.cols(), modes.cols()) = context.m_output_mesh->GetConductanceMatrix();
+}
+
+// Adaptive frequency sweep. The circuit matrices are modeled as rational functions of sqrt(f), since the skin effect
+// makes the resistance proportional to sqrt(f), which is a rational function of sqrt(f) but not of f. The sweep starts
+// with a few frequencies spread over the range, and then repeatedly solves the frequency where the rational models of
+// the last two orders disagree the most, until they agree everywhere. The results at solved frequencies are exact, the
+// others come from the final model.
+static void TLineSolveAdaptiveSweep(TLineContext &context, const Eigen::MatrixXr &modes, std::vector<real_t> &circuit_matrices) {
+	size_t matrices_size = (size_t) (4 * modes.cols() * modes.cols());
+	size_t frequency_count = context.m_frequencies.size();
+
+	// the models need distinct points, so duplicate frequencies are solved only once
+	std::vector<real_t> frequencies = context.m_frequencies;
+	std::sort(frequencies.begin(), frequencies.end());
+	frequencies.erase(std::unique(frequencies.begin(), frequencies.end()), frequencies.end());
+	size_t point_count = frequencies.size();
+	Eigen::VectorXr points(point_count);
+	for(size_t i = 0; i < point_count; ++i) {
+		points[(Eigen::Index) i] = std::sqrt(frequencies[i] / frequencies.back());
+	}
+
+	// the initial samples are spread evenly over the range of the model variable
+	std::vector<bool> solved(point_count, false);
+	std::vector<size_t> samples;
+	std::vector<real_t> sample_data;
+	auto add_sample = [&](size_t point) {
+		solved[point] = true;
+		samples.push_back(point);
+		sample_data.resize(matrices_size * samples.size());
+		TLineSolveFrequency(context, modes, frequencies[point], sample_data.data() + matrices_size * (samples.size() - 1));
+	};
+	for(size_t i = 0; i < TLINE_ADAPTIVE_SWEEP_INITIAL_SAMPLES; ++i) {
+		real_t target = points[0] + (points[(Eigen::Index) point_count - 1] - points[0]) * (real_t) i / (real_t) (TLINE_ADAPTIVE_SWEEP_INITIAL_SAMPLES - 1);
+		size_t point = (size_t) (std::lower_bound(points.data(), points.data() + point_count, target) - points.data());
+		if(point == point_count || (point != 0 && target - points[(Eigen::Index) point - 1] < points[(Eigen::Index) point] - target))
+			--point;
+		if(!solved[point])
+			add_sample(point);
+	}
+
+	RationalModel model, previous_model;
+	Eigen::VectorXr scale(4);
+	Eigen::RowVectorXr values1((Eigen::Index) matrices_size), values2((Eigen::Index) matrices_size);
+	for( ; ; ) {
+
+		// update progress
+		if(context.m_progress_callback) {
+			context.m_progress_callback(samples.size());
+		}
+		if(samples.size() == point_count)
+			break;
+
+		// scale each matrix by its largest value, so they all get the same relative tolerance
+		Eigen::Map<const Eigen::Matrix<real_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> sample_values(
+					sample_data.data(), (Eigen::Index) samples.size(), (Eigen::Index) matrices_size);
+		Eigen::Index matrix_size = (Eigen::Index) matrices_size / 4;
+		for(Eigen::Index m = 0; m < 4; ++m) {
+			scale[m] = sample_values.middleCols(m * matrix_size, matrix_size).cwiseAbs().maxCoeff();
+			if(!(scale[m] > 0.0))
+				scale[m] = 1.0;
+		}
+		Eigen::VectorXr sample_points((Eigen::Index) samples.size());
+		Eigen::MatrixXr scaled_values(sample_values.rows(), sample_values.cols());
+		for(size_t i = 0; i < samples.size(); ++i) {
+			sample_points[(Eigen::Index) i] = points[(Eigen::Index) samples[i]];
+		}
+		for(Eigen::Index m = 0; m < 4; ++m) {
+			scaled_values.middleCols(m * matrix_size, matrix_size) = sample_values.middleCols(m * matrix_size, matrix_size) / scale[m];
+		}
+		// fit the models and find the frequency where they disagree the most
+		size_t max_order = (samples.size() + 1) / 2;
+		real_t fit_error = FitRationalModel(sample_points, scaled_values, max_order, TLINE_ADAPTIVE_SWEEP_TOLERANCE * 0.01, model, previous_model);
+		size_t worst_point = INDEX_NONE;
+		real_t worst_error = -1.0;
+		for(size_t i = 0; i < point_count; ++i) {
+			if(solved[i])
+				continue;
+			model.Evaluate(points[(Eigen::Index) i], values1.data());
+			previous_model.Evaluate(points[(Eigen::Index) i], values2.data());
+			real_t error = (values1 - values2).cwiseAbs().maxCoeff();
+			if(!std::isfinite(error))
+				error = std::numeric_limits<real_t>::infinity();
+			if(error > worst_error) {
+				worst_point = i;
+				worst_error = error;
+			}
+		}
+		if(worst_error <= TLINE_ADAPTIVE_SWEEP_TOLERANCE && fit_error <= TLINE_ADAPTIVE_SWEEP_TOLERANCE)
+			break;
+		add_sample(worst_point);
+
+	}
+
+	// evaluate the model at all requested frequencies
+	circuit_matrices.resize(matrices_size * frequency_count);
+	for(size_t i = 0; i < frequency_count; ++i) {
+		real_t *matrices = circuit_matrices.data() + matrices_size * i;
+		size_t point = (size_t) (std::lower_bound(frequencies.begin(), frequencies.end(), context.m_frequencies[i]) - frequencies.begin());
+		auto it = std::find(samples.begin(), samples.end(), point);
+		if(it != samples.end()) {
+			std::copy_n(sample_data.data() + matrices_size * (size_t) (it - samples.begin()), matrices_size, matrices);
+		} else {
+			model.Evaluate(points[(Eigen::Index) point], matrices);
+			for(size_t m = 0; m < 4; ++m) {
+				Eigen::Map<Eigen::VectorXr>(matrices + matrices_size / 4 * m, (Eigen::Index) matrices_size / 4) *= scale[(Eigen::Index) m];
+			}
+		}
+	}
+
+	// the field solution of the mesh should be the one of the last frequency, as with a normal sweep
+	if(context.m_requested_images && samples.back() != (size_t) (std::lower_bound(frequencies.begin(), frequencies.end(), context.m_frequencies.back()) - frequencies.begin())) {
+		context.m_output_mesh->Solve(modes, context.m_frequencies.back(), false);
+	}
+
+#if SIMULATION_VERBOSE
+	std::cerr << "TLineSolveAdaptiveSweep: frequencies=" << frequency_count << " solved=" << samples.size()
+			  << " order=" << model.GetOrder() << std::endl;
+#endif
+
+}
+
 void TLineSolveModes(TLineContext &context, const Eigen::MatrixXr &modes) {
 
+	// Only calculate what is needed for the requested results. All results except L and C depend on R or G (even the
+	// impedance, which is the real part of the lossy characteristic impedance), so they need the loss calculations.
+	bool solve_losses = ((context.m_requested_results & ~TLINERESULT_MASK_LOSSLESS) != 0);
+	bool solve_eigenmodes = ((context.m_requested_results & TLINERESULT_MASK_EIGENMODES) != 0);
+	real_t nan = std::numeric_limits<real_t>::quiet_NaN();
+
 	// initialize
+	context.m_output_mesh->SetRequestedOutputs(solve_losses, context.m_requested_images);
+	context.m_output_mesh->SetMemoryBudget(context.m_memory_budget);
+	context.m_output_mesh->SetMixedPrecision(context.m_mixed_precision);
+	context.m_output_mesh->SetElementOrder(context.m_element_order);
 	context.m_output_mesh->Initialize();
+	context.m_output_mesh->PrepareFrequencies(context.m_frequencies);
+	for(const std::string &warning : context.m_output_mesh->GetWarnings()) {
+		if(std::find(context.m_warnings.begin(), context.m_warnings.end(), warning) == context.m_warnings.end())
+			context.m_warnings.push_back(warning);
+	}
 
-	context.m_results.clear();
-	context.m_results.resize(TLINERESULT_COUNT * (size_t) modes.cols() * context.m_frequencies.size());
+	// solve all frequencies (or just enough of them for an adaptive sweep) and store the full circuit matrices (L, C, R
+	// and G for each frequency), the eigenmodes are calculated afterwards for the whole sweep at once
+	size_t modes_count = (size_t) modes.cols(), matrix_size = modes_count * modes_count;
+	if(context.m_adaptive_sweep && context.m_frequencies.size() >= TLINE_ADAPTIVE_SWEEP_MIN_FREQUENCIES) {
+		TLineSolveAdaptiveSweep(context, modes, context.m_circuit_matrices);
+		if(context.m_progress_callback) {
+			context.m_progress_callback(context.m_frequencies.size());
+		}
+	} else {
+		context.m_circuit_matrices.resize(4 * matrix_size * context.m_frequencies.size());
+		for(size_t i = 0; i < context.m_frequencies.size(); ++i) {
+			TLineSolveFrequency(context, modes, context.m_frequencies[i], context.m_circuit_matrices.data() + 4 * matrix_size * i);
+			if(context.m_progress_callback) {
+				context.m_progress_callback(i + 1);
+			}
+		}
+	}
+	std::vector<real_t> inductance(matrix_size * context.m_frequencies.size()), capacitance(matrix_size * context.m_frequencies.size());
+	std::vector<real_t> resistance(matrix_size * context.m_frequencies.size()), conductance(matrix_size * context.m_frequencies.size());
 	for(size_t i = 0; i < context.m_frequencies.size(); ++i) {
+		const real_t *matrices = context.m_circuit_matrices.data() + 4 * matrix_size * i;
+		std::copy_n(matrices, matrix_size, inductance.data() + matrix_size * i);
+		std::copy_n(matrices + matrix_size, matrix_size, capacitance.data() + matrix_size * i);
+		std::copy_n(matrices + 2 * matrix_size, matrix_size, resistance.data() + matrix_size * i);
+		std::copy_n(matrices + 3 * matrix_size, matrix_size, conductance.data() + matrix_size * i);
+	}
+
+	// calculate eigenmodes
+	std::vector<complex_t> characteristic_impedances(modes_count * context.m_frequencies.size(), complex_t(nan, nan));
+	std::vector<complex_t> propagation_constants(modes_count * context.m_frequencies.size(), complex_t(nan, nan));
+	if(solve_eigenmodes) {
+		SolveEigenModesBatch(modes_count, context.m_frequencies.size(), context.m_frequencies.data(), inductance.data(), capacitance.data(),
+							 resistance.data(), conductance.data(), characteristic_impedances.data(), propagation_constants.data());
+	}
 
-		// solve
-		context.m_output_mesh->Solve(modes, context.m_frequencies[i]);
+	// without losses, R and G are unknown rather than zero
+	if(!solve_losses) {
+		std::fill(resistance.begin(), resistance.end(), nan);
+		std::fill(conductance.begin(), conductance.end(), nan);
+		for(size_t i = 0; i < context.m_frequencies.size(); ++i) {
+			std::fill_n(context.m_circuit_matrices.data() + 4 * matrix_size * i + 2 * matrix_size, 2 * matrix_size, nan);
+		}
+	}
 
+	context.m_results.clear();
+	context.m_results.resize(TLINERESULT_COUNT * modes_count * context.m_frequencies.size());
+	for(size_t i = 0; i < context.m_frequencies.size(); ++i) {
 		real_t omega = 2.0 * M_PI * context.m_frequencies[i];
-		for(size_t j = 0; j < (size_t) modes.cols(); ++j) {
+		for(size_t j = 0; j < modes_count; ++j) {
 
 			// process results
-			real_t ind = context.m_output_mesh->GetInductanceMatrix()((Eigen::Index) j, (Eigen::Index) j);
-			real_t cap = context.m_output_mesh->GetCapacitanceMatrix()((Eigen::Index) j, (Eigen::Index) j);
-			real_t res = context.m_output_mesh->GetResistanceMatrix()((Eigen::Index) j, (Eigen::Index) j);
-			real_t cond = context.m_output_mesh->GetConductanceMatrix()((Eigen::Index) j, (Eigen::Index) j);
-			complex_t z0 = context.m_output_mesh->GetCharacteristicImpedances()[(Eigen::Index) j];
-			complex_t gamma = context.m_output_mesh->GetPropagationConstants()[(Eigen::Index) j];
+			size_t diagonal_offset = matrix_size * i + (modes_count + 1) * j;
+			real_t ind = inductance[diagonal_offset];
+			real_t cap = capacitance[diagonal_offset];
+			real_t res = resistance[diagonal_offset];
+			real_t cond = conductance[diagonal_offset];
+			complex_t z0 = characteristic_impedances[modes_count * i + j];
+			complex_t gamma = propagation_constants[modes_count * i + j];
 
 			// generate outputs
-			real_t *output_values = context.m_results.data() + TLINERESULT_COUNT * ((size_t) modes.cols() * i + j);
+			real_t *output_values = context.m_results.data() + TLINERESULT_COUNT * (modes_count * i + j);
 			output_values[TLINERESULT_IMPEDANCE] = z0.real();
 			output_values[TLINERESULT_VELOCITY] = omega / gamma.imag();
 			output_values[TLINERESULT_WAVELENGTH] = 2.0 * M_PI / gamma.imag() * 1e3;
@@ -131,14 +332,12 @@ void TLineSolveModes(TLineContext &context, const Eigen::MatrixXr &modes) {
 			output_values[TLINERESULT_CONDUCTANCE] = cond * 1e-3;
 			output_values[TLINERESULT_ALPHA] = gamma.real();
 			output_values[TLINERESULT_BETA] = gamma.imag();
+			for(size_t k = 0; k < TLINERESULT_COUNT; ++k) {
+				if(((context.m_requested_results >> k) & 1) == 0)
+					output_values[k] = nan;
+			}
 
 		}
-
-		// update progress
-		if(context.m_progress_callback) {
-			context.m_progress_callback(i + 1);
-		}
-
 	}
 
 	// cleanup
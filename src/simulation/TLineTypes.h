@@ -52,6 +52,11 @@ enum TLineResult {
 	TLINERESULT_COUNT, // must be last
 };
 
+// bitmasks of results (1 << TLineResult)
+constexpr uint32_t TLINERESULT_MASK_ALL = (1u << TLINERESULT_COUNT) - 1;
+constexpr uint32_t TLINERESULT_MASK_LOSSLESS = (1u << TLINERESULT_INDUCTANCE) | (1u << TLINERESULT_CAPACITANCE); // don't depend on R and G
+constexpr uint32_t TLINERESULT_MASK_EIGENMODES = TLINERESULT_MASK_ALL & ~(TLINERESULT_MASK_LOSSLESS | (1u << TLINERESULT_RESISTANCE) | (1u << TLINERESULT_CONDUCTANCE)); // need eigenmodes
+
 struct TLineParameter {
 	std::string m_name;
 	TLineParameterType m_type;
@@ -66,11 +71,38 @@ struct TLineContext {
 	real_t m_mesh_detail;
 	VData::Dict m_parameters;
 	std::vector<real_t> m_results;
+	std::vector<real_t> m_circuit_matrices;
 	std::unique_ptr<GenericMesh> m_output_mesh;
 	std::function<void(size_t)> m_progress_callback;
+
+	// The simulation skips whatever is not needed for the requested results (e.g. the loss calculations if only
+	// inductance and capacitance are requested). Results that were not requested are set to NaN. The field solution
+	// (needed to draw images of the output mesh) is only kept if images are requested. Note that the impedance, velocity,
+	// wavelength and beta are derived from the lossy line (sqrt((R + jwL) / (G + jwC))), so they still need the loss
+	// calculations. At low frequencies R is comparable to wL, so leaving out the losses would change the impedance.
+	uint32_t m_requested_results;
+	bool m_requested_images;
+
+	// Maximum amount of memory (in bytes) used by the mesh, or 0 for no limit. See GenericMesh::SetMemoryBudget. If the
+	// mesh had to reduce the mesh detail to stay within the budget, this is reported in the warnings (without duplicates).
+	size_t m_memory_budget;
+	std::vector<std::string> m_warnings;
+
+	// Allows single-precision factorizations with iterative refinement. See GenericMesh::SetMixedPrecision.
+	bool m_mixed_precision;
+
+	// Polynomial order of the finite elements (1 = linear, 2 = quadratic). See GenericMesh::SetElementOrder.
+	size_t m_element_order;
+
+	// Solves frequency sweeps at only a few frequencies, and interpolates the circuit matrices in between with a
+	// rational model. New frequencies are added until the model is accurate everywhere, so smooth sweeps need far
+	// fewer solves.
+	bool m_adaptive_sweep;
+
+	inline TLineContext() : m_material_database(NULL), m_mesh_detail(1.0), m_requested_results(TLINERESULT_MASK_ALL), m_requested_images(true), m_memory_budget(0), m_mixed_precision(false), m_element_order(1), m_adaptive_sweep(false) {}
 };
 
-typedef void (*TLineSimulate)(TLineContext&);
+typedef std::function<void(TLineContext&)> TLineSimulate;
 
 struct TLineType {
 	std::string m_name, m_description;
@@ -85,6 +117,7 @@ extern const char *const TLINERESULT_UNITS[TLINERESULT_COUNT];
 extern std::vector<TLineType> g_tline_types;
 
 void RegisterTLineTypes();
+void RegisterTLineTypesFromFile(const std::string &filename);
 
 std::string CanonicalName(const std::string& name);
 const MaterialConductor* FindConductor(VDataDictReader &root, const char *key, MaterialDatabase *material_database);
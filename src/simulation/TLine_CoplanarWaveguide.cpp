@@ -40,8 +40,8 @@ void TLine_CoplanarWaveguide_Single(TLineContext &context) {
 	real_t solder_mask_thickness_2 = root.GetMember("solder_mask_thickness_2").AsFloat() * 1e-3;
 	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
 
-	real_t space_x = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 15.0;
-	real_t space_y = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 25.0;
+	real_t space_x = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
 	Box2D track_box = {
 		-0.5 * track_width,
 		0.5 * track_width,
@@ -108,6 +108,7 @@ void TLine_CoplanarWaveguide_Single(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -145,8 +146,8 @@ void TLine_CoplanarWaveguide_Differential(TLineContext &context) {
 	real_t solder_mask_thickness_2 = root.GetMember("solder_mask_thickness_2").AsFloat() * 1e-3;
 	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
 
-	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 15.0;
-	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 25.0;
+	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
 	Box2D track1_box = {
 		-0.5 * track_spacing - track_width,
 		-0.5 * track_spacing,
@@ -220,6 +221,7 @@ void TLine_CoplanarWaveguide_Differential(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal1 = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
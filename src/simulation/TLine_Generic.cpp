@@ -0,0 +1,440 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "TLineTypes.h"
+
+#include "GridMesh2D.h"
+#include "TriMesh2D.h"
+#include "Json.h"
+#include "MaterialDatabase.h"
+
+#include <algorithm>
+#include <memory>
+
+// Generic cross-sections are read from JSON files instead of being hard-coded. This makes it possible to simulate
+// arbitrary structures such as buses with many coupled tracks. A file contains either a single cross-section or a dict
+// with a list of "types", for example:
+//
+//     {
+//         "name": "Bus (2 tracks)",
+//         "description": "Two coupled tracks above a ground plane.",
+//         "parameters": [
+//             {"name": "Track Width", "type": "real", "default": 0.2},
+//             {"name": "Track Material", "type": "conductor", "default": "Copper"},
+//             {"name": "Substrate Material", "type": "dielectric", "default": "Isola DE104"}
+//         ],
+//         "world": [-10.0, 10.0, 0.0, 20.0],
+//         "focus": [-1.0, 1.0, 0.0, 0.5],
+//         "ports": [
+//             {"name": "Ground", "infinite_area": true, "reference": true},
+//             {"name": "Track 1"},
+//             {"name": "Track 2"}
+//         ],
+//         "conductors": [
+//             {"box": [-10.0, 10.0, 0.0, 0.0], "material": "Track Material", "port": "Ground"},
+//             {"box": [-0.6, -0.4, 0.2, 0.235], "fine": true, "material": "Track Material", "port": "Track 1"},
+//             {"box": [0.4, 0.6, 0.2, 0.235], "fine": true, "material": "Track Material", "port": "Track 2"}
+//         ],
+//         "dielectrics": [
+//             {"box": [-10.0, 10.0, 0.0, 0.2], "material": "Substrate Material"}
+//         ]
+//     }
+//
+// Lengths are in mm. Box coordinates are either numbers or the name of a real parameter. Instead of a box, conductors
+// and dielectrics can also have a "polygon", which is a list of points, e.g. [[-0.5, 0.2], [0.5, 0.2], [0.45, 0.235],
+// [-0.45, 0.235]] for a trapezoidal track. Cross-sections that contain polygons are simulated with TriMesh2D instead
+// of GridMesh2D. Boxes and polygons marked as "fine" get a fine mesh around their edges, the step size is derived from
+// the smallest fine box or polygon bounding box. Port types are "fixed" (the default) or "floating". Each mode is a
+// list of voltages for the fixed ports, e.g. {"name": "Differential", "ports": {"Track 1": 0.5, "Track 2": -0.5}}. If
+// no modes are given, every fixed port that is not a reference gets its own mode, which results in the full inductance
+// and capacitance matrices. All these modes are solved together, so the cost of the mesh factorization is shared by all
+// ports.
+
+struct GenericCoordinate {
+	real_t m_value;
+	size_t m_parameter;
+};
+
+struct GenericBox {
+	GenericCoordinate m_coordinates[4];
+	std::vector<GenericCoordinate> m_polygon; // x1, y1, x2, y2, ... (empty for boxes)
+	bool m_fine;
+	size_t m_material;
+	size_t m_port;
+};
+
+struct GenericPort {
+	GenericMesh::PortType m_type;
+	bool m_infinite_area;
+};
+
+struct GenericCrossSection {
+	std::vector<std::string> m_parameter_names;
+	GenericCoordinate m_world[4], m_focus[4];
+	std::vector<GenericPort> m_ports;
+	std::vector<GenericBox> m_conductors, m_dielectrics;
+	bool m_has_polygons;
+	Eigen::MatrixXr m_modes;
+};
+
+static size_t GenericFindParameter(const TLineType &tline_type, VDataReader reader, TLineParameterType type) {
+	std::string name = reader.AsString();
+	size_t param_index = INDEX_NONE;
+	for(size_t i = 0; i < tline_type.m_parameters.size(); ++i) {
+		if(CanonicalName(tline_type.m_parameters[i].m_name) == CanonicalName(name)) {
+			param_index = i;
+			break;
+		}
+	}
+	if(param_index == INDEX_NONE)
+		throw std::runtime_error(MakeString("Transmission line type '", tline_type.m_name, "' has no parameter '", name, "'."));
+	if(tline_type.m_parameters[param_index].m_type != type)
+		throw std::runtime_error(MakeString("Parameter '", name, "' of transmission line type '", tline_type.m_name, "' has the wrong type."));
+	return param_index;
+}
+
+static void GenericParseBox(GenericCoordinate coordinates[4], const TLineType &tline_type, VDataReader reader) {
+	if(reader.GetElementCount() != 4)
+		throw std::runtime_error(MakeString("Expected '", reader, "' to have 4 elements (x1, x2, y1, y2)."));
+	for(size_t i = 0; i < 4; ++i) {
+		VDataReader element = reader.GetElement(i);
+		if(element.GetType() == VDATA_STRING) {
+			coordinates[i].m_value = 0.0;
+			coordinates[i].m_parameter = GenericFindParameter(tline_type, element, TLINE_PARAMETERTYPE_REAL);
+		} else {
+			coordinates[i].m_value = element.AsFloat();
+			coordinates[i].m_parameter = INDEX_NONE;
+		}
+	}
+}
+
+static void GenericParsePolygon(std::vector<GenericCoordinate> &coordinates, const TLineType &tline_type, VDataReader reader) {
+	if(reader.GetElementCount() < 3)
+		throw std::runtime_error(MakeString("Expected '", reader, "' to have at least 3 points."));
+	coordinates.resize(reader.GetElementCount() * 2);
+	for(size_t i = 0; i < reader.GetElementCount(); ++i) {
+		VDataReader point = reader.GetElement(i);
+		if(point.GetElementCount() != 2)
+			throw std::runtime_error(MakeString("Expected '", point, "' to have 2 elements (x, y)."));
+		for(size_t j = 0; j < 2; ++j) {
+			VDataReader element = point.GetElement(j);
+			GenericCoordinate &coordinate = coordinates[i * 2 + j];
+			if(element.GetType() == VDATA_STRING) {
+				coordinate.m_value = 0.0;
+				coordinate.m_parameter = GenericFindParameter(tline_type, element, TLINE_PARAMETERTYPE_REAL);
+			} else {
+				coordinate.m_value = element.AsFloat();
+				coordinate.m_parameter = INDEX_NONE;
+			}
+		}
+	}
+}
+
+static void GenericParseShape(GenericBox &box, const TLineType &tline_type, VDataReader reader) {
+	if(reader.HasMember("polygon")) {
+		if(reader.HasMember("box"))
+			throw std::runtime_error(MakeString("Expected '", reader, "' to have either a box or a polygon, not both."));
+		for(size_t i = 0; i < 4; ++i) {
+			box.m_coordinates[i] = GenericCoordinate{0.0, INDEX_NONE};
+		}
+		GenericParsePolygon(box.m_polygon, tline_type, reader.GetMember("polygon"));
+	} else {
+		GenericParseBox(box.m_coordinates, tline_type, reader.GetMember("box"));
+	}
+}
+
+static size_t GenericFindPort(const std::vector<std::string> &port_names, VDataReader reader) {
+	std::string name = reader.AsString();
+	auto it = std::find(port_names.begin(), port_names.end(), name);
+	if(it == port_names.end())
+		throw std::runtime_error(MakeString("Port '", name, "' does not exist."));
+	return (size_t) (it - port_names.begin());
+}
+
+static Box2D GenericEvaluateBox(const GenericCoordinate coordinates[4], const std::vector<real_t> &values) {
+	real_t v[4];
+	for(size_t i = 0; i < 4; ++i) {
+		v[i] = ((coordinates[i].m_parameter == INDEX_NONE)? coordinates[i].m_value : values[coordinates[i].m_parameter]) * 1e-3;
+	}
+	return Box2D(v[0], v[1], v[2], v[3]).Normalized();
+}
+
+static std::vector<Vector2D> GenericEvaluatePolygon(const std::vector<GenericCoordinate> &coordinates, const std::vector<real_t> &values) {
+	std::vector<Vector2D> polygon(coordinates.size() / 2);
+	for(size_t i = 0; i < polygon.size(); ++i) {
+		const GenericCoordinate &x = coordinates[i * 2], &y = coordinates[i * 2 + 1];
+		polygon[i].x = ((x.m_parameter == INDEX_NONE)? x.m_value : values[x.m_parameter]) * 1e-3;
+		polygon[i].y = ((y.m_parameter == INDEX_NONE)? y.m_value : values[y.m_parameter]) * 1e-3;
+	}
+	return polygon;
+}
+
+static Box2D GenericEvaluateBounds(const GenericBox &box, const std::vector<real_t> &values) {
+	if(box.m_polygon.empty())
+		return GenericEvaluateBox(box.m_coordinates, values);
+	std::vector<Vector2D> polygon = GenericEvaluatePolygon(box.m_polygon, values);
+	Box2D bounds(polygon[0].x, polygon[0].x, polygon[0].y, polygon[0].y);
+	for(const Vector2D &point : polygon) {
+		bounds.x1 = std::min(bounds.x1, point.x);
+		bounds.x2 = std::max(bounds.x2, point.x);
+		bounds.y1 = std::min(bounds.y1, point.y);
+		bounds.y2 = std::max(bounds.y2, point.y);
+	}
+	return bounds;
+}
+
+static void GenericCriticalDimension(real_t &critical_dimension, const std::vector<GenericBox> &boxes, const std::vector<real_t> &values) {
+	for(const GenericBox &box : boxes) {
+		if(!box.m_fine)
+			continue;
+		Box2D b = GenericEvaluateBounds(box, values);
+		if(b.x2 > b.x1)
+			critical_dimension = std::min(critical_dimension, b.x2 - b.x1);
+		if(b.y2 > b.y1)
+			critical_dimension = std::min(critical_dimension, b.y2 - b.y1);
+	}
+}
+
+// GridMesh2D only supports boxes, it is only used for cross-sections without polygons
+static void GenericAddConductor(GridMesh2D &mesh, const GenericBox &box, const std::vector<real_t> &values, real_t step, const MaterialConductor *material, size_t port) {
+	mesh.AddConductor(GenericEvaluateBox(box.m_coordinates, values), step, material, port);
+}
+static void GenericAddDielectric(GridMesh2D &mesh, const GenericBox &box, const std::vector<real_t> &values, real_t step, const MaterialDielectric *material) {
+	mesh.AddDielectric(GenericEvaluateBox(box.m_coordinates, values), step, material);
+}
+static void GenericAddConductor(TriMesh2D &mesh, const GenericBox &box, const std::vector<real_t> &values, real_t step, const MaterialConductor *material, size_t port) {
+	if(box.m_polygon.empty()) {
+		mesh.AddConductor(GenericEvaluateBox(box.m_coordinates, values), step, material, port);
+	} else {
+		mesh.AddConductor(GenericEvaluatePolygon(box.m_polygon, values), step, material, port);
+	}
+}
+static void GenericAddDielectric(TriMesh2D &mesh, const GenericBox &box, const std::vector<real_t> &values, real_t step, const MaterialDielectric *material) {
+	if(box.m_polygon.empty()) {
+		mesh.AddDielectric(GenericEvaluateBox(box.m_coordinates, values), step, material);
+	} else {
+		mesh.AddDielectric(GenericEvaluatePolygon(box.m_polygon, values), step, material);
+	}
+}
+
+template<class MeshType>
+static void GenericAddShapes(MeshType &mesh, const GenericCrossSection &cross_section, const std::vector<real_t> &values, real_t step1, VDataDictReader &root, TLineContext &context) {
+	real_t step0 = REAL_MAX;
+	std::vector<size_t> ports(cross_section.m_ports.size());
+	for(size_t i = 0; i < cross_section.m_ports.size(); ++i) {
+		ports[i] = mesh.AddPort(cross_section.m_ports[i].m_type, cross_section.m_ports[i].m_infinite_area);
+	}
+	for(const GenericBox &box : cross_section.m_conductors) {
+		const MaterialConductor *material = FindConductor(root, cross_section.m_parameter_names[box.m_material].c_str(), context.m_material_database);
+		GenericAddConductor(mesh, box, values, (box.m_fine)? step1 : step0, material, ports[box.m_port]);
+	}
+	for(const GenericBox &box : cross_section.m_dielectrics) {
+		const MaterialDielectric *material = FindDielectric(root, cross_section.m_parameter_names[box.m_material].c_str(), context.m_material_database);
+		GenericAddDielectric(mesh, box, values, (box.m_fine)? step1 : step0, material);
+	}
+}
+
+static void TLine_Generic(const GenericCrossSection &cross_section, TLineContext &context) {
+
+	VDataDictReader root(context.m_parameters);
+
+	// read the real parameters, materials are looked up when they are used
+	std::vector<real_t> values(cross_section.m_parameter_names.size(), 0.0);
+	for(size_t i = 0; i < values.size(); ++i) {
+		VDataReader value = root.GetMember(cross_section.m_parameter_names[i].c_str());
+		if(value.GetType() == VDATA_INT || value.GetType() == VDATA_FLOAT)
+			values[i] = value.AsFloat();
+	}
+
+	Box2D world_box = GenericEvaluateBox(cross_section.m_world, values);
+	Box2D world_focus = GenericEvaluateBox(cross_section.m_focus, values);
+
+	// the critical dimension is the smallest non-zero size of all fine boxes
+	real_t critical_dimension = REAL_MAX;
+	GenericCriticalDimension(critical_dimension, cross_section.m_conductors, values);
+	GenericCriticalDimension(critical_dimension, cross_section.m_dielectrics, values);
+	if(critical_dimension == REAL_MAX)
+		critical_dimension = std::min(world_focus.x2 - world_focus.x1, world_focus.y2 - world_focus.y1);
+	if(!FinitePositive(critical_dimension))
+		throw std::runtime_error("The cross-section has no non-empty fine boxes or focus area.");
+	if(cross_section.m_has_polygons) {
+		real_t step1 = critical_dimension * TriMesh2D::DEFAULT_MESH_STEP / context.m_mesh_detail;
+		std::unique_ptr<TriMesh2D> mesh(new TriMesh2D(world_box, world_focus, TriMesh2D::DEFAULT_MESH_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+		GenericAddShapes(*mesh, cross_section, values, step1, root, context);
+		context.m_output_mesh = std::move(mesh);
+	} else {
+		real_t step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
+		std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+		GenericAddShapes(*mesh, cross_section, values, step1, root, context);
+		context.m_output_mesh = std::move(mesh);
+	}
+
+	TLineSolveModes(context, cross_section.m_modes);
+
+}
+
+static void RegisterTLine_Generic(VDataReader reader) {
+
+	std::shared_ptr<GenericCrossSection> cross_section = std::make_shared<GenericCrossSection>();
+	TLineType tline_type;
+	tline_type.m_name = reader.GetMember("name").AsString();
+	VData default_description = "";
+	tline_type.m_description = reader.GetMemberDefault("description", default_description).AsString();
+
+	// parameters
+	VDataReader parameters = reader.GetMember("parameters");
+	for(size_t i = 0; i < parameters.GetElementCount(); ++i) {
+		VDataReader parameter = parameters.GetElement(i);
+		std::string name = parameter.GetMember("name").AsString();
+		std::string type = parameter.GetMember("type").AsString();
+		VDataReader default_value = parameter.GetMember("default");
+		if(type == "real") {
+			tline_type.m_parameters.push_back(TLineParameter{name, TLINE_PARAMETERTYPE_REAL, FloatScale(default_value.AsFloat()), true, false});
+		} else if(type == "bool") {
+			tline_type.m_parameters.push_back(TLineParameter{name, TLINE_PARAMETERTYPE_BOOL, default_value.AsBool(), false, false});
+		} else if(type == "conductor") {
+			tline_type.m_parameters.push_back(TLineParameter{name, TLINE_PARAMETERTYPE_MATERIAL_CONDUCTOR, default_value.AsString(), false, false});
+		} else if(type == "dielectric") {
+			tline_type.m_parameters.push_back(TLineParameter{name, TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC, default_value.AsString(), false, false});
+		} else {
+			throw std::runtime_error(MakeString("Parameter '", name, "' has unknown type '", type, "'."));
+		}
+		cross_section->m_parameter_names.push_back(CanonicalName(name));
+	}
+
+	// world
+	GenericParseBox(cross_section->m_world, tline_type, reader.GetMember("world"));
+	GenericParseBox(cross_section->m_focus, tline_type, reader.GetMember("focus"));
+
+	// ports
+	VData default_port_type = "fixed";
+	VData default_false = false;
+	std::vector<std::string> port_names;
+	std::vector<size_t> fixed_indices;
+	std::vector<bool> reference_ports;
+	size_t fixed_count = 0;
+	VDataReader ports = reader.GetMember("ports");
+	for(size_t i = 0; i < ports.GetElementCount(); ++i) {
+		VDataReader port = ports.GetElement(i);
+		std::string name = port.GetMember("name").AsString();
+		if(std::find(port_names.begin(), port_names.end(), name) != port_names.end())
+			throw std::runtime_error(MakeString("Port '", name, "' is defined twice."));
+		std::string type = port.GetMemberDefault("type", default_port_type).AsString();
+		GenericPort generic_port;
+		if(type == "fixed") {
+			generic_port.m_type = GenericMesh::PORTTYPE_FIXED;
+		} else if(type == "floating") {
+			generic_port.m_type = GenericMesh::PORTTYPE_FLOATING;
+		} else {
+			throw std::runtime_error(MakeString("Port '", name, "' has unknown type '", type, "'."));
+		}
+		generic_port.m_infinite_area = port.GetMemberDefault("infinite_area", default_false).AsBool();
+		bool reference = port.GetMemberDefault("reference", default_false).AsBool();
+		if(reference && generic_port.m_type != GenericMesh::PORTTYPE_FIXED)
+			throw std::runtime_error(MakeString("Reference port '", name, "' must be fixed."));
+		cross_section->m_ports.push_back(generic_port);
+		port_names.push_back(name);
+		fixed_indices.push_back((generic_port.m_type == GenericMesh::PORTTYPE_FIXED)? fixed_count++ : INDEX_NONE);
+		reference_ports.push_back(reference);
+	}
+
+	// conductors and dielectrics
+	cross_section->m_has_polygons = false;
+	VDataReader conductors = reader.GetMember("conductors");
+	for(size_t i = 0; i < conductors.GetElementCount(); ++i) {
+		VDataReader conductor = conductors.GetElement(i);
+		GenericBox box;
+		GenericParseShape(box, tline_type, conductor);
+		box.m_fine = conductor.GetMemberDefault("fine", default_false).AsBool();
+		box.m_material = GenericFindParameter(tline_type, conductor.GetMember("material"), TLINE_PARAMETERTYPE_MATERIAL_CONDUCTOR);
+		box.m_port = GenericFindPort(port_names, conductor.GetMember("port"));
+		cross_section->m_has_polygons |= !box.m_polygon.empty();
+		cross_section->m_conductors.push_back(box);
+	}
+	VDataReader dielectrics = reader.GetMember("dielectrics");
+	for(size_t i = 0; i < dielectrics.GetElementCount(); ++i) {
+		VDataReader dielectric = dielectrics.GetElement(i);
+		GenericBox box;
+		GenericParseShape(box, tline_type, dielectric);
+		box.m_fine = dielectric.GetMemberDefault("fine", default_false).AsBool();
+		box.m_material = GenericFindParameter(tline_type, dielectric.GetMember("material"), TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC);
+		box.m_port = INDEX_NONE;
+		cross_section->m_has_polygons |= !box.m_polygon.empty();
+		cross_section->m_dielectrics.push_back(box);
+	}
+
+	// modes
+	if(reader.HasMember("modes")) {
+		VDataReader modes = reader.GetMember("modes");
+		cross_section->m_modes.setZero((Eigen::Index) fixed_count, (Eigen::Index) modes.GetElementCount());
+		for(size_t i = 0; i < modes.GetElementCount(); ++i) {
+			VDataReader mode = modes.GetElement(i);
+			tline_type.m_modes.push_back(mode.GetMember("name").AsString());
+			VDataReader voltages = mode.GetMember("ports");
+			for(size_t j = 0; j < voltages.GetMemberCount(); ++j) {
+				stringtag_t key = voltages.GetMemberKey(j);
+				std::string port_name = StringRegistry::GetString(key);
+				auto it = std::find(port_names.begin(), port_names.end(), port_name);
+				if(it == port_names.end())
+					throw std::runtime_error(MakeString("Port '", port_name, "' does not exist."));
+				size_t fixed_index = fixed_indices[(size_t) (it - port_names.begin())];
+				if(fixed_index == INDEX_NONE)
+					throw std::runtime_error(MakeString("Mode '", tline_type.m_modes.back(), "' uses port '", port_name, "' which is not fixed."));
+				cross_section->m_modes((Eigen::Index) fixed_index, (Eigen::Index) i) = voltages.GetMember(key).AsFloat();
+			}
+		}
+	} else {
+		for(size_t i = 0; i < port_names.size(); ++i) {
+			if(fixed_indices[i] != INDEX_NONE && !reference_ports[i])
+				tline_type.m_modes.push_back(port_names[i]);
+		}
+		cross_section->m_modes.setZero((Eigen::Index) fixed_count, (Eigen::Index) tline_type.m_modes.size());
+		size_t mode = 0;
+		for(size_t i = 0; i < port_names.size(); ++i) {
+			if(fixed_indices[i] != INDEX_NONE && !reference_ports[i])
+				cross_section->m_modes((Eigen::Index) fixed_indices[i], (Eigen::Index) mode++) = 1.0;
+		}
+	}
+	if(tline_type.m_modes.empty())
+		throw std::runtime_error(MakeString("Transmission line type '", tline_type.m_name, "' has no modes."));
+	if(tline_type.m_modes.size() >= fixed_count)
+		throw std::runtime_error(MakeString("Transmission line type '", tline_type.m_name, "' must have fewer modes than fixed ports."));
+
+	tline_type.m_simulate = [cross_section](TLineContext &context) {
+		TLine_Generic(*cross_section, context);
+	};
+	g_tline_types.push_back(std::move(tline_type));
+
+}
+
+void RegisterTLineTypesFromFile(const std::string &filename) {
+	VData data;
+	Json::FromFile(data, filename);
+	VDataReader reader(data);
+	if(reader.GetType() == VDATA_DICT && reader.HasMember("types")) {
+		VDataReader list = reader.GetMember("types");
+		for(size_t i = 0; i < list.GetElementCount(); ++i) {
+			RegisterTLine_Generic(list.GetElement(i));
+		}
+	} else {
+		RegisterTLine_Generic(reader);
+	}
+}
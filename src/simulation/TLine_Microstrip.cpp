@@ -23,9 +23,32 @@ along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
 #include "GridMesh2D.h"
 #include "Json.h"
 #include "MaterialDatabase.h"
+#include "TriMesh2D.h"
 
 #include <iostream> // TODO: remove
 
+// Generates the polygon of a trapezoidal track (with the bottom at y) and of the solder mask that covers it. The sides
+// of the solder mask are parallel to the sides of the track, at a distance equal to the solder mask thickness.
+inline void MakeTrapezoidalTrack(std::vector<Vector2D> &track_polygon, std::vector<Vector2D> &solder_mask_polygon, real_t center,
+								 real_t width_bottom, real_t width_top, real_t y, real_t thickness, real_t solder_mask_thickness) {
+	real_t slope = (thickness > 0.0)? 0.5 * (width_bottom - width_top) / thickness : 0.0;
+	real_t offset = solder_mask_thickness * std::sqrt(1.0 + slope * slope);
+	real_t mask_bottom = 0.5 * width_bottom + offset;
+	real_t mask_top = 0.5 * width_bottom - slope * (thickness + solder_mask_thickness) + offset;
+	track_polygon = {
+		Vector2D(center - 0.5 * width_bottom, y),
+		Vector2D(center + 0.5 * width_bottom, y),
+		Vector2D(center + 0.5 * width_top, y + thickness),
+		Vector2D(center - 0.5 * width_top, y + thickness),
+	};
+	solder_mask_polygon = {
+		Vector2D(center - mask_bottom, y),
+		Vector2D(center + mask_bottom, y),
+		Vector2D(center + mask_top, y + thickness + solder_mask_thickness),
+		Vector2D(center - mask_top, y + thickness + solder_mask_thickness),
+	};
+}
+
 void TLine_Microstrip_Single(TLineContext &context) {
 
 	VDataDictReader root(context.m_parameters);
@@ -39,8 +62,8 @@ void TLine_Microstrip_Single(TLineContext &context) {
 	real_t solder_mask_thickness_2 = root.GetMember("solder_mask_thickness_2").AsFloat() * 1e-3;
 	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
 
-	real_t space_x = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 15.0;
-	real_t space_y = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 25.0;
+	real_t space_x = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
 	Box2D track_box = {
 		-0.5 * track_width,
 		0.5 * track_width,
@@ -88,6 +111,7 @@ void TLine_Microstrip_Single(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -122,8 +146,8 @@ void TLine_Microstrip_Single_TwoSubstrates(TLineContext &context) {
 	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
 
 	real_t substrate_thickness_total = substrate_thickness_1 + substrate_thickness_2;
-	real_t space_x = (track_width + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 15.0;
-	real_t space_y = (track_width + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 25.0;
+	real_t space_x = (track_width + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
 	Box2D track_box = {
 		-0.5 * track_width,
 		0.5 * track_width,
@@ -177,6 +201,7 @@ void TLine_Microstrip_Single_TwoSubstrates(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -212,8 +237,8 @@ void TLine_Microstrip_Single_Buried(TLineContext &context) {
 	bool reverse_buildup = root.GetMember("reverse_buildup").AsBool();
 
 	real_t substrate_thickness_total = substrate_thickness_1 + substrate_thickness_2;
-	real_t space_x = (track_width + track_thickness + substrate_thickness_total + solder_mask_thickness) * 15.0;
-	real_t space_y = (track_width + track_thickness + substrate_thickness_total + solder_mask_thickness) * 25.0;
+	real_t space_x = (track_width + track_thickness + substrate_thickness_total + solder_mask_thickness) * 3.0;
+	real_t space_y = (track_width + track_thickness + substrate_thickness_total + solder_mask_thickness) * 3.0;
 	Box2D track_box = {
 		-0.5 * track_width,
 		0.5 * track_width,
@@ -261,6 +286,7 @@ void TLine_Microstrip_Single_Buried(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -293,8 +319,8 @@ void TLine_Microstrip_Differential(TLineContext &context) {
 	real_t solder_mask_thickness_2 = root.GetMember("solder_mask_thickness_2").AsFloat() * 1e-3;
 	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
 
-	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 15.0;
-	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 25.0;
+	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
 	Box2D track1_box = {
 		-0.5 * track_spacing - track_width,
 		-0.5 * track_spacing,
@@ -349,6 +375,7 @@ void TLine_Microstrip_Differential(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal1 = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -388,8 +415,8 @@ void TLine_Microstrip_Differential_TwoSubstrates(TLineContext &context) {
 	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
 
 	real_t substrate_thickness_total = substrate_thickness_1 + substrate_thickness_2;
-	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 15.0;
-	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 25.0;
+	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
 	Box2D track1_box = {
 		-0.5 * track_spacing - track_width,
 		-0.5 * track_spacing,
@@ -450,6 +477,7 @@ void TLine_Microstrip_Differential_TwoSubstrates(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal1 = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -490,8 +518,8 @@ void TLine_Microstrip_Differential_Buried(TLineContext &context) {
 	bool reverse_buildup = root.GetMember("reverse_buildup").AsBool();
 
 	real_t substrate_thickness_total = substrate_thickness_1 + substrate_thickness_2;
-	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + solder_mask_thickness) * 15.0;
-	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + solder_mask_thickness) * 25.0;
+	real_t space_x = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + solder_mask_thickness) * 3.0;
+	real_t space_y = (track_width * 2 + track_spacing + track_thickness + substrate_thickness_total + solder_mask_thickness) * 3.0;
 	Box2D track1_box = {
 		-0.5 * track_spacing - track_width,
 		-0.5 * track_spacing,
@@ -540,6 +568,7 @@ void TLine_Microstrip_Differential_Buried(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
 	size_t port_signal1 = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, false);
@@ -561,6 +590,160 @@ void TLine_Microstrip_Differential_Buried(TLineContext &context) {
 
 }
 
+void TLine_Microstrip_Single_Trapezoidal(TLineContext &context) {
+
+	VDataDictReader root(context.m_parameters);
+
+	real_t track_width = root.GetMember("track_width").AsFloat() * 1e-3;
+	real_t track_width_top = root.GetMember("track_width_top").AsFloat() * 1e-3;
+	real_t track_thickness = root.GetMember("track_thickness").AsFloat() * 1e-3;
+	const MaterialConductor *track_material = FindConductor(root, "track_material", context.m_material_database);
+	real_t substrate_thickness = root.GetMember("substrate_thickness").AsFloat() * 1e-3;
+	const MaterialDielectric *substrate_material = FindDielectric(root, "substrate_material", context.m_material_database);
+	real_t solder_mask_thickness_1 = root.GetMember("solder_mask_thickness_1").AsFloat() * 1e-3;
+	real_t solder_mask_thickness_2 = root.GetMember("solder_mask_thickness_2").AsFloat() * 1e-3;
+	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
+
+	real_t track_width_max = std::max(track_width, track_width_top);
+	real_t space_x = (track_width_max + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width_max + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	std::vector<Vector2D> track_polygon, solder_mask_polygon2;
+	MakeTrapezoidalTrack(track_polygon, solder_mask_polygon2, 0.0, track_width, track_width_top, substrate_thickness, track_thickness, solder_mask_thickness_1);
+	Box2D world_box = {
+		-0.5 * track_width_max - space_x,
+		0.5 * track_width_max + space_x,
+		0.0,
+		substrate_thickness + track_thickness + space_y,
+	};
+	Box2D world_focus = {
+		-0.5 * track_width_max,
+		0.5 * track_width_max,
+		0.0,
+		substrate_thickness + track_thickness,
+	};
+	Box2D ground_box = {
+		world_box.x1,
+		world_box.x2,
+		0.0,
+		0.0,
+	};
+	Box2D substrate_box = {
+		world_box.x1,
+		world_box.x2,
+		0.0,
+		substrate_thickness,
+	};
+	Box2D solder_mask_box1 = {
+		substrate_box.x1,
+		substrate_box.x2,
+		substrate_box.y2,
+		substrate_box.y2 + solder_mask_thickness_2,
+	};
+
+	real_t critical_dimension = vmin(track_width, substrate_thickness);
+	real_t step0 = REAL_MAX, step1 = critical_dimension * TriMesh2D::DEFAULT_MESH_STEP / context.m_mesh_detail;
+
+	std::unique_ptr<TriMesh2D> mesh(new TriMesh2D(world_box, world_focus, TriMesh2D::DEFAULT_MESH_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
+
+	size_t port_ground = mesh->AddPort(TriMesh2D::PORTTYPE_FIXED, true);
+	size_t port_signal = mesh->AddPort(TriMesh2D::PORTTYPE_FIXED, false);
+
+	mesh->AddConductor(ground_box, step0, track_material, port_ground);
+	mesh->AddConductor(track_polygon, step1, track_material, port_signal);
+	mesh->AddDielectric(substrate_box, step0, substrate_material);
+	mesh->AddDielectric(solder_mask_box1, step0, solder_mask_material);
+	mesh->AddDielectric(solder_mask_polygon2, step0, solder_mask_material);
+
+	context.m_output_mesh = std::move(mesh);
+
+	Eigen::MatrixXr modes(2, 1);
+	modes.col(0) << 0.0, 1.0;
+	TLineSolveModes(context, modes);
+
+}
+
+void TLine_Microstrip_Differential_Trapezoidal(TLineContext &context) {
+
+	VDataDictReader root(context.m_parameters);
+
+	real_t track_width = root.GetMember("track_width").AsFloat() * 1e-3;
+	real_t track_width_top = root.GetMember("track_width_top").AsFloat() * 1e-3;
+	real_t track_spacing = root.GetMember("track_spacing").AsFloat() * 1e-3;
+	real_t track_thickness = root.GetMember("track_thickness").AsFloat() * 1e-3;
+	const MaterialConductor *track_material = FindConductor(root, "track_material", context.m_material_database);
+	real_t substrate_thickness = root.GetMember("substrate_thickness").AsFloat() * 1e-3;
+	const MaterialDielectric *substrate_material = FindDielectric(root, "substrate_material", context.m_material_database);
+	real_t solder_mask_thickness_1 = root.GetMember("solder_mask_thickness_1").AsFloat() * 1e-3;
+	real_t solder_mask_thickness_2 = root.GetMember("solder_mask_thickness_2").AsFloat() * 1e-3;
+	const MaterialDielectric *solder_mask_material = FindDielectric(root, "solder_mask_material", context.m_material_database);
+
+	// the track spacing is measured at the bottom of the tracks
+	real_t track_width_max = std::max(track_width, track_width_top);
+	real_t track_center = 0.5 * (track_spacing + track_width);
+	real_t space_x = (track_width_max * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	real_t space_y = (track_width_max * 2 + track_spacing + track_thickness + substrate_thickness + std::max(solder_mask_thickness_1, solder_mask_thickness_2)) * 3.0;
+	std::vector<Vector2D> track1_polygon, track2_polygon, solder_mask_polygon2, solder_mask_polygon3;
+	MakeTrapezoidalTrack(track1_polygon, solder_mask_polygon2, -track_center, track_width, track_width_top, substrate_thickness, track_thickness, solder_mask_thickness_1);
+	MakeTrapezoidalTrack(track2_polygon, solder_mask_polygon3, track_center, track_width, track_width_top, substrate_thickness, track_thickness, solder_mask_thickness_1);
+	Box2D world_box = {
+		-track_center - 0.5 * track_width_max - space_x,
+		track_center + 0.5 * track_width_max + space_x,
+		0.0,
+		substrate_thickness + track_thickness + space_y,
+	};
+	Box2D world_focus = {
+		-track_center - 0.5 * track_width_max,
+		track_center + 0.5 * track_width_max,
+		0.0,
+		substrate_thickness + track_thickness,
+	};
+	Box2D ground_box = {
+		world_box.x1,
+		world_box.x2,
+		0.0,
+		0.0,
+	};
+	Box2D substrate_box = {
+		world_box.x1,
+		world_box.x2,
+		0.0,
+		substrate_thickness,
+	};
+	Box2D solder_mask_box1 = {
+		substrate_box.x1,
+		substrate_box.x2,
+		substrate_box.y2,
+		substrate_box.y2 + solder_mask_thickness_2,
+	};
+
+	real_t critical_dimension = vmin(track_width, track_spacing, substrate_thickness);
+	real_t step0 = REAL_MAX, step1 = critical_dimension * TriMesh2D::DEFAULT_MESH_STEP / context.m_mesh_detail;
+
+	std::unique_ptr<TriMesh2D> mesh(new TriMesh2D(world_box, world_focus, TriMesh2D::DEFAULT_MESH_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
+
+	size_t port_ground = mesh->AddPort(TriMesh2D::PORTTYPE_FIXED, true);
+	size_t port_signal1 = mesh->AddPort(TriMesh2D::PORTTYPE_FIXED, false);
+	size_t port_signal2 = mesh->AddPort(TriMesh2D::PORTTYPE_FIXED, false);
+
+	mesh->AddConductor(ground_box, step0, track_material, port_ground);
+	mesh->AddConductor(track1_polygon, step1, track_material, port_signal1);
+	mesh->AddConductor(track2_polygon, step1, track_material, port_signal2);
+	mesh->AddDielectric(substrate_box, step0, substrate_material);
+	mesh->AddDielectric(solder_mask_box1, step0, solder_mask_material);
+	mesh->AddDielectric(solder_mask_polygon2, step0, solder_mask_material);
+	mesh->AddDielectric(solder_mask_polygon3, step0, solder_mask_material);
+
+	context.m_output_mesh = std::move(mesh);
+
+	Eigen::MatrixXr modes(3, 2);
+	modes.col(0) << 0.0, 0.5, -0.5;
+	modes.col(1) << 0.0, 1.0, 1.0;
+	TLineSolveModes(context, modes);
+
+}
+
 void TLine_Microstrip_Asymmetric(TLineContext &context) {
 
 	VDataDictReader root(context.m_parameters);
@@ -644,6 +827,7 @@ void TLine_Microstrip_Asymmetric(TLineContext &context) {
 	real_t step0 = REAL_MAX, step1 = critical_dimension * GridMesh2D::DEFAULT_GRID_STEP / context.m_mesh_detail;
 
 	std::unique_ptr<GridMesh2D> mesh(new GridMesh2D(world_box, world_focus, GridMesh2D::DEFAULT_GRID_INC / context.m_mesh_detail, critical_dimension * 1.0e-6));
+	mesh->SetOpenBoundary(Vector2D(0.0, 0.0), Vector2D(0.0, 1.0));
 	//mesh->SetPML(pml_box, Box2D(space, space, REAL_MAX, space), 1.0);
 
 	size_t port_ground = mesh->AddPort(GridMesh2D::PORTTYPE_FIXED, true);
@@ -670,6 +854,7 @@ void TLine_Microstrip_Asymmetric(TLineContext &context) {
 void RegisterTLine_Microstrip() {
 
 	VData default_track_width = Json::FromString("1.0");
+	VData default_track_width_top = Json::FromString("0.95");
 	VData default_track_spacing = Json::FromString("1.0");
 	VData default_track_thickness = Json::FromString("0.035");
 	VData default_substrate_thickness_1 = Json::FromString("1.6");
@@ -799,6 +984,45 @@ void RegisterTLine_Microstrip() {
 		&TLine_Microstrip_Differential_Buried,
 	});
 
+	g_tline_types.push_back(TLineType{
+		"Microstrip (single, trapezoidal)",
+		"A single track above a ground plane, with sloped sides due to etching. The top of the track is usually narrower than the bottom. "
+		"Microstrips require very little space but are more susceptible to crosstalk than most other types of transmission lines.",
+		{
+			{"Track Width"            , TLINE_PARAMETERTYPE_REAL               , default_track_width            , true , 0},
+			{"Track Width Top"        , TLINE_PARAMETERTYPE_REAL               , default_track_width_top        , true , 0},
+			{"Track Thickness"        , TLINE_PARAMETERTYPE_REAL               , default_track_thickness        , true , 0},
+			{"Track Material"         , TLINE_PARAMETERTYPE_MATERIAL_CONDUCTOR , default_track_material         , false, 1},
+			{"Substrate Thickness"    , TLINE_PARAMETERTYPE_REAL               , default_substrate_thickness_1  , true , 0},
+			{"Substrate Material"     , TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC, default_substrate_material     , false, 1},
+			{"Solder Mask Thickness 1", TLINE_PARAMETERTYPE_REAL               , default_solder_mask_thickness_1, true , 0},
+			{"Solder Mask Thickness 2", TLINE_PARAMETERTYPE_REAL               , default_solder_mask_thickness_2, true , 0},
+			{"Solder Mask Material"   , TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC, default_solder_mask_material   , false, 0},
+		},
+		{"Single-ended"},
+		&TLine_Microstrip_Single_Trapezoidal,
+	});
+
+	g_tline_types.push_back(TLineType{
+		"Microstrip (differential, trapezoidal)",
+		"A differential pair above a ground plane, with sloped sides due to etching. The track spacing is measured at the bottom of the tracks. "
+		"Microstrips require very little space but are more susceptible to crosstalk than most other types of transmission lines.",
+		{
+			{"Track Width"            , TLINE_PARAMETERTYPE_REAL               , default_track_width            , true , 0},
+			{"Track Width Top"        , TLINE_PARAMETERTYPE_REAL               , default_track_width_top        , true , 0},
+			{"Track Spacing"          , TLINE_PARAMETERTYPE_REAL               , default_track_spacing          , true , 0},
+			{"Track Thickness"        , TLINE_PARAMETERTYPE_REAL               , default_track_thickness        , true , 0},
+			{"Track Material"         , TLINE_PARAMETERTYPE_MATERIAL_CONDUCTOR , default_track_material         , false, 1},
+			{"Substrate Thickness"    , TLINE_PARAMETERTYPE_REAL               , default_substrate_thickness_1  , true , 0},
+			{"Substrate Material"     , TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC, default_substrate_material     , false, 1},
+			{"Solder Mask Thickness 1", TLINE_PARAMETERTYPE_REAL               , default_solder_mask_thickness_1, true , 0},
+			{"Solder Mask Thickness 2", TLINE_PARAMETERTYPE_REAL               , default_solder_mask_thickness_2, true , 0},
+			{"Solder Mask Material"   , TLINE_PARAMETERTYPE_MATERIAL_DIELECTRIC, default_solder_mask_material   , false, 0},
+		},
+		{"Differential", "Common-mode"},
+		&TLine_Microstrip_Differential_Trapezoidal,
+	});
+
 	g_tline_types.push_back(TLineType{
 		"Microstrip (asymmetric)",
 		"A simple test case for eigenmode decomposition.",
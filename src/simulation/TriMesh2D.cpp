@@ -0,0 +1,1960 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TriMesh2D.h"
+
+#include "MiscMath.h"
+#include "StringHelper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <map>
+
+#ifndef SIMULATION_VERBOSE
+#define SIMULATION_VERBOSE 1
+#endif
+
+// bulk storage sizes of the matrix builders (a node has 6 neighbors on average, about half of them with a higher index,
+// plus the diagonal, the few columns that need more use the hash table)
+constexpr size_t POTENTIAL_BULK_SIZE = 6, SURFACE_BULK_SIZE = 4;
+
+// The refinement doesn't split polygon edges or triangles below this fraction of the smallest step size, which
+// guarantees that it terminates even for polygons with very sharp angles.
+constexpr real_t MIN_EDGE_LENGTH_FRACTION = 0.1;
+
+// Triangles outside the conductors are split if the ratio of the circumradius to the shortest edge is larger than this
+// (sqrt(2) is the limit for which Ruppert's algorithm is guaranteed to terminate, it corresponds to a minimum angle of
+// about 20.7 degrees).
+constexpr real_t MAX_RADIUS_EDGE_RATIO = M_SQRT2;
+
+// same as GridMesh2D
+constexpr real_t MEMORY_BUDGET_DETAIL_STEP = M_SQRT2;
+constexpr size_t MEMORY_BUDGET_MAX_STEPS = 6;
+
+inline size_t BytesToMegabytes(size_t bytes) {
+	return (bytes + (1 << 20) - 1) >> 20;
+}
+
+// Returns twice the signed area of the triangle (a, b, c), which is positive if the points are in counterclockwise order.
+inline real_t Orient(const Vector2D &a, const Vector2D &b, const Vector2D &c) {
+	return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+// Returns a positive value if d lies inside the circumcircle of the counterclockwise triangle (a, b, c). Results that are
+// smaller than the worst-case rounding error (using the error bound of Shewchuk) are returned as zero, otherwise
+// cocircular points (which are very common here) could make the triangulation flip the same edge back and forth.
+inline real_t InCircle(const Vector2D &a, const Vector2D &b, const Vector2D &c, const Vector2D &d) {
+	real_t adx = a.x - d.x, ady = a.y - d.y;
+	real_t bdx = b.x - d.x, bdy = b.y - d.y;
+	real_t cdx = c.x - d.x, cdy = c.y - d.y;
+	real_t alift = adx * adx + ady * ady, blift = bdx * bdx + bdy * bdy, clift = cdx * cdx + cdy * cdy;
+	real_t det = alift * (bdx * cdy - cdx * bdy) + blift * (cdx * ady - adx * cdy) + clift * (adx * bdy - bdx * ady);
+	real_t permanent = alift * (fabs(bdx * cdy) + fabs(cdx * bdy)) + blift * (fabs(cdx * ady) + fabs(adx * cdy)) +
+					   clift * (fabs(adx * bdy) + fabs(bdx * ady));
+	return (fabs(det) > 1.2e-15 * permanent)? det : 0.0;
+}
+
+inline Vector2D Circumcenter(const Vector2D &a, const Vector2D &b, const Vector2D &c) {
+	real_t bx = b.x - a.x, by = b.y - a.y;
+	real_t cx = c.x - a.x, cy = c.y - a.y;
+	real_t b2 = bx * bx + by * by, c2 = cx * cx + cy * cy;
+	real_t d = 2.0 * (bx * cy - by * cx);
+	return Vector2D(a.x + (cy * b2 - by * c2) / d, a.y + (bx * c2 - cx * b2) / d);
+}
+
+inline real_t SquaredDistance(const Vector2D &a, const Vector2D &b) {
+	return square(b.x - a.x) + square(b.y - a.y);
+}
+
+// Returns true if c lies inside the diametral circle of the segment (a, b), i.e. the angle at c is at least 90 degrees.
+inline bool Encroaches(const Vector2D &a, const Vector2D &b, const Vector2D &c) {
+	return (a.x - c.x) * (b.x - c.x) + (a.y - c.y) * (b.y - c.y) <= 0.0;
+}
+
+// Adds the stiffness matrix of a linear triangle to a matrix builder. The coefficients are the dot products of the
+// gradients of the basis functions in the x and y direction, multiplied by the area.
+template<class SparseMatrix, typename F>
+inline void BuildMatrix_Symm3(SparseMatrix &matrix, const size_t (&vars)[3], const real_t (&coef_x)[3][3], const real_t (&coef_y)[3][3], F scale_x, F scale_y) {
+	for(size_t a = 0; a < 3; ++a) {
+		matrix.Insert(vars[a], vars[a], (scale_x * coef_x[a][a] + scale_y * coef_y[a][a]) * 0.5);
+		for(size_t b = a + 1; b < 3; ++b) {
+			matrix.Insert(vars[a], vars[b], scale_x * coef_x[a][b] + scale_y * coef_y[a][b]);
+		}
+	}
+}
+
+template<typename F>
+inline void BuildMatrix_Asymm3(SparseBlockMatrixC<F> &matrix, const size_t (&rows)[3], const size_t (&cols)[3], const real_t (&coef_x)[3][3], const real_t (&coef_y)[3][3], F scale_x, F scale_y) {
+	for(size_t a = 0; a < 3; ++a) {
+		if(rows[a] != INDEX_NONE) {
+			for(size_t b = 0; b < 3; ++b) {
+				matrix.Insert(rows[a], cols[b], scale_x * coef_x[a][b] + scale_y * coef_y[a][b]);
+			}
+		}
+	}
+}
+
+TriMesh2D::TriMesh2D(const Box2D &world_box, const Box2D &world_focus, real_t mesh_inc, real_t mesh_epsilon) {
+	if(!FinitePositive(mesh_inc))
+		throw std::runtime_error("TriMesh2D error: mesh_inc must be positive.");
+	if(!FinitePositive(mesh_epsilon))
+		throw std::runtime_error("TriMesh2D error: mesh_epsilon must be positive.");
+	m_world_box = world_box.Normalized();
+	m_world_focus = world_focus.Normalized();
+	m_mesh_inc = mesh_inc;
+	m_mesh_epsilon = mesh_epsilon;
+	m_open_boundary = false;
+	m_open_boundary_origin = Vector2D(0.0, 0.0);
+	m_open_boundary_dipole = Vector2D(0.0, 1.0);
+	m_min_edge_length = 0.0;
+	m_vars_free = 0;
+	m_vars_fixed = 0;
+	m_vars_surf = 0;
+	m_port_reference = INDEX_NONE;
+	m_homogeneous_permittivity = 0.0;
+}
+
+TriMesh2D::~TriMesh2D() {
+	// nothing
+}
+
+// Same as GridMesh2D::SetOpenBoundary.
+void TriMesh2D::SetOpenBoundary(const Vector2D &origin, const Vector2D &dipole) {
+	real_t norm = std::hypot(dipole.x, dipole.y);
+	if(!FinitePositive(norm))
+		throw std::runtime_error("TriMesh2D error: The dipole direction must not be zero.");
+	m_open_boundary = true;
+	m_open_boundary_origin = origin;
+	m_open_boundary_dipole = Vector2D(dipole.x / norm, dipole.y / norm);
+}
+
+size_t TriMesh2D::AddPort(PortType type, bool infinite_area) {
+	if(IsInitialized())
+		throw std::runtime_error("TriMesh2D error: Can't add port after initialization.");
+	m_ports.emplace_back(type, infinite_area);
+	return m_ports.size() - 1;
+}
+
+void TriMesh2D::AddConductor(const Box2D &box, real_t step, const MaterialConductor *material, size_t port) {
+	AddConductor(box, Box2D(step, step, step, step), material, port);
+}
+
+void TriMesh2D::AddConductor(const Box2D &box, const Box2D &step, const MaterialConductor *material, size_t port) {
+	std::vector<Vector2D> polygon;
+	std::vector<real_t> steps;
+	BoxToPolygon(polygon, steps, box, step);
+	AddConductor(polygon, steps, material, port);
+}
+
+void TriMesh2D::AddConductor(const std::vector<Vector2D> &polygon, real_t step, const MaterialConductor *material, size_t port) {
+	AddConductor(polygon, std::vector<real_t>(polygon.size(), step), material, port);
+}
+
+// The polygon can be in clockwise or counterclockwise order, but it must not intersect itself. Polygons with zero area
+// (e.g. a line segment) are allowed for conductors, they represent conductors with negligible thickness. The step size
+// of each edge is given separately (steps[i] is the step size of the edge from point i to point i + 1), it is used at
+// both ends of the edge.
+void TriMesh2D::AddConductor(const std::vector<Vector2D> &polygon, const std::vector<real_t> &steps, const MaterialConductor *material, size_t port) {
+	if(IsInitialized())
+		throw std::runtime_error("TriMesh2D error: Can't add conductor after initialization.");
+	if(polygon.size() < 2)
+		throw std::runtime_error("TriMesh2D error: Conductor polygon must have at least 2 points.");
+	for(const Vector2D &point : polygon) {
+		if(!std::isfinite(point.x) || !std::isfinite(point.y))
+			throw std::runtime_error("TriMesh2D error: Conductor polygon must be finite.");
+	}
+	if(steps.size() != polygon.size())
+		throw std::runtime_error("TriMesh2D error: Conductor polygon must have one step per edge.");
+	for(real_t step : steps) {
+		if(!FinitePositive(step))
+			throw std::runtime_error("TriMesh2D error: Conductor step must be positive.");
+	}
+	if(material == NULL)
+		throw std::runtime_error("TriMesh2D error: Material can't be NULL.");
+	if(port >= m_ports.size())
+		throw std::runtime_error("TriMesh2D error: Invalid port index.");
+	std::vector<Vector2D> clipped_polygon = polygon;
+	std::vector<real_t> clipped_steps = steps;
+	ClipPolygon(clipped_polygon, clipped_steps, m_world_box, m_mesh_epsilon);
+	m_conductors.emplace_back(std::move(clipped_polygon), std::move(clipped_steps), material, port);
+}
+
+void TriMesh2D::AddDielectric(const Box2D &box, real_t step, const MaterialDielectric *material) {
+	AddDielectric(box, Box2D(step, step, step, step), material);
+}
+
+void TriMesh2D::AddDielectric(const Box2D &box, const Box2D &step, const MaterialDielectric *material) {
+	std::vector<Vector2D> polygon;
+	std::vector<real_t> steps;
+	BoxToPolygon(polygon, steps, box, step);
+	AddDielectric(polygon, steps, material);
+}
+
+void TriMesh2D::AddDielectric(const std::vector<Vector2D> &polygon, real_t step, const MaterialDielectric *material) {
+	AddDielectric(polygon, std::vector<real_t>(polygon.size(), step), material);
+}
+
+void TriMesh2D::AddDielectric(const std::vector<Vector2D> &polygon, const std::vector<real_t> &steps, const MaterialDielectric *material) {
+	if(IsInitialized())
+		throw std::runtime_error("TriMesh2D error: Can't add dielectric after initialization.");
+	if(polygon.size() < 3)
+		throw std::runtime_error("TriMesh2D error: Dielectric polygon must have at least 3 points.");
+	for(const Vector2D &point : polygon) {
+		if(!std::isfinite(point.x) || !std::isfinite(point.y))
+			throw std::runtime_error("TriMesh2D error: Dielectric polygon must be finite.");
+	}
+	if(steps.size() != polygon.size())
+		throw std::runtime_error("TriMesh2D error: Dielectric polygon must have one step per edge.");
+	for(real_t step : steps) {
+		if(!FinitePositive(step))
+			throw std::runtime_error("TriMesh2D error: Dielectric step must be positive.");
+	}
+	if(material == NULL)
+		throw std::runtime_error("TriMesh2D error: Material can't be NULL.");
+	std::vector<Vector2D> clipped_polygon = polygon;
+	std::vector<real_t> clipped_steps = steps;
+	ClipPolygon(clipped_polygon, clipped_steps, m_world_box, m_mesh_epsilon);
+	m_dielectrics.emplace_back(std::move(clipped_polygon), std::move(clipped_steps), material);
+}
+
+Box2D TriMesh2D::GetWorldBox2D() {
+	return m_world_box;
+}
+
+Box2D TriMesh2D::GetWorldFocus2D() {
+	return m_world_focus;
+}
+
+void TriMesh2D::GetImage2D(std::vector<real_t> &image_value, std::vector<Vector2D> &image_gradient, size_t width, size_t height, const Box2D &view, MeshImageType type, size_t mode) {
+	if(!IsInitialized())
+		throw std::runtime_error("TriMesh2D error: The mesh must be initialized first.");
+	if(type != MESHIMAGETYPE_MESH) {
+		if(!IsSolved())
+			throw std::runtime_error("TriMesh2D error: The mesh must be solved first.");
+		if(!AreFieldsRequested())
+			throw std::runtime_error("TriMesh2D error: The fields were not requested.");
+		if(mode >= GetModeCount())
+			throw std::runtime_error("TriMesh2D error: Invalid mode index.");
+	}
+
+	// clear image data
+	image_value.clear();
+	image_value.resize(width * height);
+	if(type != MESHIMAGETYPE_MESH) {
+		image_gradient.clear();
+		image_gradient.resize(width * height);
+	}
+
+	// get the values at the nodes of each triangle
+	std::vector<std::array<real_t, 3>> triangle_values;
+	GetTriangleNodeValues(triangle_values, mode, type);
+
+	// The mesh image shows the triangle edges as lines with a width of about one pixel.
+	real_t pixel_x = (view.x2 - view.x1) / (real_t) width, pixel_y = (view.y2 - view.y1) / (real_t) height;
+	real_t line_width = 0.5 * std::max(fabs(pixel_x), fabs(pixel_y));
+
+	// draw the triangles (pixels on shared edges are drawn twice, with the same value)
+	for(size_t t = 0; t < m_triangles.size(); ++t) {
+		const Triangle &triangle = m_triangles[t];
+		Vector2D points[3];
+		for(size_t k = 0; k < 3; ++k) {
+			points[k] = GetPoint(triangle.m_nodes[k]);
+		}
+		real_t area2 = Orient(points[0], points[1], points[2]);
+
+		// find the pixels that can be inside the triangle (the center of pixel i is at view.x1 + (i + 0.5) * pixel_x)
+		real_t fx1 = REAL_MAX, fx2 = -REAL_MAX, fy1 = REAL_MAX, fy2 = -REAL_MAX;
+		for(size_t k = 0; k < 3; ++k) {
+			real_t fx = (points[k].x - view.x1) / pixel_x - 0.5, fy = (points[k].y - view.y1) / pixel_y - 0.5;
+			fx1 = std::min(fx1, fx);
+			fx2 = std::max(fx2, fx);
+			fy1 = std::min(fy1, fy);
+			fy2 = std::max(fy2, fy);
+		}
+		if(fx2 < 0.0 || fy2 < 0.0 || fx1 > (real_t) width - 1.0 || fy1 > (real_t) height - 1.0)
+			continue;
+		size_t ix1 = (size_t) std::max(0.0, ceil(fx1)), ix2 = (size_t) std::min((real_t) width - 1.0, floor(fx2));
+		size_t iy1 = (size_t) std::max(0.0, ceil(fy1)), iy2 = (size_t) std::min((real_t) height - 1.0, floor(fy2));
+
+		// the gradients of the basis functions are constant
+		real_t grad_x[3], grad_y[3], heights[3];
+		for(size_t k = 0; k < 3; ++k) {
+			const Vector2D &p1 = points[(k + 1) % 3], &p2 = points[(k + 2) % 3];
+			grad_x[k] = (p1.y - p2.y) / area2;
+			grad_y[k] = (p2.x - p1.x) / area2;
+			heights[k] = area2 / std::hypot(p2.x - p1.x, p2.y - p1.y);
+		}
+		const std::array<real_t, 3> &values = triangle_values[t];
+		Vector2D gradient(values[0] * grad_x[0] + values[1] * grad_x[1] + values[2] * grad_x[2],
+						  values[0] * grad_y[0] + values[1] * grad_y[1] + values[2] * grad_y[2]);
+
+		for(size_t j = iy1; j <= iy2; ++j) {
+			real_t y = view.y1 + ((real_t) j + 0.5) * pixel_y;
+			for(size_t i = ix1; i <= ix2; ++i) {
+				real_t x = view.x1 + ((real_t) i + 0.5) * pixel_x;
+				Vector2D point(x, y);
+				real_t bary[3];
+				bool inside = true;
+				for(size_t k = 0; k < 3; ++k) {
+					bary[k] = Orient(points[(k + 1) % 3], points[(k + 2) % 3], point) / area2;
+					if(bary[k] < -1e-9)
+						inside = false;
+				}
+				if(!inside)
+					continue;
+				size_t index = i + j * width;
+				if(type == MESHIMAGETYPE_MESH) {
+					real_t edge_distance = std::min(std::min(bary[0] * heights[0], bary[1] * heights[1]), bary[2] * heights[2]);
+					image_value[index] = values[0] + ((edge_distance < line_width)? 0.0 : 0.1);
+				} else {
+					image_value[index] = bary[0] * values[0] + bary[1] * values[1] + bary[2] * values[2];
+					image_gradient[index] = gradient;
+				}
+			}
+		}
+	}
+
+}
+
+void TriMesh2D::DoInitialize() {
+	assert(!IsInitialized());
+
+	if(GetElementOrder() != 1)
+		throw std::runtime_error("TriMesh2D error: Only linear elements (order 1) are supported.");
+
+	// If there is a memory budget, reduce the mesh detail until the predicted memory usage fits (same as GridMesh2D).
+	real_t detail_reduction = 1.0;
+	for(size_t step = 0; ; ++step) {
+
+#if SIMULATION_VERBOSE
+		auto t1 = std::chrono::high_resolution_clock::now();
+#endif
+		InitTriangulation();
+#if SIMULATION_VERBOSE
+		auto t2 = std::chrono::high_resolution_clock::now();
+#endif
+		InitRefinement();
+#if SIMULATION_VERBOSE
+		auto t3 = std::chrono::high_resolution_clock::now();
+#endif
+		InitVariables();
+#if SIMULATION_VERBOSE
+		auto t4 = std::chrono::high_resolution_clock::now();
+#endif
+
+#if SIMULATION_VERBOSE
+		std::cerr << "TriMesh2D stats:"
+				  << " nodes=" << m_nodes.size()
+				  << " triangles=" << m_triangles.size()
+				  << " vars=" << m_vars_free << "+" << m_vars_fixed
+				  << std::endl;
+		std::cerr << "TriMesh2D init time:"
+				  << " triangulation=" << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us"
+				  << " refinement=" << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() << "us"
+				  << " vars=" << std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count() << "us"
+				  << std::endl;
+#endif
+
+		if(GetMemoryBudget() == 0)
+			break;
+		size_t predicted_memory = PredictMemoryUsage(1);
+		if(predicted_memory <= GetMemoryBudget())
+			break;
+		if(step == MEMORY_BUDGET_MAX_STEPS) {
+			throw std::runtime_error(MakeString("TriMesh2D error: The mesh needs about ", BytesToMegabytes(predicted_memory), " MB of memory, "
+												"which exceeds the memory budget of ", BytesToMegabytes(GetMemoryBudget()), " MB, "
+												"even after reducing the mesh detail by a factor ", detail_reduction, "."));
+		}
+
+		ClearVariables();
+		ReduceDetail(MEMORY_BUDGET_DETAIL_STEP);
+		detail_reduction *= MEMORY_BUDGET_DETAIL_STEP;
+
+	}
+
+	if(detail_reduction != 1.0) {
+		AddWarning(MakeString("The mesh detail was reduced by a factor ", detail_reduction, " to stay within the memory budget of ",
+							  BytesToMegabytes(GetMemoryBudget()), " MB."));
+	}
+
+	m_port_solver.SetMixedPrecision(IsMixedPrecision());
+
+}
+
+void TriMesh2D::DoPrepareFrequencies(const std::vector<real_t> &frequencies) {
+	std::vector<const MaterialConductor*> conductors(m_conductors.size());
+	for(size_t i = 0; i < m_conductors.size(); ++i) {
+		conductors[i] = m_conductors[i].m_material;
+	}
+	std::vector<const MaterialDielectric*> dielectrics(m_dielectrics.size());
+	for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+		dielectrics[i] = m_dielectrics[i].m_material;
+	}
+	m_material_table.Build(frequencies, conductors, dielectrics);
+
+	// same as GridMesh2D
+	bool factor_reuse = (frequencies.size() > 1 && !IsMixedPrecision());
+	if(factor_reuse && GetMemoryBudget() != 0)
+		factor_reuse = (PredictMemoryUsage(2) <= GetMemoryBudget());
+	m_port_solver.SetFactorReuse(factor_reuse);
+
+}
+
+void TriMesh2D::DoSolve() {
+	assert(IsInitialized());
+
+#if SIMULATION_VERBOSE
+	auto t1 = std::chrono::high_resolution_clock::now();
+#endif
+	BuildMatrices();
+#if SIMULATION_VERBOSE
+	auto t2 = std::chrono::high_resolution_clock::now();
+#endif
+	size_t port_reference = (m_open_boundary)? INDEX_NONE : m_port_reference; // see PortSolver::Solve
+	m_port_solver.Solve(m_matrix_epot, m_matrix_mpot, m_homogeneous_permittivity, m_matrix_surf_resid, m_matrix_surf_loss, m_surf_solver,
+						m_vector_dc_resistances, port_reference, AreLossesRequested(), AreLossesRequested() || AreFieldsRequested(), m_port_matrices);
+#if SIMULATION_VERBOSE
+	auto t3 = std::chrono::high_resolution_clock::now();
+#endif
+
+#if SIMULATION_VERBOSE
+	std::cerr << "TriMesh2D solve time:"
+			  << " build=" << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us"
+			  << " solve=" << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() << "us"
+			  << std::endl;
+	std::cerr << "TriMesh2D solver:"
+			  << " reuse=" << m_port_solver.IsFactorReuse()
+			  << " factorizations=" << m_port_solver.GetFactorizationCount()
+			  << " iterations=" << m_port_solver.GetIterationCount()
+			  << std::endl;
+	std::cerr << "TriMesh2D memory:"
+			  << " tables=" << BytesToMegabytes(GetTableMemoryUsage()) << "MB"
+			  << " matrices=" << BytesToMegabytes(GetMatrixMemoryUsage()) << "MB"
+			  << " solver=" << BytesToMegabytes(GetSolverMemoryUsage()) << "MB"
+			  << " solutions=" << BytesToMegabytes(GetSolutionMemoryUsage()) << "MB"
+			  << std::endl;
+#endif
+
+}
+
+void TriMesh2D::DoSetModes() {
+	assert(IsInitialized());
+
+	// reconstruct the solutions of the modes for the images
+	if(!AreFieldsRequested()) {
+		m_eigen_solution_epot.resize(0, 0);
+		m_eigen_solution_mpot.resize(0, 0);
+		m_eigen_solution_surf.resize(0, 0);
+		return;
+	}
+	m_port_solver.GetModeSolutions(GetModes(), m_eigen_solution_epot, m_eigen_solution_mpot, m_eigen_solution_surf);
+
+}
+
+void TriMesh2D::DoCleanup() {
+	m_matrix_epot[0].Free();
+	m_matrix_epot[1].Free();
+	m_matrix_epot[2].Free();
+	m_matrix_mpot[0].Free();
+	m_matrix_mpot[1].Free();
+	m_matrix_mpot[2].Free();
+	EigenSparseFree(m_matrix_surf_resid[0]);
+	EigenSparseFree(m_matrix_surf_resid[1]);
+	EigenSparseFree(m_matrix_surf_loss);
+	m_matrix_surf_loss_parts.clear();
+	m_matrix_surf_loss_parts.shrink_to_fit();
+	m_surf_loss_part_conductors.clear();
+	m_surf_solver.Clear();
+	m_port_solver.Clear();
+	m_material_table.Clear();
+}
+
+size_t TriMesh2D::GetFixedVariableCount() {
+	assert(IsInitialized());
+	return m_vars_fixed;
+}
+
+void TriMesh2D::InitTriangulation() {
+	assert(!IsInitialized());
+
+	if(!(m_world_box.x2 - m_world_box.x1 > m_mesh_epsilon) || !(m_world_box.y2 - m_world_box.y1 > m_mesh_epsilon))
+		throw std::runtime_error("TriMesh2D error: The world box must not be empty.");
+
+	// collect the polygon edges, the world box is treated as a polygon without conductor
+	struct PolygonEdge {
+		Vector2D m_point1, m_point2;
+		size_t m_edge;
+	};
+	std::vector<PolygonEdge> polygon_edges;
+	auto add_polygon = [&](const std::vector<Vector2D> &polygon, const std::vector<real_t> &steps, size_t edge) {
+		if(polygon.size() < 2)
+			return;
+		// a polygon with 2 points is a single edge, which gets the smallest step size of both sides
+		size_t count = (polygon.size() == 2)? 1 : polygon.size();
+		for(size_t i = 0; i < count; ++i) {
+			const Vector2D &p1 = polygon[i], &p2 = polygon[(i + 1) % polygon.size()];
+			real_t step = (polygon.size() == 2)? std::min(steps[0], steps[1]) : steps[i];
+			polygon_edges.push_back(PolygonEdge{p1, p2, edge});
+			if(step != REAL_MAX) {
+				m_size_points.push_back(SizePoint{p1, step});
+				m_size_points.push_back(SizePoint{p2, step});
+			}
+		}
+	};
+	std::vector<Vector2D> world_polygon{
+		Vector2D(m_world_box.x1, m_world_box.y1), Vector2D(m_world_box.x2, m_world_box.y1),
+		Vector2D(m_world_box.x2, m_world_box.y2), Vector2D(m_world_box.x1, m_world_box.y2),
+	};
+	add_polygon(world_polygon, std::vector<real_t>(4, REAL_MAX), m_conductors.size());
+	for(size_t i = 0; i < m_conductors.size(); ++i) {
+		add_polygon(m_conductors[i].m_polygon, m_conductors[i].m_steps, i);
+	}
+	for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+		add_polygon(m_dielectrics[i].m_polygon, m_dielectrics[i].m_steps, m_conductors.size());
+	}
+
+	// the refinement stops at a fraction of the smallest step size
+	real_t min_step = std::max(m_world_box.x2 - m_world_box.x1, m_world_box.y2 - m_world_box.y1);
+	for(const SizePoint &size_point : m_size_points) {
+		min_step = std::min(min_step, size_point.m_step);
+	}
+	m_min_edge_length = std::max(min_step * MIN_EDGE_LENGTH_FRACTION, 4.0 * m_mesh_epsilon);
+
+	// Add the end points of the polygon edges as nodes, merging points that are closer than epsilon. The corners of the
+	// world box become the first 4 nodes.
+	auto find_node = [&](const Vector2D &point) {
+		for(size_t i = 0; i < m_nodes.size(); ++i) {
+			if(fabs(m_nodes[i].m_point.x - point.x) <= m_mesh_epsilon && fabs(m_nodes[i].m_point.y - point.y) <= m_mesh_epsilon)
+				return i;
+		}
+		return AddNode(point);
+	};
+	std::vector<std::vector<std::pair<real_t, size_t>>> edge_splits(polygon_edges.size());
+	for(size_t i = 0; i < polygon_edges.size(); ++i) {
+		edge_splits[i].emplace_back(0.0, find_node(polygon_edges[i].m_point1));
+		edge_splits[i].emplace_back(1.0, find_node(polygon_edges[i].m_point2));
+	}
+
+	// Split the polygon edges where they touch or cross other edges, so the edges only meet at nodes. This compares all
+	// pairs of edges, but there are very few of them.
+	auto add_split = [&](size_t i, const Vector2D &point) {
+		const PolygonEdge &edge = polygon_edges[i];
+		real_t dx = edge.m_point2.x - edge.m_point1.x, dy = edge.m_point2.y - edge.m_point1.y;
+		real_t length = std::hypot(dx, dy);
+		real_t t = ((point.x - edge.m_point1.x) * dx + (point.y - edge.m_point1.y) * dy) / (length * length);
+		if(fabs(Orient(edge.m_point1, edge.m_point2, point)) > m_mesh_epsilon * length || t * length <= m_mesh_epsilon || (1.0 - t) * length <= m_mesh_epsilon)
+			return;
+		edge_splits[i].emplace_back(t, find_node(point));
+	};
+	for(size_t i = 0; i < polygon_edges.size(); ++i) {
+		for(size_t j = i + 1; j < polygon_edges.size(); ++j) {
+			const PolygonEdge &edge1 = polygon_edges[i], &edge2 = polygon_edges[j];
+			add_split(i, edge2.m_point1);
+			add_split(i, edge2.m_point2);
+			add_split(j, edge1.m_point1);
+			add_split(j, edge1.m_point2);
+			real_t tolerance1 = m_mesh_epsilon * std::sqrt(SquaredDistance(edge1.m_point1, edge1.m_point2));
+			real_t tolerance2 = m_mesh_epsilon * std::sqrt(SquaredDistance(edge2.m_point1, edge2.m_point2));
+			real_t o1 = Orient(edge1.m_point1, edge1.m_point2, edge2.m_point1), o2 = Orient(edge1.m_point1, edge1.m_point2, edge2.m_point2);
+			real_t o3 = Orient(edge2.m_point1, edge2.m_point2, edge1.m_point1), o4 = Orient(edge2.m_point1, edge2.m_point2, edge1.m_point2);
+			if(((o1 > tolerance1 && o2 < -tolerance1) || (o1 < -tolerance1 && o2 > tolerance1)) &&
+			   ((o3 > tolerance2 && o4 < -tolerance2) || (o3 < -tolerance2 && o4 > tolerance2))) {
+				real_t t1 = o3 / (o3 - o4), t2 = o1 / (o1 - o2);
+				size_t node = find_node(Vector2D(edge1.m_point1.x + (edge1.m_point2.x - edge1.m_point1.x) * t1,
+												 edge1.m_point1.y + (edge1.m_point2.y - edge1.m_point1.y) * t1));
+				edge_splits[i].emplace_back(t1, node);
+				edge_splits[j].emplace_back(t2, node);
+			}
+		}
+	}
+
+	// Convert the split edges to segments between consecutive nodes, without duplicates. Conductor surfaces take
+	// precedence over other polygon edges, and later conductors over earlier ones.
+	std::map<std::pair<size_t, size_t>, size_t> segment_map;
+	for(size_t i = 0; i < polygon_edges.size(); ++i) {
+		std::vector<std::pair<real_t, size_t>> &splits = edge_splits[i];
+		std::sort(splits.begin(), splits.end());
+		for(size_t k = 1; k < splits.size(); ++k) {
+			size_t node1 = splits[k - 1].second, node2 = splits[k].second;
+			if(node1 == node2)
+				continue;
+			auto key = std::make_pair(std::min(node1, node2), std::max(node1, node2));
+			auto it = segment_map.find(key);
+			if(it == segment_map.end()) {
+				segment_map.emplace(key, polygon_edges[i].m_edge);
+			} else if(polygon_edges[i].m_edge != m_conductors.size()) {
+				it->second = polygon_edges[i].m_edge;
+			}
+		}
+	}
+	std::vector<std::array<size_t, 3>> segments;
+	segments.reserve(segment_map.size());
+	for(auto &segment : segment_map) {
+		segments.push_back({{segment.first.first, segment.first.second, segment.second}});
+	}
+
+	// triangulate the world box, then insert the other nodes
+	size_t t0 = AddTriangle(INDEX_NONE), t1 = AddTriangle(INDEX_NONE);
+	SetTriangle(t0, 0, 1, 2, INDEX_NONE, t1, INDEX_NONE, INDEX_NONE, INDEX_NONE, INDEX_NONE);
+	SetTriangle(t1, 0, 2, 3, INDEX_NONE, INDEX_NONE, t0, INDEX_NONE, INDEX_NONE, INDEX_NONE);
+	std::vector<size_t> fan;
+	size_t last = t0;
+	for(size_t i = 4; i < m_nodes.size(); ++i) {
+		InsertNode(i, Locate(GetPoint(i), last), fan);
+		last = fan[0];
+	}
+
+	InitConstraints(segments);
+	InitRegions();
+
+}
+
+// Inserts the segments into the triangulation with the algorithm of Sloan: the edges that cross the segment are flipped
+// until none are left, and then the new edges are flipped until they are locally Delaunay again.
+void TriMesh2D::InitConstraints(const std::vector<std::array<size_t, 3>> &segments) {
+	assert(!IsInitialized());
+
+	std::vector<size_t> node_triangles;
+	std::deque<std::pair<size_t, size_t>> crossing_edges;
+	std::vector<std::pair<size_t, size_t>> new_edges;
+	for(const std::array<size_t, 3> &segment : segments) {
+		size_t node1 = segment[0], node2 = segment[1];
+		size_t t, i;
+		if(!FindEdge(node1, node2, t, i)) {
+			Vector2D point1 = GetPoint(node1), point2 = GetPoint(node2);
+
+			// find the first edge that crosses the segment
+			size_t left = INDEX_NONE, right = INDEX_NONE;
+			GetNodeTriangles(node1, node_triangles);
+			for(size_t tri : node_triangles) {
+				const Triangle &triangle = m_triangles[tri];
+				size_t k = GetNodeIndex(triangle, node1);
+				size_t a = triangle.m_nodes[(k + 1) % 3], b = triangle.m_nodes[(k + 2) % 3];
+				if(Orient(point1, point2, GetPoint(a)) < 0.0 && Orient(point1, point2, GetPoint(b)) > 0.0) {
+					t = tri;
+					right = a;
+					left = b;
+					break;
+				}
+			}
+			if(left == INDEX_NONE)
+				throw std::runtime_error("TriMesh2D error: Failed to insert polygon edge.");
+
+			// walk along the segment and collect the other crossing edges
+			crossing_edges.clear();
+			for( ; ; ) {
+				crossing_edges.emplace_back(right, left);
+				const Triangle &triangle = m_triangles[t];
+				size_t k = 3 - GetNodeIndex(triangle, left) - GetNodeIndex(triangle, right);
+				size_t u = triangle.m_neighbors[k];
+				if(u == INDEX_NONE)
+					throw std::runtime_error("TriMesh2D error: Failed to insert polygon edge.");
+				const Triangle &other = m_triangles[u];
+				size_t next = other.m_nodes[GetNeighborIndex(other, t)];
+				if(next == node2)
+					break;
+				real_t orient = Orient(point1, point2, GetPoint(next));
+				if(orient > 0.0) {
+					left = next;
+				} else if(orient < 0.0) {
+					right = next;
+				} else {
+					throw std::runtime_error("TriMesh2D error: Polygon edge passes through a node.");
+				}
+				t = u;
+			}
+
+			// flip the crossing edges, the edges that still cross are tried again later
+			new_edges.clear();
+			size_t attempts = 0;
+			while(!crossing_edges.empty()) {
+				if(++attempts > 100 * (segments.size() + m_triangles.size()))
+					throw std::runtime_error("TriMesh2D error: Failed to insert polygon edge.");
+				std::pair<size_t, size_t> edge = crossing_edges.front();
+				crossing_edges.pop_front();
+				size_t te, ie;
+				if(!FindEdge(edge.first, edge.second, te, ie))
+					throw std::runtime_error("TriMesh2D error: Failed to insert polygon edge.");
+				const Triangle &triangle = m_triangles[te];
+				const Triangle &other = m_triangles[triangle.m_neighbors[ie]];
+				size_t p = triangle.m_nodes[ie], d = other.m_nodes[GetNeighborIndex(other, te)];
+				size_t a = triangle.m_nodes[(ie + 1) % 3], b = triangle.m_nodes[(ie + 2) % 3];
+				if(Orient(GetPoint(p), GetPoint(a), GetPoint(d)) <= 0.0 || Orient(GetPoint(p), GetPoint(d), GetPoint(b)) <= 0.0) {
+					crossing_edges.push_back(edge); // not convex
+					continue;
+				}
+				FlipEdge(te, ie);
+				if(p != node1 && p != node2 && d != node1 && d != node2 &&
+				   (Orient(point1, point2, GetPoint(p)) > 0.0) != (Orient(point1, point2, GetPoint(d)) > 0.0)) {
+					crossing_edges.emplace_back(p, d);
+				} else {
+					new_edges.emplace_back(p, d);
+				}
+			}
+
+			// restore the Delaunay property of the new edges (except the segment itself)
+			for(bool changed = true; changed; ) {
+				changed = false;
+				for(std::pair<size_t, size_t> &edge : new_edges) {
+					if((edge.first == node1 && edge.second == node2) || (edge.first == node2 && edge.second == node1))
+						continue;
+					size_t te, ie;
+					if(!FindEdge(edge.first, edge.second, te, ie))
+						throw std::runtime_error("TriMesh2D error: Failed to insert polygon edge.");
+					const Triangle &triangle = m_triangles[te];
+					if(triangle.m_neighbors[ie] == INDEX_NONE || triangle.m_edges[ie] != INDEX_NONE)
+						continue;
+					const Triangle &other = m_triangles[triangle.m_neighbors[ie]];
+					size_t p = triangle.m_nodes[ie], d = other.m_nodes[GetNeighborIndex(other, te)];
+					size_t a = triangle.m_nodes[(ie + 1) % 3], b = triangle.m_nodes[(ie + 2) % 3];
+					if(InCircle(GetPoint(p), GetPoint(a), GetPoint(b), GetPoint(d)) > 0.0 &&
+					   Orient(GetPoint(p), GetPoint(a), GetPoint(d)) > 0.0 && Orient(GetPoint(p), GetPoint(d), GetPoint(b)) > 0.0) {
+						FlipEdge(te, ie);
+						edge = std::make_pair(p, d);
+						changed = true;
+					}
+				}
+			}
+
+			if(!FindEdge(node1, node2, t, i))
+				throw std::runtime_error("TriMesh2D error: Failed to insert polygon edge.");
+		}
+
+		// mark the edge on both sides
+		Triangle &triangle = m_triangles[t];
+		triangle.m_edges[i] = segment[2];
+		if(triangle.m_neighbors[i] != INDEX_NONE) {
+			Triangle &other = m_triangles[triangle.m_neighbors[i]];
+			other.m_edges[GetNeighborIndex(other, t)] = segment[2];
+		}
+
+	}
+
+}
+
+// Assigns the conductor and dielectric of each triangle based on its centroid. Triangles that are added later inherit
+// them from the triangle that they were split from, which is always in the same region.
+void TriMesh2D::InitRegions() {
+	assert(!IsInitialized());
+
+	for(Triangle &triangle : m_triangles) {
+		const Vector2D &p0 = GetPoint(triangle.m_nodes[0]), &p1 = GetPoint(triangle.m_nodes[1]), &p2 = GetPoint(triangle.m_nodes[2]);
+		Vector2D centroid((p0.x + p1.x + p2.x) / 3.0, (p0.y + p1.y + p2.y) / 3.0);
+		triangle.m_conductor = INDEX_NONE;
+		for(size_t i = m_conductors.size(); i > 0; --i) {
+			if(PolygonContains(m_conductors[i - 1].m_polygon, centroid)) {
+				triangle.m_conductor = i - 1;
+				break;
+			}
+		}
+		triangle.m_dielectric = INDEX_NONE;
+		for(size_t i = m_dielectrics.size(); i > 0; --i) {
+			if(PolygonContains(m_dielectrics[i - 1].m_polygon, centroid)) {
+				triangle.m_dielectric = i - 1;
+				break;
+			}
+		}
+	}
+
+}
+
+// Refines the mesh with Ruppert's algorithm. Polygon edges that are encroached (i.e. a node lies inside their diametral
+// circle) are split in half. Triangles that are too large or badly shaped are split by inserting their circumcenter,
+// unless it would encroach on a polygon edge, in which case that edge is split instead. Triangles inside conductors are
+// never refined, since they don't contribute to the matrices.
+void TriMesh2D::InitRefinement() {
+	assert(!IsInitialized());
+
+	std::deque<std::pair<size_t, size_t>> segment_queue;
+	std::deque<std::array<size_t, 4>> triangle_queue;
+	real_t min_split_length2 = square(2.0 * m_min_edge_length);
+	auto can_split = [&](size_t node1, size_t node2) {
+		return SquaredDistance(GetPoint(node1), GetPoint(node2)) >= min_split_length2;
+	};
+	auto check_triangle = [&](size_t t) {
+		const Triangle &triangle = m_triangles[t];
+		if(triangle.m_conductor != INDEX_NONE)
+			return;
+		for(size_t k = 0; k < 3; ++k) {
+			if(triangle.m_edges[k] == INDEX_NONE)
+				continue;
+			size_t a = triangle.m_nodes[(k + 1) % 3], b = triangle.m_nodes[(k + 2) % 3];
+			if(Encroaches(GetPoint(a), GetPoint(b), GetPoint(triangle.m_nodes[k])) && can_split(a, b))
+				segment_queue.emplace_back(a, b);
+		}
+		if(IsBadTriangle(t))
+			triangle_queue.push_back({{t, triangle.m_nodes[0], triangle.m_nodes[1], triangle.m_nodes[2]}});
+	};
+	for(size_t t = 0; t < m_triangles.size(); ++t) {
+		check_triangle(t);
+	}
+
+	std::vector<size_t> fan, cavity;
+	std::vector<uint8_t> in_cavity;
+	std::vector<std::pair<size_t, size_t>> encroached;
+	for( ; ; ) {
+
+		// split encroached segments first
+		if(!segment_queue.empty()) {
+			std::pair<size_t, size_t> segment = segment_queue.front();
+			segment_queue.pop_front();
+			size_t t, i;
+			if(!FindEdge(segment.first, segment.second, t, i))
+				continue; // already split
+			const Vector2D &p1 = GetPoint(segment.first), &p2 = GetPoint(segment.second);
+			size_t node = AddNode(Vector2D(0.5 * (p1.x + p2.x), 0.5 * (p1.y + p2.y)));
+			SplitEdge(t, i, node, fan);
+			Legalize(fan);
+			for(size_t f : fan) {
+				check_triangle(f);
+			}
+			continue;
+		}
+
+		if(triangle_queue.empty())
+			break;
+
+		// skip triangles that no longer exist
+		std::array<size_t, 4> entry = triangle_queue.front();
+		triangle_queue.pop_front();
+		const Triangle &triangle = m_triangles[entry[0]];
+		if(triangle.m_nodes[0] != entry[1] || triangle.m_nodes[1] != entry[2] || triangle.m_nodes[2] != entry[3])
+			continue;
+
+		// find the triangle that contains the circumcenter, if the way is blocked by a polygon edge, split it
+		Vector2D center = Circumcenter(GetPoint(entry[1]), GetPoint(entry[2]), GetPoint(entry[3]));
+		size_t blocked_edge;
+		size_t t = WalkTo(center, entry[0], blocked_edge);
+		if(blocked_edge != INDEX_NONE) {
+			const Triangle &blocked = m_triangles[t];
+			size_t a = blocked.m_nodes[(blocked_edge + 1) % 3], b = blocked.m_nodes[(blocked_edge + 2) % 3];
+			if(can_split(a, b)) {
+				segment_queue.emplace_back(a, b);
+				triangle_queue.push_back(entry);
+			}
+			continue;
+		}
+
+		// find the cavity of the circumcenter, and check whether it encroaches on any polygon edges
+		cavity.clear();
+		cavity.push_back(t);
+		in_cavity.resize(m_triangles.size(), 0);
+		in_cavity[t] = 1;
+		encroached.clear();
+		for(size_t c = 0; c < cavity.size(); ++c) {
+			const Triangle &tri = m_triangles[cavity[c]];
+			for(size_t k = 0; k < 3; ++k) {
+				size_t a = tri.m_nodes[(k + 1) % 3], b = tri.m_nodes[(k + 2) % 3];
+				if(tri.m_edges[k] != INDEX_NONE) {
+					if(Encroaches(GetPoint(a), GetPoint(b), center))
+						encroached.emplace_back(a, b);
+					continue;
+				}
+				size_t u = tri.m_neighbors[k];
+				if(u == INDEX_NONE || in_cavity[u])
+					continue;
+				const Triangle &other = m_triangles[u];
+				if(InCircle(GetPoint(other.m_nodes[0]), GetPoint(other.m_nodes[1]), GetPoint(other.m_nodes[2]), center) > 0.0) {
+					cavity.push_back(u);
+					in_cavity[u] = 1;
+				}
+			}
+		}
+		for(size_t c : cavity) {
+			in_cavity[c] = 0;
+		}
+		if(!encroached.empty()) {
+			bool split = false;
+			for(std::pair<size_t, size_t> &segment : encroached) {
+				if(can_split(segment.first, segment.second)) {
+					segment_queue.push_back(segment);
+					split = true;
+				}
+			}
+			if(split)
+				triangle_queue.push_back(entry);
+			continue;
+		}
+
+		// don't insert nodes on top of existing nodes (this can only happen due to rounding errors)
+		const Triangle &target = m_triangles[t];
+		if(SquaredDistance(GetPoint(target.m_nodes[0]), center) <= square(m_mesh_epsilon) ||
+		   SquaredDistance(GetPoint(target.m_nodes[1]), center) <= square(m_mesh_epsilon) ||
+		   SquaredDistance(GetPoint(target.m_nodes[2]), center) <= square(m_mesh_epsilon))
+			continue;
+
+		// insert the circumcenter
+		size_t node = AddNode(center);
+		InsertNode(node, t, fan);
+		for(size_t f : fan) {
+			check_triangle(f);
+		}
+
+	}
+
+}
+
+void TriMesh2D::InitVariables() {
+	assert(!IsInitialized());
+
+	// assign ports to the nodes of conductors, including conductors with zero area
+	auto set_port = [&](size_t node_index, size_t conductor) {
+		Node &node = m_nodes[node_index];
+		size_t port = m_conductors[conductor].m_port;
+		if(node.m_port != INDEX_NONE && node.m_port != port)
+			throw std::runtime_error(MakeString("TriMesh2D error: Port ", port, " makes contact with port ", node.m_port, "."));
+		node.m_port = port;
+	};
+	for(const Triangle &triangle : m_triangles) {
+		for(size_t k = 0; k < 3; ++k) {
+			if(triangle.m_conductor != INDEX_NONE)
+				set_port(triangle.m_nodes[k], triangle.m_conductor);
+			size_t conductor = GetEdgeConductor(triangle.m_edges[k]);
+			if(conductor != INDEX_NONE) {
+				set_port(triangle.m_nodes[(k + 1) % 3], conductor);
+				set_port(triangle.m_nodes[(k + 2) % 3], conductor);
+			}
+		}
+	}
+
+	// assign variables to free nodes (they are renumbered later)
+	for(Node &node : m_nodes) {
+		if(node.m_port == INDEX_NONE)
+			node.m_var = m_vars_free++;
+	}
+
+	// assign variables to ports (floating ports are coupled to many nodes, so they go last)
+	for(size_t i = 0; i < m_ports.size(); ++i) {
+		Port &port = m_ports[i];
+		switch(port.m_type) {
+			case PORTTYPE_FIXED: {
+				port.m_var = INDEX_OFFSET + m_vars_fixed++;
+				break;
+			}
+			case PORTTYPE_FLOATING: {
+				port.m_var = m_vars_free++;
+				break;
+			}
+		}
+	}
+
+	// select the reference port, preferably one with infinite area (i.e. ground)
+	for(size_t i = 0; i < m_ports.size(); ++i) {
+		Port &port = m_ports[i];
+		if(port.m_type == PORTTYPE_FIXED && (m_port_reference == INDEX_NONE || port.m_infinite_area)) {
+			m_port_reference = port.m_var - INDEX_OFFSET;
+			if(port.m_infinite_area)
+				break;
+		}
+	}
+
+	// assign port variables to nodes
+	for(size_t i = 0; i < m_nodes.size(); ++i) {
+		Node &node = m_nodes[i];
+		if(node.m_port != INDEX_NONE) {
+			node.m_var = m_ports[node.m_port].m_var;
+		}
+	}
+
+	// Renumber the free variables in approximate minimum degree order, which is a good fill-reducing ordering for
+	// unstructured meshes. The pattern of the potential matrices is derived from the triangles outside the conductors.
+	std::vector<Eigen::Triplet<real_t>> pattern_triplets;
+	for(const Triangle &triangle : m_triangles) {
+		if(triangle.m_conductor != INDEX_NONE)
+			continue;
+		for(size_t j = 0; j < 3; ++j) {
+			for(size_t k = 0; k < 3; ++k) {
+				size_t var_j = m_nodes[triangle.m_nodes[j]].m_var, var_k = m_nodes[triangle.m_nodes[k]].m_var;
+				if(var_j < m_vars_free && var_k < m_vars_free)
+					pattern_triplets.emplace_back((int) var_j, (int) var_k, 1.0);
+			}
+		}
+	}
+	Eigen::SparseMatrix<real_t> pattern((Eigen::Index) m_vars_free, (Eigen::Index) m_vars_free);
+	pattern.setFromTriplets(pattern_triplets.begin(), pattern_triplets.end());
+	pattern_triplets.clear();
+	pattern_triplets.shrink_to_fit();
+	Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> permutation;
+	Eigen::AMDOrdering<int>()(pattern, permutation);
+	EigenSparseFree(pattern);
+	std::vector<size_t> var_order(m_vars_free);
+	for(size_t i = 0; i < m_vars_free; ++i) {
+		var_order[(size_t) permutation.indices()[(Eigen::Index) i]] = i;
+	}
+	for(Node &node : m_nodes) {
+		if(node.m_var < m_vars_free)
+			node.m_var = var_order[node.m_var];
+	}
+	for(Port &port : m_ports) {
+		if(port.m_type == PORTTYPE_FLOATING)
+			port.m_var = var_order[port.m_var];
+	}
+
+	// assign variables to surface nodes
+	for(const Triangle &triangle : m_triangles) {
+		if(triangle.m_conductor != INDEX_NONE)
+			continue;
+		for(size_t k = 0; k < 3; ++k) {
+			Node &node = m_nodes[triangle.m_nodes[k]];
+			if(node.m_port != INDEX_NONE && node.m_var_surf == INDEX_NONE) {
+				node.m_var_surf = m_vars_surf++;
+			}
+		}
+	}
+
+	// sort the triangles by the last free variable they touch (with a counting sort), like GridMesh2D
+	std::vector<size_t> triangle_keys(m_triangles.size());
+	std::vector<size_t> key_offsets(m_vars_free + 2, 0);
+	for(size_t t = 0; t < m_triangles.size(); ++t) {
+		size_t key = 0;
+		for(size_t k = 0; k < 3; ++k) {
+			Node &node = m_nodes[m_triangles[t].m_nodes[k]];
+			if(node.m_port == INDEX_NONE)
+				key = std::max<size_t>(key, node.m_var + 1);
+		}
+		triangle_keys[t] = key;
+		++key_offsets[key + 1];
+	}
+	for(size_t i = 1; i < key_offsets.size(); ++i) {
+		key_offsets[i] += key_offsets[i - 1];
+	}
+	m_triangle_order.resize(m_triangles.size());
+	for(size_t t = 0; t < m_triangles.size(); ++t) {
+		m_triangle_order[key_offsets[triangle_keys[t]]++] = t;
+	}
+
+	// avoid problems later
+	if(m_vars_free == 0)
+		throw std::runtime_error("TriMesh2D error: The mesh has no free variables.");
+	if(m_vars_fixed == 0)
+		throw std::runtime_error("TriMesh2D error: The mesh has no fixed variables.");
+	if(m_vars_surf == 0)
+		throw std::runtime_error("TriMesh2D error: The mesh has no surface variables.");
+
+}
+
+void TriMesh2D::ClearVariables() {
+	assert(!IsInitialized());
+
+	// undo InitTriangulation, InitRefinement and InitVariables, so they can be called again with different settings
+	m_size_points.clear();
+	m_size_points.shrink_to_fit();
+	m_min_edge_length = 0.0;
+	m_nodes.clear();
+	m_nodes.shrink_to_fit();
+	m_triangles.clear();
+	m_triangles.shrink_to_fit();
+	m_triangle_order.clear();
+	m_triangle_order.shrink_to_fit();
+	m_vars_free = 0;
+	m_vars_fixed = 0;
+	m_vars_surf = 0;
+	m_port_reference = INDEX_NONE;
+
+}
+
+void TriMesh2D::ReduceDetail(real_t factor) {
+	assert(!IsInitialized());
+
+	// The mesh detail scales the mesh increment and all step sizes, so this has the same effect as a lower mesh detail
+	// setting. Unlimited steps (REAL_MAX) are left alone.
+	auto scale = [factor](real_t &step) {
+		if(step != REAL_MAX)
+			step *= factor;
+	};
+	scale(m_mesh_inc);
+	for(Conductor &conductor : m_conductors) {
+		for(real_t &step : conductor.m_steps) {
+			scale(step);
+		}
+	}
+	for(Dielectric &dielectric : m_dielectrics) {
+		for(real_t &step : dielectric.m_steps) {
+			scale(step);
+		}
+	}
+
+}
+
+void TriMesh2D::BuildMatrices() {
+	assert(IsInitialized() && !IsSolved());
+
+	// load material properties, from the table if possible
+	m_conductor_properties.clear();
+	m_conductor_properties.resize(m_conductors.size());
+	m_dielectric_properties.clear();
+	m_dielectric_properties.resize(m_dielectrics.size());
+	size_t table_frequency = m_material_table.FindFrequency(GetFrequency());
+	if(table_frequency != INDEX_NONE) {
+		for(size_t i = 0; i < m_conductors.size(); ++i) {
+			m_conductor_properties[i] = m_material_table.GetConductorProperties(table_frequency, i);
+		}
+		for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+			m_dielectric_properties[i] = m_material_table.GetDielectricProperties(table_frequency, i);
+		}
+	} else {
+		for(size_t i = 0; i < m_conductors.size(); ++i) {
+			GetConductorProperties(m_conductor_properties[i], m_conductors[i].m_material, GetFrequency());
+		}
+		for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+			GetDielectricProperties(m_dielectric_properties[i], m_dielectrics[i].m_material, GetFrequency());
+		}
+	}
+
+	// check whether all triangles outside the conductors have the same real isotropic permittivity (see GridMesh2D)
+	m_homogeneous_permittivity = 0.0;
+	bool homogeneous = true;
+	real_t homogeneous_permittivity = 0.0;
+	for(size_t t = 0; t < m_triangles.size() && homogeneous; ++t) {
+		const Triangle &triangle = m_triangles[t];
+		if(triangle.m_conductor != INDEX_NONE)
+			continue;
+		real_t permittivity_x = VACUUM_PERMITTIVITY, permittivity_y = VACUUM_PERMITTIVITY;
+		if(triangle.m_dielectric != INDEX_NONE) {
+			permittivity_x = m_dielectric_properties[triangle.m_dielectric].m_permittivity_x.real();
+			permittivity_y = m_dielectric_properties[triangle.m_dielectric].m_permittivity_y.real();
+		}
+		if(homogeneous_permittivity == 0.0)
+			homogeneous_permittivity = permittivity_x;
+		homogeneous = (permittivity_x == homogeneous_permittivity && permittivity_y == homogeneous_permittivity);
+	}
+	if(homogeneous)
+		m_homogeneous_permittivity = homogeneous_permittivity;
+
+	// the surface currents are needed for the surface losses and the current image
+	bool solve_surface = (AreLossesRequested() || AreFieldsRequested());
+
+	// allocate matrices
+	std::vector<real_t> port_dc_conductances(m_ports.size(), 0.0);
+	SparseBlockMatrixCSL<complex_t> matrix_epot, matrix_mpot;
+	SparseBlockMatrixC<real_t> matrix_surf_resid;
+	matrix_epot.Reset(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, POTENTIAL_BULK_SIZE);
+	matrix_mpot.Reset(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, POTENTIAL_BULK_SIZE);
+	if(solve_surface) {
+		matrix_surf_resid.Reset(m_vars_surf, 0, m_vars_free, m_vars_fixed, SURFACE_BULK_SIZE);
+	}
+
+	// build matrices
+	for(size_t i = 0; i < m_triangle_order.size(); ++i) {
+
+		// get triangle
+		const Triangle &triangle = m_triangles[m_triangle_order[i]];
+		Vector2D points[3];
+		size_t vars[3], vars_surf[3];
+		for(size_t k = 0; k < 3; ++k) {
+			const Node &node = m_nodes[triangle.m_nodes[k]];
+			points[k] = node.m_point;
+			vars[k] = node.m_var;
+			vars_surf[k] = node.m_var_surf;
+		}
+		real_t area2 = Orient(points[0], points[1], points[2]);
+
+		// skip triangles that are inside conductors
+		if(triangle.m_conductor != INDEX_NONE) {
+			size_t port = m_conductors[triangle.m_conductor].m_port;
+			real_t conductivity = m_conductor_properties[triangle.m_conductor].m_conductivity;
+			port_dc_conductances[port] += conductivity * 0.5 * area2;
+			continue;
+		}
+
+		// get dielectric properties
+		complex_t permittivity_x(VACUUM_PERMITTIVITY, 0.0), permittivity_y(VACUUM_PERMITTIVITY, 0.0);
+		if(triangle.m_dielectric != INDEX_NONE) {
+			permittivity_x = m_dielectric_properties[triangle.m_dielectric].m_permittivity_x;
+			permittivity_y = m_dielectric_properties[triangle.m_dielectric].m_permittivity_y;
+		}
+
+		// The gradient of basis function k is (b_k, c_k) / area2, so the stiffness matrix is
+		// (b_j * b_k + c_j * c_k) / (2 * area2).
+		real_t b[3], c[3], coef_x[3][3], coef_y[3][3];
+		for(size_t k = 0; k < 3; ++k) {
+			b[k] = points[(k + 1) % 3].y - points[(k + 2) % 3].y;
+			c[k] = points[(k + 2) % 3].x - points[(k + 1) % 3].x;
+		}
+		for(size_t j = 0; j < 3; ++j) {
+			for(size_t k = 0; k < 3; ++k) {
+				coef_x[j][k] = b[j] * b[k] / (2.0 * area2);
+				coef_y[j][k] = c[j] * c[k] / (2.0 * area2);
+			}
+		}
+
+		// add to potential matrices
+		BuildMatrix_Symm3(matrix_epot, vars, coef_x, coef_y, permittivity_x, permittivity_y);
+		if(m_homogeneous_permittivity == 0.0) {
+			BuildMatrix_Symm3(matrix_mpot, vars, coef_x, coef_y, complex_t(1.0 / VACUUM_PERMEABILITY), complex_t(1.0 / VACUUM_PERMEABILITY));
+		}
+
+		// add to surface residual matrix
+		if(solve_surface) {
+			BuildMatrix_Asymm3(matrix_surf_resid, vars_surf, vars, coef_x, coef_y, 1.0 / VACUUM_PERMEABILITY, 1.0 / VACUUM_PERMEABILITY);
+		}
+
+		// add the open boundary condition to the edges of the world box (see GridMesh2D::BuildMatrices)
+		if(m_open_boundary) {
+			for(size_t k = 0; k < 3; ++k) {
+				if(triangle.m_neighbors[k] != INDEX_NONE || GetEdgeConductor(triangle.m_edges[k]) != INDEX_NONE)
+					continue;
+				size_t k0 = (k + 1) % 3, k1 = (k + 2) % 3;
+				real_t length = std::sqrt(SquaredDistance(points[k0], points[k1]));
+				real_t normal_x = (points[k1].y - points[k0].y) / length, normal_y = (points[k0].x - points[k1].x) / length;
+				real_t dx = 0.5 * (points[k0].x + points[k1].x) - m_open_boundary_origin.x;
+				real_t dy = 0.5 * (points[k0].y + points[k1].y) - m_open_boundary_origin.y;
+				real_t dn = dx * normal_x + dy * normal_y;
+				real_t dp = dx * m_open_boundary_dipole.x + dy * m_open_boundary_dipole.y;
+				real_t np = normal_x * m_open_boundary_dipole.x + normal_y * m_open_boundary_dipole.y;
+				real_t alpha = 2.0 * dn / (dx * dx + dy * dy) - ((np == 0.0)? 0.0 : np / dp);
+				if(!(alpha > 0.0))
+					continue;
+				complex_t permittivity = (fabs(normal_x) > fabs(normal_y))? permittivity_x : permittivity_y;
+				complex_t coef_epot = alpha * length / 6.0 * permittivity;
+				real_t coef_mpot = alpha * length / 6.0 / VACUUM_PERMEABILITY;
+				BuildMatrix_Symm1(matrix_epot, vars[k0], vars[k1], 2.0 * coef_epot, coef_epot);
+				if(m_homogeneous_permittivity == 0.0) {
+					BuildMatrix_Symm1(matrix_mpot, vars[k0], vars[k1], complex_t(2.0 * coef_mpot), complex_t(coef_mpot));
+				}
+				if(solve_surface) {
+					BuildMatrix_Asymm1(matrix_surf_resid, vars_surf[k0], vars_surf[k1], vars[k0], vars[k1], 2.0 * coef_mpot, coef_mpot);
+				}
+			}
+		}
+
+	}
+
+	// convert port DC conductance to resistance
+	m_vector_dc_resistances.resize((Eigen::Index) m_vars_fixed);
+	for(size_t i = 0; i < m_ports.size(); ++i) {
+		size_t var = m_ports[i].m_var;
+		if(var >= INDEX_OFFSET) {
+			m_vector_dc_resistances[(Eigen::Index) (var - INDEX_OFFSET)] = (m_ports[i].m_infinite_area)? 0.0 : 1.0 / port_dc_conductances[i];
+		}
+	}
+
+	// convert to Eigen sparse matrices
+	matrix_epot.GetMatrixA().ToEigenSplit(m_matrix_epot[0]);
+	matrix_epot.GetMatrixBC().ToEigenSplit(m_matrix_epot[1]);
+	matrix_epot.GetMatrixD().ToEigenSplit(m_matrix_epot[2]);
+	matrix_mpot.GetMatrixA().ToEigenSplit(m_matrix_mpot[0]);
+	matrix_mpot.GetMatrixBC().ToEigenSplit(m_matrix_mpot[1]);
+	matrix_mpot.GetMatrixD().ToEigenSplit(m_matrix_mpot[2]);
+
+	// build the surface matrices if needed, and scale the loss matrix
+	if(solve_surface) {
+		matrix_surf_resid.GetMatrixA().ToEigen(m_matrix_surf_resid[0]);
+		matrix_surf_resid.GetMatrixB().ToEigen(m_matrix_surf_resid[1]);
+		if(!m_surf_solver.IsFactorized()) {
+			BuildSurfaceMatrices();
+		}
+	}
+	if(AreLossesRequested()) {
+		m_matrix_surf_loss = m_matrix_surf_loss_parts[0] / m_conductor_properties[m_surf_loss_part_conductors[0]].m_surface_conductivity;
+		for(size_t i = 1; i < m_matrix_surf_loss_parts.size(); ++i) {
+			m_matrix_surf_loss += m_matrix_surf_loss_parts[i] / m_conductor_properties[m_surf_loss_part_conductors[i]].m_surface_conductivity;
+		}
+	}
+
+}
+
+void TriMesh2D::BuildSurfaceMatrices() {
+	assert(IsInitialized());
+
+	// conductors with the same material share the same part of the loss matrix
+	std::vector<size_t> conductor_parts(m_conductors.size());
+	m_surf_loss_part_conductors.clear();
+	for(size_t i = 0; i < m_conductors.size(); ++i) {
+		size_t part = 0;
+		while(part < m_surf_loss_part_conductors.size() && m_conductors[m_surf_loss_part_conductors[part]].m_material != m_conductors[i].m_material) {
+			++part;
+		}
+		if(part == m_surf_loss_part_conductors.size())
+			m_surf_loss_part_conductors.push_back(i);
+		conductor_parts[i] = part;
+	}
+
+	// allocate matrices
+	SparseMatrixCSL<real_t> matrix_surf_curr;
+	std::vector<SparseMatrixCSL<real_t>> matrix_surf_loss_parts(m_surf_loss_part_conductors.size());
+	matrix_surf_curr.Reset(m_vars_surf, m_vars_surf, 2);
+	for(size_t i = 0; i < matrix_surf_loss_parts.size(); ++i) {
+		matrix_surf_loss_parts[i].Reset(m_vars_surf, m_vars_surf, 2);
+	}
+
+	// build matrices from the conductor surfaces, as seen from the triangles outside the conductors
+	for(const Triangle &triangle : m_triangles) {
+		if(triangle.m_conductor != INDEX_NONE)
+			continue;
+		for(size_t k = 0; k < 3; ++k) {
+			size_t conductor = GetEdgeConductor(triangle.m_edges[k]);
+			if(conductor == INDEX_NONE)
+				continue;
+			const Node &node0 = m_nodes[triangle.m_nodes[(k + 1) % 3]];
+			const Node &node1 = m_nodes[triangle.m_nodes[(k + 2) % 3]];
+			assert(node0.m_var_surf != INDEX_NONE);
+			assert(node1.m_var_surf != INDEX_NONE);
+			real_t coef_curr = 1.0 / 6.0 * std::sqrt(SquaredDistance(node0.m_point, node1.m_point));
+			BuildMatrix_Symm1(matrix_surf_curr, node0.m_var_surf, node1.m_var_surf, 2.0 * coef_curr, coef_curr);
+			BuildMatrix_Symm1(matrix_surf_loss_parts[conductor_parts[conductor]], node0.m_var_surf, node1.m_var_surf, 2.0 * coef_curr, coef_curr);
+		}
+	}
+
+	// convert to Eigen sparse matrices
+	Eigen::SparseMatrix<real_t> eigen_surf_curr;
+	matrix_surf_curr.ToEigen(eigen_surf_curr);
+	m_matrix_surf_loss_parts.resize(matrix_surf_loss_parts.size());
+	for(size_t i = 0; i < matrix_surf_loss_parts.size(); ++i) {
+		matrix_surf_loss_parts[i].ToEigen(m_matrix_surf_loss_parts[i]);
+	}
+
+	// The current matrix consists of one chain for each conductor perimeter, which can be factorized very efficiently.
+	m_surf_solver.Factorize(eigen_surf_curr);
+
+#if SIMULATION_VERBOSE
+	std::cerr << "TriMesh2D surface matrices: chains=" << m_surf_solver.GetChainCount()
+			  << " general=" << m_surf_solver.GetGeneralSize() << std::endl;
+#endif
+
+}
+
+size_t TriMesh2D::AddNode(const Vector2D &point) {
+	if(m_nodes.size() >= COMPACT_INDEX_LIMIT)
+		throw std::runtime_error("TriMesh2D error: The mesh has too many nodes.");
+	m_nodes.emplace_back();
+	m_nodes.back().m_point = point;
+	return m_nodes.size() - 1;
+}
+
+// Adds a triangle with the same conductor and dielectric as the parent triangle (if any).
+size_t TriMesh2D::AddTriangle(size_t parent) {
+	if(m_triangles.size() >= COMPACT_INDEX_LIMIT)
+		throw std::runtime_error("TriMesh2D error: The mesh has too many triangles.");
+	m_triangles.emplace_back();
+	if(parent != INDEX_NONE) {
+		m_triangles.back().m_conductor = m_triangles[parent].m_conductor;
+		m_triangles.back().m_dielectric = m_triangles[parent].m_dielectric;
+	}
+	return m_triangles.size() - 1;
+}
+
+void TriMesh2D::SetTriangle(size_t t, size_t n0, size_t n1, size_t n2, size_t t0, size_t t1, size_t t2, size_t e0, size_t e1, size_t e2) {
+	Triangle &triangle = m_triangles[t];
+	triangle.m_nodes[0] = n0;
+	triangle.m_nodes[1] = n1;
+	triangle.m_nodes[2] = n2;
+	triangle.m_neighbors[0] = t0;
+	triangle.m_neighbors[1] = t1;
+	triangle.m_neighbors[2] = t2;
+	triangle.m_edges[0] = e0;
+	triangle.m_edges[1] = e1;
+	triangle.m_edges[2] = e2;
+	m_nodes[n0].m_triangle = t;
+	m_nodes[n1].m_triangle = t;
+	m_nodes[n2].m_triangle = t;
+}
+
+void TriMesh2D::ReplaceNeighbor(size_t t, size_t old_neighbor, size_t new_neighbor) {
+	if(t == INDEX_NONE)
+		return;
+	Triangle &triangle = m_triangles[t];
+	triangle.m_neighbors[GetNeighborIndex(triangle, old_neighbor)] = new_neighbor;
+}
+
+// Returns all triangles that contain the given node, in counterclockwise order if possible.
+void TriMesh2D::GetNodeTriangles(size_t node, std::vector<size_t> &triangles) {
+	triangles.clear();
+	size_t start = m_nodes[node].m_triangle, t = start;
+	do {
+		triangles.push_back(t);
+		const Triangle &triangle = m_triangles[t];
+		t = triangle.m_neighbors[(GetNodeIndex(triangle, node) + 1) % 3];
+	} while(t != INDEX_NONE && t != start);
+	if(t == INDEX_NONE) {
+		// the node is on the boundary, also go clockwise
+		t = start;
+		for( ; ; ) {
+			const Triangle &triangle = m_triangles[t];
+			t = triangle.m_neighbors[(GetNodeIndex(triangle, node) + 2) % 3];
+			if(t == INDEX_NONE)
+				break;
+			triangles.push_back(t);
+		}
+	}
+}
+
+// Finds a triangle t that contains the edge between the given nodes, with i the index of the opposite node.
+bool TriMesh2D::FindEdge(size_t node1, size_t node2, size_t &t, size_t &i) {
+	std::vector<size_t> triangles;
+	GetNodeTriangles(node1, triangles);
+	for(size_t tri : triangles) {
+		const Triangle &triangle = m_triangles[tri];
+		size_t k = GetNodeIndex(triangle, node1);
+		if(triangle.m_nodes[(k + 1) % 3] == node2) {
+			t = tri;
+			i = (k + 2) % 3;
+			return true;
+		}
+		if(triangle.m_nodes[(k + 2) % 3] == node2) {
+			t = tri;
+			i = (k + 1) % 3;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Finds the triangle that contains the given point with a remembering stochastic walk: the walk never goes back to the
+// previous triangle, and the edge that is tested first is chosen pseudo-randomly. A visibility walk that always tests
+// the edges in the same order can get stuck in a cycle when rounding errors make the triangulation slightly
+// non-Delaunay (e.g. for cocircular nodes, which are very common here). If the walk still takes too long, all triangles
+// are searched.
+size_t TriMesh2D::Locate(const Vector2D &point, size_t start) {
+	size_t t = start, previous = INDEX_NONE;
+	uint32_t random = 0x12345678;
+	for(size_t step = 0; step < 4 * m_triangles.size() + 16; ++step) {
+		const Triangle &triangle = m_triangles[t];
+		random = random * 1664525u + 1013904223u;
+		size_t first = (random >> 16) % 3;
+		size_t next = INDEX_NONE;
+		for(size_t j = 0; j < 3; ++j) {
+			size_t k = (first + j) % 3;
+			if(triangle.m_neighbors[k] != INDEX_NONE && triangle.m_neighbors[k] != previous &&
+			   Orient(GetPoint(triangle.m_nodes[(k + 1) % 3]), GetPoint(triangle.m_nodes[(k + 2) % 3]), point) < 0.0) {
+				next = triangle.m_neighbors[k];
+				break;
+			}
+		}
+		if(next == INDEX_NONE)
+			return t;
+		previous = t;
+		t = next;
+	}
+	size_t best = INDEX_NONE;
+	real_t best_distance = -REAL_MAX;
+	for(size_t tri = 0; tri < m_triangles.size(); ++tri) {
+		const Triangle &triangle = m_triangles[tri];
+		real_t distance = REAL_MAX;
+		for(size_t k = 0; k < 3; ++k) {
+			const Vector2D &a = GetPoint(triangle.m_nodes[(k + 1) % 3]), &b = GetPoint(triangle.m_nodes[(k + 2) % 3]);
+			distance = std::min(distance, Orient(a, b, point) / std::sqrt(SquaredDistance(a, b)));
+		}
+		if(distance > best_distance) {
+			best = tri;
+			best_distance = distance;
+		}
+	}
+	return best;
+}
+
+// Walks in a straight line from the centroid of the start triangle to the given point. Returns the triangle that
+// contains the point, or the triangle where the walk is blocked by a polygon edge (in which case blocked_edge is the
+// index of that edge). Unlike Locate, this never crosses polygon edges, which is needed because the refinement doesn't
+// keep the mesh Delaunay across them.
+size_t TriMesh2D::WalkTo(const Vector2D &point, size_t start, size_t &blocked_edge) {
+	const Triangle &start_triangle = m_triangles[start];
+	const Vector2D &s0 = GetPoint(start_triangle.m_nodes[0]), &s1 = GetPoint(start_triangle.m_nodes[1]), &s2 = GetPoint(start_triangle.m_nodes[2]);
+	Vector2D origin((s0.x + s1.x + s2.x) / 3.0, (s0.y + s1.y + s2.y) / 3.0);
+	size_t t = start, previous = INDEX_NONE;
+	for(size_t step = 0; step < m_triangles.size() + 16; ++step) {
+		const Triangle &triangle = m_triangles[t];
+
+		// leave through the edge that the line crosses, the point must be on the other side
+		size_t exit = INDEX_NONE, fallback = INDEX_NONE;
+		for(size_t k = 0; k < 3; ++k) {
+			if(triangle.m_neighbors[k] == previous && previous != INDEX_NONE)
+				continue;
+			const Vector2D &a = GetPoint(triangle.m_nodes[(k + 1) % 3]), &b = GetPoint(triangle.m_nodes[(k + 2) % 3]);
+			if(Orient(a, b, point) >= 0.0)
+				continue;
+			if(fallback == INDEX_NONE)
+				fallback = k;
+			real_t oa = Orient(origin, point, a), ob = Orient(origin, point, b);
+			if((oa <= 0.0 && ob >= 0.0) || (oa >= 0.0 && ob <= 0.0)) {
+				exit = k;
+				break;
+			}
+		}
+		if(exit == INDEX_NONE)
+			exit = fallback;
+		if(exit == INDEX_NONE) {
+			blocked_edge = INDEX_NONE;
+			return t;
+		}
+		if(triangle.m_neighbors[exit] == INDEX_NONE || triangle.m_edges[exit] != INDEX_NONE) {
+			blocked_edge = exit;
+			return t;
+		}
+		previous = t;
+		t = triangle.m_neighbors[exit];
+	}
+	throw std::runtime_error("TriMesh2D error: Point location failed.");
+}
+
+// Inserts a node in triangle t (which must contain it) and restores the Delaunay property. If the node is on one of the
+// edges, that edge is split instead. The triangles that contain the new node are returned in fan.
+void TriMesh2D::InsertNode(size_t node, size_t t, std::vector<size_t> &fan) {
+	const Triangle &triangle = m_triangles[t];
+	Vector2D point = GetPoint(node);
+	size_t best_edge = INDEX_NONE;
+	real_t best_distance = m_mesh_epsilon;
+	for(size_t k = 0; k < 3; ++k) {
+		const Vector2D &a = GetPoint(triangle.m_nodes[(k + 1) % 3]), &b = GetPoint(triangle.m_nodes[(k + 2) % 3]);
+		real_t distance = Orient(a, b, point) / std::sqrt(SquaredDistance(a, b));
+		if(distance <= best_distance) {
+			best_distance = distance;
+			best_edge = k;
+		}
+	}
+	if(best_edge == INDEX_NONE) {
+		SplitTriangle(t, node, fan);
+	} else {
+		SplitEdge(t, best_edge, node, fan);
+	}
+	Legalize(fan);
+}
+
+// Splits triangle (a, b, c) into (p, b, c), (p, c, a) and (p, a, b).
+void TriMesh2D::SplitTriangle(size_t t, size_t node, std::vector<size_t> &fan) {
+	Triangle old = m_triangles[t];
+	size_t t1 = AddTriangle(t), t2 = AddTriangle(t);
+	SetTriangle(t , node, old.m_nodes[1], old.m_nodes[2], old.m_neighbors[0], t1, t2, old.m_edges[0], INDEX_NONE, INDEX_NONE);
+	SetTriangle(t1, node, old.m_nodes[2], old.m_nodes[0], old.m_neighbors[1], t2, t , old.m_edges[1], INDEX_NONE, INDEX_NONE);
+	SetTriangle(t2, node, old.m_nodes[0], old.m_nodes[1], old.m_neighbors[2], t , t1, old.m_edges[2], INDEX_NONE, INDEX_NONE);
+	ReplaceNeighbor(old.m_neighbors[1], t, t1);
+	ReplaceNeighbor(old.m_neighbors[2], t, t2);
+	fan.assign({t, t1, t2});
+}
+
+// Splits edge i of triangle t = (c, a, b) and its neighbor u = (d, b, a) into (p, c, a), (p, b, c), (p, d, b) and
+// (p, a, d). The halves of the edge keep its type (e.g. conductor surface).
+void TriMesh2D::SplitEdge(size_t t, size_t i, size_t node, std::vector<size_t> &fan) {
+	Triangle old_t = m_triangles[t];
+	size_t u = old_t.m_neighbors[i], edge = old_t.m_edges[i];
+	size_t c = old_t.m_nodes[i], a = old_t.m_nodes[(i + 1) % 3], b = old_t.m_nodes[(i + 2) % 3];
+	size_t tb = AddTriangle(t);
+	if(u == INDEX_NONE) {
+		SetTriangle(t , node, c, a, old_t.m_neighbors[(i + 2) % 3], INDEX_NONE, tb, old_t.m_edges[(i + 2) % 3], edge, INDEX_NONE);
+		SetTriangle(tb, node, b, c, old_t.m_neighbors[(i + 1) % 3], t, INDEX_NONE, old_t.m_edges[(i + 1) % 3], INDEX_NONE, edge);
+		ReplaceNeighbor(old_t.m_neighbors[(i + 1) % 3], t, tb);
+		fan.assign({t, tb});
+		return;
+	}
+	Triangle old_u = m_triangles[u];
+	size_t j = GetNeighborIndex(old_u, t);
+	size_t d = old_u.m_nodes[j];
+	assert(old_u.m_nodes[(j + 1) % 3] == b && old_u.m_nodes[(j + 2) % 3] == a);
+	size_t ua = AddTriangle(u);
+	SetTriangle(t , node, c, a, old_t.m_neighbors[(i + 2) % 3], ua, tb, old_t.m_edges[(i + 2) % 3], edge, INDEX_NONE);
+	SetTriangle(tb, node, b, c, old_t.m_neighbors[(i + 1) % 3], t, u, old_t.m_edges[(i + 1) % 3], INDEX_NONE, edge);
+	SetTriangle(u , node, d, b, old_u.m_neighbors[(j + 2) % 3], tb, ua, old_u.m_edges[(j + 2) % 3], edge, INDEX_NONE);
+	SetTriangle(ua, node, a, d, old_u.m_neighbors[(j + 1) % 3], u, t, old_u.m_edges[(j + 1) % 3], INDEX_NONE, edge);
+	ReplaceNeighbor(old_t.m_neighbors[(i + 1) % 3], t, tb);
+	ReplaceNeighbor(old_u.m_neighbors[(j + 1) % 3], u, ua);
+	fan.assign({t, tb, u, ua});
+}
+
+// Flips edge i of triangle t = (p, a, b) and its neighbor u = (d, b, a), which become (p, a, d) and (p, d, b).
+void TriMesh2D::FlipEdge(size_t t, size_t i) {
+	Triangle old_t = m_triangles[t];
+	size_t u = old_t.m_neighbors[i];
+	assert(u != INDEX_NONE && old_t.m_edges[i] == INDEX_NONE);
+	Triangle old_u = m_triangles[u];
+	size_t j = GetNeighborIndex(old_u, t);
+	size_t p = old_t.m_nodes[i], a = old_t.m_nodes[(i + 1) % 3], b = old_t.m_nodes[(i + 2) % 3], d = old_u.m_nodes[j];
+	SetTriangle(t, p, a, d, old_u.m_neighbors[(j + 1) % 3], u, old_t.m_neighbors[(i + 2) % 3],
+				old_u.m_edges[(j + 1) % 3], INDEX_NONE, old_t.m_edges[(i + 2) % 3]);
+	SetTriangle(u, p, d, b, old_u.m_neighbors[(j + 2) % 3], old_t.m_neighbors[(i + 1) % 3], t,
+				old_u.m_edges[(j + 2) % 3], old_t.m_edges[(i + 1) % 3], INDEX_NONE);
+	ReplaceNeighbor(old_u.m_neighbors[(j + 1) % 3], u, t);
+	ReplaceNeighbor(old_t.m_neighbors[(i + 1) % 3], t, u);
+}
+
+// Restores the Delaunay property after inserting a node, by flipping the edges opposite to the new node (Lawson's
+// algorithm). The new node is always node 0 of the triangles in the fan. Polygon edges are never flipped.
+void TriMesh2D::Legalize(std::vector<size_t> &fan) {
+	size_t node = m_triangles[fan[0]].m_nodes[0];
+	Vector2D point = GetPoint(node);
+	std::vector<size_t> stack(fan);
+	while(!stack.empty()) {
+		size_t t = stack.back();
+		stack.pop_back();
+		const Triangle &triangle = m_triangles[t];
+		size_t u = triangle.m_neighbors[0];
+		if(u == INDEX_NONE || triangle.m_edges[0] != INDEX_NONE)
+			continue;
+		const Triangle &other = m_triangles[u];
+		const Vector2D &a = GetPoint(triangle.m_nodes[1]), &b = GetPoint(triangle.m_nodes[2]);
+		const Vector2D &d = GetPoint(other.m_nodes[GetNeighborIndex(other, t)]);
+		if(InCircle(point, a, b, d) > 0.0 && Orient(point, a, d) > 0.0 && Orient(point, d, b) > 0.0) {
+			FlipEdge(t, 0);
+			fan.push_back(u);
+			stack.push_back(t);
+			stack.push_back(u);
+		}
+	}
+}
+
+// A triangle is bad if its circumradius is too large compared to the local step size or to its shortest edge.
+bool TriMesh2D::IsBadTriangle(size_t t) {
+	const Triangle &triangle = m_triangles[t];
+	if(triangle.m_conductor != INDEX_NONE)
+		return false;
+	const Vector2D &p0 = GetPoint(triangle.m_nodes[0]), &p1 = GetPoint(triangle.m_nodes[1]), &p2 = GetPoint(triangle.m_nodes[2]);
+	real_t l0 = SquaredDistance(p1, p2), l1 = SquaredDistance(p2, p0), l2 = SquaredDistance(p0, p1);
+	real_t radius2 = l0 * l1 * l2 / (4.0 * square(Orient(p0, p1, p2)));
+	real_t shortest2 = std::min(std::min(l0, l1), l2);
+	if(radius2 > square(MAX_RADIUS_EDGE_RATIO) * shortest2 && shortest2 > square(m_min_edge_length))
+		return true;
+	real_t step = GetStepSize(Vector2D((p0.x + p1.x + p2.x) / 3.0, (p0.y + p1.y + p2.y) / 3.0));
+	return (step != REAL_MAX && radius2 > 0.5 * square(step));
+}
+
+// Returns the local step size, which grows linearly with the distance to the polygon corners.
+real_t TriMesh2D::GetStepSize(const Vector2D &point) {
+	real_t step = REAL_MAX;
+	for(const SizePoint &size_point : m_size_points) {
+		step = std::min(step, size_point.m_step + m_mesh_inc * std::sqrt(SquaredDistance(point, size_point.m_point)));
+	}
+	return step;
+}
+
+// Returns the number of nonzero coefficients below the diagonal of the LDL^T factorization of the potential matrices
+// (see PortSolver::PredictFactorNonZeros). The index structure of the matrix is derived from the triangles directly.
+size_t TriMesh2D::PredictFactorNonZeros() {
+
+	// collect the coefficients above the diagonal for each column (duplicates don't matter)
+	std::vector<size_t> upper_outer(m_vars_free + 1, 0);
+	std::vector<CompactIndex> upper_inner;
+	for(size_t pass = 0; pass < 2; ++pass) {
+		for(const Triangle &triangle : m_triangles) {
+			if(triangle.m_conductor != INDEX_NONE)
+				continue;
+			size_t vars[3];
+			for(size_t j = 0; j < 3; ++j) {
+				vars[j] = m_nodes[triangle.m_nodes[j]].m_var;
+			}
+			for(size_t j = 0; j < 3; ++j) {
+				for(size_t k = 0; k < 3; ++k) {
+					if(vars[j] < vars[k] && vars[k] < m_vars_free) {
+						if(pass == 0) {
+							++upper_outer[vars[k] + 1];
+						} else {
+							upper_inner[upper_outer[vars[k]]++] = (CompactIndex) vars[j];
+						}
+					}
+				}
+			}
+		}
+		if(pass == 0) {
+			for(size_t k = 0; k < m_vars_free; ++k) {
+				upper_outer[k + 1] += upper_outer[k];
+			}
+			upper_inner.resize(upper_outer[m_vars_free]);
+		} else {
+			for(size_t k = m_vars_free; k > 0; --k) {
+				upper_outer[k] = upper_outer[k - 1];
+			}
+			upper_outer[0] = 0;
+		}
+	}
+
+	return PortSolver::PredictFactorNonZeros(m_vars_free, upper_outer, upper_inner);
+
+}
+
+// Predicts the peak memory usage of Solve, with the given number of factorizations (see GridMesh2D::PredictMemoryUsage).
+// A free variable has 3 neighbors with a higher index on average (plus the diagonal) in the potential matrices, and
+// the surface matrices have less than 4 coefficients per free variable.
+size_t TriMesh2D::PredictMemoryUsage(size_t factors) {
+	size_t potential_row_size = 4, surface_row_size = 4;
+	size_t table_memory = GetTableMemoryUsage();
+	size_t builder_memory = SparseBlockMatrixCSL<complex_t>::PredictMemoryUsage(m_vars_free, m_vars_fixed, m_vars_free, m_vars_fixed, POTENTIAL_BULK_SIZE) * 2 +
+							SparseBlockMatrixC<real_t>::PredictMemoryUsage(m_vars_surf, 0, m_vars_free, m_vars_fixed, SURFACE_BULK_SIZE);
+	size_t matrix_memory = m_vars_free * (potential_row_size * (sizeof(int) + 2 * sizeof(real_t)) * 2 + surface_row_size * (sizeof(int) + sizeof(real_t)));
+	size_t factor_memory = (PredictFactorNonZeros() * (sizeof(int) + sizeof(real_t)) + m_vars_free * (sizeof(real_t) + 4 * sizeof(int))) * factors +
+						   m_vars_free * potential_row_size * (sizeof(int) + sizeof(real_t));
+	size_t excitations = (m_open_boundary)? m_vars_fixed : m_vars_fixed - 1;
+	size_t solution_memory = ((factors > 1)? 8 : 3) * m_vars_free * excitations * sizeof(real_t);
+	size_t build_peak = table_memory + builder_memory + matrix_memory;
+	size_t solve_peak = table_memory + matrix_memory + factor_memory + solution_memory;
+
+#if SIMULATION_VERBOSE
+	std::cerr << "TriMesh2D predicted memory:"
+			  << " tables=" << BytesToMegabytes(table_memory) << "MB"
+			  << " builders=" << BytesToMegabytes(builder_memory) << "MB"
+			  << " matrices=" << BytesToMegabytes(matrix_memory) << "MB"
+			  << " factor=" << BytesToMegabytes(factor_memory) << "MB"
+			  << " solutions=" << BytesToMegabytes(solution_memory) << "MB"
+			  << " budget=" << BytesToMegabytes(GetMemoryBudget()) << "MB"
+			  << std::endl;
+#endif
+
+	return std::max(build_peak, solve_peak);
+}
+
+size_t TriMesh2D::GetMemoryUsage() {
+	return GetTableMemoryUsage() + GetMatrixMemoryUsage() + GetSolverMemoryUsage() + GetSolutionMemoryUsage();
+}
+
+size_t TriMesh2D::GetTableMemoryUsage() {
+	return m_size_points.capacity() * sizeof(SizePoint) + m_nodes.capacity() * sizeof(Node) +
+			m_triangles.capacity() * sizeof(Triangle) + m_triangle_order.capacity() * sizeof(CompactIndex);
+}
+
+size_t TriMesh2D::GetMatrixMemoryUsage() {
+	size_t usage = (size_t) m_vector_dc_resistances.size() * sizeof(real_t);
+	for(size_t i = 0; i < 3; ++i) {
+		usage += m_matrix_epot[i].GetMemoryUsage() + m_matrix_mpot[i].GetMemoryUsage();
+	}
+	usage += EigenSparseMemoryUsage(m_matrix_surf_resid[0]) + EigenSparseMemoryUsage(m_matrix_surf_resid[1]) + EigenSparseMemoryUsage(m_matrix_surf_loss);
+	for(const Eigen::SparseMatrix<real_t> &part : m_matrix_surf_loss_parts) {
+		usage += EigenSparseMemoryUsage(part);
+	}
+	return usage;
+}
+
+size_t TriMesh2D::GetSolverMemoryUsage() {
+	return m_port_solver.GetSolverMemoryUsage() + m_surf_solver.GetMemoryUsage();
+}
+
+size_t TriMesh2D::GetSolutionMemoryUsage() {
+	const Eigen::MatrixXr *matrices[] = {
+		&m_eigen_solution_epot, &m_eigen_solution_mpot, &m_eigen_solution_surf,
+	};
+	size_t usage = m_port_solver.GetSolutionMemoryUsage();
+	for(const Eigen::MatrixXr *matrix : matrices) {
+		usage += (size_t) matrix->size() * sizeof(real_t);
+	}
+	return usage;
+}
+
+// Returns the image values at the nodes of each triangle. For the mesh image, all nodes have the value of the material.
+// The energy is averaged over the triangles that share a node and have the same dielectric, like GridMesh2D.
+void TriMesh2D::GetTriangleNodeValues(std::vector<std::array<real_t, 3>> &triangle_values, size_t mode, MeshImageType type) {
+	assert(IsInitialized());
+	triangle_values.clear();
+	triangle_values.resize(m_triangles.size(), {{0.0, 0.0, 0.0}});
+	switch(type) {
+		case MESHIMAGETYPE_MESH: {
+			size_t num_materials = 0;
+			const MaterialDielectric *last_material = NULL;
+			std::vector<real_t> dielectric_values(m_dielectrics.size());
+			for(size_t i = 0; i < m_dielectrics.size(); ++i) {
+				if(m_dielectrics[i].m_material != last_material) {
+					++num_materials;
+					last_material = m_dielectrics[i].m_material;
+				}
+				dielectric_values[i] = (real_t) num_materials * 0.9 / (real_t) (num_materials + 1);
+			}
+			for(size_t t = 0; t < m_triangles.size(); ++t) {
+				const Triangle &triangle = m_triangles[t];
+				real_t val = (triangle.m_conductor != INDEX_NONE)? 0.0 : (triangle.m_dielectric != INDEX_NONE)? dielectric_values[triangle.m_dielectric] : 0.9;
+				triangle_values[t] = {{val, val, val}};
+			}
+			break;
+		}
+		case MESHIMAGETYPE_EPOT:
+		case MESHIMAGETYPE_MPOT: {
+			Eigen::MatrixXr &solution = (type == MESHIMAGETYPE_EPOT)? m_eigen_solution_epot : m_eigen_solution_mpot;
+			real_t *solution_values = solution.data() + solution.outerStride() * (ptrdiff_t) mode;
+			const real_t *fixed_values = GetModes().data() + GetModes().outerStride() * (ptrdiff_t) mode;
+			real_t max_value = 0.0;
+			for(size_t i = 0; i < m_vars_fixed; ++i) {
+				max_value = std::max(max_value, fabs(fixed_values[i]));
+			}
+			real_t scale = 1.0 / max_value;
+			for(size_t t = 0; t < m_triangles.size(); ++t) {
+				for(size_t k = 0; k < 3; ++k) {
+					size_t var = m_nodes[m_triangles[t].m_nodes[k]].m_var;
+					triangle_values[t][k] = (var < INDEX_OFFSET)? solution_values[var] * scale : fixed_values[var - INDEX_OFFSET] * scale;
+				}
+			}
+			break;
+		}
+		case MESHIMAGETYPE_ENERGY: {
+			real_t *solution_epot = m_eigen_solution_epot.data() + m_eigen_solution_epot.outerStride() * (ptrdiff_t) mode;
+			real_t *solution_mpot = m_eigen_solution_mpot.data() + m_eigen_solution_mpot.outerStride() * (ptrdiff_t) mode;
+			const real_t *fixed_values = GetModes().data() + GetModes().outerStride() * (ptrdiff_t) mode;
+			std::vector<std::vector<real_t>> dielectric_values(m_dielectrics.size() + 1);
+			std::vector<std::vector<int32_t>> dielectric_count(m_dielectrics.size() + 1);
+			for(size_t i = 0; i < dielectric_values.size(); ++i) {
+				dielectric_values[i].resize(m_nodes.size(), 0.0);
+				dielectric_count[i].resize(m_nodes.size(), 0);
+			}
+			for(size_t pass = 0; pass < 2; ++pass) {
+				for(size_t t = 0; t < m_triangles.size(); ++t) {
+					const Triangle &triangle = m_triangles[t];
+					if(triangle.m_conductor != INDEX_NONE)
+						continue;
+					size_t dielectric_index = (triangle.m_dielectric == INDEX_NONE)? 0 : triangle.m_dielectric + 1;
+					if(pass == 1) {
+						for(size_t k = 0; k < 3; ++k) {
+							size_t node = triangle.m_nodes[k];
+							triangle_values[t][k] = dielectric_values[dielectric_index][node] / (real_t) dielectric_count[dielectric_index][node];
+						}
+						continue;
+					}
+					const Vector2D &p0 = GetPoint(triangle.m_nodes[0]), &p1 = GetPoint(triangle.m_nodes[1]), &p2 = GetPoint(triangle.m_nodes[2]);
+					const Vector2D *points[3] = {&p0, &p1, &p2};
+					real_t area2 = Orient(p0, p1, p2);
+					real_t ex = 0.0, ey = 0.0, hx = 0.0, hy = 0.0;
+					for(size_t k = 0; k < 3; ++k) {
+						size_t var = m_nodes[triangle.m_nodes[k]].m_var;
+						real_t value_epot = (var < INDEX_OFFSET)? solution_epot[var] : fixed_values[var - INDEX_OFFSET];
+						real_t value_mpot = (var < INDEX_OFFSET)? solution_mpot[var] : fixed_values[var - INDEX_OFFSET];
+						real_t b = points[(k + 1) % 3]->y - points[(k + 2) % 3]->y, c = points[(k + 2) % 3]->x - points[(k + 1) % 3]->x;
+						ex += value_epot * b;
+						ey += value_epot * c;
+						hx += value_mpot * b;
+						hy += value_mpot * c;
+					}
+					real_t energy = (ex * hx + ey * hy) / square(area2);
+					for(size_t k = 0; k < 3; ++k) {
+						dielectric_values[dielectric_index][triangle.m_nodes[k]] += energy;
+						++dielectric_count[dielectric_index][triangle.m_nodes[k]];
+					}
+				}
+			}
+			real_t max_value = 0.0;
+			for(size_t t = 0; t < triangle_values.size(); ++t) {
+				for(size_t k = 0; k < 3; ++k) {
+					max_value = std::max(max_value, fabs(triangle_values[t][k]));
+				}
+			}
+			real_t scale = 1.0 / max_value;
+			for(size_t t = 0; t < triangle_values.size(); ++t) {
+				for(size_t k = 0; k < 3; ++k) {
+					triangle_values[t][k] *= scale;
+				}
+			}
+			break;
+		}
+		case MESHIMAGETYPE_CURRENT: {
+			real_t *solution_values = m_eigen_solution_surf.data() + m_eigen_solution_surf.outerStride() * (ptrdiff_t) mode;
+			real_t max_value = 0.0;
+			for(size_t i = 0; i < m_vars_surf; ++i) {
+				max_value = std::max(max_value, fabs(solution_values[i]));
+			}
+			real_t scale = 1.0 / max_value;
+			for(size_t t = 0; t < m_triangles.size(); ++t) {
+				const Triangle &triangle = m_triangles[t];
+				if(triangle.m_conductor == INDEX_NONE)
+					continue;
+				for(size_t k = 0; k < 3; ++k) {
+					size_t var_surf = m_nodes[triangle.m_nodes[k]].m_var_surf;
+					triangle_values[t][k] = (var_surf == INDEX_NONE)? 0.0 : solution_values[var_surf] * scale;
+				}
+			}
+			break;
+		}
+	}
+}
+
+// Converts a box to a counterclockwise polygon, with the step sizes of the sides in the same order.
+void TriMesh2D::BoxToPolygon(std::vector<Vector2D> &polygon, std::vector<real_t> &steps, const Box2D &box, const Box2D &step) {
+	Box2D b = box.Normalized();
+	polygon = {Vector2D(b.x1, b.y1), Vector2D(b.x2, b.y1), Vector2D(b.x2, b.y2), Vector2D(b.x1, b.y2)};
+	steps = {step.y1, step.x2, step.y2, step.x1};
+}
+
+// Clips the polygon to the box (Sutherland-Hodgman) and removes duplicate points. New edges along the sides of the box
+// get step size REAL_MAX, since they coincide with the edges of the world box.
+void TriMesh2D::ClipPolygon(std::vector<Vector2D> &polygon, std::vector<real_t> &steps, const Box2D &box, real_t epsilon) {
+	for(size_t side = 0; side < 4; ++side) {
+		auto distance = [&](const Vector2D &point) {
+			switch(side) {
+				case 0: return point.x - box.x1;
+				case 1: return box.x2 - point.x;
+				case 2: return point.y - box.y1;
+				default: return box.y2 - point.y;
+			}
+		};
+		std::vector<Vector2D> result_polygon;
+		std::vector<real_t> result_steps;
+		for(size_t i = 0; i < polygon.size(); ++i) {
+			const Vector2D &p1 = polygon[i], &p2 = polygon[(i + 1) % polygon.size()];
+			real_t d1 = distance(p1), d2 = distance(p2);
+			if(d1 >= 0.0) {
+				result_polygon.push_back(p1);
+				result_steps.push_back(steps[i]);
+			}
+			if((d1 >= 0.0) != (d2 >= 0.0)) {
+				real_t frac = d1 / (d1 - d2);
+				result_polygon.emplace_back(p1.x + (p2.x - p1.x) * frac, p1.y + (p2.y - p1.y) * frac);
+				result_steps.push_back((d2 >= 0.0)? steps[i] : REAL_MAX);
+			}
+		}
+		polygon = std::move(result_polygon);
+		steps = std::move(result_steps);
+	}
+	auto same_point = [&](const Vector2D &a, const Vector2D &b) {
+		return fabs(a.x - b.x) <= epsilon && fabs(a.y - b.y) <= epsilon;
+	};
+	std::vector<Vector2D> result_polygon;
+	std::vector<real_t> result_steps;
+	for(size_t i = 0; i < polygon.size(); ++i) {
+		if(!result_polygon.empty() && same_point(polygon[i], result_polygon.back())) {
+			result_steps.back() = std::min(result_steps.back(), steps[i]);
+		} else {
+			result_polygon.push_back(polygon[i]);
+			result_steps.push_back(steps[i]);
+		}
+	}
+	while(result_polygon.size() > 1 && same_point(result_polygon.front(), result_polygon.back())) {
+		result_steps[0] = std::min(result_steps[0], result_steps.back());
+		result_polygon.pop_back();
+		result_steps.pop_back();
+	}
+	polygon = std::move(result_polygon);
+	steps = std::move(result_steps);
+}
+
+// Even-odd rule, polygons with less than 3 points contain nothing.
+bool TriMesh2D::PolygonContains(const std::vector<Vector2D> &polygon, const Vector2D &point) {
+	if(polygon.size() < 3)
+		return false;
+	bool inside = false;
+	for(size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+		const Vector2D &a = polygon[i], &b = polygon[j];
+		if((a.y > point.y) != (b.y > point.y)) {
+			real_t x = a.x + (point.y - a.y) * (b.x - a.x) / (b.y - a.y);
+			if(point.x < x)
+				inside = !inside;
+		}
+	}
+	return inside;
+}
+
+size_t TriMesh2D::GetNodeIndex(const Triangle &triangle, size_t node) {
+	for(size_t k = 0; k < 2; ++k) {
+		if(triangle.m_nodes[k] == node)
+			return k;
+	}
+	assert(triangle.m_nodes[2] == node);
+	return 2;
+}
+
+size_t TriMesh2D::GetNeighborIndex(const Triangle &triangle, size_t neighbor) {
+	for(size_t k = 0; k < 2; ++k) {
+		if(triangle.m_neighbors[k] == neighbor)
+			return k;
+	}
+	assert(triangle.m_neighbors[2] == neighbor);
+	return 2;
+}
@@ -0,0 +1,207 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Basics.h"
+#include "ChainSolver.h"
+#include "Eigen.h"
+#include "EigenSparse.h"
+#include "GenericMesh.h"
+#include "MaterialDatabase.h"
+#include "PortSolver.h"
+#include "SparseMatrix.h"
+#include "Vector.h"
+
+// Unstructured mesh of linear triangular elements. Conductors and dielectrics are arbitrary polygons (e.g. trapezoidal
+// tracks), which GridMesh2D can only approximate with a staircase of very small cells. The mesh is a constrained
+// Delaunay triangulation of the polygon edges, which is refined (Ruppert's algorithm) until all triangles outside the
+// conductors are well-shaped and no larger than the local step size. The step size grows linearly with the distance
+// to the polygon corners, where the fields and surface currents are singular. Unlike a tensor grid, the small triangles
+// stay close to the corners that need them, so sloped edges don't need any more nodes than straight ones.
+
+class TriMesh2D : public GenericMesh {
+
+public:
+	static constexpr real_t DEFAULT_MESH_INC = 0.15;
+	static constexpr real_t DEFAULT_MESH_STEP = 0.0001;
+
+private:
+	struct Port {
+		PortType m_type;
+		bool m_infinite_area;
+		size_t m_var;
+		inline Port(PortType type, bool infinite_area) : m_type(type), m_infinite_area(infinite_area), m_var(INDEX_NONE) {}
+	};
+	struct Conductor {
+		std::vector<Vector2D> m_polygon;
+		std::vector<real_t> m_steps;
+		const MaterialConductor *m_material;
+		size_t m_port;
+		inline Conductor(std::vector<Vector2D> &&polygon, std::vector<real_t> &&steps, const MaterialConductor *material, size_t port)
+			: m_polygon(std::move(polygon)), m_steps(std::move(steps)), m_material(material), m_port(port) {}
+	};
+	struct Dielectric {
+		std::vector<Vector2D> m_polygon;
+		std::vector<real_t> m_steps;
+		const MaterialDielectric *m_material;
+		inline Dielectric(std::vector<Vector2D> &&polygon, std::vector<real_t> &&steps, const MaterialDielectric *material)
+			: m_polygon(std::move(polygon)), m_steps(std::move(steps)), m_material(material) {}
+	};
+	struct SizePoint {
+		Vector2D m_point;
+		real_t m_step;
+	};
+	// nodes and triangles use compact indices to save memory bandwidth (the constructors set them to INDEX_NONE)
+	struct Node {
+		Vector2D m_point;
+		CompactIndex m_triangle; // any triangle that contains the node
+		CompactIndex m_port;
+		CompactIndex m_var, m_var_surf;
+	};
+	// The nodes are in counterclockwise order. Neighbor and edge i refer to the edge opposite to node i. The edge is
+	// INDEX_NONE for normal edges, the conductor index for conductor surfaces, or the number of conductors for other
+	// polygon edges. Polygon edges are constrained, the triangulation never flips them.
+	struct Triangle {
+		CompactIndex m_nodes[3];
+		CompactIndex m_neighbors[3];
+		CompactIndex m_edges[3];
+		CompactIndex m_conductor, m_dielectric;
+	};
+
+private:
+	Box2D m_world_box, m_world_focus;
+	real_t m_mesh_inc, m_mesh_epsilon;
+
+	bool m_open_boundary;
+	Vector2D m_open_boundary_origin, m_open_boundary_dipole;
+
+	std::vector<Port> m_ports;
+	std::vector<Conductor> m_conductors;
+	std::vector<Dielectric> m_dielectrics;
+
+	std::vector<SizePoint> m_size_points;
+	real_t m_min_edge_length;
+	std::vector<Node> m_nodes;
+	std::vector<Triangle> m_triangles;
+	std::vector<CompactIndex> m_triangle_order;
+	size_t m_vars_free, m_vars_fixed, m_vars_surf;
+	size_t m_port_reference;
+
+	MaterialPropertyTable m_material_table;
+	std::vector<MaterialConductorProperties> m_conductor_properties;
+	std::vector<MaterialDielectricProperties> m_dielectric_properties;
+	real_t m_homogeneous_permittivity;
+	Eigen::VectorXr m_vector_dc_resistances;
+	EigenSparseSplit m_matrix_epot[3], m_matrix_mpot[3];
+	Eigen::SparseMatrix<real_t> m_matrix_surf_resid[2], m_matrix_surf_loss;
+
+	// The surface current and surface loss matrices only depend on the geometry, so they are built and factorized only
+	// once. The loss matrix is split by conductor material and scaled by the surface resistivity at each frequency.
+	std::vector<Eigen::SparseMatrix<real_t>> m_matrix_surf_loss_parts;
+	std::vector<size_t> m_surf_loss_part_conductors;
+	ChainSolver m_surf_solver;
+
+	// The nodes of an unstructured mesh have no natural ordering, so the free variables are numbered in a fill-reducing
+	// order (see InitVariables), which the port solver uses directly.
+	PortSolver m_port_solver;
+	Eigen::MatrixXr m_eigen_solution_epot, m_eigen_solution_mpot, m_eigen_solution_surf;
+
+public:
+	TriMesh2D(const Box2D &world_box, const Box2D &world_focus, real_t mesh_inc, real_t mesh_epsilon);
+	virtual ~TriMesh2D();
+
+	// noncopyable
+	TriMesh2D(const TriMesh2D&) = delete;
+	TriMesh2D& operator=(const TriMesh2D&) = delete;
+
+	void SetOpenBoundary(const Vector2D &origin, const Vector2D &dipole);
+
+	size_t AddPort(PortType type, bool infinite_area);
+	void AddConductor(const Box2D &box, real_t step, const MaterialConductor *material, size_t port);
+	void AddConductor(const Box2D &box, const Box2D &step, const MaterialConductor *material, size_t port);
+	void AddConductor(const std::vector<Vector2D> &polygon, real_t step, const MaterialConductor *material, size_t port);
+	void AddConductor(const std::vector<Vector2D> &polygon, const std::vector<real_t> &steps, const MaterialConductor *material, size_t port);
+	void AddDielectric(const Box2D &box, real_t step, const MaterialDielectric *material);
+	void AddDielectric(const Box2D &box, const Box2D &step, const MaterialDielectric *material);
+	void AddDielectric(const std::vector<Vector2D> &polygon, real_t step, const MaterialDielectric *material);
+	void AddDielectric(const std::vector<Vector2D> &polygon, const std::vector<real_t> &steps, const MaterialDielectric *material);
+
+	virtual Box2D GetWorldBox2D() override;
+	virtual Box2D GetWorldFocus2D() override;
+	virtual void GetImage2D(std::vector<real_t> &image_value, std::vector<Vector2D> &image_gradient, size_t width, size_t height, const Box2D &view, MeshImageType type, size_t mode) override;
+	virtual size_t GetMemoryUsage() override;
+
+protected:
+	virtual void DoInitialize() override;
+	virtual void DoPrepareFrequencies(const std::vector<real_t> &frequencies) override;
+	virtual void DoSolve() override;
+	virtual void DoSetModes() override;
+	virtual void DoCleanup() override;
+	virtual size_t GetFixedVariableCount() override;
+
+private:
+	void InitTriangulation();
+	void InitConstraints(const std::vector<std::array<size_t, 3>> &segments);
+	void InitRegions();
+	void InitRefinement();
+	void InitVariables();
+	void ClearVariables();
+	void ReduceDetail(real_t factor);
+	void BuildMatrices();
+	void BuildSurfaceMatrices();
+
+	size_t AddNode(const Vector2D &point);
+	size_t AddTriangle(size_t parent);
+	void SetTriangle(size_t t, size_t n0, size_t n1, size_t n2, size_t t0, size_t t1, size_t t2, size_t e0, size_t e1, size_t e2);
+	void ReplaceNeighbor(size_t t, size_t old_neighbor, size_t new_neighbor);
+	void GetNodeTriangles(size_t node, std::vector<size_t> &triangles);
+	bool FindEdge(size_t node1, size_t node2, size_t &t, size_t &i);
+	size_t Locate(const Vector2D &point, size_t start);
+	size_t WalkTo(const Vector2D &point, size_t start, size_t &blocked_edge);
+	void InsertNode(size_t node, size_t t, std::vector<size_t> &fan);
+	void SplitTriangle(size_t t, size_t node, std::vector<size_t> &fan);
+	void SplitEdge(size_t t, size_t i, size_t node, std::vector<size_t> &fan);
+	void FlipEdge(size_t t, size_t i);
+	void Legalize(std::vector<size_t> &fan);
+	bool IsBadTriangle(size_t t);
+	real_t GetStepSize(const Vector2D &point);
+
+	size_t PredictFactorNonZeros();
+	size_t PredictMemoryUsage(size_t factors);
+	size_t GetTableMemoryUsage();
+	size_t GetMatrixMemoryUsage();
+	size_t GetSolverMemoryUsage();
+	size_t GetSolutionMemoryUsage();
+
+	void GetTriangleNodeValues(std::vector<std::array<real_t, 3>> &triangle_values, size_t mode, MeshImageType type);
+
+private:
+	inline size_t GetEdgeConductor(size_t edge) { return (edge < m_conductors.size())? edge : INDEX_NONE; }
+	inline const Vector2D& GetPoint(size_t node) { return m_nodes[node].m_point; }
+
+private:
+	static void BoxToPolygon(std::vector<Vector2D> &polygon, std::vector<real_t> &steps, const Box2D &box, const Box2D &step);
+	static void ClipPolygon(std::vector<Vector2D> &polygon, std::vector<real_t> &steps, const Box2D &box, real_t epsilon);
+	static bool PolygonContains(const std::vector<Vector2D> &polygon, const Vector2D &point);
+	static size_t GetNodeIndex(const Triangle &triangle, size_t node);
+	static size_t GetNeighborIndex(const Triangle &triangle, size_t neighbor);
+
+};
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2016  The AlterPCB team
+Contact: Maarten Baert <maarten-baert@hotmail.com>
+
+This file is part of AlterPCB.
+
+AlterPCB is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AlterPCB is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this AlterPCB.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "TLineSimAPI.h"
+
+#include <cmath>
+#include <cstdio>
+
+// Checks that the library returns the results in SI units, by solving the default microstrip line and comparing the
+// inductance and capacitance (per meter) with the impedance and velocity. With per-mm units (nH/mm and pF/mm) both
+// checks would be off by several orders of magnitude.
+
+bool CheckRange(const char *name, double value, double low, double high) {
+	if(!(value >= low && value <= high)) {
+		fprintf(stderr, "%s = %g is outside the expected range [%g, %g].\n", name, value, low, high);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+
+	const char *materials_file = (argc > 1)? argv[1] : "data/materials.json";
+	char error[256];
+	tlinesim_materials *materials = tlinesim_materials_load(materials_file, error, sizeof(error));
+	if(materials == NULL) {
+		fprintf(stderr, "Failed to load materials: %s\n", error);
+		return 1;
+	}
+	tlinesim_session *session = tlinesim_session_create(materials, "Microstrip (single)", error, sizeof(error));
+	if(session == NULL) {
+		fprintf(stderr, "Failed to create session: %s\n", error);
+		tlinesim_materials_free(materials);
+		return 1;
+	}
+
+	double frequency = 1.0e9;
+	double impedance = NAN, velocity = NAN, inductance = NAN, capacitance = NAN;
+	bool success = (tlinesim_session_set_frequencies(session, &frequency, 1) == 0 &&
+		tlinesim_session_solve(session) == 0 &&
+		tlinesim_session_get_result(session, 0, 0, TLINESIM_RESULT_IMPEDANCE, &impedance) == 0 &&
+		tlinesim_session_get_result(session, 0, 0, TLINESIM_RESULT_VELOCITY, &velocity) == 0 &&
+		tlinesim_session_get_result(session, 0, 0, TLINESIM_RESULT_INDUCTANCE, &inductance) == 0 &&
+		tlinesim_session_get_result(session, 0, 0, TLINESIM_RESULT_CAPACITANCE, &capacitance) == 0);
+	if(!success) {
+		fprintf(stderr, "Simulation failed: %s\n", tlinesim_session_error(session));
+	} else {
+		printf("Z0 = %g ohm, v = %g m/s, L = %g H/m, C = %g F/m\n", impedance, velocity, inductance, capacitance);
+		success &= CheckRange("L", inductance, 1.0e-7, 1.0e-6);
+		success &= CheckRange("C", capacitance, 1.0e-11, 1.0e-9);
+		success &= CheckRange("sqrt(L/C) / Z0", std::sqrt(inductance / capacitance) / impedance, 0.99, 1.01);
+		success &= CheckRange("1 / sqrt(L * C) / v", 1.0 / std::sqrt(inductance * capacitance) / velocity, 0.99, 1.01);
+	}
+
+	tlinesim_session_destroy(session);
+	tlinesim_materials_free(materials);
+	if(!success)
+		return 1;
+	printf("All tests passed.\n");
+	return 0;
+
+}
@@ -2,7 +2,12 @@
 
 import os
 
-project_file = "alterpcb-tlinesim.pro"
+# each project includes the files in the listed directories ("" is the source directory itself)
+projects = {
+	"alterpcb-tlinesim.pro": ["", "common", "gui", "simulation"],
+	"alterpcb-tlinesim-cli.pro": ["cli", "common", "simulation"],
+	"alterpcb-tlinesim-lib.pro": ["library", "common", "simulation", "tests"],
+}
 marker = "\n########## Warning: Everything below this line is auto-generated and will be overwritten! ##########\n"
 
 source_dir = os.path.dirname(os.path.realpath(__file__))
@@ -22,26 +27,26 @@ dirconfigs = {
 	"main": "!tests",
 }
 
-files = {}
-
-for (dirpath, dirnames, filenames) in os.walk("."):
-	dirnames.sort()
-	filenames.sort()
-	for fn in filenames:
-		sourcetype = sourcetypes.get(os.path.splitext(fn)[1])
-		if sourcetype is None:
+def findfiles(dirs):
+	files = {}
+	for (dirpath, dirnames, filenames) in os.walk("."):
+		dirnames.sort()
+		filenames.sort()
+		if dirpath[2:].partition("/")[0] not in dirs:
 			continue
-		config = dirconfigs.get(dirpath.partition("/")[2], "default")
-		if config not in files:
-			files[config] = {}
-		if sourcetype not in files[config]:
-			files[config][sourcetype] = []
-		files[config][sourcetype].append(os.path.join(dirpath, fn)[2:])
-
-with open(project_file, "r") as f:
-	text = f.read()
+		for fn in filenames:
+			sourcetype = sourcetypes.get(os.path.splitext(fn)[1])
+			if sourcetype is None:
+				continue
+			config = dirconfigs.get(dirpath.partition("/")[2], "default")
+			if config not in files:
+				files[config] = {}
+			if sourcetype not in files[config]:
+				files[config][sourcetype] = []
+			files[config][sourcetype].append(os.path.join(dirpath, fn)[2:])
+	return files
 
-def writefiles(tabs, config):
+def writefiles(files, tabs, config):
 	text = ""
 	if config in files:
 		if "headers" in files[config]:
@@ -50,22 +55,28 @@ def writefiles(tabs, config):
 			text += "\n" + tabs + "SOURCES += \\\n\t" + tabs + (" \\\n\t" + tabs).join(files[config]["sources"]) + "\n"
 	return text
 
-(before, _, after) = text.partition(marker)
-text = before + marker
-for config in configs:
-	if config in files:
-		text += "\n" + config + " {\n"
-		text += writefiles("\t", config)
-		if "!" + config in files:
-			text += "\n} else {\n"
-			text += writefiles("\t", "!" + config)
-		text += "\n}\n"
-	elif "!" + config in files:
-		text += "\n!" + config + " {\n"
-		text += writefiles("\t", "!" + config)
-		text += "\n}\n"
-text += writefiles("", "default")
+for (project_file, dirs) in sorted(projects.items()):
+
+	files = findfiles(dirs)
+
+	with open(project_file, "r") as f:
+		text = f.read()
 
-with open(project_file, "w") as f:
-	f.write(text)
+	(before, _, after) = text.partition(marker)
+	text = before + marker
+	for config in configs:
+		if config in files:
+			text += "\n" + config + " {\n"
+			text += writefiles(files, "\t", config)
+			if "!" + config in files:
+				text += "\n} else {\n"
+				text += writefiles(files, "\t", "!" + config)
+			text += "\n}\n"
+		elif "!" + config in files:
+			text += "\n!" + config + " {\n"
+			text += writefiles(files, "\t", "!" + config)
+			text += "\n}\n"
+	text += writefiles(files, "", "default")
 
+	with open(project_file, "w") as f:
+		f.write(text)